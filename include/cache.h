@@ -1,8 +1,15 @@
 #pragma once
 /**
  * Different constants and functions for interacting with caches.
+ *
+ * The cache geometry gets discovered at startup, from CPUID leaf 4 on Intel and
+ * 0x8000001D on AMD, or from sysfs if neither is available.
+ *
+ * The L3 is sliced, with one slice per core sharing it, and reported with the sets of all
+ * slices. Its set bits and mask are the ones of a single slice.
  */
 
+#include <stdbool.h>
 #include <stdint.h>
 
 typedef struct UarfCache UarfCache;
@@ -17,29 +24,73 @@ struct UarfCache {
     uint8_t l2_ways;
     // uint8_t L2_ACCESS_DT = 16;
 
+    // Set index bits within one slice, 0 if the sets cannot be split into the slices
     uint8_t l3_set_bits;
     uint8_t l3_ways;
     // uint8_t L3_ACCESS_DT = 51;
+    // Sets over all slices, as reported by the CPU, and number of slices
+    uint64_t l3_sets;
+    uint16_t l3_slices;
+
+    // Number of logical CPUs sharing the cache
+    uint16_t l1_shared;
+    uint16_t l2_shared;
+    uint16_t l3_shared;
+
+    // Set index bits of an address, derived from the above
+    uint64_t l1_set_mask;
+    uint64_t l2_set_mask;
+    uint64_t l3_set_mask;
 };
 
 extern UarfCache cache;
 
+/**
+ * Get the cache slice that the physical address `pa` maps to.
+ */
+typedef uint64_t (*UarfSliceFn)(uint64_t pa);
+
+/**
+ * Discover the cache geometry of the current CPU and store it in `cache`.
+ *
+ * Runs automatically at startup.
+ */
+void uarf_cache_init(void);
+
+/**
+ * Set the L3 geometry to `sets` sets of `ways` ways over all `slices` slices, and derive
+ * the set bits and mask of one slice. Overrides the discovered geometry.
+ *
+ * @returns false if the sets cannot be split into slices of a power of two sets, the set
+ * bits are 0 then
+ */
+bool uarf_cache_set_l3(uint64_t sets, uint8_t ways, uint16_t slices);
+
 /**
  * Get the cache set bits of p.
  */
-uint64_t uarf_get_set_bits(uint64_t addr, uint64_t set_bits);
+static inline uint64_t uarf_get_set_bits(uint64_t addr, uint64_t set_bits) {
+    uint64_t mask = ((1ul << set_bits) - 1) << cache.cache_line_bits;
+    return addr & mask;
+}
 
 /**
  * Get the L1 cache set that p maps to.
  */
-uint64_t uarf_get_l1_set(uint64_t addr);
+static inline uint64_t uarf_get_l1_set(uint64_t addr) {
+    return (addr & cache.l1_set_mask) >> cache.cache_line_bits;
+}
 
 /**
  * Get the L2 cache set that p maps to.
  */
-uint64_t uarf_get_l2_set(uint64_t addr);
+static inline uint64_t uarf_get_l2_set(uint64_t addr) {
+    return (addr & cache.l2_set_mask) >> cache.cache_line_bits;
+}
 
 /**
  * Get the L3 cache set that p maps to.
  */
-uint64_t uarf_get_l3_set(uint64_t addr);
+static inline uint64_t uarf_get_l3_set(uint64_t addr) {
+    return (addr & cache.l3_set_mask) >> cache.cache_line_bits;
+}
@@ -2,22 +2,103 @@
  * Functionality related to eviction.
  *
  * Provides means to build evictions sets, reduce and access them.
+ *
+ * An eviction set (ES) is stored as a compact array of the addresses of its lines. The
+ * lines themselves form a doubly linked ring, in which every line holds a pointer to the
+ * next and previous line. Accessing the ES is then a pointer chase through the ring,
+ * which neither touches the address array nor does any bookkeeping.
+ *
+ * Elements can be removed in O(1), by swapping them with the last active element and
+ * unlinking them from the ring. The removed elements stay right behind the active ones,
+ * such that they can be restored in O(1), in reverse order of their removal.
  */
 
-#include "dll.h"
+#pragma once
+
+#include "cache.h"
+#include "mem.h"
+#include "stub.h"
+#include "vsnip.h"
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
-typedef UarfDll Es;
-typedef UarfDllNode EsElem;
+/**
+ * Start of every line of an ES. Links the line into the ring of the ES.
+ */
+typedef struct UarfEsLine UarfEsLine;
+struct UarfEsLine {
+    UarfEsLine *next;
+    UarfEsLine *prev;
+};
+
+typedef struct UarfEs UarfEs;
+struct UarfEs {
+    // Addresses of the lines, [0, size) are active, [size, size + num_removed) are
+    // removed, the most recently removed first
+    union {
+        UarfEsLine **lines;
+        uint64_t *addrs;
+    };
+    size_t size;
+    size_t num_removed;
+    size_t capacity;
+    // Where traversals start, NULL if the ES is empty
+    UarfEsLine *ring;
+    // Pages backing the lines, owned by the ES
+    uint64_t *pages;
+    size_t num_pages;
+    size_t page_size;
+    // Pool the pages are returned to, NULL if they get unmapped
+    UarfPagePool *pool;
+    // Straight-line access kernel built by `uarf_es_jit`
+    UarfStub jit;
+};
+
+// Short alias used throughout the experiments
+typedef UarfEs Es;
+
+/**
+ * Pool of the pages of ESs built by `uarf_es_init`.
+ *
+ * Pages of deinitialized ESs are recycled for the next ones, so memory use stays flat.
+ * Use `uarf_page_pool_trim` to unmap the pages not in use.
+ */
+extern UarfPagePool uarf_es_pool;
+
+/**
+ * Get the number of active elements in `es`.
+ */
+static inline size_t uarf_es_size(Es *es) {
+    return es->size;
+}
+
+/**
+ * Get the address of the `i`-th active element of `es`.
+ */
+static inline uint64_t uarf_es_get(Es *es, size_t i) {
+    return es->addrs[i];
+}
 
 void uarf_es_init(Es **es, size_t es_size);
+void uarf_es_init_addrs(Es **es, const uint64_t *addrs, size_t n);
+void uarf_es_init_huge(Es **es, size_t es_size, void *victim, uint8_t set_bits,
+                       size_t page_size, UarfSliceFn slice_fn);
 void uarf_es_deinit(Es *es);
+void uarf_es_remove(Es *es, size_t i);
+void uarf_es_restore(Es *es);
+void uarf_es_filter(Es *es, bool filter(uint64_t addr));
 void uarf_es_access_fbf(Es *es, size_t num_rep);
 void uarf_es_access_local(Es *es, size_t num_rep);
+void uarf_es_jit(Es *es, UarfAccessPattern pattern, size_t reps, UarfAccessFence fence);
+void uarf_es_access_jit(Es *es, size_t num_rep);
 float uarf_es_effectiveness(Es *es, void *victim, size_t reps, bool is_in_cache(void *),
                             void es_access(Es *es, size_t num_rep));
 size_t uarf_es_reduce(Es *es, void *victim,
                       float es_eff(Es *es, void *victim, size_t reps,
                                    void es_access(Es *es, size_t num_rep)),
                       void es_access(Es *es, size_t num_rep));
+size_t uarf_es_reduce_group(Es *es, void *victim, size_t ways, size_t reps,
+                            float es_eff(Es *es, void *victim, size_t reps,
+                                         void es_access(Es *es, size_t num_rep)),
+                            void es_access(Es *es, size_t num_rep));
@@ -0,0 +1,159 @@
+/**
+ * Catalogue of L3 eviction sets, one for every set and slice.
+ *
+ * Building is spread over multiple threads, in three phases:
+ * 1. Every thread maps and translates its own arena of pages. The lines of all arenas
+ *    get sorted into buckets by their (set, slice).
+ * 2. Threads take (set, slice) targets from a shared counter, so they work on different
+ *    sets at any time, and reduce the lines of the bucket to an eviction set.
+ * 3. As all threads share the L3, an eviction set may only have appeared to work due to
+ *    the accesses of other threads. Each thread cross-checks the sets built by another
+ *    thread, one thread after the other, so nothing else accesses the L3 meanwhile.
+ *    Sets that fail get rebuilt in parallel and checked once more, then dropped if they
+ *    still fail.
+ *
+ * Eviction sets consist of virtual addresses of freshly mapped pages, so they are lost
+ * at the end of a run. To reuse them, the lines can come from a file that keeps its
+ * physical frames, e.g., on hugetlbfs. The catalogue file records the offset into that
+ * backing file and the physical address of every line. On load, sets whose frames
+ * changed or that stopped working get rebuilt, all others are used as they are.
+ *
+ * Usage:
+ *  UarfEsCatalog cat = uarf_es_catalog_build(4, 1 << 16, NULL, 1, 200);
+ *  uarf_es_catalog_print_stats(&cat);
+ *  uarf_es_access_fbf(uarf_es_catalog_get(&cat, set, 0), 1);
+ *  uarf_es_catalog_free(&cat);
+ *
+ * Reuse across runs:
+ *  UarfEsCatalog cat;
+ *  if (!uarf_es_catalog_load(&cat, "l3.cat", "/dev/hugepages/l3", 4, 1 << 16, NULL, 1,
+ *                            200)) {
+ *      cat = uarf_es_catalog_build_backed("/dev/hugepages/l3", 4, 1 << 16, NULL, 1, 200);
+ *  }
+ *  uarf_es_catalog_save(&cat, "l3.cat");
+ */
+
+#pragma once
+
+#include "cache.h"
+#include "evict.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct UarfEsCatalogEntry UarfEsCatalogEntry;
+struct UarfEsCatalogEntry {
+    // NULL if no set could be built
+    Es *es;
+    // Line in the same set and slice, not part of `es`
+    uint64_t victim;
+    // Thread that built the set, UARF_ES_CATALOG_LOADED if loaded from a file
+    uint32_t builder;
+};
+
+#define UARF_ES_CATALOG_LOADED UINT32_MAX
+
+typedef struct UarfEsCatalogStats UarfEsCatalogStats;
+struct UarfEsCatalogStats {
+    // Reading and validating a catalogue file
+    double load_secs;
+    // Sets taken from the file as they are
+    size_t num_loaded;
+    // Sets from the file whose frames changed or that stopped working
+    size_t num_stale;
+
+    double arena_secs;
+    double build_secs;
+    double check_secs;
+    size_t num_built;
+    // Sets that failed the cross-check and got rebuilt, they may still be missing
+    size_t num_rebuilt;
+    size_t num_missing;
+    double sets_per_sec;
+};
+
+typedef struct UarfEsCatalog UarfEsCatalog;
+struct UarfEsCatalog {
+    size_t num_sets;
+    size_t num_slices;
+    UarfSliceFn slice_fn;
+    uint64_t thresh;
+    // [[slice 0 ... num_slices - 1 of set 0], [... of set 1], ...]
+    UarfEsCatalogEntry *entries;
+
+    // Lines come from `num_threads` consecutive arenas of `arena_pages` pages at `base`
+    size_t num_threads;
+    size_t arena_pages;
+    uint64_t base;
+    // File the arenas are mapped from, -1 if anonymous
+    int backing_fd;
+
+    UarfEsCatalogStats stats;
+};
+
+/**
+ * Build a catalogue of eviction sets for every L3 set and slice.
+ *
+ * @param num_threads threads to build with, pinned to different CPUs
+ * @param arena_pages number of 4KB pages mapped by each thread
+ * @param slice_fn slice function, NULL to ignore slices
+ * @param num_slices number of values returned by `slice_fn`, 1 if NULL
+ * @param thresh access time above which a line counts as evicted
+ */
+UarfEsCatalog uarf_es_catalog_build(size_t num_threads, size_t arena_pages,
+                                    UarfSliceFn slice_fn, size_t num_slices,
+                                    uint64_t thresh);
+
+/**
+ * Like `uarf_es_catalog_build`, but map the arenas from file `backing`.
+ *
+ * The file gets created or resized if needed. For the sets to be reusable, it has to
+ * keep its physical frames across runs, e.g., by being on hugetlbfs.
+ */
+UarfEsCatalog uarf_es_catalog_build_backed(const char *backing, size_t num_threads,
+                                           size_t arena_pages, UarfSliceFn slice_fn,
+                                           size_t num_slices, uint64_t thresh);
+
+/**
+ * Write `cat` to file `path`. Only makes sense for catalogues with a backing file.
+ */
+void uarf_es_catalog_save(UarfEsCatalog *cat, const char *path);
+
+/**
+ * Load the catalogue in file `path` with the lines in file `backing`.
+ *
+ * The parameters are the ones of `uarf_es_catalog_build_backed`, and have to be the ones
+ * the catalogue was built with. Every set is re-verified. Sets whose lines changed their
+ * physical frames or that do not evict their victim anymore get rebuilt from the arenas.
+ *
+ * @returns false if the file does not exist, is corrupt, or does not match the
+ * parameters, the backing file or the cache geometry
+ */
+bool uarf_es_catalog_load(UarfEsCatalog *cat, const char *path, const char *backing,
+                          size_t num_threads, size_t arena_pages, UarfSliceFn slice_fn,
+                          size_t num_slices, uint64_t thresh);
+
+/**
+ * Free all eviction sets and arenas of `cat`. The backing file is kept.
+ */
+void uarf_es_catalog_free(UarfEsCatalog *cat);
+
+/**
+ * Get the entry for `set` and `slice`.
+ */
+static inline UarfEsCatalogEntry *uarf_es_catalog_entry(UarfEsCatalog *cat, size_t set,
+                                                        size_t slice) {
+    return &cat->entries[set * cat->num_slices + slice];
+}
+
+/**
+ * Get the eviction set for `set` and `slice`, NULL if there is none.
+ */
+static inline Es *uarf_es_catalog_get(UarfEsCatalog *cat, size_t set, size_t slice) {
+    return uarf_es_catalog_entry(cat, set, slice)->es;
+}
+
+/**
+ * Print the build statistics of `cat`.
+ */
+void uarf_es_catalog_print_stats(UarfEsCatalog *cat);
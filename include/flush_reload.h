@@ -16,6 +16,9 @@
 // Address of result array
 #define FR_RES 0xfff3f200000ul
 
+// Address of latency histogram
+#define FR_HIST 0xfff4f200000ul
+
 // Distance between two entries in the buffer
 #define FR_STRIDE_BITS 12
 #define FR_STRIDE      (1UL << FR_STRIDE_BITS)
@@ -35,6 +38,23 @@
 #endif
 
 #define FR_CONFIG_BIN_MAPPING_SIZE 10
+
+// Upper bound on the number of histogram buckets per slot
+#define FR_HIST_MAX_BUCKETS 64
+
+/**
+ * How reload timings are distributed over the histogram buckets.
+ */
+typedef enum UarfFrHistMode UarfFrHistMode;
+enum UarfFrHistMode {
+    // Do not collect a histogram
+    UARF_FR_HIST_NONE = 0,
+    // Bucket i holds timings in [2^i, 2^(i+1)), bucket 0 also holds 0
+    UARF_FR_HIST_LOG2 = 1,
+    // Bucket i holds timings in [i * width, (i + 1) * width)
+    UARF_FR_HIST_LINEAR = 2,
+};
+
 typedef struct UarfFrConfig UarfFrConfig;
 struct UarfFrConfig {
     // First flush and reload buffer
@@ -87,11 +107,53 @@ struct UarfFrConfig {
     // Size of buffer and result array in bytes
     size_t buf_size;
     size_t res_size;
+    // Optional latency histogram, enabled by uarf_fr_hist_init
+    struct {
+        UarfFrHistMode mode;
+        // Number of buckets per slot, the last one collects all larger timings
+        uint8_t num_buckets;
+        // Width of a bucket in cycles, only used by UARF_FR_HIST_LINEAR
+        uint16_t bucket_width;
+        // [[all buckets of slot 0], [all buckets of slot 1], ... [all buckets of slot
+        // num_slots - 1]]
+        union {
+            uint32_t *p;
+            uintptr_t addr;
+        };
+        // Narrow counters the reload increments, merged into `p` at the end of a batch.
+        // Same layout as `p`
+        uint16_t *batch_p;
+        // Number of reloads accumulated in `batch_p`
+        uint16_t batch_len;
+        // Size of histogram in bytes
+        size_t size;
+        // Access time of every slot in the last reload, bucketed after the timed loop
+        uint32_t *dt_p;
+    } hist;
 };
 
 static __always_inline void uarf_fr_reset(UarfFrConfig *conf) {
     UARF_LOG_TRACE("(%p)\n", conf);
     memset(conf->res_p, 0, conf->num_slots * conf->num_bins * sizeof(uint32_t));
+    if (conf->hist.mode != UARF_FR_HIST_NONE) {
+        memset(conf->hist.p, 0, conf->hist.size);
+        memset(conf->hist.batch_p, 0, conf->hist.size / 2);
+        conf->hist.batch_len = 0;
+    }
+}
+
+/**
+ * Get the histogram bucket of the access time `dt`.
+ */
+static __always_inline size_t uarf_fr_hist_bucket(UarfFrConfig *conf, uint64_t dt) {
+    size_t bucket;
+    if (conf->hist.mode == UARF_FR_HIST_LOG2) {
+        bucket = 63 - __builtin_clzl(dt | 1);
+    }
+    else {
+        bucket = dt / conf->hist.bucket_width;
+    }
+    return min(bucket, (size_t) conf->hist.num_buckets - 1);
 }
 
 void uarf_fr_flush(UarfFrConfig *conf);
@@ -101,8 +163,20 @@ UarfFrConfig uarf_fr_init(uint16_t num_slots, uint8_t num_bins, size_t *bin_map)
 
 void uarf_fr_deinit(UarfFrConfig *conf);
 uint64_t uarf_fr_num_hits(UarfFrConfig *conf);
+void uarf_fr_bin_hits(UarfFrConfig *conf, uint64_t *out);
+void uarf_fr_slot_hits(UarfFrConfig *conf, uint64_t *out);
+size_t uarf_fr_max_slot(UarfFrConfig *conf, bool *is_tie);
+size_t uarf_fr_top_slots(UarfFrConfig *conf, size_t k, size_t *idx);
 void uarf_fr_print(UarfFrConfig *conf);
 
+void uarf_fr_hist_init(UarfFrConfig *conf, UarfFrHistMode mode, uint8_t num_buckets,
+                       uint16_t bucket_width);
+void uarf_fr_hist_merge(UarfFrConfig *conf);
+uint64_t uarf_fr_hist_bucket_start(UarfFrConfig *conf, size_t bucket);
+uint64_t uarf_fr_hist_hits(UarfFrConfig *conf, size_t slot, uint64_t thresh);
+uint64_t uarf_fr_hist_thresh(UarfFrConfig *conf);
+void uarf_fr_hist_print(UarfFrConfig *conf);
+
 static __always_inline void uarf_fr_reload(UarfFrConfig *conf) {
     UARF_LOG_TRACE("(%p)\n", conf);
     uarf_fr_reload_binned(conf, 0);
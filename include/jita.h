@@ -35,6 +35,8 @@ typedef struct UarfJitaCtxt UarfJitaCtxt;
 struct UarfJitaCtxt {
     UarfSnip snips[JITA_CTXT_MAX_SNIPS];
     size_t n_snips;
+    // End of every snippet relative to the start of the stub, as of the last allocation
+    uint32_t snip_ends[JITA_CTXT_MAX_SNIPS];
 };
 
 /**
@@ -117,3 +119,50 @@ void uarf_jita_push_vsnip_jmp_near_rel(UarfJitaCtxt *ctxt, uint32_t offset,
  * Create a virtual snippet that adds `num` nops
  */
 void uarf_jita_push_vsnip_fill_nop(UarfJitaCtxt *ctxt, uint32_t num);
+
+/**
+ * Create a virtual snippet that returns
+ */
+void uarf_jita_push_vsnip_ret(UarfJitaCtxt *ctxt);
+
+/**
+ * Create a virtual snippet that loads from the `n` addresses at `addrs` in `pattern`,
+ * `reps` times, with `fence` after every load.
+ *
+ * `addrs` has to stay valid until the context is allocated.
+ */
+void uarf_jita_push_vsnip_access(UarfJitaCtxt *ctxt, const uint64_t *addrs, uint32_t n,
+                                 UarfAccessPattern pattern, uint32_t reps,
+                                 UarfAccessFence fence);
+
+/**
+ * Create a virtual snippet that loads from the `n` addresses at `addrs` in order and
+ * times the loads with `probe` set.
+ *
+ * The cycles of the timed loads are stored to the uint32_t array passed as the first
+ * argument. `addrs` and `probe` have to stay valid until the context is allocated.
+ */
+void uarf_jita_push_vsnip_timed_access(UarfJitaCtxt *ctxt, const uint64_t *addrs,
+                                       const bool *probe, uint32_t n);
+
+/**
+ * Create a virtual snippet that starts measuring the counters of `m`.
+ *
+ * Only clobbers rax, rcx and rdx, without touching the stack. `m` has to stay valid
+ * while the stub exists.
+ */
+void uarf_jita_push_vsnip_measure_begin(UarfJitaCtxt *ctxt, UarfMeasure *m);
+
+/**
+ * Create a virtual snippet that stops measuring the counters of `m` and stores their
+ * differences since the begin to `m->res`.
+ */
+void uarf_jita_push_vsnip_measure_end(UarfJitaCtxt *ctxt, UarfMeasure *m);
+
+/**
+ * Measure the counters of `m` around an empty region `rounds` times and keep the
+ * minimum as overhead, subtracted by `uarf_measure_get`.
+ *
+ * Overwrites `m->res`.
+ */
+void uarf_jita_measure_calibrate(UarfMeasure *m, size_t rounds);
@@ -37,6 +37,13 @@
 #define UARF_ROUND_DOWN_2M(num) UARF_ROUND_DOWN(num, PAGE_SIZE_2M)
 #define UARF_ROUND_UP_2M(num)   UARF_ROUND_UP(num, PAGE_SIZE_2M)
 
+/**
+ * Prevent the compiler from moving memory accesses across.
+ */
+static __always_inline void uarf_barrier(void) {
+    asm volatile("" ::: "memory");
+}
+
 static __always_inline void uarf_sfence(void) {
     asm volatile("sfence" ::: "memory");
 }
@@ -119,6 +126,16 @@ static __always_inline uint32_t uarf_cpuid_edx(uint32_t leaf) {
     return edx;
 }
 
+/**
+ * Whether the CPU is from AMD.
+ */
+static __always_inline bool uarf_cpu_is_amd(void) {
+    uint32_t eax, ebx = 0, ecx = 0, edx = 0;
+    uarf_cpuid(0, &eax, &ebx, &ecx, &edx);
+    // "AuthenticAMD"
+    return ebx == 0x68747541 && edx == 0x69746e65 && ecx == 0x444d4163;
+}
+
 static __always_inline void uarf_cpuid_user(uint32_t leaf, uint32_t *eax, uint32_t *ebx,
                                             uint32_t *ecx, uint32_t *edx) {
     uarf_pi_cpuid(leaf, eax, ebx, ecx, edx);
@@ -530,16 +547,19 @@ static __always_inline uint64_t uarf_get_access_time(const void *p) {
     return t0;
 }
 
-// Depends on optimisations!
+// Overheads subtracted by the helpers below, calibrated at startup, see `timer.h`. The
+// defaults only apply until then, they depend on the CPU and the optimisations.
 #define UARF_ACCESS_TIME_A_OVERHEAD 57
+#define UARF_ACCESS_TIME_M_OVERHEAD 135
+extern uint64_t uarf_access_time_a_overhead;
+extern uint64_t uarf_access_time_m_overhead;
+
 /**
  * Get the number of cycles needed to read from `p`
  *
  * Used the APERF MSR
  *
  * Use same fences as "AMD Prefetch Attacks" paper
- *
- * Overhead: 57
  */
 static __always_inline uint64_t uarf_get_access_time_a(const void *p) {
     uarf_mfence();
@@ -551,19 +571,15 @@ static __always_inline uint64_t uarf_get_access_time_a(const void *p) {
     t0 = uarf_rdpru_aperf() - t0;
     uarf_mfence();
     uarf_lfence();
-    return t0 - UARF_ACCESS_TIME_A_OVERHEAD;
+    return t0 - uarf_access_time_a_overhead;
 }
 
-// Depends on optimisations!
-#define UARF_ACCESS_TIME_M_OVERHEAD 135
 /**
  * Get the number of cycles needed to read from `p`
  *
  * Used the MPERF MSR
  *
  * Use same fences as "AMD Prefetch Attacks" paper
- *
- * Overhead: 135
  */
 static __always_inline uint64_t uarf_get_access_time_m(const void *p) {
     uarf_mfence();
@@ -575,7 +591,7 @@ static __always_inline uint64_t uarf_get_access_time_m(const void *p) {
     t0 = uarf_rdpru_mperf() - t0;
     uarf_mfence();
     uarf_lfence();
-    return t0 - UARF_ACCESS_TIME_M_OVERHEAD;
+    return t0 - uarf_access_time_m_overhead;
 }
 
 static volatile uint64_t uarf_loc = 0;
@@ -1,5 +1,6 @@
 #pragma once
 #include "log.h"
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -69,10 +70,79 @@ static inline void uarf_free_or_die(void *ptr) {
     free(ptr);
 }
 
+/**
+ * Translator from virtual to physical addresses of a process.
+ *
+ * Keeps the pagemap open and caches the translations per page.
+ */
+typedef struct UarfPagemap UarfPagemap;
+struct UarfPagemap {
+    int fd;
+    uint64_t pid;
+    // Direct mapped cache from virtual page number to page frame number
+    uint64_t *cache_vpn;
+    uint64_t *cache_pfn;
+    size_t cache_size;
+};
+
+UarfPagemap uarf_pagemap_open(uint64_t pid);
+void uarf_pagemap_close(UarfPagemap *pm);
+void uarf_pagemap_flush(UarfPagemap *pm);
+size_t uarf_pagemap_va_to_pa_batch(UarfPagemap *pm, const uint64_t *va, uint64_t *pa,
+                                   size_t n);
+uint64_t uarf_pagemap_va_to_pa(UarfPagemap *pm, uint64_t va);
 uint64_t uarf_va_to_pa(uint64_t va, uint64_t pid);
+// Attempts to map a random page before giving up, a random address is rarely taken
+#define UARF_ALLOC_RANDOM_TRIES 1000
+
 void *uarf_alloc_random_page(void);
 void *uarf_alloc_random_hugepage(void);
 
+// Every how many recycled pages one is replaced by a new physical page
+#define UARF_PAGE_POOL_REMAP_PERIOD 16
+
+/**
+ * Slot of the page index of a UarfPagePool.
+ */
+typedef struct UarfPagePoolSlot UarfPagePoolSlot;
+struct UarfPagePoolSlot {
+    // Page, 0 if the slot is empty
+    uint64_t page;
+    // Position of the page in `pages` of the pool
+    size_t i;
+    // Whether the page is in `free` of the pool
+    bool free;
+};
+
+/**
+ * Pool of locked pages at random addresses.
+ *
+ * Tracks every page it hands out, so pages can be recycled instead of leaked and all of
+ * them can be released at once. Recycled pages get re-randomised, see
+ * `uarf_page_pool_get`. A zeroed pool is empty and ready to use.
+ */
+typedef struct UarfPagePool UarfPagePool;
+struct UarfPagePool {
+    // All pages of the pool
+    uint64_t *pages;
+    size_t num_pages;
+    size_t cap_pages;
+    // Pages that are not handed out
+    uint64_t *free;
+    size_t num_free;
+    size_t cap_free;
+    // Pages recycled so far
+    size_t num_recycled;
+    // Hash table of all pages with linear probing, to find them in constant time
+    UarfPagePoolSlot *index;
+    size_t cap_index;
+};
+
+uint64_t uarf_page_pool_get(UarfPagePool *pool);
+void uarf_page_pool_put(UarfPagePool *pool, uint64_t page);
+void uarf_page_pool_trim(UarfPagePool *pool);
+void uarf_page_pool_deinit(UarfPagePool *pool);
+
 /**
  * Access the page containing `addr` at some offset from `addr` to get the mapping into
  * the TLB.
@@ -78,13 +78,23 @@ struct UarfPfcConfig {
     uint64_t exclude;
 
     // Have the counter disabled to start.
-    // Must not be true when wanting to use rdpmc, as it leads to issues, because then the
-    // index/offset are not initalised at the time when we extract them.
+    // When wanting to use rdpmc, the index/offset are only initialised once started.
     bool start_disabled;
 
+    // Keep the counter on the PMU at all times, so it is never rescheduled to another
+    // index. Required by `uarf_pfc_read_rdpmc`.
+    bool pinned;
+
     // Whether to run the measurement on a E-Core
     // On Intel this requires a specific configuration
     bool on_ecore;
+
+    // Sample the IP every `sample_period` events instead of only counting, into a ring
+    // buffer of `sample_pages` pages, a power of two, see `pfc_sample.h`
+    uint64_t sample_period;
+    uint32_t sample_pages;
+    // Skid constraint of the samples, as perf_event_attr::precise_ip
+    uint8_t precise_ip;
 };
 
 /**
@@ -95,6 +105,9 @@ struct UarfPfc {
     // Event selection
     UarfPfcConfig config;
 
+    // Bytes mapped at `page`, the metadata page and the ring buffer if sampling
+    size_t map_size;
+
     // Open file descriptor as returned by parf_event_open
     int fd;
 
@@ -104,21 +117,67 @@ struct UarfPfc {
 
     // The following fields are relevant when using the rdpmc instruction, as opposed to
     // the read system call, to read the counter. `index` is indicates the desired PMU,
-    // while `offset` and `mask` are used to convert the retrieved value to the actual
-    // count.
+    // while `offset` and `width` are used to convert the retrieved value to the actual
+    // count. Snapshot of the mmaped page, updated by `uarf_pfc_refresh_rdpmc`.
+    // `index` is UARF_PFC_RDPMC_INVALID while the counter is not on the PMU.
     uint32_t rdpmc_index;
     int64_t rdpmc_offset;
-    uint64_t rdpmc_mask;
+    uint16_t rdpmc_width;
 };
 
+/**
+ * Sign-extend the `width` bit value returned by `rdpmc`.
+ */
+static __always_inline int64_t uarf_pfc_sign_extend(uint64_t raw, uint16_t width) {
+    int64_t pmc = raw << (64 - width);
+    return pmc >> (64 - width);
+}
+
+// rdpmc index of a counter that is not on the PMU
+#define UARF_PFC_RDPMC_INVALID 0xffffffffu
+
+/**
+ * Update the rdpmc snapshot of pfc from the mmaped page.
+ *
+ * Follows the seqlock protocol of the kernel, retrying while the page gets updated.
+ *
+ * @returns false if the counter is not on the PMU right now
+ */
+static __always_inline bool uarf_pfc_refresh_rdpmc(UarfPfc *pfc) {
+    volatile struct perf_event_mmap_page *page = pfc->page;
+    uint32_t seq;
+    uint32_t index;
+
+    do {
+        seq = page->lock;
+        uarf_barrier();
+        index = page->index;
+        pfc->rdpmc_offset = page->offset;
+        pfc->rdpmc_width = page->pmc_width;
+        uarf_barrier();
+    } while (page->lock != seq);
+
+    // The page holds the index plus one, 0 while not on the PMU
+    pfc->rdpmc_index = index ? index - 1 : UARF_PFC_RDPMC_INVALID;
+    return page->cap_user_rdpmc && index;
+}
+
 /**
  * Start the PMU described by pfc.
+ *
+ * The counter only gets its index on the PMU once enabled, so the rdpmc snapshot is
+ * refreshed afterwards. The refresh, a few loads and two compares, gets counted by events
+ * that include user space. Measure the empty region as a baseline if that matters.
  */
 static __always_inline void uarf_pfc_start(UarfPfc *pfc) {
     UARF_LOG_TRACE("(%p)\n", pfc);
     if (ioctl(pfc->fd, PERF_EVENT_IOC_ENABLE, 0) == -1) {
         UARF_LOG_WARNING("Failed to reset: %d\n", errno);
     }
+    // Enabling may schedule the counter to another index
+    if (!uarf_pfc_refresh_rdpmc(pfc) && pfc->page->cap_user_rdpmc) {
+        UARF_LOG_WARNING("Counter is not on the PMU, rdpmc reads will fail\n");
+    }
 }
 
 /**
@@ -161,15 +220,7 @@ static __always_inline uint64_t uarf_pfc_read(UarfPfc *pfc) {
  */
 static __always_inline uint64_t uarf_pm_transform_raw2(UarfPfc *pfc, uint64_t raw) {
     UARF_LOG_TRACE("(%p, %lu)\n", pfc, raw);
-
-    // Sign-extend
-    // TODO: required?
-    // pmc <<= 64 - pfc->page->pmc_width;
-    // pmc >>= 64 - pfc->page->pmc_width;
-
-    raw += pfc->rdpmc_offset;
-    raw &= pfc->rdpmc_mask;
-    return raw;
+    return pfc->rdpmc_offset + uarf_pfc_sign_extend(raw, pfc->rdpmc_width);
 }
 
 /*
@@ -182,13 +233,189 @@ static __always_inline uint64_t uarf_pm_transform_raw1(UarfPfc *pfc, uint32_t lo
     return uarf_pm_transform_raw2(pfc, ((uint64_t) hi << 32) | lo);
 }
 
+/**
+ * Get the value of the PMU described by pfc with a single `rdpmc`, for tight loops.
+ *
+ * Relies on the snapshot of index and offset taken at init and start, without retrying
+ * or scaling. Only valid for pinned counters, which never get rescheduled.
+ */
 static __always_inline uint64_t uarf_pfc_read_rdpmc(UarfPfc *pfc) {
     // UARF_LOG_TRACE("(%p)\n", pfc); // Adds noise
-    uint64_t value = uarf_rdpmc(pfc->rdpmc_index);
-    UARF_LOG_DEBUG("raw PFC value: %lu\n", value);
-    // value += pfc->offset;
-    // value &= pfc->mask;
-    return value;
+    uarf_assert(pfc->rdpmc_index != UARF_PFC_RDPMC_INVALID);
+    return pfc->rdpmc_offset +
+           uarf_pfc_sign_extend(uarf_rdpmc(pfc->rdpmc_index), pfc->rdpmc_width);
+}
+
+/**
+ * Get the value of the PMU described by pfc without a system call, if possible.
+ *
+ * Follows the seqlock protocol of the kernel, so it stays correct when the counter gets
+ * rescheduled. If the counter was multiplexed, the value is scaled up to the whole time
+ * it was enabled. Falls back to `read` if the counter is not on the PMU.
+ */
+static __always_inline uint64_t uarf_pfc_read_rdpmc_safe(UarfPfc *pfc) {
+    volatile struct perf_event_mmap_page *page = pfc->page;
+    uint32_t seq;
+    uint32_t index;
+    uint64_t count;
+    uint64_t enabled;
+    uint64_t running;
+    uint64_t cyc = 0;
+    uint16_t shift = 0;
+    uint32_t mult = 0;
+    uint64_t offset = 0;
+    bool cap_time;
+
+    do {
+        seq = page->lock;
+        uarf_barrier();
+
+        enabled = page->time_enabled;
+        running = page->time_running;
+        cap_time = page->cap_user_time && enabled != running;
+        if (cap_time) {
+            // Conversion of the TSC, consistent with the times only within the seqlock
+            shift = page->time_shift;
+            mult = page->time_mult;
+            offset = page->time_offset;
+            cyc = uarf_rdtsc();
+        }
+
+        index = page->index;
+        count = page->offset;
+        if (page->cap_user_rdpmc && index) {
+            count += uarf_pfc_sign_extend(uarf_rdpmc(index - 1), page->pmc_width);
+        }
+
+        uarf_barrier();
+    } while (page->lock != seq);
+
+    if (!page->cap_user_rdpmc || !index) {
+        return uarf_pfc_read(pfc);
+    }
+
+    if (cap_time) {
+        // Time since the page was last updated, from the TSC
+        uint64_t quot = cyc >> shift;
+        uint64_t rem = cyc & ((1ul << shift) - 1);
+        uint64_t delta = offset + quot * mult + ((rem * mult) >> shift);
+        enabled += delta;
+        running += delta;
+    }
+    if (running && running != enabled) {
+        count = (uint64_t) ((__uint128_t) count * enabled / running);
+    }
+
+    return count;
+}
+
+// Maximum number of counters in a group, beyond the number of counters of current CPUs
+#define UARF_PFC_GROUP_MAX 8
+
+/**
+ * Performance counters scheduled, started, stopped and read together.
+ *
+ * The first counter is the group leader, all operations go through it.
+ */
+typedef struct UarfPfcGroup UarfPfcGroup;
+struct UarfPfcGroup {
+    UarfPfc pfcs[UARF_PFC_GROUP_MAX];
+    size_t num_pfcs;
+
+    // Time the group was enabled and actually on the PMU, as of the last
+    // `uarf_pfc_group_read`. They differ if the kernel had to multiplex the group.
+    uint64_t time_enabled;
+    uint64_t time_running;
+};
+
+/**
+ * Start all PMUs of group.
+ *
+ * Like `uarf_pfc_start`, the rdpmc refresh of every counter gets counted.
+ */
+static __always_inline void uarf_pfc_group_start(UarfPfcGroup *group) {
+    UARF_LOG_TRACE("(%p)\n", group);
+    if (ioctl(group->pfcs[0].fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP) == -1) {
+        UARF_LOG_WARNING("Failed to start group: %d\n", errno);
+    }
+    for (size_t i = 0; i < group->num_pfcs; i++) {
+        UarfPfc *pfc = &group->pfcs[i];
+        if (!uarf_pfc_refresh_rdpmc(pfc) && pfc->page->cap_user_rdpmc) {
+            UARF_LOG_WARNING("Counter %lu is not on the PMU, rdpmc reads will fail\n", i);
+        }
+    }
+}
+
+/**
+ * Stop all PMUs of group.
+ */
+static __always_inline void uarf_pfc_group_stop(UarfPfcGroup *group) {
+    // No tracing, it falsifies the result
+    if (ioctl(group->pfcs[0].fd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP) == -1) {
+        UARF_LOG_WARNING("Failed to stop group: %d\n", errno);
+    }
+}
+
+/**
+ * Reset all PMUs of group.
+ *
+ * Also stops the counters.
+ */
+static __always_inline void uarf_pfc_group_reset(UarfPfcGroup *group) {
+    UARF_LOG_TRACE("(%p)\n", group);
+    uarf_pfc_group_stop(group);
+    if (ioctl(group->pfcs[0].fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP) == -1) {
+        UARF_LOG_WARNING("Failed to reset group: %d\n", errno);
+    }
+}
+
+/**
+ * Get the values of all PMUs of group with a single read.
+ *
+ * @param counts receives the values, in order of the members
+ */
+static __always_inline void uarf_pfc_group_read(UarfPfcGroup *group, uint64_t *counts) {
+    UARF_LOG_TRACE("(%p, %p)\n", group, counts);
+
+    // Layout of PERF_FORMAT_GROUP with both PERF_FORMAT_TOTAL_TIME_* flags
+    struct {
+        uint64_t nr;
+        uint64_t time_enabled;
+        uint64_t time_running;
+        uint64_t values[UARF_PFC_GROUP_MAX];
+    } buf;
+    size_t size = (3 + group->num_pfcs) * sizeof(uint64_t);
+
+    if (read(group->pfcs[0].fd, &buf, size) != (ssize_t) size) {
+        UARF_LOG_WARNING("Failed to read group: %d\n", errno);
+        memset(counts, 0, group->num_pfcs * sizeof(uint64_t));
+        group->time_enabled = group->time_running = 0;
+        return;
+    }
+    memcpy(counts, buf.values, group->num_pfcs * sizeof(uint64_t));
+    group->time_enabled = buf.time_enabled;
+    group->time_running = buf.time_running;
+}
+
+/**
+ * Get the raw values of all PMUs of group with back-to-back `rdpmc`.
+ *
+ * Nothing but the counter reads runs between the first and the last read. Convert the
+ * values with `uarf_pm_transform_raw2`.
+ *
+ * @param raw receives the raw values, in order of the members
+ */
+static __always_inline void uarf_pfc_group_read_rdpmc(UarfPfcGroup *group,
+                                                      uint64_t *raw) {
+    // No tracing, it adds noise
+    for (size_t i = 0; i < group->num_pfcs; i++) {
+        uarf_assert(group->pfcs[i].rdpmc_index != UARF_PFC_RDPMC_INVALID);
+    }
+    uarf_lfence();
+    for (size_t i = 0; i < group->num_pfcs; i++) {
+        raw[i] = uarf_rdpmc(group->pfcs[i].rdpmc_index);
+    }
+    uarf_lfence();
 }
 
 /**
@@ -209,3 +436,30 @@ int uarf_pfc_init(UarfPfc *pfc, UarfPfcConfig pfc_config);
  * De-initialize a PFC
  */
 void uarf_pfc_deinit(UarfPfc *pfc);
+
+/*
+ * Initialize a group of `n` PFCs, the first being the leader.
+ *
+ * The `start_disabled` of the leader applies to the whole group.
+ */
+int uarf_pfc_group_init(UarfPfcGroup *group, const UarfPfcConfig *configs, size_t n);
+
+/*
+ * Initialize a group of `n` PFCs like `uarf_pfc_group_init`, measuring thread `pid` on
+ * `cpu`.
+ *
+ * `pid` 0 is the calling thread, -1 all threads on `cpu`, i.e., system-wide. `cpu` -1 is
+ * any CPU. Counters of other threads or CPUs can only be read with `read`, not `rdpmc`.
+ */
+int uarf_pfc_group_init_on(UarfPfcGroup *group, const UarfPfcConfig *configs, size_t n,
+                           pid_t pid, int cpu);
+
+/*
+ * De-initialize a group of PFCs
+ */
+void uarf_pfc_group_deinit(UarfPfcGroup *group);
+
+/*
+ * Get the number of general purpose counters of the core PMU, as reported by CPUID.
+ */
+size_t uarf_pfc_num_counters(void);
@@ -11,6 +11,12 @@
  */
 #define UARF_AMD_EX_RET_INSTR UARF_PFC_PMU_CONFIG(.event = 0xC0, .umask = 0x00)
 
+/**
+ * [Retired Ops] (Core::X86::Pmc::Core::ExRetOps)
+ * The number of macro-ops retired.
+ */
+#define UARF_AMD_EX_RET_OPS UARF_PFC_PMU_CONFIG(.event = 0xC1, .umask = 0x00)
+
 /**
  * [Retired Near Returns Mispredicted]
  * (Core::X86::Pmc::Core::ExRetNearRetMispred)
@@ -35,6 +41,14 @@
  */
 #define UARF_AMD_EX_RET_IND_BRCH_INSTR UARF_PFC_PMU_CONFIG(.event = 0xCC, .umask = 0x00)
 
+/**
+ * [Source of Op Dispatched From Decoder] (Core::X86::Pmc::Core::DeSrcOpDisp)
+ * The number of ops dispatched from the x86 decoder, the op cache and the microcode
+ * sequencer. Dispatched ops that do not retire, see UARF_AMD_EX_RET_OPS, were on a
+ * mispredicted path.
+ */
+#define UARF_AMD_DE_SRC_OP_DISP UARF_PFC_PMU_CONFIG(.event = 0xAA, .umask = 0x07)
+
 /**
  * [SMIs Received] (Core::X86::Pmc::Core::LsSmiRx)
  * Counts the number of SMIs
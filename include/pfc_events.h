@@ -0,0 +1,64 @@
+/**
+ * Catalogue of named performance events for several microarchitectures
+ *
+ * Unlike the macros of `pfc_amd.h` and `pfc_intel.h`, which follow the compile-time
+ * UARCH, the catalogue holds the encodings of all supported microarchitectures and gets
+ * queried at runtime. The same binary can thus count the same events on different
+ * machines.
+ *
+ * Names follow the lowercase convention of perf, e.g., "ex_ret_brn_ind_misp" or
+ * "br_misp_retired.all_branches". Lookups go through a perfect hash table, built once
+ * at startup.
+ *
+ * Usage:
+ *  UarfPfc pfc;
+ *  UarfPfcConfig config = {.exclude = UARF_PFC_EXCLUDE_KERNEL};
+ *  uarf_assert(!uarf_pfc_init_by_name(&pfc, "ex_ret_brn_ind_misp", config));
+ */
+
+#pragma once
+
+#include "pfc.h"
+#include "uarch.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct UarfPfcEvent UarfPfcEvent;
+struct UarfPfcEvent {
+    // One of the microarchitectures of `uarch.h`
+    uint32_t uarch;
+    const char *name;
+    // UarfPfcEventSel of the event
+    uint64_t pmu_conf;
+};
+
+// All events of all microarchitectures
+extern const UarfPfcEvent uarf_pfc_events[];
+extern const size_t uarf_pfc_num_events;
+
+/**
+ * Get the microarchitecture of the current CPU, 0 if it is none of `uarch.h`.
+ */
+uint32_t uarf_pfc_host_uarch(void);
+
+/**
+ * Get the name of `uarch`.
+ */
+const char *uarf_pfc_uarch_str(uint32_t uarch);
+
+/**
+ * Look up the event `name` of `uarch`.
+ *
+ * @returns NULL if `uarch` has no such event
+ */
+const UarfPfcEvent *uarf_pfc_event_lookup(uint32_t uarch, const char *name);
+
+/**
+ * Initialize a PFC for the event `name` of the current CPU.
+ *
+ * The event replaces `pmu_conf` of `config`, the remaining fields apply.
+ *
+ * @returns 0 on success, -1 if the event is unknown or cannot be opened
+ */
+int uarf_pfc_init_by_name(UarfPfc *pfc, const char *name, UarfPfcConfig config);
@@ -5,6 +5,7 @@
  */
 
 #include "pfc.h"
+#include "uarch.h"
 
 /**
  * INST_RETIRED.ANY_P
@@ -22,3 +23,39 @@
  */
 #define UARF_INTEL_INST_RETIRED_PREC_DIST                                                \
     UARF_PFC_PMU_CONFIG(.event = 0xC0, .umask = 0x01)
+
+/**
+ * UOPS_ISSUED.ANY
+ *
+ * Counts the number of uops that the RAT issues to the scheduler. Issued uops that do
+ * not retire, see UARF_INTEL_UOPS_RETIRED_SLOTS, were on a mispredicted path.
+ * Golden Cove moved it from event 0x0E of the Skylake derived cores to 0xAE.
+ */
+#if UARF_IS_UARCH(COFFEE_LAKE)
+#define UARF_INTEL_UOPS_ISSUED_ANY UARF_PFC_PMU_CONFIG(.event = 0x0E, .umask = 0x01)
+#else
+#define UARF_INTEL_UOPS_ISSUED_ANY UARF_PFC_PMU_CONFIG(.event = 0xAE, .umask = 0x01)
+#endif
+
+/**
+ * UOPS_RETIRED.SLOTS
+ *
+ * Counts the retirement slots used.
+ */
+#define UARF_INTEL_UOPS_RETIRED_SLOTS UARF_PFC_PMU_CONFIG(.event = 0xC2, .umask = 0x02)
+
+/**
+ * BR_MISP_RETIRED.ALL_BRANCHES
+ *
+ * Counts all mispredicted branch instructions retired.
+ */
+#define UARF_INTEL_BR_MISP_RETIRED_ALL_BRANCHES                                          \
+    UARF_PFC_PMU_CONFIG(.event = 0xC5, .umask = 0x00)
+
+/**
+ * MACHINE_CLEARS.COUNT
+ *
+ * Counts the number of machine clears (nukes), i.e., restarts of the whole pipeline.
+ */
+#define UARF_INTEL_MACHINE_CLEARS_COUNT                                                  \
+    UARF_PFC_PMU_CONFIG(.event = 0xC3, .umask = 0x01, .edge = 1, .cmask = 1)
@@ -0,0 +1,111 @@
+/**
+ * Program performance counters directly through their MSRs
+ *
+ * Bypasses perf_event, and with it the scheduling, multiplexing and NMI handling of the
+ * kernel, for the lowest possible measurement overhead. Requires the pi kernel module.
+ *
+ * MSRs are per core and pi accesses them on the CPU issuing the ioctl, so the calling
+ * thread gets pinned to one CPU for the lifetime of the counters. Only counters that are
+ * disabled at init get used, and their previous configuration is restored at deinit.
+ * perf may still schedule events onto the same counters later, use
+ * `uarf_pfc_msr_check` to detect that.
+ *
+ * The previous affinity is saved in a `cpu_set_t`, so includers need _GNU_SOURCE.
+ *
+ * Usage:
+ *  UarfPfcMsr pm;
+ *  UarfPfcConfig configs[] = {{.pmu_conf = UARF_AMD_EX_RET_INSTR}};
+ *  uarf_assert(!uarf_pfc_msr_init(&pm, 0, configs, 1));
+ *  uarf_pfc_msr_reset(&pm);
+ *  uarf_pfc_msr_start(&pm);
+ *  uint64_t start = uarf_pfc_msr_read(&pm, 0);
+ *  ...
+ *  uint64_t count = uarf_pfc_msr_read(&pm, 0) - start;
+ *  uarf_pfc_msr_deinit(&pm);
+ */
+
+#pragma once
+
+#include "lib.h"
+#include "pfc.h"
+#include <sched.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Most general purpose counters of current CPUs
+#define UARF_PFC_MSR_MAX 8
+
+typedef struct UarfPfcMsr UarfPfcMsr;
+struct UarfPfcMsr {
+    int cpu;
+    size_t num_pfcs;
+
+    // For every counter in use: its index for `rdpmc`, its MSRs and the event selection
+    // it counts with, without the enable bit
+    uint32_t index[UARF_PFC_MSR_MAX];
+    uint32_t msr_sel[UARF_PFC_MSR_MAX];
+    uint32_t msr_ctr[UARF_PFC_MSR_MAX];
+    uint64_t sel[UARF_PFC_MSR_MAX];
+    // Previous contents of the MSRs of the counter
+    uint64_t saved_sel[UARF_PFC_MSR_MAX];
+    uint64_t saved_ctr[UARF_PFC_MSR_MAX];
+
+    // Global enable of the counters, 0 if the PMU has none
+    uint32_t msr_global_ctrl;
+    uint64_t saved_global_ctrl;
+
+    // Bits of the counters
+    uint64_t mask;
+
+    // Disabled perf event mapped only to have the kernel allow `rdpmc`
+    UarfPfc pce;
+
+    // CPUs the thread was allowed to run on before getting pinned
+    cpu_set_t saved_affinity;
+};
+
+/**
+ * Program the counters for `n` `configs` on `cpu` and pin the calling thread to it.
+ *
+ * The counters start disabled. If init fails, the thread keeps its previous affinity.
+ *
+ * @returns 0 on success, -1 if pi is missing or not enough counters are free
+ */
+int uarf_pfc_msr_init(UarfPfcMsr *pm, int cpu, const UarfPfcConfig *configs, size_t n);
+
+/**
+ * Restore the previous configuration of all counters in use and the previous affinity
+ * of the calling thread.
+ */
+void uarf_pfc_msr_deinit(UarfPfcMsr *pm);
+
+/**
+ * Start all counters of pm.
+ */
+void uarf_pfc_msr_start(UarfPfcMsr *pm);
+
+/**
+ * Stop all counters of pm.
+ */
+void uarf_pfc_msr_stop(UarfPfcMsr *pm);
+
+/**
+ * Stop and zero all counters of pm.
+ */
+void uarf_pfc_msr_reset(UarfPfcMsr *pm);
+
+/**
+ * Check whether all counters of pm still hold the configuration written by us, and are
+ * still enabled in the global control, if the PMU has one.
+ *
+ * @returns false if someone else, most likely perf, reprogrammed a counter
+ */
+bool uarf_pfc_msr_check(UarfPfcMsr *pm);
+
+/**
+ * Get the value of the `i`-th counter of pm with a bare `rdpmc`.
+ */
+static __always_inline uint64_t uarf_pfc_msr_read(UarfPfcMsr *pm, size_t i) {
+    return uarf_rdpmc(pm->index[i]) & pm->mask;
+}
@@ -0,0 +1,134 @@
+/**
+ * Multiplex more events than the PMU has counters over repetitions of a region
+ *
+ * The requested events get partitioned into groups that fit onto the counters at once.
+ * Every repetition of the measured region counts one group, rotating through all groups,
+ * so each event is sampled in every `num_groups`-th repetition. The per-repetition
+ * samples of an event give its mean, the standard error of the mean as confidence, and
+ * the scaled estimate over all repetitions.
+ *
+ * Unlike the multiplexing of the kernel, which rotates on a timer and extrapolates by
+ * time, a group is always on the PMU for a whole repetition. Samples of repetitions in
+ * which the kernel descheduled the group anyway, e.g., for another perf user, get
+ * dropped.
+ *
+ * Usage:
+ *  UarfPfcMux mux;
+ *  UarfPfcConfig configs[] = {{.pmu_conf = UARF_AMD_EX_RET_INSTR}, ...};
+ *  uarf_assert(!uarf_pfc_mux_init(&mux, configs, 20, 0));
+ *  for (size_t i = 0; i < reps; i++) {
+ *      uarf_pfc_mux_begin(&mux);
+ *      ...
+ *      uarf_pfc_mux_end(&mux);
+ *  }
+ *  uarf_pfc_mux_print(&mux);
+ *  uarf_pfc_mux_deinit(&mux);
+ */
+
+#pragma once
+
+#include "pfc.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Maximum number of multiplexed events
+#define UARF_PFC_MUX_MAX 32
+
+/**
+ * Running statistics of the samples of one event.
+ */
+typedef struct UarfPfcMuxStat UarfPfcMuxStat;
+struct UarfPfcMuxStat {
+    uint64_t num_samples;
+    double mean;
+    // Sum of squared differences from the mean, updated after Welford
+    double m2;
+};
+
+typedef struct UarfPfcMuxResult UarfPfcMuxResult;
+struct UarfPfcMuxResult {
+    // Count per repetition, with its standard error
+    double mean;
+    double error;
+    // Count over all repetitions, with its standard error
+    double total;
+    double total_error;
+    uint64_t num_samples;
+};
+
+typedef struct UarfPfcMux UarfPfcMux;
+struct UarfPfcMux {
+    size_t num_events;
+    // Name of every event, NULL unless initialized by name
+    const char *names[UARF_PFC_MUX_MAX];
+
+    // Groups hold consecutive events, starting with event `first[g]`
+    UarfPfcGroup groups[UARF_PFC_MUX_MAX];
+    size_t first[UARF_PFC_MUX_MAX];
+    size_t num_groups;
+
+    // Group of the current repetition
+    size_t cur;
+    // Times of that group at the start of the repetition. The kernel accumulates them
+    // since opening, resetting the group does not clear them.
+    uint64_t time_enabled;
+    uint64_t time_running;
+    // Repetitions so far, and those whose sample got dropped
+    uint64_t num_reps;
+    uint64_t num_dropped;
+
+    UarfPfcMuxStat stats[UARF_PFC_MUX_MAX];
+};
+
+/**
+ * Partition `n` `configs` into groups of at most `group_size` events.
+ *
+ * Groups the kernel cannot schedule at once, e.g., due to counter constraints of an
+ * event, get split further. The `start_disabled` and `pinned` of the configs are ignored.
+ *
+ * @param group_size maximum events per group, 0 for the number of counters of the CPU
+ * @returns 0 on success, -1 if an event cannot be counted at all
+ */
+int uarf_pfc_mux_init(UarfPfcMux *mux, const UarfPfcConfig *configs, size_t n,
+                      size_t group_size);
+
+/**
+ * Like `uarf_pfc_mux_init`, but for the catalogue events `names` of the current CPU.
+ *
+ * The event replaces `pmu_conf` of `config`, the remaining fields apply to all events.
+ */
+int uarf_pfc_mux_init_by_name(UarfPfcMux *mux, const char *const *names, size_t n,
+                              UarfPfcConfig config, size_t group_size);
+
+/**
+ * Close all counters of mux.
+ */
+void uarf_pfc_mux_deinit(UarfPfcMux *mux);
+
+/**
+ * Start counting the next group for one repetition of the measured region.
+ */
+void uarf_pfc_mux_begin(UarfPfcMux *mux);
+
+/**
+ * Stop counting the current group and record its counts as samples.
+ */
+void uarf_pfc_mux_end(UarfPfcMux *mux);
+
+/**
+ * Drop all samples, e.g., after a warm up.
+ */
+void uarf_pfc_mux_clear(UarfPfcMux *mux);
+
+/**
+ * Get the estimate for the `i`-th event.
+ *
+ * The error is infinite with fewer than two samples.
+ */
+UarfPfcMuxResult uarf_pfc_mux_result(UarfPfcMux *mux, size_t i);
+
+/**
+ * Print the estimates of all events, with their 95% confidence interval.
+ */
+void uarf_pfc_mux_print(UarfPfcMux *mux);
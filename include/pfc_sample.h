@@ -0,0 +1,136 @@
+/**
+ * Attribute sampled events to code regions, e.g., the snippets of JIT stubs
+ *
+ * A sampling counter records the IP every `sample_period` events into a ring buffer
+ * shared with the kernel. `uarf_pfc_sampler_drain` parses the records in place, without
+ * copying them out, and counts every IP into the histogram of the region it falls into.
+ * Regions follow their stub, so drain before reallocating a stub elsewhere.
+ *
+ * Draining costs a few instructions per record and no system call, so a sampler can run
+ * during a whole sweep, draining e.g. once per candidate. Records that did not fit into
+ * the ring get counted as lost.
+ *
+ * Samples have skid, i.e., the IP may be some instructions after the one causing the
+ * event, unless `precise_ip` is supported for the event.
+ *
+ * Usage:
+ *  UarfPfcSampler s;
+ *  UarfPfcConfig config = {.pmu_conf = UARF_AMD_EX_RET_BRN_IND_MISP,
+ *                          .exclude = UARF_PFC_EXCLUDE_KERNEL,
+ *                          .sample_period = 1,
+ *                          .sample_pages = 64};
+ *  uarf_assert(!uarf_pfc_sampler_init(&s, config));
+ *  uarf_pfc_sampler_add_jita(&s, "victim", &jita_victim, &stub_victim);
+ *  for (...) {
+ *      ...
+ *      uarf_pfc_sampler_drain(&s);
+ *  }
+ *  uarf_pfc_sampler_print(&s);
+ *  uarf_pfc_sampler_deinit(&s);
+ */
+
+#pragma once
+
+#include "jita.h"
+#include "pfc.h"
+#include "stub.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define UARF_PFC_SAMPLE_MAX_REGIONS 16
+// Largest histogram of a region, in bytes of code
+#define UARF_PFC_SAMPLE_HIST_MAX 0x10000
+
+typedef struct UarfPfcSampleRegion UarfPfcSampleRegion;
+struct UarfPfcSampleRegion {
+    const char *name;
+    // Stub the region follows, NULL for a fixed region at `start`
+    const UarfStub *stub;
+    uint64_t start;
+    uint64_t size;
+    // Context the stub was allocated from, for the snippet boundaries, or NULL
+    const UarfJitaCtxt *ctxt;
+
+    uint64_t num_samples;
+    // Samples per byte offset into the region, for the first `hist_size` bytes, at most
+    // UARF_PFC_SAMPLE_HIST_MAX
+    uint32_t *hist;
+    uint64_t hist_size;
+};
+
+typedef struct UarfPfcSampler UarfPfcSampler;
+struct UarfPfcSampler {
+    UarfPfc pfc;
+    // Ring buffer, its size is a power of two
+    uint8_t *data;
+    uint64_t data_mask;
+
+    UarfPfcSampleRegion regions[UARF_PFC_SAMPLE_MAX_REGIONS];
+    size_t num_regions;
+
+    // Samples parsed, samples outside of all regions, records dropped by the kernel
+    uint64_t num_samples;
+    uint64_t num_other;
+    uint64_t num_lost;
+};
+
+/**
+ * Open a sampling counter for `config`, with `sample_period` set.
+ *
+ * `sample_pages` defaults to 64. The counter starts unless `start_disabled` is set.
+ *
+ * @returns 0 on success, -1 if the counter cannot be opened
+ */
+int uarf_pfc_sampler_init(UarfPfcSampler *s, UarfPfcConfig config);
+
+/**
+ * Close the counter and free all histograms.
+ */
+void uarf_pfc_sampler_deinit(UarfPfcSampler *s);
+
+/**
+ * Attribute samples in [`start`, `start` + `size`) to a region called `name`.
+ *
+ * @returns index of the region
+ */
+size_t uarf_pfc_sampler_add_region(UarfPfcSampler *s, const char *name, uint64_t start,
+                                   uint64_t size);
+
+/**
+ * Attribute samples in the code of `stub` to a region called `name`, wherever the stub
+ * is allocated at the time of draining.
+ *
+ * @returns index of the region
+ */
+size_t uarf_pfc_sampler_add_stub(UarfPfcSampler *s, const char *name,
+                                 const UarfStub *stub);
+
+/**
+ * Like `uarf_pfc_sampler_add_stub`, and break the samples down by the snippets of the
+ * context `ctxt` that `stub` was allocated from.
+ */
+size_t uarf_pfc_sampler_add_jita(UarfPfcSampler *s, const char *name,
+                                 const UarfJitaCtxt *ctxt, const UarfStub *stub);
+
+/**
+ * Parse and consume all records in the ring buffer.
+ *
+ * @returns number of parsed samples
+ */
+uint64_t uarf_pfc_sampler_drain(UarfPfcSampler *s);
+
+/**
+ * Zero all histograms and statistics.
+ */
+void uarf_pfc_sampler_clear(UarfPfcSampler *s);
+
+/**
+ * Get the number of samples in the `i`-th snippet of a region added with
+ * `uarf_pfc_sampler_add_jita`.
+ */
+uint64_t uarf_pfc_sampler_snip_samples(UarfPfcSampleRegion *region, size_t i);
+
+/**
+ * Print the samples per region and snippet, and the hottest offsets of every region.
+ */
+void uarf_pfc_sampler_print(UarfPfcSampler *s);
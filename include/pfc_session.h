@@ -0,0 +1,117 @@
+/**
+ * Counter sessions spanning several CPUs
+ *
+ * A session opens the same group of events once per CPU of a set, either for one thread,
+ * e.g., a vCPU thread, or for all threads on the CPUs, i.e., system-wide. This measures
+ * the SMT sibling of the experiment or the CPU a guest runs on, next to the own CPU.
+ *
+ * All groups start and stop with back-to-back ioctls in the same order, so every CPU is
+ * measured for the same duration, only shifted by the few microseconds of the calls
+ * before it. `uarf_pfc_session_read` takes a snapshot per CPU with one grouped `read`
+ * each.
+ *
+ * The CPU sets are `cpu_set_t`, so includers need _GNU_SOURCE.
+ *
+ * Usage:
+ *  UarfPfcSession s;
+ *  UarfPfcConfig configs[] = {{.pmu_conf = UARF_AMD_EX_RET_BRN_IND_MISP}};
+ *  cpu_set_t cpus;
+ *  CPU_ZERO(&cpus);
+ *  CPU_SET(cpu, &cpus);
+ *  CPU_SET(uarf_pfc_smt_sibling(cpu), &cpus);
+ *  uarf_assert(!uarf_pfc_session_init(&s, configs, 1, &cpus, -1));
+ *  uarf_pfc_session_start(&s);
+ *  ...
+ *  uarf_pfc_session_stop(&s);
+ *  uarf_pfc_session_read(&s);
+ *  uarf_pfc_session_print(&s);
+ *  uarf_pfc_session_deinit(&s);
+ */
+
+#pragma once
+
+#include "pfc.h"
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * Counter values of one CPU, as of the last `uarf_pfc_session_read`.
+ */
+typedef struct UarfPfcSnapshot UarfPfcSnapshot;
+struct UarfPfcSnapshot {
+    uint64_t counts[UARF_PFC_GROUP_MAX];
+    uint64_t time_enabled;
+    uint64_t time_running;
+};
+
+typedef struct UarfPfcSession UarfPfcSession;
+struct UarfPfcSession {
+    // Thread measured, -1 for all threads
+    pid_t pid;
+
+    // One group and snapshot per CPU, in ascending order of the CPUs
+    size_t num_cpus;
+    int *cpus;
+    UarfPfcGroup *groups;
+    UarfPfcSnapshot *snaps;
+};
+
+/**
+ * Open the `n` events of `configs` as one group on every CPU of `cpus`.
+ *
+ * All groups start stopped, regardless of `start_disabled`.
+ *
+ * @param pid thread to measure, 0 for the calling one, -1 for all, i.e., system-wide
+ * @returns 0 on success, -1 if a counter cannot be opened
+ */
+int uarf_pfc_session_init(UarfPfcSession *s, const UarfPfcConfig *configs, size_t n,
+                          const cpu_set_t *cpus, pid_t pid);
+
+/**
+ * Close all counters of the session.
+ */
+void uarf_pfc_session_deinit(UarfPfcSession *s);
+
+/**
+ * Start the groups of all CPUs.
+ */
+void uarf_pfc_session_start(UarfPfcSession *s);
+
+/**
+ * Stop the groups of all CPUs, in the order they were started.
+ */
+void uarf_pfc_session_stop(UarfPfcSession *s);
+
+/**
+ * Reset the counters of all CPUs to zero, also stops them.
+ */
+void uarf_pfc_session_reset(UarfPfcSession *s);
+
+/**
+ * Take a snapshot of every CPU into `snaps`.
+ */
+void uarf_pfc_session_read(UarfPfcSession *s);
+
+/**
+ * Get the snapshot of `cpu`, NULL if it is not part of the session.
+ */
+const UarfPfcSnapshot *uarf_pfc_session_snap(UarfPfcSession *s, int cpu);
+
+/**
+ * Get the `i`-th event summed over all CPUs, as of the last snapshot.
+ */
+uint64_t uarf_pfc_session_sum(UarfPfcSession *s, size_t i);
+
+/**
+ * Print the last snapshot of every CPU.
+ */
+void uarf_pfc_session_print(UarfPfcSession *s);
+
+/**
+ * Get the SMT sibling of `cpu`, from the topology in sysfs.
+ *
+ * @returns the lowest other CPU of the same core, -1 if there is none
+ */
+int uarf_pfc_smt_sibling(int cpu);
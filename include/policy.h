@@ -0,0 +1,119 @@
+/**
+ * Characterisation of cache replacement policies.
+ *
+ * An access pattern is written as a string of line names separated by whitespace, e.g.,
+ * "A B C D E A? F B?". Every distinct name is a different line of the same cache set.
+ * A name followed by "?" is a probe: the access is timed and reported as hit or miss.
+ * All lines are flushed before every run of the pattern.
+ *
+ * The pattern gets JIT compiled into straight-line code over the lines of a reduced
+ * eviction set and run many times. The measured hit rates of the probes are matched
+ * against the outcome predicted by simulators of candidate policies.
+ *
+ * Usage:
+ *  UarfPolicyPattern pat;
+ *  uarf_assert(uarf_policy_parse(&pat, "A B C D E F G H I A? B?"));
+ *  uint32_t hits[UARF_POLICY_MAX_STEPS];
+ *  // Lines evicted from the L1 still hit in the L2, so tell both apart
+ *  uint64_t thresh = (l1_hit_time + l2_hit_time) / 2;
+ *  uarf_policy_measure(&pat, es, 1000, thresh, hits);
+ *  UarfPolicyMatch match = uarf_policy_match(&pat, cache.l1_ways, hits, 1000);
+ *  uarf_policy_print_match(&pat, &match, hits, 1000);
+ */
+
+#pragma once
+
+#include "evict.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define UARF_POLICY_MAX_STEPS 256
+#define UARF_POLICY_MAX_LINES 64
+#define UARF_POLICY_MAX_WAYS  32
+// Including the terminating null byte
+#define UARF_POLICY_MAX_NAME 16
+
+typedef enum UarfPolicy UarfPolicy;
+enum UarfPolicy {
+    UARF_POLICY_LRU,
+    UARF_POLICY_FIFO,
+    // Binary tree of bits pointing towards the next victim, needs a power of two ways
+    UARF_POLICY_TREE_PLRU,
+    // Quad-age LRU, hits set the age to 0, misses insert with age 1 or 2. The victim is
+    // the leftmost line of age 3, if there is none all ages get incremented first.
+    UARF_POLICY_QLRU_M1,
+    UARF_POLICY_QLRU_M2,
+    // Static RRIP with frequency priority: like QLRU_M2, but hits decrement the age
+    UARF_POLICY_SRRIP_FP,
+    UARF_POLICY_NUM,
+};
+
+typedef struct UarfPolicyStep UarfPolicyStep;
+struct UarfPolicyStep {
+    // Index of the line, in order of first appearance in the pattern
+    uint8_t line;
+    bool probe;
+};
+
+typedef struct UarfPolicyPattern UarfPolicyPattern;
+struct UarfPolicyPattern {
+    char names[UARF_POLICY_MAX_LINES][UARF_POLICY_MAX_NAME];
+    UarfPolicyStep steps[UARF_POLICY_MAX_STEPS];
+    size_t num_steps;
+    size_t num_lines;
+    size_t num_probes;
+};
+
+typedef struct UarfPolicyMatch UarfPolicyMatch;
+struct UarfPolicyMatch {
+    size_t ways;
+    // Fraction of probes where the policy predicts the measured majority outcome, -1 if
+    // the policy does not support the number of ways
+    double score[UARF_POLICY_NUM];
+    UarfPolicy best;
+};
+
+/**
+ * Parse the access pattern `str` into `pat`.
+ *
+ * @returns false if the pattern is malformed or too long
+ */
+bool uarf_policy_parse(UarfPolicyPattern *pat, const char *str);
+
+/**
+ * Simulate `pat` on an empty set of `ways` under `policy`.
+ *
+ * @param hit receives for the k-th probe whether it hits
+ */
+void uarf_policy_simulate(UarfPolicy policy, size_t ways, const UarfPolicyPattern *pat,
+                          bool *hit);
+
+/**
+ * Run `pat` `reps` times on the first lines of `es`, which all need to be congruent.
+ *
+ * Lines are only flushed before every run, so a line evicted from the level under test
+ * still hits in the next level. A threshold that only separates cache hits from memory,
+ * like FR_THRESH, thus counts every probe as hit.
+ *
+ * @param thresh access time below which a probe counts as hit, between the access times
+ * of the level under test and the next level
+ * @param hits receives for the k-th probe the number of runs in which it hit
+ */
+void uarf_policy_measure(const UarfPolicyPattern *pat, Es *es, size_t reps,
+                         uint64_t thresh, uint32_t *hits);
+
+/**
+ * Match the measured `hits` out of `reps` runs of `pat` against all policies for a set of
+ * `ways`.
+ */
+UarfPolicyMatch uarf_policy_match(const UarfPolicyPattern *pat, size_t ways,
+                                  const uint32_t *hits, size_t reps);
+
+const char *uarf_policy_str(UarfPolicy policy);
+
+/**
+ * Print the measured hit rates next to the predictions of every policy.
+ */
+void uarf_policy_print_match(const UarfPolicyPattern *pat, const UarfPolicyMatch *match,
+                             const uint32_t *hits, size_t reps);
@@ -6,6 +6,7 @@
 #include <sys/mman.h>
 
 #include "lib.h"
+#include "reduce.h"
 
 // SPDX-License-Identifier: GPL-3.0-only
 #pragma once
@@ -294,29 +295,25 @@ static char strengths[][8] = {
  * Find the reload buffer entry that had the most hits.
  */
 static size_t rb_max_index(size_t *results, long max_byte) {
-    size_t max = 0x0;
-    for (size_t c = 0x1; c <= max_byte; ++c) {
-        if (results[c] > results[max])
-            max = c;
-    }
-    return max;
+    return uarf_reduce_argmax_u64((uint64_t *) results, max_byte + 1, NULL);
 }
 
 static int sorted_idx[RB_SLOTS];
 
 /**
  * Find the `n` reload buffer entries that had the most hits.
+ *
+ * Stops at the first entry that has no more hits than entry 0.
  */
 static inline int *rb_sort(size_t *results, long n) {
-    static size_t tmp[RB_SLOTS];
+    size_t top[RB_SLOTS];
     memset(sorted_idx, 0xff, RB_SLOTS * sizeof(*sorted_idx));
-    memcpy(tmp, results, n * sizeof(*results));
-    for (int i = 0; i < n; ++i) {
-        int maxi = rb_max_index(tmp, RB_SLOTS - 1);
-        if (maxi == 0)
+    size_t num_top = uarf_reduce_top_k_u64((uint64_t *) results, RB_SLOTS,
+                                           min((size_t) n, (size_t) RB_SLOTS), top);
+    for (size_t i = 0; i < num_top; ++i) {
+        if (top[i] == 0 || results[top[i]] <= results[0])
             break;
-        sorted_idx[i] = maxi;
-        tmp[maxi] = 0;
+        sorted_idx[i] = top[i];
     }
     return sorted_idx;
 }
@@ -0,0 +1,90 @@
+/**
+ * Reduction of result vectors and matrices.
+ *
+ * Used to post-process large flush+reload results. All kernels come in a scalar, an
+ * AVX2 and an AVX-512 version. The fastest one supported by the CPU is chosen at
+ * runtime on first use.
+ *
+ * Matrices are stored row major, i.e., as [[row 0], [row 1], ... [row num_rows - 1]].
+ * For flush+reload results, a row is a bin and a column is a slot.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Available implementations of the reduction kernels.
+ */
+typedef enum UarfReduceImplType UarfReduceImplType;
+enum UarfReduceImplType {
+    UARF_REDUCE_IMPL_AUTO = 0,
+    UARF_REDUCE_IMPL_SCALAR = 1,
+    UARF_REDUCE_IMPL_AVX2 = 2,
+    UARF_REDUCE_IMPL_AVX512 = 3,
+};
+
+/**
+ * Select the implementation to use.
+ *
+ * UARF_REDUCE_IMPL_AUTO picks the fastest one supported by the CPU.
+ *
+ * @returns the selected implementation, which differs from `type` if the CPU does not
+ * support it.
+ */
+UarfReduceImplType uarf_reduce_select(UarfReduceImplType type);
+
+/**
+ * Get the name of the currently selected implementation.
+ */
+const char *uarf_reduce_impl_name(void);
+
+/**
+ * Get the sum of all `n` elements of `v`.
+ */
+uint64_t uarf_reduce_sum(const uint32_t *v, size_t n);
+
+/**
+ * Get the sum of each row of matrix `m`, i.e., the per-bin sums.
+ *
+ * @param out array of `num_rows` elements, receiving the sums
+ */
+void uarf_reduce_row_sums(const uint32_t *m, size_t num_rows, size_t num_cols,
+                          uint64_t *out);
+
+/**
+ * Get the sum of each column of matrix `m`, i.e., the per-slot totals.
+ *
+ * @param out array of `num_cols` elements, receiving the sums
+ */
+void uarf_reduce_col_sums(const uint32_t *m, size_t num_rows, size_t num_cols,
+                          uint64_t *out);
+
+/**
+ * Get the index of the first largest element of `v`.
+ *
+ * @param is_tie if not NULL, set to whether another element has the same value
+ */
+size_t uarf_reduce_argmax(const uint32_t *v, size_t n, bool *is_tie);
+
+/**
+ * Same as `uarf_reduce_argmax` for 64 bit elements.
+ */
+size_t uarf_reduce_argmax_u64(const uint64_t *v, size_t n, bool *is_tie);
+
+/**
+ * Get the indices of the `k` largest elements of `v`, in descending order of their
+ * value. Equal values are ordered by ascending index.
+ *
+ * @param idx array of `k` elements, receiving the indices
+ *
+ * @returns the number of indices written, i.e., min(k, n)
+ */
+size_t uarf_reduce_top_k(const uint32_t *v, size_t n, size_t k, size_t *idx);
+
+/**
+ * Same as `uarf_reduce_top_k` for 64 bit elements.
+ */
+size_t uarf_reduce_top_k_u64(const uint64_t *v, size_t n, size_t k, size_t *idx);
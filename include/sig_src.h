@@ -0,0 +1,209 @@
+/**
+ * Signal sources telling whether the victim speculated in a round
+ *
+ * Experiments bracket the victim with `uarf_sig_src_prepare` and `uarf_sig_src_collect`
+ * and count signaling rounds, independent of how the signal is observed:
+ * - UARF_SIG_SRC_FR: cache hits on a flush+reload buffer touched by the gadget
+ * - UARF_SIG_SRC_PFC: deltas of performance counters around the victim, e.g.,
+ *   mispredicted indirect branches, ops dispatched but not retired, or machine clears
+ *
+ * Counter signals need neither a reload nor a buffer shared with the victim, e.g., mapped
+ * into a guest, and are insensitive to cache noise. The counters of a source form one
+ * group and get read with back-to-back `rdpmc`. Derived signals are the difference of the
+ * deltas of two counters, e.g., ops dispatched minus ops retired.
+ *
+ * Most events also count the regular work of the victim. Their thresholds come from
+ * rounds in which the victim runs but does not speculate, see `uarf_sig_src_calibrate`.
+ *
+ * Dispatch is a switch on the kind, not a function pointer, so observing a round adds no
+ * indirect branches to the predictor state under test.
+ *
+ * Usage:
+ *  UarfSigSrc src;
+ *  UarfPfcConfig configs[] = {{.pmu_conf = UARF_AMD_DE_SRC_OP_DISP},
+ *                             {.pmu_conf = UARF_AMD_EX_RET_OPS}};
+ *  uarf_assert(!uarf_sig_src_init_pfc(&src, configs, 2));
+ *  src.pfc.primary = uarf_sig_src_add_diff(&src, 0, 1);
+ *  for (size_t r = 0; r < rounds; r++) {
+ *      uarf_sig_src_prepare(&src);
+ *      victim_without_training();
+ *      uarf_sig_src_collect(&src, r);
+ *  }
+ *  uarf_sig_src_calibrate(&src);
+ *  for (size_t r = 0; r < rounds; r++) {
+ *      uarf_sig_src_prepare(&src);
+ *      victim();
+ *      uarf_sig_src_collect(&src, r);
+ *  }
+ *  uint64_t hits = uarf_sig_src_hits(&src);
+ *  uarf_sig_src_deinit(&src);
+ */
+
+#pragma once
+
+#include "compiler.h"
+#include "flush_reload.h"
+#include "lib.h"
+#include "pfc.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum UarfSigSrcKind UarfSigSrcKind;
+enum UarfSigSrcKind {
+    UARF_SIG_SRC_FR = 0,
+    UARF_SIG_SRC_PFC = 1,
+};
+
+// Maximum number of derived signals of a counter source
+#define UARF_SIG_SRC_MAX_DIFFS   4
+#define UARF_SIG_SRC_MAX_SIGNALS (UARF_PFC_GROUP_MAX + UARF_SIG_SRC_MAX_DIFFS)
+
+/**
+ * Derived signal, the delta of counter `minuend` minus the one of counter `subtrahend`.
+ */
+typedef struct UarfSigSrcDiff UarfSigSrcDiff;
+struct UarfSigSrcDiff {
+    size_t minuend;
+    size_t subtrahend;
+};
+
+/**
+ * Counter deltas as signal.
+ *
+ * The signals are the counters, in order, followed by the derived signals. A round
+ * signals on a signal if its delta exceeds the threshold.
+ */
+typedef struct UarfSigSrcPfc UarfSigSrcPfc;
+struct UarfSigSrcPfc {
+    UarfPfcGroup group;
+    // Raw counter values at the start of the round
+    uint64_t start[UARF_PFC_GROUP_MAX];
+    UarfSigSrcDiff diffs[UARF_SIG_SRC_MAX_DIFFS];
+    size_t num_diffs;
+    // Signal counted by `uarf_sig_src_hits`, the first counter by default
+    size_t primary;
+
+    int64_t thresh[UARF_SIG_SRC_MAX_SIGNALS];
+    // Largest delta, sum of deltas and number of signaling rounds per signal
+    int64_t max[UARF_SIG_SRC_MAX_SIGNALS];
+    int64_t sum[UARF_SIG_SRC_MAX_SIGNALS];
+    uint64_t hits[UARF_SIG_SRC_MAX_SIGNALS];
+    uint64_t num_rounds;
+};
+
+typedef struct UarfSigSrc UarfSigSrc;
+struct UarfSigSrc {
+    UarfSigSrcKind kind;
+    union {
+        // Not owned, initialized and freed by the caller
+        UarfFrConfig *fr;
+        UarfSigSrcPfc pfc;
+    };
+};
+
+/**
+ * Use the flush+reload buffer `fr` as signal.
+ */
+void uarf_sig_src_init_fr(UarfSigSrc *src, UarfFrConfig *fr);
+
+/**
+ * Use the deltas of `n` counters as signal, the first one for `uarf_sig_src_hits`.
+ *
+ * The counters start right away and only get read with `rdpmc` from then on. Pin the
+ * leader to keep the group on the PMU. All thresholds are 0 until calibrated.
+ *
+ * @returns 0 on success, -1 if the counters cannot be opened
+ */
+int uarf_sig_src_init_pfc(UarfSigSrc *src, const UarfPfcConfig *configs, size_t n);
+
+/**
+ * Add the delta of counter `minuend` minus the one of counter `subtrahend` as signal.
+ *
+ * @returns index of the signal, e.g., for `primary`
+ */
+size_t uarf_sig_src_add_diff(UarfSigSrc *src, size_t minuend, size_t subtrahend);
+
+/**
+ * Free the resources owned by src.
+ */
+void uarf_sig_src_deinit(UarfSigSrc *src);
+
+/**
+ * Forget all observed rounds.
+ */
+void uarf_sig_src_reset(UarfSigSrc *src);
+
+/**
+ * Set the thresholds of a counter source to the largest deltas of the rounds observed
+ * since the last reset, and reset.
+ *
+ * Observe rounds in which the victim runs as in the experiment, but does not speculate,
+ * e.g., without training. Then the thresholds cover both its regular work and the noise
+ * of reading the counters. No-op for flush+reload.
+ */
+void uarf_sig_src_calibrate(UarfSigSrc *src);
+
+/**
+ * Get the number of signals: hits over all slots for flush+reload, signaling rounds of
+ * the `primary` signal for counters.
+ */
+uint64_t uarf_sig_src_hits(UarfSigSrc *src);
+
+/**
+ * Print the observed signals.
+ */
+void uarf_sig_src_print(UarfSigSrc *src);
+
+/**
+ * Prepare a round, right before running the victim.
+ */
+static __always_inline void uarf_sig_src_prepare(UarfSigSrc *src) {
+    // No tracing, it adds noise
+    switch (src->kind) {
+    case UARF_SIG_SRC_FR:
+        uarf_fr_flush(src->fr);
+        break;
+    case UARF_SIG_SRC_PFC:
+        uarf_pfc_group_read_rdpmc(&src->pfc.group, src->pfc.start);
+        break;
+    }
+}
+
+/**
+ * Observe the signal of a round, right after running the victim.
+ *
+ * @param round index of the round, selects the bin of flush+reload
+ */
+static __always_inline void uarf_sig_src_collect(UarfSigSrc *src, size_t round) {
+    // No tracing, it adds noise
+    switch (src->kind) {
+    case UARF_SIG_SRC_FR:
+        uarf_fr_reload_binned(src->fr, round);
+        break;
+    case UARF_SIG_SRC_PFC: {
+        UarfSigSrcPfc *pfc = &src->pfc;
+        uint64_t end[UARF_PFC_GROUP_MAX];
+        uarf_pfc_group_read_rdpmc(&pfc->group, end);
+
+        size_t n = pfc->group.num_pfcs;
+        int64_t delta[UARF_SIG_SRC_MAX_SIGNALS];
+        for (size_t i = 0; i < n; i++) {
+            UarfPfc *p = &pfc->group.pfcs[i];
+            delta[i] = uarf_pfc_sign_extend(end[i] - pfc->start[i], p->rdpmc_width);
+        }
+        for (size_t d = 0; d < pfc->num_diffs; d++) {
+            UarfSigSrcDiff *diff = &pfc->diffs[d];
+            delta[n + d] = delta[diff->minuend] - delta[diff->subtrahend];
+        }
+
+        for (size_t i = 0; i < n + pfc->num_diffs; i++) {
+            pfc->sum[i] += delta[i];
+            pfc->hits[i] += delta[i] > pfc->thresh[i];
+            pfc->max[i] = max(pfc->max[i], delta[i]);
+        }
+        pfc->num_rounds++;
+        break;
+    }
+    }
+}
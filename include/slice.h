@@ -0,0 +1,106 @@
+/**
+ * Reverse engineering of the L3 slice hash.
+ *
+ * The slice of a physical address is assumed to be an XOR hash: every bit of the slice
+ * is the parity of the address bits selected by a mask. Addresses of the same slice thus
+ * differ in a vector of the kernel of the hash, which lets us solve for the masks over
+ * GF(2) from addresses grouped by slice.
+ *
+ * The groups come from timing: addresses in the same set of the same slice conflict with
+ * each other, while addresses of other slices do not.
+ *
+ * Usage:
+ *  UarfSliceHash hash;
+ *  if (uarf_slice_hash_discover(&hash, 1 << 16, FR_THRESH)) {
+ *      uarf_slice_hash_set(&hash);
+ *      uarf_es_init_huge(&es, 64, victim, cache.l3_set_bits, PAGE_SIZE_2M, uarf_slice_of);
+ *  }
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Up to 2^UARF_SLICE_MAX_BITS slices
+#define UARF_SLICE_MAX_BITS 8
+
+typedef struct UarfSliceHash UarfSliceHash;
+struct UarfSliceHash {
+    uint8_t num_bits;
+    // Bit i of the slice is the parity of the address masked with masks[i]
+    uint64_t masks[UARF_SLICE_MAX_BITS];
+};
+
+/**
+ * Get the slice of physical address `pa` under `hash`.
+ */
+static inline uint64_t uarf_slice_hash_apply(const UarfSliceHash *hash, uint64_t pa) {
+    uint64_t slice = 0;
+    for (uint8_t i = 0; i < hash->num_bits; i++) {
+        slice |= (uint64_t) __builtin_parityl(pa & hash->masks[i]) << i;
+    }
+    return slice;
+}
+
+/**
+ * Use `hash` for `uarf_slice_of`.
+ */
+void uarf_slice_hash_set(const UarfSliceHash *hash);
+
+/**
+ * Get the slice of physical address `pa` under the hash set by `uarf_slice_hash_set`.
+ *
+ * Can be passed wherever a `UarfSliceFn` is expected.
+ */
+uint64_t uarf_slice_of(uint64_t pa);
+
+/**
+ * Solve for the hash given `n` physical addresses `pa` and the slice group of each of
+ * them, considering address bits `min_bit` to `max_bit`.
+ *
+ * Group IDs are arbitrary, the solved hash numbers the slices differently.
+ *
+ * @returns true if the hash separates all groups, false if the samples do not suffice
+ * or are inconsistent with an XOR hash
+ */
+bool uarf_slice_hash_solve(UarfSliceHash *hash, const uint64_t *pa, const uint64_t *group,
+                           size_t n, uint8_t min_bit, uint8_t max_bit);
+
+/**
+ * Like `uarf_slice_hash_solve`, for addresses that all map to the same set of their
+ * slice. Considers all address bits above the set index of a slice.
+ */
+bool uarf_slice_hash_solve_set(UarfSliceHash *hash, const uint64_t *pa,
+                               const uint64_t *group, size_t n);
+
+/**
+ * Group the `n` lines at `va` into slices by timing conflicts.
+ *
+ * All lines need to map to the same L3 set. Builds a minimal eviction set for a line not
+ * grouped yet and puts all lines evicted by it into the same group, until all lines are
+ * grouped.
+ *
+ * @param thresh access time above which a line counts as evicted
+ * @param group receives the group of each line, UINT64_MAX if it could not be grouped
+ *
+ * @returns the number of groups
+ */
+size_t uarf_slice_group_by_conflicts(const uint64_t *va, size_t n, uint64_t thresh,
+                                     uint64_t *group);
+
+/**
+ * Discover the slice hash of the L3.
+ *
+ * Maps `num_pages` pages, picks lines that map to the same L3 set using the pagemap,
+ * groups them by timing conflicts and solves for the hash.
+ *
+ * @returns true on success
+ */
+bool uarf_slice_hash_discover(UarfSliceHash *hash, size_t num_pages, uint64_t thresh);
+
+/**
+ * Print the masks of `hash`.
+ */
+void uarf_slice_hash_print(const UarfSliceHash *hash);
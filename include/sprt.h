@@ -0,0 +1,104 @@
+/**
+ * Sequential probability ratio test (SPRT) for flush+reload results.
+ *
+ * Decides after every round whether a slot shows a signal, shows no signal, or whether
+ * more rounds are needed. Each round is a Bernoulli trial (hit or no hit) and the test
+ * compares the hit rate `p0` of noise against the hit rate `p1` of a signal.
+ *
+ * The test stops as soon as the evidence suffices for the requested error rates:
+ * - `alpha`: probability to report a signal if there is none (false positive)
+ * - `beta`: probability to report no signal if there is one (false negative)
+ *
+ * Usage:
+ *  UarfSprt sprt = uarf_sprt_init(0.01, 0.2, 0.01, 0.01);
+ *  for (size_t r = 0; r < max_rounds; r++) {
+ *      run_round();
+ *      if (uarf_sprt_update_total(&sprt, res_p[SECRET], r + 1) != UARF_SPRT_UNDECIDED)
+ *          break;
+ *  }
+ */
+
+#pragma once
+
+#include "flush_reload.h"
+#include <stdint.h>
+
+typedef enum UarfSprtDecision UarfSprtDecision;
+enum UarfSprtDecision {
+    UARF_SPRT_UNDECIDED = 0,
+    UARF_SPRT_SIGNAL = 1,
+    UARF_SPRT_NO_SIGNAL = 2,
+};
+
+typedef struct UarfSprt UarfSprt;
+struct UarfSprt {
+    double p0;
+    double p1;
+    double alpha;
+    double beta;
+
+    // Log-likelihood ratio contributed by a hit and a miss
+    double llr_hit;
+    double llr_miss;
+    // Decision boundaries on the accumulated log-likelihood ratio
+    double upper;
+    double lower;
+
+    // Accumulated log-likelihood ratio
+    double llr;
+    // Observed rounds and hits
+    uint64_t n;
+    uint64_t hits;
+    UarfSprtDecision decision;
+};
+
+/**
+ * Create a new test.
+ *
+ * @param p0 hit rate without a signal, 0 < p0 < p1
+ * @param p1 hit rate with a signal, p0 < p1 < 1
+ * @param alpha false positive rate, 0 < alpha < 0.5
+ * @param beta false negative rate, 0 < beta < 0.5
+ */
+UarfSprt uarf_sprt_init(double p0, double p1, double alpha, double beta);
+
+/**
+ * Forget all observations, keeping the parameters.
+ */
+void uarf_sprt_reset(UarfSprt *sprt);
+
+/**
+ * Add `rounds` observed rounds of which `hits` had a hit.
+ *
+ * Once decided, further observations are ignored.
+ *
+ * @returns the current decision
+ */
+UarfSprtDecision uarf_sprt_update(UarfSprt *sprt, uint64_t hits, uint64_t rounds);
+
+/**
+ * Same as `uarf_sprt_update` but with cumulative counts, e.g., directly taken from a
+ * result array that accumulates over rounds.
+ *
+ * Only the difference to the counts of the last update is added.
+ */
+UarfSprtDecision uarf_sprt_update_total(UarfSprt *sprt, uint64_t total_hits,
+                                        uint64_t total_rounds);
+
+/**
+ * Same as `uarf_sprt_update_total` with the hits of `slot` over all bins of `conf`.
+ */
+UarfSprtDecision uarf_sprt_update_fr(UarfSprt *sprt, UarfFrConfig *conf, size_t slot,
+                                     uint64_t total_rounds);
+
+/**
+ * Get the worst case expected number of rounds until a decision.
+ *
+ * Useful to pick the maximum number of rounds before giving up as undecided.
+ */
+uint64_t uarf_sprt_expected_rounds(UarfSprt *sprt);
+
+/**
+ * Get a human readable name of `decision`.
+ */
+const char *uarf_sprt_decision_str(UarfSprtDecision decision);
@@ -0,0 +1,77 @@
+/**
+ * Overhead calibration of the timers
+ *
+ * Measures every timer around an empty region, with the same fences as the timing
+ * helpers of `lib.h`, at startup. The overheads depend on the CPU, the compiler and its
+ * optimisations, so they are never hard-coded. `uarf_get_access_time_a` and
+ * `uarf_get_access_time_m` subtract the calibrated minimum.
+ *
+ * If UARF_TIMER_PROFILE_ENV names a file, the calibration gets loaded from it if it was
+ * made on the same CPU by the same build, and stored to it otherwise.
+ *
+ * Usage:
+ *  const UarfTimerCal *cal = uarf_timer_cal(UARF_TIMER_TSC);
+ *  uint64_t dt = uarf_get_access_time(p) - cal->min;
+ */
+
+#pragma once
+
+#include "pfc.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Environment variable with the path of the calibration profile
+#define UARF_TIMER_PROFILE_ENV "UARF_TIMER_PROFILE"
+
+typedef enum UarfTimer UarfTimer;
+enum UarfTimer {
+    // rdtsc and rdtscp, as in uarf_get_access_time
+    UARF_TIMER_TSC = 0,
+    // rdpru of APERF, as in uarf_get_access_time_a
+    UARF_TIMER_APERF = 1,
+    // rdpru of MPERF, as in uarf_get_access_time_m
+    UARF_TIMER_MPERF = 2,
+    // rdpmc of a counter, only calibrated by uarf_timer_calibrate_pmc
+    UARF_TIMER_PMC = 3,
+    // clock_gettime of CLOCK_MONOTONIC, in nanoseconds
+    UARF_TIMER_CLOCK = 4,
+    UARF_TIMER_NUM = 5,
+};
+
+/**
+ * Ticks a timer reports for an empty region.
+ */
+typedef struct UarfTimerCal UarfTimerCal;
+struct UarfTimerCal {
+    bool available;
+    uint64_t min;
+    uint64_t median;
+    // Difference between the 90th and the 10th percentile
+    uint64_t jitter;
+};
+
+/**
+ * Get the calibration of `timer`.
+ */
+const UarfTimerCal *uarf_timer_cal(UarfTimer timer);
+
+/**
+ * Get the name of `timer`.
+ */
+const char *uarf_timer_str(UarfTimer timer);
+
+/**
+ * Calibrate all timers but UARF_TIMER_PMC again, over `rounds` empty regions each.
+ */
+void uarf_timer_calibrate(size_t rounds);
+
+/**
+ * Calibrate UARF_TIMER_PMC with the started counter `pfc`, over `rounds` empty
+ * regions.
+ */
+void uarf_timer_calibrate_pmc(UarfPfc *pfc, size_t rounds);
+
+/**
+ * Print the calibration of all timers.
+ */
+void uarf_timer_print(void);
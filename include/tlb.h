@@ -0,0 +1,142 @@
+#pragma once
+/**
+ * TLB geometry and eviction sets for TLB entries.
+ *
+ * The geometry gets discovered at startup, from CPUID leaf 0x18 on Intel and
+ * 0x80000005/0x80000006 on AMD. If neither is available, typical values are assumed,
+ * which the calibration of the eviction sets makes up for.
+ *
+ * A TLB eviction set consists of pages whose virtual page numbers map to the same TLB set
+ * as the victim. Data pages are accessed through an ES with one line per page, at
+ * different page offsets so the lines do not conflict in the cache. Code pages are stubs
+ * holding a single return, which get called.
+ *
+ * Usage:
+ *  UarfTlbEs tes = uarf_tlb_es_init(UARF_TLB_L2, victim, 4 * tlb.l2.ways);
+ *  uarf_assert(uarf_tlb_es_calibrate(&tes, victim, 100));
+ *  uarf_tlb_es_access(&tes);
+ *  uint64_t t = uarf_tlb_time_load(_ptr(victim));
+ *  uarf_tlb_es_deinit(&tes);
+ */
+
+#include "evict.h"
+#include "stub.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct UarfTlbGeometry UarfTlbGeometry;
+struct UarfTlbGeometry {
+    uint32_t sets;
+    uint32_t ways;
+    // Set index is the XOR of the two lowest groups of VPN bits instead of the lowest bits
+    bool xor_index;
+};
+
+typedef struct UarfTlb UarfTlb;
+struct UarfTlb {
+    // 4KB page TLBs
+    UarfTlbGeometry l1d;
+    UarfTlbGeometry l1i;
+    UarfTlbGeometry l2;
+};
+
+extern UarfTlb tlb;
+
+/**
+ * Discover the TLB geometry of the current CPU and store it in `tlb`.
+ *
+ * Runs automatically at startup.
+ */
+void uarf_tlb_init(void);
+
+/**
+ * Get the set of virtual address `va` in a TLB of geometry `geo`.
+ */
+static inline uint64_t uarf_tlb_set(const UarfTlbGeometry *geo, uint64_t va) {
+    uint64_t vpn = va >> 12;
+    if (geo->xor_index) {
+        vpn ^= vpn / geo->sets;
+    }
+    return vpn % geo->sets;
+}
+
+typedef enum UarfTlbTarget UarfTlbTarget;
+enum UarfTlbTarget {
+    UARF_TLB_L1D,
+    UARF_TLB_L1I,
+    UARF_TLB_L2,
+    // The L2 TLB, through code pages. Evicts from the L1 iTLB along the way, so fetching
+    // the victim takes a page walk.
+    UARF_TLB_L2_CODE,
+};
+
+typedef struct UarfTlbEs UarfTlbEs;
+struct UarfTlbEs {
+    UarfTlbTarget target;
+    // Pages congruent to the victim in the target TLB
+    uint64_t *pages;
+    size_t num_pages;
+    // For data TLBs, one line on every page
+    Es *es;
+    // For code targets, a stub returning right away on every page
+    UarfStub *stubs;
+
+    // Eviction pattern: access the first `size` pages `reps` times
+    size_t size;
+    size_t reps;
+    // Access time above which the victim's translation counts as evicted, 0 until
+    // calibrated
+    uint64_t thresh;
+};
+
+/**
+ * Build an eviction set of `num_pages` pages for the translation of `victim` in the
+ * `target` TLB.
+ *
+ * Until calibrated, the pattern accesses all pages twice.
+ */
+UarfTlbEs uarf_tlb_es_init(UarfTlbTarget target, uint64_t victim, size_t num_pages);
+
+/**
+ * Unmap all pages of `tes`.
+ */
+void uarf_tlb_es_deinit(UarfTlbEs *tes);
+
+/**
+ * Access `tes` with its eviction pattern.
+ */
+void uarf_tlb_es_access(UarfTlbEs *tes);
+
+/**
+ * Find the cheapest eviction pattern of `tes` for `victim`, `trials` measurements each.
+ *
+ * The victim needs to be a data address for data targets and the address of a return
+ * for code targets. Sets the threshold between the access time with a hot and an evicted
+ * translation, then takes the pattern with the fewest accesses whose median slowdown of the
+ * victim is at least 90% of the one of accessing all pages twice.
+ *
+ * @returns false if accessing all pages does not slow down the victim
+ */
+bool uarf_tlb_es_calibrate(UarfTlbEs *tes, uint64_t victim, size_t trials);
+
+/**
+ * Check whether accessing `tes` evicts the translation of `victim`, calibrated with
+ * `uarf_tlb_es_calibrate`.
+ *
+ * Times the victim after accessing `tes` with its eviction pattern.
+ *
+ * @returns true if the access time of the victim is above the threshold of `tes`
+ */
+bool uarf_tlb_es_evicted(UarfTlbEs *tes, uint64_t victim);
+
+/**
+ * Time a load from `p`. With the line in the cache, it is dominated by the translation.
+ */
+uint64_t uarf_tlb_time_load(void *p);
+
+/**
+ * Time a call to the return at `p`.
+ */
+uint64_t uarf_tlb_time_exec(void *p);
+
@@ -5,11 +5,17 @@
 
 #include "compiler.h"
 
-#define UARF_INTEL 0x100
-#define ALDER_LAKE (UARF_INTEL + 0x12)
+// Supported as UARCH are ALDER_LAKE and ZEN4, the event catalogue knows all of them
+#define UARF_INTEL  0x100
+#define COFFEE_LAKE (UARF_INTEL + 0x08)
+#define ALDER_LAKE  (UARF_INTEL + 0x12)
+#define RAPTOR_LAKE (UARF_INTEL + 0x13)
 
 #define UARF_AMD 0x200
+#define ZEN2     (UARF_AMD + 0x2)
+#define ZEN3     (UARF_AMD + 0x3)
 #define ZEN4     (UARF_AMD + 0x4)
+#define ZEN5     (UARF_AMD + 0x5)
 
 #if UARCH + 0 == 0
 #pragma message "Set default UARCH"
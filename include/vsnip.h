@@ -3,8 +3,10 @@
  */
 
 #pragma once
+#include "lib.h"
 #include "log.h"
 #include "stub.h"
+#include <stdbool.h>
 #include <stdint.h>
 
 #ifdef UARF_LOG_TAG
@@ -65,6 +67,131 @@ struct Uarf_VsnipFill {
     uint32_t times;
 };
 
+/**
+ * Order in which vsnip_access visits its addresses
+ */
+typedef enum UarfAccessPattern UarfAccessPattern;
+enum UarfAccessPattern {
+    UARF_ACCESS_FWD,
+    UARF_ACCESS_BWD,
+    // Forward, backward and forward again
+    UARF_ACCESS_FBF,
+};
+
+/**
+ * Fence inserted by vsnip_access after every access
+ */
+typedef enum UarfAccessFence UarfAccessFence;
+enum UarfAccessFence {
+    UARF_FENCE_NONE,
+    UARF_FENCE_LFENCE,
+    UARF_FENCE_MFENCE,
+};
+
+/**
+ * vsnippet that loads from the `n` addresses at `addrs` in `pattern`, `reps` times
+ *
+ * Every load is a `movabs al, [addr]` with the address as immediate, so the code is
+ * straight-line and does not touch any memory but the addresses. Clobbers rax.
+ * `addrs` has to stay valid until the snippet is allocated.
+ */
+typedef struct UarfVsnipAccess UarfVsnipAccess;
+struct UarfVsnipAccess {
+    const uint64_t *addrs;
+    uint32_t n;
+    uint32_t reps;
+    UarfAccessPattern pattern;
+    UarfAccessFence fence;
+};
+
+/**
+ * vsnippet that loads from the `n` addresses at `addrs` in order, with an lfence after
+ * every load
+ *
+ * Loads with `probe[i]` set are timed with rdtscp. The cycles of the k-th timed load are
+ * stored as uint32_t at index k of the array passed in rdi. Clobbers rax, rcx, rdx, rsi
+ * and r8. `addrs` and `probe` have to stay valid until the snippet is allocated.
+ */
+typedef struct UarfVsnipTimedAccess UarfVsnipTimedAccess;
+struct UarfVsnipTimedAccess {
+    const uint64_t *addrs;
+    const bool *probe;
+    uint32_t n;
+};
+
+// Most counters read by one measurement
+#define UARF_MEASURE_MAX 4
+
+// Counter index that reads the time stamp counter with rdtscp instead of rdpmc
+#define UARF_MEASURE_TSC 0xffffffffu
+
+/**
+ * Counters read at the begin and end of a measured region, and their result slots
+ *
+ * Has to stay valid, i.e., at the same address, while stubs measuring into it exist.
+ */
+typedef struct UarfMeasure UarfMeasure;
+struct UarfMeasure {
+    uint32_t n;
+    // rdpmc index of every counter, or UARF_MEASURE_TSC
+    uint32_t index[UARF_MEASURE_MAX];
+    // Bits of every counter, the difference gets sign-extended from them
+    uint8_t width[UARF_MEASURE_MAX];
+    // Difference of every counter between begin and end of the last run
+    uint64_t res[UARF_MEASURE_MAX];
+    // Difference of every counter for an empty region, see uarf_jita_measure_calibrate
+    uint64_t overhead[UARF_MEASURE_MAX];
+};
+
+/**
+ * Get an initialized measure_t without counters.
+ */
+static __always_inline UarfMeasure uarf_measure_init(void) {
+    return (UarfMeasure) {.n = 0};
+}
+
+/**
+ * Add the time stamp counter to m.
+ */
+static __always_inline void uarf_measure_add_tsc(UarfMeasure *m) {
+    uarf_assert(m->n < UARF_MEASURE_MAX);
+    m->index[m->n] = UARF_MEASURE_TSC;
+    m->width[m->n++] = 64;
+}
+
+/**
+ * Add the performance counter with rdpmc `index` and `width` bits to m, e.g.,
+ * `rdpmc_index` and `rdpmc_width` of a started UarfPfc.
+ */
+static __always_inline void uarf_measure_add_pmc(UarfMeasure *m, uint32_t index,
+                                                 uint8_t width) {
+    uarf_assert(m->n < UARF_MEASURE_MAX);
+    uarf_assert(width > 0 && width <= 64);
+    // Also the index of a counter that is not on the PMU
+    uarf_assert(index != UARF_MEASURE_TSC);
+    m->index[m->n] = index;
+    m->width[m->n++] = width;
+}
+
+/**
+ * Get the difference of the `i`-th counter of the last run, without the overhead.
+ */
+static __always_inline uint64_t uarf_measure_get(UarfMeasure *m, size_t i) {
+    return m->res[i] > m->overhead[i] ? m->res[i] - m->overhead[i] : 0;
+}
+
+/**
+ * vsnippet that reads the counters of `m` at the begin or end of a measured region
+ *
+ * Register-only: the begin stores the counters to the result slots, the end replaces
+ * them with the differences. Both are fenced by lfence. Clobbers rax, rcx and rdx.
+ */
+typedef struct UarfVsnipMeasure UarfVsnipMeasure;
+struct UarfVsnipMeasure {
+    UarfMeasure *m;
+    bool end;
+};
+
 /**
  * Represents a virtual snippet
  */
@@ -77,6 +204,9 @@ struct UarfVsnip {
         VSNIP_JMP_NEAR_ABS,
         VSNIP_JMP_NEAR_REL,
         VSNIP_FILL,
+        VSNIP_ACCESS,
+        VSNIP_TIMED_ACCESS,
+        VSNIP_MEASURE,
     } type;
     union {
         UarfVsnipAlign vsnip_align;
@@ -85,6 +215,9 @@ struct UarfVsnip {
         UarfVsnipJmpNearAbs vsnip_jmp_near_abs;
         UarfVsnipJmpNearRel vsnip_jmp_near_rel;
         Uarf_VsnipFill vsnip_fill;
+        UarfVsnipAccess vsnip_access;
+        UarfVsnipTimedAccess vsnip_timed_access;
+        UarfVsnipMeasure vsnip_measure;
     };
 };
 
@@ -158,3 +291,42 @@ int uarf_vsnip_jmp_near_rel_alloc(UarfVsnipJmpNearRel *snip, uint64_t *base_addr
  */
 int uarf_vsnip_fill_alloc(Uarf_VsnipFill *snip, uint64_t *base_addr_ptr,
                           uint64_t rem_size);
+
+/**
+ * Allocation function for vsnip_access_t
+ *
+ * @param snip pointer to vsnip to allocate
+ * @param base_addr_ptr to address where to allocate to. Gets updated to new base
+ * address
+ * @param rem_size number of bytes that are mapped starting at `*base_addr_ptr`
+ *
+ * @returns -ENOSPC if `rem_size` is too small to allocate nsnip, else ESUCCESS
+ */
+int uarf_vsnip_access_alloc(UarfVsnipAccess *snip, uint64_t *base_addr_ptr,
+                            uint64_t rem_size);
+
+/**
+ * Allocation function for vsnip_timed_access_t
+ *
+ * @param snip pointer to vsnip to allocate
+ * @param base_addr_ptr to address where to allocate to. Gets updated to new base
+ * address
+ * @param rem_size number of bytes that are mapped starting at `*base_addr_ptr`
+ *
+ * @returns -ENOSPC if `rem_size` is too small to allocate nsnip, else ESUCCESS
+ */
+int uarf_vsnip_timed_access_alloc(UarfVsnipTimedAccess *snip, uint64_t *base_addr_ptr,
+                                  uint64_t rem_size);
+
+/**
+ * Allocation function for vsnip_measure_t
+ *
+ * @param snip pointer to vsnip to allocate
+ * @param base_addr_ptr to address where to allocate to. Gets updated to new base
+ * address
+ * @param rem_size number of bytes that are mapped starting at `*base_addr_ptr`
+ *
+ * @returns -ENOSPC if `rem_size` is too small to allocate nsnip, else ESUCCESS
+ */
+int uarf_vsnip_measure_alloc(UarfVsnipMeasure *snip, uint64_t *base_addr_ptr,
+                             uint64_t rem_size);
@@ -1,36 +1,302 @@
 #include "cache.h"
-#include "uarch.h"
-
-#if UARF_IS_UARCH(ZEN4)
-UarfCache cache = {
-    .cache_line_bits = 6,
-    .cache_line_size = (1 << 6),
-    .l1_set_bits = 6,
-    .l1_ways = 8,
-    .l2_set_bits = 11,
-    .l2_ways = 8,
-    .l3_set_bits = 15,
-    .l3_ways = 16,
-};
-// #elif defined UARCH && UARCH == skylake
-#else
+#include "lib.h"
+#include "log.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
 UarfCache cache = {};
-#warning "No cache design for this microarch"
-#endif
 
-uint64_t uarf_get_set_bits(uint64_t addr, uint64_t set_bits) {
-    uint64_t mask = ((1 << set_bits) - 1) << cache.cache_line_bits;
-    return addr & mask;
+// Cache types as reported by CPUID
+#define CPUID_CACHE_TYPE_NULL        0
+#define CPUID_CACHE_TYPE_DATA        1
+#define CPUID_CACHE_TYPE_INSTRUCTION 2
+#define CPUID_CACHE_TYPE_UNIFIED     3
+
+#define SYSFS_CACHE_PATH    "/sys/devices/system/cpu/cpu0/cache"
+#define SYSFS_TOPOLOGY_PATH "/sys/devices/system/cpu/cpu0/topology"
+
+/**
+ * Number of bits to index `num` elements, a power of two.
+ */
+static uint8_t index_bits(uint64_t num) {
+    if (!num) {
+        return 0;
+    }
+    uarf_assert(IS_POW_TWO(num));
+    return __builtin_ctzl(num);
+}
+
+/**
+ * Number of bits to index the `sets` of an unsliced cache of `level`.
+ *
+ * @returns 0 if `sets` is not a power of two
+ */
+static uint8_t set_bits(uint8_t level, uint64_t sets) {
+    if (!IS_POW_TWO(sets)) {
+        UARF_LOG_DEBUG("L%u has %lu sets, not a power of two\n", level, sets);
+        return 0;
+    }
+    return index_bits(sets);
+}
+
+/**
+ * Get the number of CPUs in the sysfs CPU list at `path`, e.g., "0-7,16".
+ */
+static uint64_t sysfs_count_cpus(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return 0;
+    }
+    uint64_t num = 0;
+    uint64_t from, to;
+    int ret;
+    while ((ret = fscanf(f, "%lu-%lu", &from, &to)) >= 1) {
+        num += ret == 2 ? to - from + 1 : 1;
+        if (fgetc(f) != ',') {
+            break;
+        }
+    }
+    fclose(f);
+    return num;
+}
+
+/**
+ * Store the geometry of a data or unified cache of `level`.
+ */
+static void cache_set_level(uint8_t level, uint64_t line_size, uint64_t ways,
+                            uint64_t sets, uint64_t shared) {
+    UARF_LOG_DEBUG("L%u: line size %lu, %lu ways, %lu sets, shared by %lu\n", level,
+                   line_size, ways, sets, shared);
+
+    cache.cache_line_bits = index_bits(line_size);
+    cache.cache_line_size = line_size;
+
+    switch (level) {
+    case 1:
+        cache.l1_set_bits = set_bits(level, sets);
+        cache.l1_ways = ways;
+        cache.l1_shared = shared;
+        break;
+    case 2:
+        cache.l2_set_bits = set_bits(level, sets);
+        cache.l2_ways = ways;
+        cache.l2_shared = shared;
+        break;
+    case 3:
+        // Set bits per slice follow once the slices are known
+        cache.l3_sets = sets;
+        cache.l3_ways = ways;
+        cache.l3_shared = shared;
+        break;
+    default:
+        UARF_LOG_DEBUG("Ignore L%u\n", level);
+        break;
+    }
+}
+
+/**
+ * Discover the caches through the deterministic cache parameters CPUID `leaf`. Intel
+ * and AMD use the same format.
+ *
+ * @returns the number of caches found
+ */
+static size_t cache_init_cpuid(uint32_t leaf) {
+    size_t num_found = 0;
+
+    for (uint32_t i = 0;; i++) {
+        uint32_t eax, ebx = 0, ecx = i, edx = 0;
+        uarf_cpuid(leaf, &eax, &ebx, &ecx, &edx);
+
+        uint32_t type = eax & 0x1f;
+        if (type == CPUID_CACHE_TYPE_NULL) {
+            break;
+        }
+        if (type == CPUID_CACHE_TYPE_INSTRUCTION) {
+            continue;
+        }
+
+        uint8_t level = (eax >> 5) & 0x7;
+        uint64_t shared = ((eax >> 14) & 0xfff) + 1;
+        uint64_t line_size = (ebx & 0xfff) + 1;
+        uint64_t ways = ((ebx >> 22) & 0x3ff) + 1;
+        uint64_t sets = _ul(ecx) + 1;
+
+        cache_set_level(level, line_size, ways, sets, shared);
+        num_found++;
+    }
+
+    return num_found;
+}
+
+/**
+ * Read the number in sysfs file `index`/`name`.
+ */
+static uint64_t sysfs_read_num(size_t index, const char *name) {
+    char path[128];
+    snprintf(path, sizeof(path), SYSFS_CACHE_PATH "/index%lu/%s", index, name);
+
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return 0;
+    }
+    uint64_t num = 0;
+    if (fscanf(f, "%lu", &num) != 1) {
+        num = 0;
+    }
+    fclose(f);
+    return num;
+}
+
+/**
+ * Get the number of CPUs in the sysfs CPU list `index`/shared_cpu_list, e.g., "0-7,16".
+ */
+static uint64_t sysfs_read_num_cpus(size_t index) {
+    char path[128];
+    snprintf(path, sizeof(path), SYSFS_CACHE_PATH "/index%lu/shared_cpu_list", index);
+    return sysfs_count_cpus(path);
+}
+
+/**
+ * Discover the caches through sysfs.
+ *
+ * @returns the number of caches found
+ */
+static size_t cache_init_sysfs(void) {
+    size_t num_found = 0;
+
+    for (size_t index = 0;; index++) {
+        char path[128];
+        snprintf(path, sizeof(path), SYSFS_CACHE_PATH "/index%lu/type", index);
+
+        FILE *f = fopen(path, "r");
+        if (!f) {
+            break;
+        }
+        char type[32] = {};
+        if (!fgets(type, sizeof(type), f)) {
+            type[0] = '\0';
+        }
+        fclose(f);
+
+        if (!strncmp(type, "Instruction", strlen("Instruction"))) {
+            continue;
+        }
+
+        cache_set_level(sysfs_read_num(index, "level"),
+                        sysfs_read_num(index, "coherency_line_size"),
+                        sysfs_read_num(index, "ways_of_associativity"),
+                        sysfs_read_num(index, "number_of_sets"),
+                        sysfs_read_num_cpus(index));
+        num_found++;
+    }
+
+    return num_found;
+}
+
+/**
+ * Get the number of logical CPUs per core.
+ */
+static uint64_t cache_threads_per_core(void) {
+    uint64_t threads = sysfs_count_cpus(SYSFS_TOPOLOGY_PATH "/thread_siblings_list");
+    if (threads) {
+        return threads;
+    }
+
+    if (uarf_cpu_is_amd()) {
+        if (uarf_cpuid_eax(0x80000000) >= 0x8000001e) {
+            return ((uarf_cpuid_ebx(0x8000001e) >> 8) & 0xff) + 1;
+        }
+    }
+    else if (uarf_cpuid_eax(0) >= 0xb) {
+        // Subleaf 0 is the SMT level
+        uint32_t eax, ebx = 0, ecx = 0, edx = 0;
+        uarf_cpuid(0xb, &eax, &ebx, &ecx, &edx);
+        if (ebx & 0xffff) {
+            return ebx & 0xffff;
+        }
+    }
+    return 1;
 }
 
-uint64_t uarf_get_l1_set(uint64_t addr) {
-    return uarf_get_set_bits(addr, cache.l1_set_bits) >> cache.cache_line_bits;
+/**
+ * Get the number of L3 slices, one per core sharing the L3.
+ *
+ * The CPUs sharing the L3 come from sysfs if possible, Intel only reports an upper
+ * bound through CPUID.
+ */
+static uint64_t cache_l3_slices(void) {
+    uint64_t shared = 0;
+    for (size_t index = 0; !shared; index++) {
+        uint64_t level = sysfs_read_num(index, "level");
+        if (!level) {
+            break;
+        }
+        if (level == 3) {
+            shared = sysfs_read_num_cpus(index);
+        }
+    }
+    if (!shared) {
+        shared = cache.l3_shared;
+    }
+
+    return max(shared / cache_threads_per_core(), 1ul);
+}
+
+bool uarf_cache_set_l3(uint64_t sets, uint8_t ways, uint16_t slices) {
+    UARF_LOG_TRACE("(%lu, %u, %u)\n", sets, ways, slices);
+
+    cache.l3_sets = sets;
+    cache.l3_ways = ways;
+    cache.l3_slices = slices;
+    cache.l3_set_bits = 0;
+
+    if (!slices || sets % slices || !IS_POW_TWO(sets / slices)) {
+        UARF_LOG_DEBUG("Cannot split %lu L3 sets into %u slices of a power of two\n",
+                       sets, slices);
+    }
+    else {
+        cache.l3_set_bits = index_bits(sets / slices);
+    }
+    cache.l3_set_mask = ((1ul << cache.l3_set_bits) - 1) << cache.cache_line_bits;
+
+    return cache.l3_set_bits;
 }
 
-uint64_t uarf_get_l2_set(uint64_t addr) {
-    return uarf_get_set_bits(addr, cache.l2_set_bits) >> cache.cache_line_bits;
+void uarf_cache_init(void) {
+    UARF_LOG_TRACE("()\n");
+
+    memset(&cache, 0, sizeof(cache));
+
+    size_t num_found = 0;
+    if (uarf_cpu_is_amd()) {
+        // Needs topology extensions
+        if (uarf_cpuid_eax(0x80000000) >= 0x8000001d &&
+            (uarf_cpuid_ecx(0x80000001) & BIT(22))) {
+            num_found = cache_init_cpuid(0x8000001d);
+        }
+    }
+    else if (uarf_cpuid_eax(0) >= 4) {
+        num_found = cache_init_cpuid(4);
+    }
+
+    if (!num_found) {
+        UARF_LOG_DEBUG("No caches reported by CPUID, use sysfs\n");
+        num_found = cache_init_sysfs();
+    }
+
+    if (!num_found) {
+        UARF_LOG_WARNING("Could not discover the cache geometry\n");
+        return;
+    }
+
+    cache.l1_set_mask = ((1ul << cache.l1_set_bits) - 1) << cache.cache_line_bits;
+    cache.l2_set_mask = ((1ul << cache.l2_set_bits) - 1) << cache.cache_line_bits;
+    if (cache.l3_sets) {
+        uarf_cache_set_l3(cache.l3_sets, cache.l3_ways, cache_l3_slices());
+    }
 }
 
-uint64_t uarf_get_l3_set(uint64_t addr) {
-    return uarf_get_set_bits(addr, cache.l3_set_bits) >> cache.cache_line_bits;
+__attribute__((constructor)) static void cache_init_constructor(void) {
+    uarf_cache_init();
 }
@@ -1,61 +1,287 @@
 #include "evict.h"
 #include "cache.h"
+#include "jita.h"
 #include "lib.h"
 #include "log.h"
 #include "mem.h"
 #include "page.h"
+#include <linux/mman.h>
+#include <string.h>
+
+// Number of times every line is accessed by `uarf_es_access_local`
+#define ES_LOCAL_REPS 32
+
+UarfPagePool uarf_es_pool = {};
+
+/**
+ * Allocate an empty ES for `es_size` lines on at most `max_pages` pages of `page_size`.
+ */
+static Es *es_alloc(size_t es_size, size_t max_pages, size_t page_size) {
+    Es *es = uarf_malloc_or_die(sizeof(Es));
+    *es = (Es) {
+        .addrs = uarf_malloc_or_die(es_size * sizeof(uint64_t)),
+        .size = 0,
+        .num_removed = 0,
+        .capacity = es_size,
+        .ring = NULL,
+        .pages = max_pages ? uarf_malloc_or_die(max_pages * sizeof(uint64_t)) : NULL,
+        .num_pages = 0,
+        .page_size = page_size,
+        .pool = NULL,
+        .jit = uarf_stub_init(),
+    };
+    return es;
+}
+
+/**
+ * Link all lines of `es` into a ring, in order of the array.
+ */
+static void es_link_ring(Es *es) {
+    for (size_t i = 0; i < es->size; i++) {
+        es->lines[i]->next = es->lines[(i + 1) % es->size];
+        es->lines[i]->prev = es->lines[(i + es->size - 1) % es->size];
+    }
+    es->ring = es->size ? es->lines[0] : NULL;
+}
 
 /**
  * Create eviction set with random elements of size `es_size`.
  */
 void uarf_es_init(Es **es, size_t es_size) {
+    UARF_LOG_TRACE("(%p, %lu)\n", es, es_size);
+
+    uarf_assert(cache.cache_line_size >= sizeof(UarfEsLine));
 
-    *es = uarf_malloc_or_die(sizeof(Es));
-    EsElem *head = uarf_malloc_or_die(sizeof(EsElem));
-    EsElem *tail = uarf_malloc_or_die(sizeof(EsElem));
-    uarf_dll_init(*es, head, NULL, tail, NULL);
+    size_t lines_per_page = PAGE_SIZE / cache.cache_line_size;
+    *es = es_alloc(es_size, div_round_up(es_size, lines_per_page), PAGE_SIZE);
+    (*es)->pool = &uarf_es_pool;
 
-    size_t i = 0;
-    while (i < es_size) {
-        uint64_t map = _ul(uarf_alloc_random_page());
-        uarf_assert(!mlock(_ptr(map), PAGE_SIZE));
+    while ((*es)->size < es_size) {
+        uint64_t map = uarf_page_pool_get(&uarf_es_pool);
+        (*es)->pages[(*es)->num_pages++] = map;
 
-        for (size_t cl = 0; i < es_size && cl < PAGE_SIZE;
-             i++, cl += cache.cache_line_size) {
-            EsElem *elem = _ptr(map + cl);
-            uarf_dll_node_init(*es, elem, _ptr(elem));
-            uarf_dll_push_tail(*es, elem);
+        for (size_t cl = 0; (*es)->size < es_size && cl < PAGE_SIZE;
+             cl += cache.cache_line_size) {
+            (*es)->addrs[(*es)->size++] = map + cl;
         }
     };
+
+    es_link_ring(*es);
+}
+
+/**
+ * Create eviction set from the `n` lines at `addrs`.
+ *
+ * The ES does not own the memory of the lines, but overwrites their start with the
+ * links of the ring.
+ */
+void uarf_es_init_addrs(Es **es, const uint64_t *addrs, size_t n) {
+    UARF_LOG_TRACE("(%p, %p, %lu)\n", es, addrs, n);
+
+    *es = es_alloc(n, 0, 0);
+    memcpy((*es)->addrs, addrs, n * sizeof(uint64_t));
+    (*es)->size = n;
+
+    es_link_ring(*es);
 }
 
 /**
- * Free all allocations made for the ES
+ * Allocate a huge page of `page_size`, either 2MB or 1GB.
+ */
+static uint64_t es_alloc_huge(size_t page_size) {
+    if (page_size == PAGE_SIZE_2M) {
+        return _ul(uarf_alloc_random_hugepage());
+    }
+
+    uarf_assert(page_size == PAGE_SIZE_1G);
+    void *map = mmap(NULL, PAGE_SIZE_1G, PROT_RWX, MMAP_FLAGS | MAP_HUGETLB | MAP_HUGE_1GB,
+                     -1, 0);
+    if (map == MAP_FAILED) {
+        UARF_LOG_ERROR("Failed to map 1GB huge page\n");
+        exit(1);
+    }
+    return _ul(map);
+}
+
+/**
+ * Create eviction set of size `es_size` with lines congruent to `victim`, taken from
+ * huge pages of `page_size` (2MB or 1GB).
+ *
+ * Within a huge page, the page offset determines the set index, so only lines in the
+ * same set of a cache with `set_bits` set index bits as `victim` get selected. If
+ * `slice_fn` is not NULL, lines also need to map to the same slice as `victim`, as
+ * given by `slice_fn` on the physical address.
+ *
+ * Such a set is orders of magnitude smaller than one from `uarf_es_init` for the same
+ * number of congruent lines.
+ */
+void uarf_es_init_huge(Es **es, size_t es_size, void *victim, uint8_t set_bits,
+                       size_t page_size, UarfSliceFn slice_fn) {
+    UARF_LOG_TRACE("(%p, %lu, %p, %u, 0x%lx, %p)\n", es, es_size, victim, set_bits,
+                   page_size, slice_fn);
+
+    uarf_assert(cache.cache_line_size >= sizeof(UarfEsLine));
+
+    // Distance between two lines of the same set
+    uint64_t set_stride = _ul(cache.cache_line_size) << set_bits;
+    uarf_assert(set_stride <= page_size);
+
+    uint64_t victim_pa = uarf_va_to_pa(_ul(victim), 0);
+    uint64_t set_offset = victim_pa & (set_stride - 1) & ~(cache.cache_line_size - 1ul);
+    uint64_t victim_slice = slice_fn ? slice_fn(victim_pa) : 0;
+
+    UARF_LOG_DEBUG("Victim PA 0x%lx, set offset 0x%lx, slice %lu\n", victim_pa,
+                   set_offset, victim_slice);
+
+    // Every page has the same number of congruent lines, but not all of them are in the
+    // same slice
+    size_t lines_per_page = page_size / set_stride;
+    size_t max_pages = div_round_up(es_size, lines_per_page);
+    *es = es_alloc(es_size, max_pages, page_size);
+
+    while ((*es)->size < es_size) {
+        if ((*es)->num_pages == max_pages) {
+            max_pages *= 2;
+            (*es)->pages = realloc((*es)->pages, max_pages * sizeof(uint64_t));
+            uarf_assert((*es)->pages);
+        }
+
+        uint64_t map = es_alloc_huge(page_size);
+        uarf_assert(!mlock(_ptr(map), page_size));
+        (*es)->pages[(*es)->num_pages++] = map;
+
+        // Huge pages are physically contiguous
+        uint64_t map_pa = uarf_va_to_pa(map, 0);
+        size_t size_before = (*es)->size;
+
+        for (uint64_t off = set_offset; (*es)->size < es_size && off < page_size;
+             off += set_stride) {
+            if (slice_fn && slice_fn(map_pa + off) != victim_slice) {
+                continue;
+            }
+            (*es)->addrs[(*es)->size++] = map + off;
+        }
+
+        UARF_LOG_DEBUG("Got %lu congruent lines from page 0x%lx\n",
+                       (*es)->size - size_before, map);
+    }
+
+    es_link_ring(*es);
+}
+
+/**
+ * Free all allocations made for the ES. Pages of the lines go back to their pool or get
+ * unmapped.
  */
 void uarf_es_deinit(Es *es) {
-    // TODO: actually free all pages of the ES...
-    uarf_free_or_die(es->head);
-    uarf_free_or_die(es->tail);
+    UARF_LOG_TRACE("(%p)\n", es);
+
+    if (es->jit.is_jita_alloc) {
+        uarf_stub_free(&es->jit);
+    }
+
+    for (size_t i = 0; i < es->num_pages; i++) {
+        if (es->pool) {
+            uarf_page_pool_put(es->pool, es->pages[i]);
+        }
+        else {
+            uarf_unmap_or_die(_ptr(es->pages[i]), es->page_size);
+        }
+    }
+    uarf_free_or_die(es->pages);
+    uarf_free_or_die(es->addrs);
     uarf_free_or_die(es);
 }
 
+/**
+ * Remove the `i`-th active element from `es`.
+ *
+ * The last active element takes its place. Removed elements can be restored with
+ * `uarf_es_restore`.
+ */
+void uarf_es_remove(Es *es, size_t i) {
+    UARF_LOG_TRACE("(%p, %lu)\n", es, i);
+    uarf_assert(i < es->size);
+
+    UarfEsLine *line = es->lines[i];
+
+    // Unlink from ring. The line keeps its links, to be restored later.
+    line->prev->next = line->next;
+    line->next->prev = line->prev;
+    if (es->ring == line) {
+        es->ring = es->size > 1 ? line->next : NULL;
+    }
+
+    es->size--;
+    es->lines[i] = es->lines[es->size];
+    es->lines[es->size] = line;
+    es->num_removed++;
+}
+
+/**
+ * Restore the most recently removed element of `es`.
+ *
+ * It becomes the last active element.
+ */
+void uarf_es_restore(Es *es) {
+    UARF_LOG_TRACE("(%p)\n", es);
+    uarf_assert(es->num_removed > 0);
+
+    UarfEsLine *line = es->lines[es->size];
+
+    // Its neighbors are the same as when it got removed, as all later removals got
+    // restored already
+    line->prev->next = line;
+    line->next->prev = line;
+    if (!es->ring) {
+        es->ring = line;
+    }
+
+    es->size++;
+    es->num_removed--;
+}
+
+/**
+ * Only keep the elements of `es` for which `filter` returns true.
+ *
+ * Filtered out elements, as well as previously removed ones, cannot be restored anymore.
+ */
+void uarf_es_filter(Es *es, bool filter(uint64_t addr)) {
+    UARF_LOG_TRACE("(%p, %p)\n", es, filter);
+
+    // Go backwards, such that the element swapped into `i` got already checked
+    for (size_t i = es->size; i-- > 0;) {
+        if (!filter(es->addrs[i])) {
+            uarf_es_remove(es, i);
+        }
+    }
+    es->num_removed = 0;
+}
+
 /**
  * Access the eviction set `es` forward, backward, forward and repeat `num_rep`
  * times.
  */
 void uarf_es_access_fbf(Es *es, size_t num_rep) {
+    if (!es->ring) {
+        return;
+    }
+
     for (size_t round = 0; round < num_rep; round++) {
+        volatile UarfEsLine *line = es->ring;
         // Forward access
-        for (EsElem *elem = es->head; elem != NULL; elem = elem->next) {
-            *(volatile uint64_t *) elem;
+        for (size_t i = 0; i < es->size; i++) {
+            line = line->next;
         }
-        // Backward access
-        for (EsElem *elem = es->tail; elem != NULL; elem = elem->prev) {
-            *(volatile uint64_t *) elem;
+        // Backward access, starting at the last line
+        line = line->prev;
+        for (size_t i = 0; i < es->size; i++) {
+            line = line->prev;
         }
         // Forward access
-        for (EsElem *elem = es->head; elem != NULL; elem = elem->next) {
-            *(volatile uint64_t *) elem;
+        line = line->next;
+        for (size_t i = 0; i < es->size; i++) {
+            line = line->next;
         }
     }
 }
@@ -64,33 +290,51 @@ void uarf_es_access_fbf(Es *es, size_t num_rep) {
  * Access the eviction set `es` with high locality,
  */
 void uarf_es_access_local(Es *es, size_t num_rep) {
+    if (!es->ring) {
+        return;
+    }
+
     for (size_t round = 0; round < num_rep; round++) {
-        // Forward access
-        for (EsElem *elem = es->head; elem != NULL; elem = elem->next) {
-            EsElem *elem_access = elem;
-            for (size_t i = 0; i < 32 && elem_access->type == UARF_DLL_NODE_TYPE_NORMAL;
-                 i++) {
-                *(volatile uint64_t *) elem_access;
+        volatile UarfEsLine *line = es->ring;
+        for (size_t i = 0; i < es->size; i++) {
+            for (size_t j = 0; j < ES_LOCAL_REPS; j++) {
+                *(volatile uint64_t *) line;
             }
+            line = line->next;
         }
-        // // Backward access
-        // for (EsElem *elem = es->tail; elem != NULL; elem = elem->prev) {
-        //     EsElem *elem_access = elem;
-        //     for (size_t i = 0; i < 10 && elem_access->type ==
-        //     UARF_DLL_NODE_TYPE_NORMAL;
-        //          i++) {
-        //         *(volatile uint64_t *) elem_access;
-        //     }
-        // }
-        // // Forward access
-        // for (EsElem *elem = es->head; elem != NULL; elem = elem->next) {
-        //     EsElem *elem_access = elem;
-        //     for (size_t i = 0; i < 1 && elem_access->type ==
-        //     UARF_DLL_NODE_TYPE_NORMAL;
-        //          i++) {
-        //         *(volatile uint64_t *) elem_access;
-        //     }
-        // }
+    }
+}
+
+/**
+ * Build a straight-line kernel that accesses the active lines of `es` in `pattern`,
+ * `reps` times, with `fence` after every access.
+ *
+ * The kernel loads from the addresses as immediates, so it neither follows the ring nor
+ * has any branches. It does not see later changes to `es`, call again after removing or
+ * restoring elements.
+ */
+void uarf_es_jit(Es *es, UarfAccessPattern pattern, size_t reps, UarfAccessFence fence) {
+    UARF_LOG_TRACE("(%p, %d, %lu, %d)\n", es, pattern, reps, fence);
+
+    if (es->jit.is_jita_alloc) {
+        uarf_stub_free(&es->jit);
+    }
+    es->jit = uarf_stub_init();
+
+    UarfJitaCtxt ctxt = uarf_jita_init();
+    uarf_jita_push_vsnip_access(&ctxt, es->addrs, es->size, pattern, reps, fence);
+    uarf_jita_push_vsnip_ret(&ctxt);
+    uarf_jita_allocate(&ctxt, &es->jit, uarf_rand47());
+}
+
+/**
+ * Run the kernel built by `uarf_es_jit` `num_rep` times.
+ */
+void uarf_es_access_jit(Es *es, size_t num_rep) {
+    uarf_assert(es->jit.is_jita_alloc);
+
+    for (size_t round = 0; round < num_rep; round++) {
+        es->jit.f();
     }
 }
 
@@ -106,7 +350,7 @@ float uarf_es_effectiveness(Es *es, void *victim, size_t reps, bool is_in_cache(
     uint64_t num_evicted = 0;
 
     for (size_t i = 0; i < reps; i++) {
-        *(volatile char *) &victim;
+        *(volatile char *) victim;
         es_access(es, 1);
         num_evicted += is_in_cache(_ptr(victim)) ? 0 : 1;
     }
@@ -125,69 +369,169 @@ size_t uarf_es_reduce(Es *es, void *victim,
                       void es_access(Es *es, size_t num_rep)) {
     UARF_LOG_TRACE("(%p, %p, %p, %p)\n", es, victim, es_eff, es_access);
 
-    size_t es_effective_size = uarf_dll_size(es);
-
     const size_t REPS = 500;
 
     while (1) {
         bool kill_in_round = false;
 
-        uarf_dll_for_each(es, kill_cand) {
-            if (kill_cand->type != UARF_DLL_NODE_TYPE_NORMAL) {
-                continue;
-            }
-
+        // Go backwards, such that the element swapped into `kill_i` upon removal got
+        // already checked
+        for (size_t kill_i = es->size; kill_i-- > 0;) {
             float eff_cur = 0;
             size_t i = 0;
             do {
                 eff_cur = es_eff(es, victim, REPS, es_access);
                 UARF_LOG_DEBUG("Current eff: %f\n", eff_cur);
                 if (i++ > 10) {
-                    printf("stuuuuck\n");
+                    UARF_LOG_WARNING("ES not effective anymore, keep trying\n");
                 }
             } while (eff_cur <= 0.5);
 
-            // UARF_LOG_DEBUG("Cur eff with %lu elements: %f\n", es_effective_size,
-            // eff_cur);
-            //
-            // // Sanity check
-            // if (eff_cur <= 0.5) {
-            //     // Check if fluke
-            //     eff_cur = es_eff(es, victim, 20 * REPS);
-            //     if (eff_cur > 0.5) {
-            //         UARF_LOG_INFO("Continue and pretend nothing happened\n");
-            //     }
-            //     else {
-            //         UARF_LOG_WARNING("Non-effective ES detection. Should not
-            //         happen\n"); uarf_assert(0); return -1;
-            //     }
-            // }
-
             // Remove candidate and check new eff
-            UarfDllNode *parent = kill_cand->prev;
-            uarf_dll_remove(kill_cand);
+            uint64_t kill_cand = uarf_es_get(es, kill_i);
+            uarf_es_remove(es, kill_i);
 
             float eff_new = es_eff(es, victim, REPS, es_access);
-            UARF_LOG_DEBUG("Remove candidate %d leads to eff %f\n", kill_cand->id,
+            UARF_LOG_DEBUG("Remove candidate 0x%lx leads to eff %f\n", kill_cand,
                            eff_new);
 
             if (eff_cur * 0.95 < eff_new) {
-                UARF_LOG_INFO("-- %d is not relevant (%f), remove\n", kill_cand->id,
+                UARF_LOG_INFO("-- 0x%lx is not relevant (%f), remove\n", kill_cand,
                               eff_new);
-                es_effective_size--;
-                uarf_assert(es_effective_size > 0);
+                uarf_assert(es->size > 0);
                 kill_in_round = true;
-                // uarf_assert(uarf_dll_size(es) == es_effective_size);
+                // Not going to restore it
+                es->num_removed = 0;
             }
             else {
-                uarf_dll_push_after(kill_cand, parent);
-                // uarf_assert(uarf_dll_size(es) == es_effective_size);
+                uarf_es_restore(es);
             }
         }
         if (!kill_in_round) {
             break;
         }
     }
-    uarf_assert(uarf_dll_size(es) == es_effective_size);
-    return es_effective_size;
+    return es->size;
+}
+
+// Number of times `uarf_es_reduce_group` may return to a previous level
+#define ES_REDUCE_MAX_BACKTRACKS 20
+
+/**
+ * Swap the `i`-th and `j`-th active element of `es`.
+ *
+ * Only the array order changes, the ring has the same lines.
+ */
+static inline void es_swap(Es *es, size_t i, size_t j) {
+    UarfEsLine *tmp = es->lines[i];
+    es->lines[i] = es->lines[j];
+    es->lines[j] = tmp;
+}
+
+/**
+ * Reduce `es` to `ways` elements that still evict `victim` by means of `es_eff`, using
+ * group testing (Vila et al., "Theory and Practice of Finding Eviction Sets").
+ *
+ * Splits `es` into `ways + 1` groups. At least one of them is not needed for eviction,
+ * so remove the first one without which `es` is still effective and repeat on the next
+ * level. If none can be removed, e.g., due to noise, undo the removal of the previous
+ * level and resume it at the next group that was not tried yet.
+ *
+ * Takes O(n * ways) accesses of `es` instead of O(n^2) of `uarf_es_reduce`.
+ *
+ * @param reps number of repetitions to measure the effectiveness
+ *
+ * @returns the number of elements of the reduced `es`, larger than `ways` if it could not
+ * be reduced
+ */
+size_t uarf_es_reduce_group(Es *es, void *victim, size_t ways, size_t reps,
+                            float es_eff(Es *es, void *victim, size_t reps,
+                                         void es_access(Es *es, size_t num_rep)),
+                            void es_access(Es *es, size_t num_rep)) {
+    UARF_LOG_TRACE("(%p, %p, %lu, %lu, %p, %p)\n", es, victim, ways, reps, es_eff,
+                   es_access);
+
+    uarf_assert(ways > 0);
+
+    // Size and index of the group removed on every level, most recent last. Removed
+    // lines are stored in the same order behind the active ones, so they can be restored.
+    size_t *removed = uarf_malloc_or_die((es->size + 1) * sizeof(size_t));
+    size_t *removed_group = uarf_malloc_or_die((es->size + 1) * sizeof(size_t));
+    size_t level = 0;
+    size_t num_backtracks = 0;
+    // Groups below this one are not tried yet on the current level
+    size_t next_group = ways + 1;
+
+    es->num_removed = 0;
+
+    while (es->size > ways) {
+        size_t n = es->size;
+        // All groups have the same size, but the last one, which is the largest
+        size_t group_size = n / (ways + 1);
+        bool removed_one = false;
+
+        for (size_t g = next_group; g-- > 0;) {
+            size_t lo = g * group_size;
+            size_t k = g == ways ? n - lo : group_size;
+            if (!k) {
+                continue;
+            }
+
+            // Move the group to the end, where it can be removed without swapping
+            for (size_t i = 0; i < k && g != ways; i++) {
+                es_swap(es, lo + i, n - k + i);
+            }
+            for (size_t i = 0; i < k; i++) {
+                uarf_es_remove(es, n - 1 - i);
+            }
+
+            float eff = es_eff(es, victim, reps, es_access);
+            UARF_LOG_DEBUG("Without group %lu of %lu elements: eff %f\n", g, k, eff);
+
+            if (eff > 0.5) {
+                removed[level] = k;
+                removed_group[level++] = g;
+                removed_one = true;
+                break;
+            }
+
+            for (size_t i = 0; i < k; i++) {
+                uarf_es_restore(es);
+            }
+            for (size_t i = k; i-- > 0 && g != ways;) {
+                es_swap(es, lo + i, n - k + i);
+            }
+        }
+
+        if (removed_one) {
+            next_group = ways + 1;
+            continue;
+        }
+
+        if (!level || num_backtracks++ >= ES_REDUCE_MAX_BACKTRACKS) {
+            UARF_LOG_WARNING("Cannot reduce ES below %lu elements\n", es->size);
+            break;
+        }
+
+        // Bring back the group of the previous level, in its original position
+        size_t k = removed[--level];
+        size_t g = removed_group[level];
+        UARF_LOG_DEBUG("Backtrack, restore group %lu of %lu elements\n", g, k);
+        for (size_t i = 0; i < k; i++) {
+            uarf_es_restore(es);
+        }
+        n = es->size;
+        size_t lo = g * (n / (ways + 1));
+        for (size_t i = k; i-- > 0 && g != ways;) {
+            es_swap(es, lo + i, n - k + i);
+        }
+        next_group = g;
+    }
+
+    // Not going to restore any of them
+    es->num_removed = 0;
+    uarf_free_or_die(removed);
+    uarf_free_or_die(removed_group);
+
+    return es->size;
 }
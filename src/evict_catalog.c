@@ -0,0 +1,757 @@
+#define _GNU_SOURCE
+#include "evict_catalog.h"
+#include "compiler.h"
+#include "lib.h"
+#include "log.h"
+#include "mem.h"
+#include "page.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef UARF_LOG_TAG
+#undef UARF_LOG_TAG
+#define UARF_LOG_TAG UARF_LOG_TAG_MEM
+#endif
+
+// Number of repetitions to measure the effectiveness of a set
+#define CATALOG_REPS 20
+
+#define CATALOG_MAGIC "UARFESC1"
+
+/**
+ * Layout of a catalogue file: the header, followed by a record for every target in the
+ * order of `entries`. Every record is followed by its `size` lines.
+ */
+typedef struct CatalogHeader CatalogHeader;
+struct CatalogHeader {
+    char magic[8];
+    uint64_t num_sets;
+    uint64_t num_slices;
+    uint64_t line_size;
+    uint64_t num_threads;
+    uint64_t arena_pages;
+};
+
+typedef struct CatalogRecord CatalogRecord;
+struct CatalogRecord {
+    // Offsets are relative to the start of the backing file
+    uint64_t victim_off;
+    uint64_t victim_pa;
+    // 0 if there is no set
+    uint64_t size;
+};
+
+typedef struct CatalogLine CatalogLine;
+struct CatalogLine {
+    uint64_t off;
+    uint64_t pa;
+};
+
+/**
+ * State shared by all threads while building.
+ */
+typedef struct CatalogBuild CatalogBuild;
+struct CatalogBuild {
+    UarfEsCatalog *cat;
+    size_t num_targets;
+    // Lines of all arenas, sorted by target
+    uint64_t *lines;
+    // Lines of target t are lines[bucket[t]] to lines[bucket[t + 1] - 1]
+    size_t *bucket;
+    // Next target to build, or index into `retry` when rebuilding
+    size_t next_target;
+    // Targets to cross-check, and the ones that failed the check
+    bool *check;
+    bool *failed;
+    // Targets to rebuild after a failed cross-check
+    size_t *retry;
+    size_t num_retry;
+};
+
+typedef struct CatalogThread CatalogThread;
+struct CatalogThread {
+    CatalogBuild *b;
+    uint32_t tid;
+    pthread_t thread;
+    // Lines of the arena and their target
+    uint64_t *va;
+    uint32_t *target;
+    size_t num_lines;
+};
+
+// Threshold of the current build
+static uint64_t catalog_thresh;
+
+static bool catalog_is_cached(void *p) {
+    return uarf_get_access_time(p) < catalog_thresh;
+}
+
+static float catalog_es_eff(Es *es, void *victim, size_t reps,
+                            void es_access(Es *es, size_t num_rep)) {
+    return uarf_es_effectiveness(es, victim, reps, catalog_is_cached, es_access);
+}
+
+static double now_secs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Pin the calling thread to the `tid`-th CPU we are allowed to run on.
+ */
+static void catalog_pin(uint32_t tid) {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed)) {
+        return;
+    }
+
+    size_t num_cpus = CPU_COUNT(&allowed);
+    size_t nth = tid % num_cpus;
+    for (size_t cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed) && !nth--) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+            UARF_LOG_DEBUG("Pin thread %u to CPU %lu\n", tid, cpu);
+            return;
+        }
+    }
+}
+
+/**
+ * Phase 1: Fault in the arena of the thread and get the target of every line.
+ */
+static void *catalog_arena(void *arg) {
+    CatalogThread *t = arg;
+    UarfEsCatalog *cat = t->b->cat;
+
+    catalog_pin(t->tid);
+
+    size_t size = cat->arena_pages * PAGE_SIZE;
+    uint64_t map = cat->base + t->tid * size;
+    uarf_assert(!mlock(_ptr(map), size));
+
+    uint64_t *page_va = uarf_malloc_or_die(cat->arena_pages * sizeof(uint64_t));
+    uint64_t *page_pa = uarf_malloc_or_die(cat->arena_pages * sizeof(uint64_t));
+    for (size_t p = 0; p < cat->arena_pages; p++) {
+        page_va[p] = map + p * PAGE_SIZE;
+    }
+
+    // Own pagemap, the one of uarf_va_to_pa is not thread safe
+    UarfPagemap pm = uarf_pagemap_open(0);
+    uarf_pagemap_va_to_pa_batch(&pm, page_va, page_pa, cat->arena_pages);
+    uarf_pagemap_close(&pm);
+
+    size_t lines_per_page = PAGE_SIZE / cache.cache_line_size;
+    t->va = uarf_malloc_or_die(cat->arena_pages * lines_per_page * sizeof(uint64_t));
+    t->target = uarf_malloc_or_die(cat->arena_pages * lines_per_page * sizeof(uint32_t));
+    t->num_lines = 0;
+
+    for (size_t p = 0; p < cat->arena_pages; p++) {
+        if (!page_pa[p]) {
+            continue;
+        }
+        for (size_t off = 0; off < PAGE_SIZE; off += cache.cache_line_size) {
+            uint64_t pa = page_pa[p] + off;
+            uint64_t slice = cat->slice_fn ? cat->slice_fn(pa) : 0;
+            uarf_assert(slice < cat->num_slices);
+
+            t->va[t->num_lines] = page_va[p] + off;
+            t->target[t->num_lines++] = uarf_get_l3_set(pa) * cat->num_slices + slice;
+        }
+    }
+
+    uarf_free_or_die(page_va);
+    uarf_free_or_die(page_pa);
+    return NULL;
+}
+
+/**
+ * Build the eviction set of `target` from the lines of its bucket.
+ *
+ * @returns true on success
+ */
+static bool catalog_build_target(CatalogBuild *b, size_t target, uint32_t tid) {
+    UarfEsCatalogEntry *entry = &b->cat->entries[target];
+    uint64_t *lines = &b->lines[b->bucket[target]];
+    size_t n = b->bucket[target + 1] - b->bucket[target];
+
+    entry->es = NULL;
+    entry->builder = tid;
+
+    // Need a victim and more lines than ways
+    if (n < cache.l3_ways + 2u) {
+        return false;
+    }
+
+    Es *es;
+    entry->victim = lines[0];
+    uarf_es_init_addrs(&es, lines + 1, n - 1);
+
+    if (catalog_es_eff(es, _ptr(entry->victim), CATALOG_REPS, uarf_es_access_fbf) <= 0.5 ||
+        uarf_es_reduce_group(es, _ptr(entry->victim), cache.l3_ways, CATALOG_REPS,
+                             catalog_es_eff, uarf_es_access_fbf) > cache.l3_ways) {
+        uarf_es_deinit(es);
+        return false;
+    }
+
+    entry->es = es;
+    return true;
+}
+
+/**
+ * Phase 2: Build targets until there are none left.
+ */
+static void *catalog_build(void *arg) {
+    CatalogThread *t = arg;
+
+    catalog_pin(t->tid);
+
+    while (true) {
+        size_t target = __atomic_fetch_add(&t->b->next_target, 1, __ATOMIC_RELAXED);
+        if (target >= t->b->num_targets) {
+            break;
+        }
+        // Loaded from a file
+        if (t->b->cat->entries[target].es) {
+            continue;
+        }
+        catalog_build_target(t->b, target, t->tid);
+    }
+
+    return NULL;
+}
+
+/**
+ * Phase 3: Check the sets built by the previous thread, only marks the ones that fail.
+ *
+ * Runs while no other thread accesses the L3, so only the set itself evicts the victim.
+ */
+static void *catalog_check(void *arg) {
+    CatalogThread *t = arg;
+    UarfEsCatalog *cat = t->b->cat;
+    uint32_t checked = (t->tid + cat->num_threads - 1) % cat->num_threads;
+
+    catalog_pin(t->tid);
+
+    for (size_t target = 0; target < t->b->num_targets; target++) {
+        UarfEsCatalogEntry *entry = &cat->entries[target];
+        if (!t->b->check[target] || !entry->es || entry->builder != checked) {
+            continue;
+        }
+        if (catalog_es_eff(entry->es, _ptr(entry->victim), CATALOG_REPS,
+                           uarf_es_access_fbf) <= 0.5) {
+            UARF_LOG_DEBUG("Set of target %lu failed cross-check\n", target);
+            t->b->failed[target] = true;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Phase 4: Rebuild the targets that failed the cross-check.
+ */
+static void *catalog_rebuild(void *arg) {
+    CatalogThread *t = arg;
+
+    catalog_pin(t->tid);
+
+    while (true) {
+        size_t i = __atomic_fetch_add(&t->b->next_target, 1, __ATOMIC_RELAXED);
+        if (i >= t->b->num_retry) {
+            break;
+        }
+        catalog_build_target(t->b, t->b->retry[i], t->tid);
+    }
+
+    return NULL;
+}
+
+/**
+ * Run `fn` on all threads and wait for them.
+ *
+ * @returns the time it took in seconds
+ */
+static double catalog_run_phase(CatalogThread *threads, size_t num_threads,
+                                void *fn(void *)) {
+    double start = now_secs();
+    for (size_t i = 0; i < num_threads; i++) {
+        uarf_assert(!pthread_create(&threads[i].thread, NULL, fn, &threads[i]));
+    }
+    for (size_t i = 0; i < num_threads; i++) {
+        uarf_assert(!pthread_join(threads[i].thread, NULL));
+    }
+    return now_secs() - start;
+}
+
+/**
+ * Run `fn` on one thread after the other.
+ *
+ * @returns the time it took in seconds
+ */
+static double catalog_run_serial(CatalogThread *threads, size_t num_threads,
+                                 void *fn(void *)) {
+    double start = now_secs();
+    for (size_t i = 0; i < num_threads; i++) {
+        uarf_assert(!pthread_create(&threads[i].thread, NULL, fn, &threads[i]));
+        uarf_assert(!pthread_join(threads[i].thread, NULL));
+    }
+    return now_secs() - start;
+}
+
+/**
+ * Drop the sets marked as failed and only mark them to be checked next.
+ *
+ * @returns the number of dropped sets
+ */
+static size_t catalog_drop_failed(CatalogBuild *b) {
+    size_t num_dropped = 0;
+    for (size_t target = 0; target < b->num_targets; target++) {
+        UarfEsCatalogEntry *entry = &b->cat->entries[target];
+        b->check[target] = b->failed[target];
+        if (!b->failed[target]) {
+            continue;
+        }
+        b->failed[target] = false;
+        uarf_es_deinit(entry->es);
+        entry->es = NULL;
+        b->retry[num_dropped++] = target;
+    }
+    return num_dropped;
+}
+
+static size_t catalog_num_targets(UarfEsCatalog *cat) {
+    return cat->num_sets * cat->num_slices;
+}
+
+static size_t catalog_map_size(UarfEsCatalog *cat) {
+    return cat->num_threads * cat->arena_pages * PAGE_SIZE;
+}
+
+/**
+ * Create a catalogue without any sets and arenas.
+ */
+static UarfEsCatalog catalog_init(size_t num_threads, size_t arena_pages,
+                                  UarfSliceFn slice_fn, size_t num_slices,
+                                  uint64_t thresh) {
+    uarf_assert(num_threads > 0);
+    uarf_assert(cache.l3_set_bits && cache.l3_ways);
+    uarf_assert(slice_fn || num_slices == 1);
+    // The set bits are the ones of a single slice, every slice needs its own entries
+    if (slice_fn && cache.l3_slices && num_slices != cache.l3_slices) {
+        UARF_LOG_WARNING("Catalogue has %lu slices, the L3 %u\n", num_slices,
+                         cache.l3_slices);
+    }
+
+    UarfEsCatalog cat = {
+        .num_sets = 1ul << cache.l3_set_bits,
+        .num_slices = num_slices,
+        .slice_fn = slice_fn,
+        .thresh = thresh,
+        .num_threads = num_threads,
+        .arena_pages = arena_pages,
+        .base = 0,
+        .backing_fd = -1,
+        .stats = {},
+    };
+
+    size_t size = catalog_num_targets(&cat) * sizeof(UarfEsCatalogEntry);
+    cat.entries = uarf_malloc_or_die(size);
+    memset(cat.entries, 0, size);
+
+    return cat;
+}
+
+/**
+ * Map the arenas of `cat`, anonymous if `backing` is NULL.
+ */
+static void catalog_map(UarfEsCatalog *cat, const char *backing) {
+    size_t size = catalog_map_size(cat);
+
+    if (!backing) {
+        cat->base = uarf_alloc_map_or_die(size);
+        return;
+    }
+
+    int fd = open(backing, O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+        UARF_LOG_ERROR("Failed to open %s: %s\n", backing, strerror(errno));
+        exit(1);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) || (_ul(st.st_size) != size && ftruncate(fd, size))) {
+        UARF_LOG_ERROR("Failed to resize %s: %s\n", backing, strerror(errno));
+        exit(1);
+    }
+
+    // Shared, so the frames stay with the file after unmapping
+    void *addr = mmap(NULL, size, PROT_RW, MAP_SHARED | MAP_POPULATE, fd, 0);
+    if (addr == MAP_FAILED) {
+        UARF_LOG_ERROR("Failed to map %s: %s\n", backing, strerror(errno));
+        exit(1);
+    }
+    uarf_assert(!mlock(addr, size));
+
+    cat->backing_fd = fd;
+    cat->base = _ul(addr);
+}
+
+/**
+ * Build all sets of `cat` that do not exist yet.
+ */
+static void catalog_fill(UarfEsCatalog *cat) {
+    size_t num_threads = cat->num_threads;
+
+    catalog_thresh = cat->thresh;
+
+    CatalogBuild b = {
+        .cat = cat,
+        .num_targets = catalog_num_targets(cat),
+        .next_target = 0,
+    };
+
+    CatalogThread *threads = uarf_malloc_or_die(num_threads * sizeof(CatalogThread));
+    for (size_t i = 0; i < num_threads; i++) {
+        threads[i] = (CatalogThread) {.b = &b, .tid = i};
+    }
+
+    cat->stats.arena_secs = catalog_run_phase(threads, num_threads, catalog_arena);
+
+    // Sort the lines of all arenas into buckets by target
+    b.bucket = uarf_malloc_or_die((b.num_targets + 1) * sizeof(size_t));
+    memset(b.bucket, 0, (b.num_targets + 1) * sizeof(size_t));
+    size_t num_lines = 0;
+    for (size_t i = 0; i < num_threads; i++) {
+        for (size_t l = 0; l < threads[i].num_lines; l++) {
+            b.bucket[threads[i].target[l] + 1]++;
+        }
+        num_lines += threads[i].num_lines;
+    }
+    for (size_t target = 0; target < b.num_targets; target++) {
+        b.bucket[target + 1] += b.bucket[target];
+    }
+    b.lines = uarf_malloc_or_die(num_lines * sizeof(uint64_t));
+    size_t *fill = uarf_malloc_or_die(b.num_targets * sizeof(size_t));
+    memcpy(fill, b.bucket, b.num_targets * sizeof(size_t));
+    for (size_t i = 0; i < num_threads; i++) {
+        for (size_t l = 0; l < threads[i].num_lines; l++) {
+            b.lines[fill[threads[i].target[l]]++] = threads[i].va[l];
+        }
+        uarf_free_or_die(threads[i].va);
+        uarf_free_or_die(threads[i].target);
+    }
+    uarf_free_or_die(fill);
+
+    UARF_LOG_INFO("Got %lu lines for %lu targets\n", num_lines, b.num_targets);
+
+    cat->stats.build_secs = catalog_run_phase(threads, num_threads, catalog_build);
+
+    // Only the main thread modifies sets that failed, after all checkers are done
+    b.check = uarf_malloc_or_die(b.num_targets * sizeof(bool));
+    b.failed = uarf_malloc_or_die(b.num_targets * sizeof(bool));
+    b.retry = uarf_malloc_or_die(b.num_targets * sizeof(size_t));
+    memset(b.check, true, b.num_targets * sizeof(bool));
+    memset(b.failed, false, b.num_targets * sizeof(bool));
+
+    cat->stats.check_secs = catalog_run_serial(threads, num_threads, catalog_check);
+    b.num_retry = catalog_drop_failed(&b);
+    cat->stats.num_rebuilt = b.num_retry;
+
+    // Rebuilt sets get checked once more, the ones failing again are dropped for good
+    if (b.num_retry) {
+        b.next_target = 0;
+        cat->stats.build_secs += catalog_run_phase(threads, num_threads, catalog_rebuild);
+        cat->stats.check_secs += catalog_run_serial(threads, num_threads, catalog_check);
+        catalog_drop_failed(&b);
+    }
+
+    for (size_t target = 0; target < b.num_targets; target++) {
+        UarfEsCatalogEntry *entry = &cat->entries[target];
+        if (entry->es && entry->builder != UARF_ES_CATALOG_LOADED) {
+            cat->stats.num_built++;
+        }
+    }
+    cat->stats.num_missing =
+        b.num_targets - cat->stats.num_loaded - cat->stats.num_built;
+    cat->stats.sets_per_sec =
+        cat->stats.num_built
+            ? cat->stats.num_built / (cat->stats.build_secs + cat->stats.check_secs)
+            : 0;
+
+    uarf_free_or_die(threads);
+    uarf_free_or_die(b.bucket);
+    uarf_free_or_die(b.lines);
+    uarf_free_or_die(b.check);
+    uarf_free_or_die(b.failed);
+    uarf_free_or_die(b.retry);
+}
+
+UarfEsCatalog uarf_es_catalog_build(size_t num_threads, size_t arena_pages,
+                                    UarfSliceFn slice_fn, size_t num_slices,
+                                    uint64_t thresh) {
+    UARF_LOG_TRACE("(%lu, %lu, %p, %lu, %lu)\n", num_threads, arena_pages, slice_fn,
+                   num_slices, thresh);
+
+    UarfEsCatalog cat = catalog_init(num_threads, arena_pages, slice_fn, num_slices, thresh);
+    catalog_map(&cat, NULL);
+    catalog_fill(&cat);
+
+    return cat;
+}
+
+UarfEsCatalog uarf_es_catalog_build_backed(const char *backing, size_t num_threads,
+                                           size_t arena_pages, UarfSliceFn slice_fn,
+                                           size_t num_slices, uint64_t thresh) {
+    UARF_LOG_TRACE("(%s, %lu, %lu, %p, %lu, %lu)\n", backing, num_threads, arena_pages,
+                   slice_fn, num_slices, thresh);
+
+    UarfEsCatalog cat = catalog_init(num_threads, arena_pages, slice_fn, num_slices, thresh);
+    catalog_map(&cat, backing);
+    catalog_fill(&cat);
+
+    return cat;
+}
+
+static void catalog_write_or_die(FILE *f, const void *p, size_t size) {
+    if (fwrite(p, size, 1, f) != 1) {
+        UARF_LOG_ERROR("Failed to write catalogue: %s\n", strerror(errno));
+        exit(1);
+    }
+}
+
+void uarf_es_catalog_save(UarfEsCatalog *cat, const char *path) {
+    UARF_LOG_TRACE("(%p, %s)\n", cat, path);
+
+    if (cat->backing_fd < 0) {
+        UARF_LOG_WARNING("Catalogue has no backing file, cannot be reused\n");
+    }
+
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        UARF_LOG_ERROR("Failed to open %s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+
+    CatalogHeader hdr = {
+        .num_sets = cat->num_sets,
+        .num_slices = cat->num_slices,
+        .line_size = cache.cache_line_size,
+        .num_threads = cat->num_threads,
+        .arena_pages = cat->arena_pages,
+    };
+    memcpy(hdr.magic, CATALOG_MAGIC, sizeof(hdr.magic));
+    catalog_write_or_die(f, &hdr, sizeof(hdr));
+
+    UarfPagemap pm = uarf_pagemap_open(0);
+
+    for (size_t target = 0; target < catalog_num_targets(cat); target++) {
+        UarfEsCatalogEntry *entry = &cat->entries[target];
+        CatalogRecord rec = {};
+
+        if (entry->es) {
+            rec.victim_off = entry->victim - cat->base;
+            rec.victim_pa = uarf_pagemap_va_to_pa(&pm, entry->victim);
+            rec.size = uarf_es_size(entry->es);
+        }
+        catalog_write_or_die(f, &rec, sizeof(rec));
+
+        for (size_t i = 0; i < rec.size; i++) {
+            uint64_t va = uarf_es_get(entry->es, i);
+            CatalogLine line = {
+                .off = va - cat->base,
+                .pa = uarf_pagemap_va_to_pa(&pm, va),
+            };
+            catalog_write_or_die(f, &line, sizeof(line));
+        }
+    }
+
+    uarf_pagemap_close(&pm);
+    fclose(f);
+}
+
+/**
+ * Take the set of `rec` with `lines` if it still has the same frames and works.
+ *
+ * @returns true if the set got taken
+ */
+static bool catalog_load_entry(UarfEsCatalog *cat, UarfPagemap *pm, size_t target,
+                               const CatalogRecord *rec, const CatalogLine *lines) {
+    size_t n = rec->size + 1;
+    uint64_t *va = uarf_malloc_or_die(n * sizeof(uint64_t));
+    uint64_t *pa = uarf_malloc_or_die(n * sizeof(uint64_t));
+
+    va[0] = cat->base + rec->victim_off;
+    for (size_t i = 0; i < rec->size; i++) {
+        va[i + 1] = cat->base + lines[i].off;
+    }
+    uarf_pagemap_va_to_pa_batch(pm, va, pa, n);
+
+    bool same = pa[0] == rec->victim_pa;
+    for (size_t i = 0; same && i < rec->size; i++) {
+        same = pa[i + 1] == lines[i].pa;
+    }
+
+    bool ok = false;
+    if (same) {
+        Es *es;
+        uarf_es_init_addrs(&es, va + 1, rec->size);
+        if (catalog_es_eff(es, _ptr(va[0]), CATALOG_REPS, uarf_es_access_fbf) > 0.5) {
+            cat->entries[target] = (UarfEsCatalogEntry) {
+                .es = es,
+                .victim = va[0],
+                .builder = UARF_ES_CATALOG_LOADED,
+            };
+            ok = true;
+        }
+        else {
+            uarf_es_deinit(es);
+        }
+    }
+
+    uarf_free_or_die(va);
+    uarf_free_or_die(pa);
+    return ok;
+}
+
+bool uarf_es_catalog_load(UarfEsCatalog *cat, const char *path, const char *backing,
+                          size_t num_threads, size_t arena_pages, UarfSliceFn slice_fn,
+                          size_t num_slices, uint64_t thresh) {
+    UARF_LOG_TRACE("(%p, %s, %s, %lu, %lu, %p, %lu, %lu)\n", cat, path, backing,
+                   num_threads, arena_pages, slice_fn, num_slices, thresh);
+    uarf_assert(num_threads > 0 && arena_pages > 0);
+    uarf_assert(slice_fn || num_slices == 1);
+
+    double start = now_secs();
+
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        UARF_LOG_INFO("No catalogue at %s\n", path);
+        return false;
+    }
+
+    CatalogHeader hdr;
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+        memcmp(hdr.magic, CATALOG_MAGIC, sizeof(hdr.magic)) ||
+        hdr.num_sets != 1ul << cache.l3_set_bits ||
+        hdr.line_size != cache.cache_line_size) {
+        UARF_LOG_WARNING("Catalogue %s does not match this machine\n", path);
+        fclose(f);
+        return false;
+    }
+
+    // Everything sized from the header has to be what the caller would build with
+    if (hdr.num_slices != num_slices || hdr.num_threads != num_threads ||
+        hdr.arena_pages != arena_pages) {
+        UARF_LOG_WARNING("Catalogue %s was built with other parameters\n", path);
+        fclose(f);
+        return false;
+    }
+
+    *cat = catalog_init(num_threads, arena_pages, slice_fn, num_slices, thresh);
+    size_t map_size = catalog_map_size(cat);
+
+    struct stat st;
+    if (stat(backing, &st) || _ul(st.st_size) != map_size) {
+        UARF_LOG_WARNING("Backing file %s does not match catalogue %s\n", backing, path);
+        uarf_free_or_die(cat->entries);
+        fclose(f);
+        return false;
+    }
+
+    catalog_map(cat, backing);
+    catalog_thresh = thresh;
+
+    UarfPagemap pm = uarf_pagemap_open(0);
+    bool ok = true;
+
+    for (size_t target = 0; ok && target < catalog_num_targets(cat); target++) {
+        CatalogRecord rec;
+        // No set has more lines than the arenas
+        if (fread(&rec, sizeof(rec), 1, f) != 1 || rec.victim_off >= map_size ||
+            rec.size > map_size / cache.cache_line_size) {
+            ok = false;
+            break;
+        }
+        if (!rec.size) {
+            continue;
+        }
+
+        CatalogLine *lines = uarf_malloc_or_die(rec.size * sizeof(CatalogLine));
+        ok = fread(lines, sizeof(CatalogLine), rec.size, f) == rec.size;
+        for (size_t i = 0; ok && i < rec.size; i++) {
+            ok = lines[i].off < map_size;
+        }
+
+        if (ok) {
+            if (catalog_load_entry(cat, &pm, target, &rec, lines)) {
+                cat->stats.num_loaded++;
+            }
+            else {
+                cat->stats.num_stale++;
+            }
+        }
+        uarf_free_or_die(lines);
+    }
+
+    uarf_pagemap_close(&pm);
+    fclose(f);
+
+    if (!ok) {
+        UARF_LOG_WARNING("Catalogue %s is corrupt\n", path);
+        uarf_es_catalog_free(cat);
+        return false;
+    }
+
+    cat->stats.load_secs = now_secs() - start;
+    UARF_LOG_INFO("Loaded %lu sets, %lu stale\n", cat->stats.num_loaded,
+                  cat->stats.num_stale);
+
+    if (cat->stats.num_loaded < catalog_num_targets(cat)) {
+        catalog_fill(cat);
+    }
+
+    return true;
+}
+
+void uarf_es_catalog_free(UarfEsCatalog *cat) {
+    UARF_LOG_TRACE("(%p)\n", cat);
+
+    for (size_t target = 0; target < catalog_num_targets(cat); target++) {
+        if (cat->entries[target].es) {
+            uarf_es_deinit(cat->entries[target].es);
+        }
+    }
+    uarf_unmap_or_die(_ptr(cat->base), catalog_map_size(cat));
+    if (cat->backing_fd >= 0) {
+        close(cat->backing_fd);
+    }
+    uarf_free_or_die(cat->entries);
+}
+
+void uarf_es_catalog_print_stats(UarfEsCatalog *cat) {
+    UARF_LOG_TRACE("(%p)\n", cat);
+
+    UarfEsCatalogStats *s = &cat->stats;
+    printf("Eviction set catalogue: %lu sets x %lu slices with %lu threads\n",
+           cat->num_sets, cat->num_slices, cat->num_threads);
+    if (s->load_secs) {
+        printf("\tload: %.3fs, loaded: %lu, stale: %lu\n", s->load_secs, s->num_loaded,
+               s->num_stale);
+    }
+    printf("\tarenas: %.3fs, build: %.3fs, cross-check: %.3fs\n", s->arena_secs,
+           s->build_secs, s->check_secs);
+    printf("\tbuilt: %lu, rebuilt: %lu, missing: %lu\n", s->num_built, s->num_rebuilt,
+           s->num_missing);
+    printf("\tthroughput: %.1f sets/s\n", s->sets_per_sec);
+}
@@ -3,6 +3,7 @@
 #include "lib.h"
 #include "log.h"
 #include "mem.h"
+#include "reduce.h"
 #include <string.h>
 
 void uarf_fr_flush(UarfFrConfig *conf) {
@@ -57,8 +58,25 @@ void uarf_fr_reload_binned(UarfFrConfig *conf, size_t iteration) {
         if (dt < conf->thresh) {
             res_bin_p[buf_i]++;
         }
+        // Only a store, bucketing would add a division between the timed loads
+        if (conf->hist.mode != UARF_FR_HIST_NONE) {
+            conf->hist.dt_p[buf_i] = dt;
+        }
     }
     uarf_mfence();
+
+    if (conf->hist.mode == UARF_FR_HIST_NONE) {
+        return;
+    }
+    for (uint64_t k = 0; k < conf->num_slots; ++k) {
+        conf->hist.batch_p[k * conf->hist.num_buckets +
+                           uarf_fr_hist_bucket(conf, conf->hist.dt_p[k])]++;
+    }
+
+    // Merge before the narrow batch counters can overflow
+    if (++conf->hist.batch_len == UINT16_MAX) {
+        uarf_fr_hist_merge(conf);
+    }
 }
 
 // Initialize the flush and reload buffer, its dummy version  and history
@@ -116,15 +134,75 @@ void uarf_fr_deinit(UarfFrConfig *conf) {
     uarf_unmap_or_die(conf->buf.base_p, conf->buf_size);
     uarf_unmap_or_die(conf->buf2.base_p, conf->buf_size);
     uarf_unmap_or_die(conf->res_p, conf->res_size);
+
+    if (conf->hist.mode != UARF_FR_HIST_NONE) {
+        uarf_unmap_or_die(conf->hist.p, conf->hist.size);
+        uarf_free_or_die(conf->hist.batch_p);
+        uarf_free_or_die(conf->hist.dt_p);
+        conf->hist.mode = UARF_FR_HIST_NONE;
+    }
 }
 
+/**
+ * Get the number of hits over all slots and bins.
+ */
 uint64_t uarf_fr_num_hits(UarfFrConfig *conf) {
-    uarf_assert(conf->num_bins == 1); // Only works with 1 bin for now
-    uint64_t sum = 0;
-    for (size_t i = 0; i < conf->num_slots; i++) {
-        sum += conf->res_p[i];
+    UARF_LOG_TRACE("(%p)\n", conf);
+    return uarf_reduce_sum(conf->res_p, conf->num_slots * conf->num_bins);
+}
+
+/**
+ * Get the number of hits of each bin, summed over all slots.
+ *
+ * @param out array of `num_bins` elements
+ */
+void uarf_fr_bin_hits(UarfFrConfig *conf, uint64_t *out) {
+    UARF_LOG_TRACE("(%p, %p)\n", conf, out);
+    uarf_reduce_row_sums(conf->res_p, conf->num_bins, conf->num_slots, out);
+}
+
+/**
+ * Get the number of hits of each slot, summed over all bins.
+ *
+ * @param out array of `num_slots` elements
+ */
+void uarf_fr_slot_hits(UarfFrConfig *conf, uint64_t *out) {
+    UARF_LOG_TRACE("(%p, %p)\n", conf, out);
+    uarf_reduce_col_sums(conf->res_p, conf->num_bins, conf->num_slots, out);
+}
+
+/**
+ * Get the slot with the most hits over all bins.
+ *
+ * @param is_tie if not NULL, set to whether another slot has as many hits
+ */
+size_t uarf_fr_max_slot(UarfFrConfig *conf, bool *is_tie) {
+    UARF_LOG_TRACE("(%p, %p)\n", conf, is_tie);
+
+    if (conf->num_bins == 1) {
+        return uarf_reduce_argmax(conf->res_p, conf->num_slots, is_tie);
     }
-    return sum;
+
+    uint64_t total[conf->num_slots];
+    uarf_fr_slot_hits(conf, total);
+    return uarf_reduce_argmax_u64(total, conf->num_slots, is_tie);
+}
+
+/**
+ * Get the `k` slots with the most hits over all bins, in descending order.
+ *
+ * @returns the number of slots written to `idx`
+ */
+size_t uarf_fr_top_slots(UarfFrConfig *conf, size_t k, size_t *idx) {
+    UARF_LOG_TRACE("(%p, %lu, %p)\n", conf, k, idx);
+
+    if (conf->num_bins == 1) {
+        return uarf_reduce_top_k(conf->res_p, conf->num_slots, k, idx);
+    }
+
+    uint64_t total[conf->num_slots];
+    uarf_fr_slot_hits(conf, total);
+    return uarf_reduce_top_k_u64(total, conf->num_slots, k, idx);
 }
 
 void uarf_fr_print(UarfFrConfig *conf) {
@@ -147,7 +225,7 @@ void uarf_fr_print(UarfFrConfig *conf) {
     }
 
     uint64_t total[conf->num_slots];
-    memset(total, 0, sizeof(total));
+    uarf_fr_slot_hits(conf, total);
 
     for (uint8_t bin = 0; bin < conf->num_bins; bin++) {
         if (bin < conf->num_bins - 1) {
@@ -158,7 +236,6 @@ void uarf_fr_print(UarfFrConfig *conf) {
         }
         for (size_t slot = 0; slot < conf->num_slots; slot++) {
             uint32_t hits = *(conf->res_p + bin * conf->num_slots + slot);
-            total[slot] += hits;
             printf("%s%04u " UARF_LOG_C_RESET, hits ? UARF_LOG_C_DARK_RED : "", hits);
         }
         printf("\n");
@@ -184,3 +261,178 @@ void uarf_fr_print(UarfFrConfig *conf) {
     }
     printf("\n");
 }
+
+/**
+ * Additionally collect a per-slot histogram of the reload access times.
+ *
+ * Must be called after `uarf_fr_init`. Allows to choose or re-apply the hit threshold
+ * after the experiment, see `uarf_fr_hist_hits` and `uarf_fr_hist_thresh`.
+ *
+ * @param mode          how timings are distributed into buckets
+ * @param num_buckets   buckets per slot, the last one also holds all larger timings
+ * @param bucket_width  width of a bucket in cycles, only for UARF_FR_HIST_LINEAR
+ */
+void uarf_fr_hist_init(UarfFrConfig *conf, UarfFrHistMode mode, uint8_t num_buckets,
+                       uint16_t bucket_width) {
+    UARF_LOG_TRACE("(%p, %d, %u, %u)\n", conf, mode, num_buckets, bucket_width);
+
+    uarf_assert(mode != UARF_FR_HIST_NONE);
+    uarf_assert(conf->hist.mode == UARF_FR_HIST_NONE);
+    uarf_assert(num_buckets > 0 && num_buckets <= FR_HIST_MAX_BUCKETS);
+    uarf_assert(mode != UARF_FR_HIST_LINEAR || bucket_width > 0);
+
+    conf->hist.mode = mode;
+    conf->hist.num_buckets = num_buckets;
+    conf->hist.bucket_width = bucket_width;
+    conf->hist.addr = FR_HIST;
+    conf->hist.size = conf->num_slots * num_buckets * sizeof(uint32_t);
+
+    uarf_map_or_die(conf->hist.p, conf->hist.size);
+    conf->hist.batch_p = uarf_malloc_or_die(conf->hist.size / 2);
+    conf->hist.dt_p = uarf_malloc_or_die(conf->num_slots * sizeof(uint32_t));
+
+    uarf_fr_reset(conf);
+}
+
+/**
+ * Add the narrow per-batch counters to the histogram and clear them.
+ *
+ * Done automatically by the reload when required, and by all functions reading the
+ * histogram.
+ */
+void uarf_fr_hist_merge(UarfFrConfig *conf) {
+    UARF_LOG_TRACE("(%p)\n", conf);
+
+    typedef uint16_t v8u16 __attribute__((vector_size(16)));
+    typedef uint32_t v8u32 __attribute__((vector_size(32)));
+
+    if (conf->hist.mode == UARF_FR_HIST_NONE || conf->hist.batch_len == 0) {
+        return;
+    }
+
+    size_t n = conf->num_slots * conf->hist.num_buckets;
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        v8u16 batch;
+        v8u32 total;
+        memcpy(&batch, conf->hist.batch_p + i, sizeof(batch));
+        memcpy(&total, conf->hist.p + i, sizeof(total));
+        total += __builtin_convertvector(batch, v8u32);
+        memcpy(conf->hist.p + i, &total, sizeof(total));
+    }
+    for (; i < n; i++) {
+        conf->hist.p[i] += conf->hist.batch_p[i];
+    }
+
+    memset(conf->hist.batch_p, 0, n * sizeof(uint16_t));
+    conf->hist.batch_len = 0;
+}
+
+/**
+ * Get the smallest access time that falls into `bucket`.
+ */
+uint64_t uarf_fr_hist_bucket_start(UarfFrConfig *conf, size_t bucket) {
+    UARF_LOG_TRACE("(%p, %lu)\n", conf, bucket);
+
+    if (conf->hist.mode == UARF_FR_HIST_LOG2) {
+        return bucket ? BIT(bucket) : 0;
+    }
+    return bucket * conf->hist.bucket_width;
+}
+
+/**
+ * Get the number of hits of `slot` as if the reload had used `thresh`.
+ *
+ * Only buckets that lie completely below `thresh` are counted.
+ */
+uint64_t uarf_fr_hist_hits(UarfFrConfig *conf, size_t slot, uint64_t thresh) {
+    UARF_LOG_TRACE("(%p, %lu, %lu)\n", conf, slot, thresh);
+    uarf_assert(conf->hist.mode != UARF_FR_HIST_NONE);
+    uarf_assert(slot < conf->num_slots);
+
+    uarf_fr_hist_merge(conf);
+
+    uint32_t *slot_hist = conf->hist.p + slot * conf->hist.num_buckets;
+    uint64_t hits = 0;
+    // The last bucket is unbounded
+    for (size_t b = 0; b + 1 < conf->hist.num_buckets; b++) {
+        if (uarf_fr_hist_bucket_start(conf, b + 1) > thresh) {
+            break;
+        }
+        hits += slot_hist[b];
+    }
+    return hits;
+}
+
+/**
+ * Suggest a hit/miss threshold from the histogram of all slots.
+ *
+ * Uses Otsu's method, i.e., the bucket boundary that maximizes the variance between
+ * the hit and the miss class.
+ */
+uint64_t uarf_fr_hist_thresh(UarfFrConfig *conf) {
+    UARF_LOG_TRACE("(%p)\n", conf);
+    uarf_assert(conf->hist.mode != UARF_FR_HIST_NONE);
+
+    uarf_fr_hist_merge(conf);
+
+    uint64_t total[FR_HIST_MAX_BUCKETS] = {0};
+    uint64_t n = 0;
+    double sum = 0;
+    for (size_t slot = 0; slot < conf->num_slots; slot++) {
+        for (size_t b = 0; b < conf->hist.num_buckets; b++) {
+            total[b] += conf->hist.p[slot * conf->hist.num_buckets + b];
+        }
+    }
+    for (size_t b = 0; b < conf->hist.num_buckets; b++) {
+        n += total[b];
+        sum += (double) b * total[b];
+    }
+
+    size_t best = 0;
+    double best_var = -1;
+    uint64_t n_low = 0;
+    double sum_low = 0;
+    for (size_t b = 0; b + 1 < conf->hist.num_buckets; b++) {
+        n_low += total[b];
+        sum_low += (double) b * total[b];
+        if (n_low == 0 || n_low == n) {
+            continue;
+        }
+        double mean_low = sum_low / n_low;
+        double mean_high = (sum - sum_low) / (n - n_low);
+        double var = (double) n_low * (n - n_low) * (mean_low - mean_high) *
+                     (mean_low - mean_high);
+        if (var > best_var) {
+            best_var = var;
+            best = b;
+        }
+    }
+
+    return uarf_fr_hist_bucket_start(conf, best + 1);
+}
+
+void uarf_fr_hist_print(UarfFrConfig *conf) {
+    UARF_LOG_TRACE("(%p)\n", conf);
+    uarf_assert(conf->hist.mode != UARF_FR_HIST_NONE);
+
+    uarf_fr_hist_merge(conf);
+
+    printf("slot \\ dt: ");
+    for (size_t b = 0; b < conf->hist.num_buckets; b++) {
+        printf("%5lu ", uarf_fr_hist_bucket_start(conf, b));
+    }
+    printf("\n");
+
+    for (size_t slot = 0; slot < conf->num_slots; slot++) {
+        printf("%10lu: ", slot);
+        for (size_t b = 0; b < conf->hist.num_buckets; b++) {
+            uint32_t count = conf->hist.p[slot * conf->hist.num_buckets + b];
+            bool is_hit = uarf_fr_hist_bucket_start(conf, b + 1) <= conf->thresh;
+            printf("%s%05u " UARF_LOG_C_RESET,
+                   count && is_hit ? UARF_LOG_C_DARK_RED : "", count);
+        }
+        printf("\n");
+    }
+}
@@ -1,6 +1,7 @@
 #include "jita.h"
 #include "errnum.h"
 #include "lib.h"
+#include <string.h>
 
 /**
  * Allocate a snip
@@ -68,6 +69,27 @@ void _uarf_allocate_vsnip(UarfJitaCtxt *ctxt, UarfStub *stub, UarfVsnip *snip) {
         }
         break;
     }
+    case VSNIP_ACCESS: {
+        while (uarf_vsnip_access_alloc(&snip->vsnip_access, &stub->end_addr,
+                                       uarf_stub_size_free(stub)) == -ENOSPC) {
+            uarf_stub_extend(stub);
+        }
+        break;
+    }
+    case VSNIP_TIMED_ACCESS: {
+        while (uarf_vsnip_timed_access_alloc(&snip->vsnip_timed_access, &stub->end_addr,
+                                             uarf_stub_size_free(stub)) == -ENOSPC) {
+            uarf_stub_extend(stub);
+        }
+        break;
+    }
+    case VSNIP_MEASURE: {
+        while (uarf_vsnip_measure_alloc(&snip->vsnip_measure, &stub->end_addr,
+                                        uarf_stub_size_free(stub)) == -ENOSPC) {
+            uarf_stub_extend(stub);
+        }
+        break;
+    }
     default: {
         UARF_LOG_WARNING("%d is invalid\n", snip->type);
         uarf_bug();
@@ -117,6 +139,7 @@ void uarf_jita_allocate(UarfJitaCtxt *ctxt, UarfStub *stub, uint64_t addr) {
         default:
             uarf_bug();
         }
+        ctxt->snip_ends[i] = stub->end_addr - stub->addr;
     }
 
     return;
@@ -265,3 +288,106 @@ void uarf_jita_push_vsnip_fill_nop(UarfJitaCtxt *ctxt, uint32_t num) {
     };
     uarf_jita_push_vsnip(ctxt, fill_snip);
 }
+
+void uarf_jita_push_vsnip_ret(UarfJitaCtxt *ctxt) {
+    UARF_LOG_TRACE("(%p)\n", ctxt);
+    uarf_assert(ctxt);
+
+    UarfVsnip ret_snip = (UarfVsnip) {
+        .type = VSNIP_FILL,
+        .vsnip_fill =
+            (Uarf_VsnipFill) {
+                .bytes = {0xc3},
+                .size = 1,
+                .times = 1,
+            },
+    };
+    uarf_jita_push_vsnip(ctxt, ret_snip);
+}
+
+void uarf_jita_push_vsnip_access(UarfJitaCtxt *ctxt, const uint64_t *addrs, uint32_t n,
+                                 UarfAccessPattern pattern, uint32_t reps,
+                                 UarfAccessFence fence) {
+    UARF_LOG_TRACE("(%p, %p, %u, %d, %u, %d)\n", ctxt, addrs, n, pattern, reps, fence);
+    uarf_assert(ctxt);
+
+    UarfVsnip access_snip = (UarfVsnip) {
+        .type = VSNIP_ACCESS,
+        .vsnip_access =
+            (UarfVsnipAccess) {
+                .addrs = addrs,
+                .n = n,
+                .reps = reps,
+                .pattern = pattern,
+                .fence = fence,
+            },
+    };
+    uarf_jita_push_vsnip(ctxt, access_snip);
+}
+
+void uarf_jita_push_vsnip_timed_access(UarfJitaCtxt *ctxt, const uint64_t *addrs,
+                                       const bool *probe, uint32_t n) {
+    UARF_LOG_TRACE("(%p, %p, %p, %u)\n", ctxt, addrs, probe, n);
+    uarf_assert(ctxt);
+
+    UarfVsnip timed_access_snip = (UarfVsnip) {
+        .type = VSNIP_TIMED_ACCESS,
+        .vsnip_timed_access =
+            (UarfVsnipTimedAccess) {
+                .addrs = addrs,
+                .probe = probe,
+                .n = n,
+            },
+    };
+    uarf_jita_push_vsnip(ctxt, timed_access_snip);
+}
+
+static void jita_push_vsnip_measure(UarfJitaCtxt *ctxt, UarfMeasure *m, bool end) {
+    uarf_assert(ctxt);
+    uarf_assert(m);
+
+    UarfVsnip measure_snip = (UarfVsnip) {
+        .type = VSNIP_MEASURE,
+        .vsnip_measure = (UarfVsnipMeasure) {.m = m, .end = end},
+    };
+    uarf_jita_push_vsnip(ctxt, measure_snip);
+}
+
+void uarf_jita_push_vsnip_measure_begin(UarfJitaCtxt *ctxt, UarfMeasure *m) {
+    UARF_LOG_TRACE("(%p, %p)\n", ctxt, m);
+    jita_push_vsnip_measure(ctxt, m, false);
+}
+
+void uarf_jita_push_vsnip_measure_end(UarfJitaCtxt *ctxt, UarfMeasure *m) {
+    UARF_LOG_TRACE("(%p, %p)\n", ctxt, m);
+    jita_push_vsnip_measure(ctxt, m, true);
+}
+
+void uarf_jita_measure_calibrate(UarfMeasure *m, size_t rounds) {
+    UARF_LOG_TRACE("(%p, %lu)\n", m, rounds);
+    uarf_assert(rounds > 0);
+
+    UarfJitaCtxt ctxt = uarf_jita_init();
+    UarfStub stub = uarf_stub_init();
+    uarf_jita_push_vsnip_measure_begin(&ctxt, m);
+    uarf_jita_push_vsnip_measure_end(&ctxt, m);
+    uarf_jita_push_vsnip_ret(&ctxt);
+    uarf_jita_allocate(&ctxt, &stub, uarf_rand47());
+
+    // The minimum, interrupts and cold caches only ever add to the overhead
+    uint64_t overhead[UARF_MEASURE_MAX];
+    memset(overhead, 0xff, sizeof(overhead));
+    for (size_t r = 0; r < rounds; r++) {
+        ((void (*)(void)) stub.ptr)();
+        for (uint32_t i = 0; i < m->n; i++) {
+            overhead[i] = min(overhead[i], m->res[i]);
+        }
+    }
+
+    for (uint32_t i = 0; i < m->n; i++) {
+        m->overhead[i] = overhead[i];
+        UARF_LOG_DEBUG("Overhead of counter %u: %lu\n", i, overhead[i]);
+    }
+
+    uarf_jita_deallocate(&ctxt, &stub);
+}
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include "mem.h"
 #include "lib.h"
 #include "page.h"
@@ -6,74 +7,506 @@
 #include <string.h>
 #include <unistd.h>
 
-/*
- * Translate `va` of process `pid` to physcial address.
+// Pagemap entry flags and PFN, see Documentation/admin-guide/mm/pagemap.rst
+#define PAGEMAP_PRESENT  (1ul << 63)
+#define PAGEMAP_PFN_MASK ((1ul << 55) - 1)
+
+// Default number of cached translations, power of two
+#define PAGEMAP_CACHE_SIZE 4096
+
+// Maximum number of entries read at once
+#define PAGEMAP_MAX_SPAN 512
+
+/**
+ * Open the pagemap of process `pid` for translations.
  *
  * If `pid` is 0, use own process.
  */
-uint64_t uarf_va_to_pa(uint64_t va, uint64_t pid) {
-    UARF_LOG_TRACE("(0x%lx, %lu)\n", va, pid);
-    static int fd;
+UarfPagemap uarf_pagemap_open(uint64_t pid) {
+    UARF_LOG_TRACE("(%lu)\n", pid);
+
+    char path[36];
     if (pid) {
-        char path[36];
         snprintf(path, sizeof(path), "/proc/%lu/pagemap", pid);
-        fd = open(path, O_RDONLY);
     }
     else {
-        fd = open("/proc/self/pagemap", O_RDONLY);
+        snprintf(path, sizeof(path), "/proc/self/pagemap");
     }
-    if (!fd) {
-        UARF_LOG_ERROR("Failed to convert va to pa. Could not open pagemap\n");
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        UARF_LOG_ERROR("Failed to open %s: %s\n", path, strerror(errno));
         exit(1);
     }
-    uint64_t pa_with_flags;
-    if (pread(fd, &pa_with_flags, 8, (va & ~0xffful) >> 9) < 0) {
-        UARF_LOG_ERROR("Failed to convert va to pa. Could not read pagemap\n");
+
+    UarfPagemap pm = {
+        .fd = fd,
+        .pid = pid,
+        .cache_vpn = uarf_malloc_or_die(PAGEMAP_CACHE_SIZE * sizeof(uint64_t)),
+        .cache_pfn = uarf_malloc_or_die(PAGEMAP_CACHE_SIZE * sizeof(uint64_t)),
+        .cache_size = PAGEMAP_CACHE_SIZE,
+    };
+    uarf_pagemap_flush(&pm);
+
+    return pm;
+}
+
+/**
+ * Close the pagemap and free the cache.
+ */
+void uarf_pagemap_close(UarfPagemap *pm) {
+    UARF_LOG_TRACE("(%p)\n", pm);
+
+    if (close(pm->fd) == -1) {
+        UARF_LOG_ERROR("Failed to close fd: %s\n", strerror(errno));
         exit(1);
     }
-    uint64_t pa = pa_with_flags & 0x7FFFFFFFFFFFFF;
-    if (!pa) {
-        UARF_LOG_ERROR(
-            "PA is all zero. Probably you do not have sufficient permissions.\n");
+    uarf_free_or_die(pm->cache_vpn);
+    uarf_free_or_die(pm->cache_pfn);
+    pm->fd = -1;
+}
+
+/**
+ * Forget all cached translations, e.g., after changing mappings.
+ */
+void uarf_pagemap_flush(UarfPagemap *pm) {
+    UARF_LOG_TRACE("(%p)\n", pm);
+    // Virtual page numbers have at most 52 bits, so this tag never matches
+    memset(pm->cache_vpn, 0xff, pm->cache_size * sizeof(uint64_t));
+}
+
+static inline size_t pagemap_cache_idx(UarfPagemap *pm, uint64_t vpn) {
+    return vpn & (pm->cache_size - 1);
+}
+
+/**
+ * Read the entries of `num` pages starting at `vpn` with a single read and cache the
+ * present ones.
+ */
+static void pagemap_read_span(UarfPagemap *pm, uint64_t vpn, size_t num,
+                              uint64_t *entries) {
+    size_t size = num * sizeof(uint64_t);
+    ssize_t ret = pread(pm->fd, entries, size, vpn * sizeof(uint64_t));
+    if (ret < 0) {
+        UARF_LOG_ERROR("Failed to read pagemap: %s\n", strerror(errno));
         exit(1);
     }
-    if (close(fd) == -1) {
-        UARF_LOG_ERROR("Failed to close fd: %s\n", strerror(errno));
+    // Short read beyond the end of the address space
+    memset(_ptr(_ul(entries) + ret), 0, size - ret);
+
+    for (size_t i = 0; i < num; i++) {
+        if (!(entries[i] & PAGEMAP_PRESENT)) {
+            continue;
+        }
+        uint64_t pfn = entries[i] & PAGEMAP_PFN_MASK;
+        if (!pfn) {
+            UARF_LOG_ERROR(
+                "PA is all zero. Probably you do not have sufficient permissions.\n");
+            exit(1);
+        }
+        size_t idx = pagemap_cache_idx(pm, vpn + i);
+        pm->cache_vpn[idx] = vpn + i;
+        pm->cache_pfn[idx] = pfn;
+    }
+}
+
+/**
+ * Get the cached PFN of `vpn`, 0 if not cached.
+ */
+static inline uint64_t pagemap_lookup(UarfPagemap *pm, uint64_t vpn) {
+    size_t idx = pagemap_cache_idx(pm, vpn);
+    return pm->cache_vpn[idx] == vpn ? pm->cache_pfn[idx] : 0;
+}
+
+/**
+ * Translate `n` virtual addresses `va` to physical addresses `pa`.
+ *
+ * Addresses on nearby pages are translated with a single read of the pagemap, so it
+ * is best to pass them sorted. Translations are cached per page.
+ *
+ * @returns the number of translated addresses. Addresses on pages that are not present
+ * get a physical address of 0.
+ */
+size_t uarf_pagemap_va_to_pa_batch(UarfPagemap *pm, const uint64_t *va, uint64_t *pa,
+                                   size_t n) {
+    UARF_LOG_TRACE("(%p, %p, %p, %lu)\n", pm, va, pa, n);
+
+    uint64_t entries[PAGEMAP_MAX_SPAN];
+    size_t num_translated = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        uint64_t vpn = va[i] >> PAGE_SHIFT;
+        uint64_t pfn = pagemap_lookup(pm, vpn);
+
+        if (!pfn) {
+            // Read up to the last of the following pages within reach
+            uint64_t vpn_last = vpn;
+            for (size_t j = i + 1; j < n; j++) {
+                uint64_t vpn_j = va[j] >> PAGE_SHIFT;
+                if (vpn_j < vpn || vpn_j >= vpn + PAGEMAP_MAX_SPAN) {
+                    break;
+                }
+                vpn_last = max(vpn_last, vpn_j);
+            }
+            pagemap_read_span(pm, vpn, vpn_last - vpn + 1, entries);
+            pfn = entries[0] & PAGEMAP_PRESENT ? entries[0] & PAGEMAP_PFN_MASK : 0;
+        }
+
+        pa[i] = pfn ? pfn << PAGE_SHIFT | (va[i] & (PAGE_SIZE - 1)) : 0;
+        num_translated += pfn ? 1 : 0;
+    }
+
+    return num_translated;
+}
+
+/**
+ * Translate the virtual address `va` to a physical address.
+ */
+uint64_t uarf_pagemap_va_to_pa(UarfPagemap *pm, uint64_t va) {
+    UARF_LOG_TRACE("(%p, 0x%lx)\n", pm, va);
+
+    uint64_t pa;
+    if (!uarf_pagemap_va_to_pa_batch(pm, &va, &pa, 1)) {
+        UARF_LOG_ERROR("Failed to convert va to pa. Page of 0x%lx not present\n", va);
         exit(1);
     }
-    return pa_with_flags << 12 | (va & 0xfff);
+    return pa;
+}
+
+/*
+ * Translate `va` of process `pid` to physcial address.
+ *
+ * If `pid` is 0, use own process.
+ *
+ * Keeps the pagemap of the last `pid` open. Every call reads the pagemap, as the mappings
+ * may have changed since the last call. Use `UarfPagemap` to translate many addresses.
+ */
+uint64_t uarf_va_to_pa(uint64_t va, uint64_t pid) {
+    UARF_LOG_TRACE("(0x%lx, %lu)\n", va, pid);
+    static UarfPagemap pm = {.fd = -1};
+
+    if (pm.fd < 0 || pm.pid != pid) {
+        if (pm.fd >= 0) {
+            uarf_pagemap_close(&pm);
+        }
+        pm = uarf_pagemap_open(pid);
+    }
+
+    uint64_t entry;
+    pagemap_read_span(&pm, va >> PAGE_SHIFT, 1, &entry);
+    if (!(entry & PAGEMAP_PRESENT)) {
+        UARF_LOG_ERROR("Failed to convert va to pa. Page of 0x%lx not present\n", va);
+        exit(1);
+    }
+
+    return (entry & PAGEMAP_PFN_MASK) << PAGE_SHIFT | (va & (PAGE_SIZE - 1));
+}
+
+/**
+ * Map `size` bytes at the random, `size`-aligned address `cand_addr`, without replacing
+ * an existing mapping.
+ *
+ * @returns the mapping, MAP_FAILED if something is mapped there already
+ */
+static void *map_random(uint64_t cand_addr, size_t size, int flags) {
+    void *map = mmap(_ptr(cand_addr), size, PROT_RWX, flags | MAP_FIXED_NOREPLACE, -1, 0);
+    // Kernels before 4.17 ignore MAP_FIXED_NOREPLACE and take the address as a hint
+    if (map != MAP_FAILED && map != _ptr(cand_addr)) {
+        uarf_unmap_or_die(map, size);
+        return MAP_FAILED;
+    }
+    return map;
+}
+
+/**
+ * Map `size` bytes at a random, `size`-aligned address.
+ *
+ * Exits after UARF_ALLOC_RANDOM_TRIES failed attempts, e.g., when out of (huge) pages.
+ */
+static void *alloc_random(size_t size, int flags) {
+    for (size_t i = 0; i < UARF_ALLOC_RANDOM_TRIES; i++) {
+        uint64_t cand_addr = uarf_rand47() & ~(size - 1);
+        void *map = map_random(cand_addr, size, flags);
+        if (map != MAP_FAILED) {
+            return map;
+        }
+    }
+    UARF_LOG_ERROR("Failed to map %luB at a random address: %s\n", size, strerror(errno));
+    exit(1);
 }
 
 /**
  * Allocate and return pointer to an page at an arbitrary address.
  *
- * Simply using malloc does not allocate them at random addresses.
+ * Simply using malloc does not allocate them at random addresses. Addresses that are
+ * already mapped are skipped, not replaced.
  */
 void *uarf_alloc_random_page(void) {
     UARF_LOG_TRACE("()\n");
-    const int flags = MMAP_FLAGS | MAP_FIXED;
-    void *map;
-    do {
-        uint64_t cand_addr = uarf_rand47() & ~(PAGE_SIZE - 1);
-        map = mmap(_ptr(cand_addr), PAGE_SIZE, PROT_RWX, flags, -1, 0);
-    } while (map == MAP_FAILED);
-    return map;
+    return alloc_random(PAGE_SIZE, MMAP_FLAGS);
 }
 
 /**
  * Allocate and return pointer to a hugepage at an arbitrary address.
  *
- * Simply using malloc does not allocate them at random addresses.
+ * Simply using malloc does not allocate them at random addresses. Addresses that are
+ * already mapped are skipped, not replaced.
  */
 void *uarf_alloc_random_hugepage(void) {
     UARF_LOG_TRACE("()\n");
-    const int flags = MMAP_FLAGS | MAP_FIXED | MAP_HUGETLB;
-    void *map;
-    do {
-        uint64_t cand_addr = uarf_rand47() & ~(PAGE_SIZE_2M - 1);
-        map = mmap(_ptr(cand_addr), PAGE_SIZE_2M, PROT_RWX, flags, -1, 0);
-    } while (map == MAP_FAILED);
-    return map;
+    return alloc_random(PAGE_SIZE_2M, MMAP_FLAGS | MAP_HUGETLB);
+}
+
+/**
+ * Append `page` to the array `arr` of `*num` pages, growing it if needed.
+ */
+static void page_pool_push(uint64_t **arr, size_t *num, size_t *cap, uint64_t page) {
+    if (*num == *cap) {
+        *cap = *cap ? *cap * 2 : 64;
+        *arr = realloc(*arr, *cap * sizeof(uint64_t));
+        uarf_assert(*arr);
+    }
+    (*arr)[(*num)++] = page;
+}
+
+static int page_cmp(const void *a, const void *b) {
+    uint64_t pa = *(const uint64_t *) a;
+    uint64_t pb = *(const uint64_t *) b;
+    return pa < pb ? -1 : pa > pb;
+}
+
+/**
+ * Unmap the `n` sorted `pages`, with a single munmap for every run of adjacent pages.
+ *
+ * @returns the number of munmap calls
+ */
+static size_t page_pool_unmap_sorted(const uint64_t *pages, size_t n) {
+    size_t num_ranges = 0;
+    for (size_t i = 0; i < n;) {
+        size_t j = i + 1;
+        while (j < n && pages[j] == pages[j - 1] + PAGE_SIZE) {
+            j++;
+        }
+        uarf_unmap_or_die(_ptr(pages[i]), (j - i) * PAGE_SIZE);
+        num_ranges++;
+        i = j;
+    }
+    return num_ranges;
+}
+
+static size_t page_pool_hash(uint64_t page) {
+    uint64_t h = (page >> PAGE_SHIFT) * 0x9e3779b97f4a7c15ul;
+    return h ^ (h >> 32);
+}
+
+/**
+ * Get the slot of `page` in the index of `pool`, or the empty slot it would go to.
+ */
+static UarfPagePoolSlot *page_pool_slot(UarfPagePool *pool, uint64_t page) {
+    size_t mask = pool->cap_index - 1;
+    size_t i = page_pool_hash(page) & mask;
+    while (pool->index[i].page && pool->index[i].page != page) {
+        i = (i + 1) & mask;
+    }
+    return &pool->index[i];
+}
+
+/**
+ * Add `page` at position `i` of the pages of `pool` to the index.
+ */
+static void page_pool_index_add(UarfPagePool *pool, uint64_t page, size_t i) {
+    // Keep the load at most one half, so probe sequences stay short
+    if (2 * pool->num_pages > pool->cap_index) {
+        UarfPagePoolSlot *old = pool->index;
+        size_t old_cap = pool->cap_index;
+
+        pool->cap_index = old_cap ? old_cap * 2 : 128;
+        pool->index = calloc(pool->cap_index, sizeof(UarfPagePoolSlot));
+        uarf_assert(pool->index);
+        for (size_t j = 0; j < old_cap; j++) {
+            if (old[j].page) {
+                *page_pool_slot(pool, old[j].page) = old[j];
+            }
+        }
+        free(old);
+    }
+
+    UarfPagePoolSlot *slot = page_pool_slot(pool, page);
+    uarf_assert(!slot->page);
+    *slot = (UarfPagePoolSlot) {.page = page, .i = i};
+}
+
+/**
+ * Remove `slot` from the index of `pool`.
+ *
+ * Shifts the following entries back instead of leaving a tombstone.
+ */
+static void page_pool_index_remove(UarfPagePool *pool, UarfPagePoolSlot *slot) {
+    size_t mask = pool->cap_index - 1;
+    size_t hole = slot - pool->index;
+    for (size_t j = (hole + 1) & mask; pool->index[j].page; j = (j + 1) & mask) {
+        // An entry can fill the hole if the hole is not before its home slot
+        size_t home = page_pool_hash(pool->index[j].page) & mask;
+        if (((j - home) & mask) >= ((j - hole) & mask)) {
+            pool->index[hole] = pool->index[j];
+            hole = j;
+        }
+    }
+    pool->index[hole].page = 0;
+}
+
+/**
+ * Get the slot of `page` in the index of `pool`.
+ */
+static UarfPagePoolSlot *page_pool_find(UarfPagePool *pool, uint64_t page) {
+    UarfPagePoolSlot *slot = pool->cap_index ? page_pool_slot(pool, page) : NULL;
+    if (!slot || !slot->page) {
+        UARF_LOG_ERROR("Page 0x%lx is not part of the pool\n", page);
+        exit(1);
+    }
+    return slot;
+}
+
+/**
+ * Move the recycled `page` to a fresh random address, keeping its physical page.
+ *
+ * @returns the new address of the page
+ */
+static uint64_t page_pool_move(UarfPagePool *pool, uint64_t page) {
+    // Reserve the target first, MREMAP_FIXED would replace whatever is mapped there
+    void *target = uarf_alloc_random_page();
+    void *map = mremap(_ptr(page), PAGE_SIZE, PAGE_SIZE, MREMAP_MAYMOVE | MREMAP_FIXED,
+                       target);
+    if (map == MAP_FAILED) {
+        UARF_LOG_ERROR("Failed to move page 0x%lx to %p\n", page, target);
+        exit(1);
+    }
+
+    // The lock moves along with the page
+    UarfPagePoolSlot *slot = page_pool_find(pool, page);
+    size_t i = slot->i;
+    page_pool_index_remove(pool, slot);
+    pool->pages[i] = _ul(map);
+    page_pool_index_add(pool, _ul(map), i);
+    return _ul(map);
+}
+
+/**
+ * Unmap the recycled `page` for good.
+ */
+static void page_pool_drop(UarfPagePool *pool, uint64_t page) {
+    UarfPagePoolSlot *slot = page_pool_find(pool, page);
+    size_t i = slot->i;
+    page_pool_index_remove(pool, slot);
+
+    // The last page takes the place of the dropped one
+    pool->pages[i] = pool->pages[--pool->num_pages];
+    if (i < pool->num_pages) {
+        page_pool_find(pool, pool->pages[i])->i = i;
+    }
+    uarf_unmap_or_die(_ptr(page), PAGE_SIZE);
+}
+
+/**
+ * Get a page from `pool`.
+ *
+ * Recycled pages are picked at random from the free ones and moved to a fresh random
+ * address, so repeated builds neither get their pages in the same order nor at the same
+ * virtual addresses. Every UARF_PAGE_POOL_REMAP_PERIOD-th recycled page is dropped and
+ * replaced by a newly mapped one, so that the physical pages change over time too. Only
+ * if there are no free pages, a new page is mapped and locked.
+ */
+uint64_t uarf_page_pool_get(UarfPagePool *pool) {
+    UARF_LOG_TRACE("(%p)\n", pool);
+
+    if (pool->num_free) {
+        size_t i = uarf_rand47() % pool->num_free;
+        uint64_t page = pool->free[i];
+        pool->free[i] = pool->free[--pool->num_free];
+        page_pool_find(pool, page)->free = false;
+
+        if (++pool->num_recycled % UARF_PAGE_POOL_REMAP_PERIOD) {
+            return page_pool_move(pool, page);
+        }
+        page_pool_drop(pool, page);
+    }
+
+    uint64_t page = _ul(uarf_alloc_random_page());
+    uarf_assert(!mlock(_ptr(page), PAGE_SIZE));
+    page_pool_push(&pool->pages, &pool->num_pages, &pool->cap_pages, page);
+    page_pool_index_add(pool, page, pool->num_pages - 1);
+    return page;
+}
+
+/**
+ * Return `page`, obtained from `uarf_page_pool_get`, to `pool`.
+ *
+ * Exits if `page` is not handed out by `pool`.
+ */
+void uarf_page_pool_put(UarfPagePool *pool, uint64_t page) {
+    UARF_LOG_TRACE("(%p, 0x%lx)\n", pool, page);
+    UarfPagePoolSlot *slot = page_pool_find(pool, page);
+    uarf_assert(!slot->free);
+    slot->free = true;
+    page_pool_push(&pool->free, &pool->num_free, &pool->cap_free, page);
+}
+
+/**
+ * Unmap all pages of `pool` that are not handed out.
+ */
+void uarf_page_pool_trim(UarfPagePool *pool) {
+    UARF_LOG_TRACE("(%p)\n", pool);
+
+    if (!pool->num_free) {
+        return;
+    }
+
+    qsort(pool->free, pool->num_free, sizeof(uint64_t), page_cmp);
+    qsort(pool->pages, pool->num_pages, sizeof(uint64_t), page_cmp);
+
+    // Keep the pages that are not free, both arrays are sorted
+    size_t n = 0;
+    size_t f = 0;
+    for (size_t i = 0; i < pool->num_pages; i++) {
+        if (f < pool->num_free && pool->pages[i] == pool->free[f]) {
+            f++;
+            continue;
+        }
+        pool->pages[n++] = pool->pages[i];
+    }
+    uarf_assert(f == pool->num_free);
+
+    size_t num_ranges = page_pool_unmap_sorted(pool->free, pool->num_free);
+    UARF_LOG_DEBUG("Unmapped %lu pages in %lu ranges\n", pool->num_free, num_ranges);
+
+    pool->num_pages = n;
+    pool->num_free = 0;
+
+    // Sorting moved the pages, none of the remaining ones is free
+    memset(pool->index, 0, pool->cap_index * sizeof(UarfPagePoolSlot));
+    for (size_t i = 0; i < n; i++) {
+        page_pool_index_add(pool, pool->pages[i], i);
+    }
+}
+
+/**
+ * Unmap all pages of `pool`, including the ones still handed out, and free the pool.
+ */
+void uarf_page_pool_deinit(UarfPagePool *pool) {
+    UARF_LOG_TRACE("(%p)\n", pool);
+
+    if (pool->num_free != pool->num_pages) {
+        UARF_LOG_WARNING("Unmapping %lu pages still in use\n",
+                         pool->num_pages - pool->num_free);
+    }
+
+    qsort(pool->pages, pool->num_pages, sizeof(uint64_t), page_cmp);
+    page_pool_unmap_sorted(pool->pages, pool->num_pages);
+
+    free(pool->pages);
+    free(pool->free);
+    free(pool->index);
+    *pool = (UarfPagePool) {};
 }
 
 void uarf_reload_tlb(uint64_t addr) {
@@ -8,8 +8,16 @@
 #include <string.h>
 #include <sys/mman.h>
 
-int uarf_pfc_init(UarfPfc *pfc, UarfPfcConfig config) {
-    UARF_LOG_TRACE("(%p, 0x%lx)\n", pfc, config.pmu_conf);
+/**
+ * Open and map the counter `pfc` for `config`.
+ *
+ * @param pid thread to measure, 0 for the calling one, -1 for all on `cpu`
+ * @param cpu CPU to measure on, -1 for any
+ * @param group_fd fd of the group leader, -1 to open a counter on its own
+ * @param read_format format of `read` on the counter
+ */
+static int pfc_open(UarfPfc *pfc, UarfPfcConfig config, pid_t pid, int cpu, int group_fd,
+                    uint64_t read_format) {
     uarf_assert(config.pmu_conf);
 
     memset(pfc, 0, sizeof(UarfPfc));
@@ -26,8 +34,17 @@ int uarf_pfc_init(UarfPfc *pfc, UarfPfcConfig config) {
     // pe.config3 = pfc->config.pmu_conf3; // Not supported on older Linux
     // versions
     pe.sample_type = PERF_SAMPLE_CPU | PERF_SAMPLE_RAW | PERF_SAMPLE_IP;
+    if (config.sample_period) {
+        // Only the IP keeps records small and of fixed size
+        pe.sample_period = config.sample_period;
+        pe.sample_type = PERF_SAMPLE_IP;
+        pe.precise_ip = config.precise_ip;
+    }
+
+    pe.read_format = read_format;
 
     pe.disabled = config.start_disabled;
+    pe.pinned = config.pinned;
 
     pe.exclude_user = !!(config.exclude & UARF_PFC_EXCLUDE_USER);
     pe.exclude_kernel = !!(config.exclude & UARF_PFC_EXCLUDE_KERNEL);
@@ -37,17 +54,27 @@ int uarf_pfc_init(UarfPfc *pfc, UarfPfcConfig config) {
     pe.exclude_guest = !!(config.exclude & UARF_PFC_EXCLUDE_GUEST);
 
     // pe.precise_ip = 2; // Try to record immediately, but do not enforce
-    // pid=0, cpu=-1 => Measure calling process/thread on any CPU
 
-    // TODO: Adjust to allow grouped events
-    pfc->fd = uarf_perf_event_open(&pe, 0, -1, -1, PERF_FLAG_FD_NO_GROUP);
+    pfc->fd = uarf_perf_event_open(&pe, pid, cpu, group_fd,
+                                   group_fd == -1 ? PERF_FLAG_FD_NO_GROUP : 0);
     if (pfc->fd == -1) {
-        UARF_LOG_ERROR("Error opening PFC 0x%llx: %d (%s)\nDo you run as root?\n",
-                       pe.config, errno, strerror(errno));
+        UARF_LOG_ERROR("Error opening PFC 0x%llx on pid %d, cpu %d: %d (%s)\n"
+                       "Do you run as root?\n",
+                       pe.config, pid, cpu, errno, strerror(errno));
         return -1;
     }
 
-    pfc->page = mmap(NULL, PAGE_SIZE, PROT_READ, MAP_SHARED, pfc->fd, 0);
+    // The reader of a ring buffer writes its tail to the metadata page
+    int prot = PROT_READ;
+    pfc->map_size = PAGE_SIZE;
+    if (config.sample_period) {
+        uint32_t pages = config.sample_pages;
+        uarf_assert(pages && !(pages & (pages - 1)));
+        prot |= PROT_WRITE;
+        pfc->map_size += pages * PAGE_SIZE;
+    }
+
+    pfc->page = mmap(NULL, pfc->map_size, prot, MAP_SHARED, pfc->fd, 0);
     if (pfc->page == MAP_FAILED) {
         UARF_LOG_ERROR("Failed to map PFC page\n");
         return -1;
@@ -56,29 +83,83 @@ int uarf_pfc_init(UarfPfc *pfc, UarfPfcConfig config) {
         UARF_LOG_WARNING("rdpmc instruction is not available!\n");
     }
 
-    // Not disabled => index != 0
-    uarf_assert(pe.disabled || pfc->page->index != 0);
-
-    pfc->rdpmc_index = pfc->page->index - 1;
-    pfc->rdpmc_offset = pfc->page->offset;
-    /*
-     * If cap_user_rdpmc this field provides the bit-width of the value
-     * read using the rdpmc() or equivalent instruction. This can be used
-     * to sign extend the result like:
-     *
-     *   pmc <<= 64 - width;
-     *   pmc >>= 64 - width; // signed shift right
-     *   count += pmc;
-     */
-    pfc->rdpmc_mask = (1ul << pfc->page->pmc_width) - 1;
+    // Not disabled => on the PMU, if rdpmc is available
+    // Counters of other threads or CPUs are never on the PMU of the calling thread
+    bool on_pmu = uarf_pfc_refresh_rdpmc(pfc);
+    bool own = pid == 0 && cpu == -1;
+    uarf_assert(pe.disabled || on_pmu || !own || !pfc->page->cap_user_rdpmc);
 
     return 0;
 }
 
+int uarf_pfc_init(UarfPfc *pfc, UarfPfcConfig config) {
+    UARF_LOG_TRACE("(%p, 0x%lx)\n", pfc, config.pmu_conf);
+    return pfc_open(pfc, config, 0, -1, -1, 0);
+}
+
 void uarf_pfc_deinit(UarfPfc *pfc) {
     UARF_LOG_TRACE("(%p)\n", pfc);
-    munmap(pfc->page, PAGE_SIZE);
+    munmap(pfc->page, pfc->map_size);
     close(pfc->fd);
     pfc->page = 0;
     pfc->fd = 0;
 }
+
+int uarf_pfc_group_init(UarfPfcGroup *group, const UarfPfcConfig *configs, size_t n) {
+    UARF_LOG_TRACE("(%p, %p, %lu)\n", group, configs, n);
+    return uarf_pfc_group_init_on(group, configs, n, 0, -1);
+}
+
+int uarf_pfc_group_init_on(UarfPfcGroup *group, const UarfPfcConfig *configs, size_t n,
+                           pid_t pid, int cpu) {
+    UARF_LOG_TRACE("(%p, %p, %lu, %d, %d)\n", group, configs, n, pid, cpu);
+    uarf_assert(n > 0 && n <= UARF_PFC_GROUP_MAX);
+
+    memset(group, 0, sizeof(UarfPfcGroup));
+
+    for (size_t i = 0; i < n; i++) {
+        // Members start and stop with the leader, starting the group enables them all
+        UarfPfcConfig config = configs[i];
+        config.start_disabled = configs[0].start_disabled;
+
+        int leader_fd = i == 0 ? -1 : group->pfcs[0].fd;
+        uint64_t read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                               PERF_FORMAT_TOTAL_TIME_RUNNING;
+        if (pfc_open(&group->pfcs[i], config, pid, cpu, leader_fd, read_format)) {
+            uarf_pfc_group_deinit(group);
+            return -1;
+        }
+        group->num_pfcs++;
+    }
+
+    return 0;
+}
+
+void uarf_pfc_group_deinit(UarfPfcGroup *group) {
+    UARF_LOG_TRACE("(%p)\n", group);
+
+    // Members first, the leader holds the group together
+    while (group->num_pfcs) {
+        uarf_pfc_deinit(&group->pfcs[--group->num_pfcs]);
+    }
+}
+
+size_t uarf_pfc_num_counters(void) {
+    UARF_LOG_TRACE("()\n");
+
+    if (uarf_cpu_is_amd()) {
+        // PerfMonV2 reports the number, otherwise the core extension has 6 instead of 4
+        if (uarf_cpuid_eax(0x80000000) >= 0x80000022 &&
+            (uarf_cpuid_eax(0x80000022) & BIT(0))) {
+            return uarf_cpuid_ebx(0x80000022) & 0xf;
+        }
+        bool ext = uarf_cpuid_eax(0x80000000) >= 0x80000001 &&
+                   (uarf_cpuid_ecx(0x80000001) & BIT(23));
+        return ext ? 6 : 4;
+    }
+
+    if (uarf_cpuid_eax(0) < 0xa) {
+        return 0;
+    }
+    return (uarf_cpuid_eax(0xa) >> 8) & 0xff;
+}
@@ -0,0 +1,276 @@
+#include "pfc_events.h"
+#include "compiler.h"
+#include "lib.h"
+#include "log.h"
+#include <string.h>
+
+#ifdef UARF_LOG_TAG
+#undef UARF_LOG_TAG
+#define UARF_LOG_TAG UARF_LOG_TAG_PFC
+#endif
+
+/**
+ * Encode an event like UARF_PFC_PMU_CONFIG, but as constant expression.
+ */
+#define EVENT_CONF(event, umask, edge, cmask)                                            \
+    ((_ul(event) & 0xff) | _ul(umask) << 8 | _ul(edge) << 18 | _ul(cmask) << 24 |        \
+     (_ul(event) >> 8) << 32)
+
+#define EVENT_EDGE(uarch_, name_, event, umask, edge, cmask)                             \
+    {.uarch = (uarch_),                                                                  \
+     .name = (name_),                                                                    \
+     .pmu_conf = EVENT_CONF(event, umask, edge, cmask)}
+
+#define EVENT(uarch_, name_, event, umask) EVENT_EDGE(uarch_, name_, event, umask, 0, 0)
+
+/**
+ * Events of the Zen core PMU, with the names of the AMD PPRs.
+ */
+#define EVENTS_ZEN(uarch)                                                                \
+    EVENT(uarch, "ex_ret_instr", 0xc0, 0x00),                                            \
+        EVENT(uarch, "ex_ret_brn", 0xc2, 0x00),                                          \
+        EVENT(uarch, "ex_ret_brn_misp", 0xc3, 0x00),                                     \
+        EVENT(uarch, "ex_ret_brn_tkn", 0xc4, 0x00),                                      \
+        EVENT(uarch, "ex_ret_brn_tkn_misp", 0xc5, 0x00),                                 \
+        EVENT(uarch, "ex_ret_near_ret", 0xc8, 0x00),                                     \
+        EVENT(uarch, "ex_ret_near_ret_mispred", 0xc9, 0x00),                             \
+        EVENT(uarch, "ex_ret_brn_ind_misp", 0xca, 0x00),                                 \
+        EVENT(uarch, "ex_ret_cond", 0xd1, 0x00),                                         \
+        EVENT(uarch, "ls_smi_rx", 0x2b, 0x00),                                           \
+        EVENT(uarch, "ls_not_halted_cyc", 0x76, 0x00)
+
+/**
+ * Events of the Skylake derived cores, with the names of the Intel SDM.
+ */
+#define EVENTS_SKYLAKE(uarch)                                                            \
+    EVENT(uarch, "inst_retired.any_p", 0xc0, 0x00),                                      \
+        EVENT(uarch, "inst_retired.prec_dist", 0xc0, 0x01),                              \
+        EVENT(uarch, "cpu_clk_unhalted.thread_p", 0x3c, 0x00),                           \
+        EVENT(uarch, "br_inst_retired.all_branches", 0xc4, 0x00),                        \
+        EVENT(uarch, "br_inst_retired.near_return", 0xc4, 0x08),                         \
+        EVENT(uarch, "br_misp_retired.all_branches", 0xc5, 0x00),                        \
+        EVENT(uarch, "mem_load_retired.l1_hit", 0xd1, 0x01),                             \
+        EVENT(uarch, "mem_load_retired.l1_miss", 0xd1, 0x08),                            \
+        EVENT(uarch, "mem_load_retired.l3_miss", 0xd1, 0x20),                            \
+        EVENT_EDGE(uarch, "machine_clears.count", 0xc3, 0x01, 1, 1)
+
+/**
+ * Events of the Golden Cove derived P-cores, with the names of the Intel SDM.
+ */
+#define EVENTS_GOLDEN_COVE(uarch)                                                        \
+    EVENTS_SKYLAKE(uarch), EVENT(uarch, "br_inst_retired.indirect", 0xc4, 0x80),         \
+        EVENT(uarch, "br_misp_retired.indirect", 0xc5, 0x80),                            \
+        EVENT(uarch, "uops_issued.any", 0xae, 0x01),                                     \
+        EVENT(uarch, "dtlb_load_misses.walk_completed", 0x12, 0x0e),                     \
+        EVENT(uarch, "itlb_misses.walk_completed", 0x11, 0x0e)
+
+const UarfPfcEvent uarf_pfc_events[] = {
+    EVENTS_ZEN(ZEN2),
+    EVENTS_ZEN(ZEN3),
+    EVENT(ZEN3, "ex_ret_ind_brch_instr", 0xcc, 0x00),
+    EVENTS_ZEN(ZEN4),
+    EVENT(ZEN4, "ex_ret_ind_brch_instr", 0xcc, 0x00),
+    EVENTS_ZEN(ZEN5),
+    EVENT(ZEN5, "ex_ret_ind_brch_instr", 0xcc, 0x00),
+
+    EVENTS_SKYLAKE(COFFEE_LAKE),
+    EVENT(COFFEE_LAKE, "dtlb_load_misses.walk_completed", 0x08, 0x0e),
+    EVENT(COFFEE_LAKE, "itlb_misses.walk_completed", 0x85, 0x0e),
+    EVENT(COFFEE_LAKE, "uops_issued.any", 0x0e, 0x01),
+    EVENTS_GOLDEN_COVE(ALDER_LAKE),
+    EVENTS_GOLDEN_COVE(RAPTOR_LAKE),
+};
+
+#define EVENTS_NUM (sizeof(uarf_pfc_events) / sizeof(*uarf_pfc_events))
+
+const size_t uarf_pfc_num_events = EVENTS_NUM;
+
+// Perfect hash by hash and displace: the bucket of a key selects the seed of its slot
+#define EVENTS_NUM_SLOTS   (2 * EVENTS_NUM)
+#define EVENTS_NUM_BUCKETS (EVENTS_NUM / 2 + 1)
+// Upper bound on tried seeds, reaching it means a duplicate event
+#define EVENTS_MAX_SEED (1u << 20)
+
+// Index into `uarf_pfc_events`, -1 if free
+static int16_t events_slots[EVENTS_NUM_SLOTS];
+static uint32_t events_seeds[EVENTS_NUM_BUCKETS];
+
+static uint64_t events_hash(uint32_t uarch, const char *name, uint32_t seed) {
+    // FNV-1a, finalized with the mixer of splitmix64
+    uint64_t h = 0xcbf29ce484222325ul ^ ((uint64_t) seed << 32 | uarch);
+    for (; *name; name++) {
+        h = (h ^ (uint8_t) *name) * 0x100000001b3ul;
+    }
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ul;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebul;
+    return h ^ (h >> 31);
+}
+
+static size_t events_bucket(const UarfPfcEvent *ev) {
+    return events_hash(ev->uarch, ev->name, 0) % EVENTS_NUM_BUCKETS;
+}
+
+/**
+ * Find a seed that places all events of `bucket` into free, distinct slots.
+ */
+static void events_place(const uint16_t *bucket, size_t n, size_t b) {
+    size_t slots[EVENTS_NUM];
+
+    for (uint32_t seed = 1; seed < EVENTS_MAX_SEED; seed++) {
+        size_t i = 0;
+        for (; i < n; i++) {
+            const UarfPfcEvent *ev = &uarf_pfc_events[bucket[i]];
+            slots[i] = events_hash(ev->uarch, ev->name, seed) % EVENTS_NUM_SLOTS;
+
+            bool taken = events_slots[slots[i]] >= 0;
+            for (size_t j = 0; j < i && !taken; j++) {
+                taken = slots[j] == slots[i];
+            }
+            if (taken) {
+                break;
+            }
+        }
+
+        if (i == n) {
+            events_seeds[b] = seed;
+            for (i = 0; i < n; i++) {
+                events_slots[slots[i]] = bucket[i];
+            }
+            return;
+        }
+    }
+
+    UARF_LOG_ERROR("Event %s is in the catalogue twice\n",
+                   uarf_pfc_events[bucket[0]].name);
+    uarf_bug();
+}
+
+__attribute__((constructor)) static void events_init(void) {
+    memset(events_slots, 0xff, sizeof(events_slots));
+
+    // Events sorted by bucket, then place the largest buckets first
+    size_t bucket_size[EVENTS_NUM_BUCKETS] = {};
+    size_t bucket_start[EVENTS_NUM_BUCKETS + 1] = {};
+    uint16_t sorted[EVENTS_NUM];
+    for (size_t i = 0; i < EVENTS_NUM; i++) {
+        bucket_size[events_bucket(&uarf_pfc_events[i])]++;
+    }
+    for (size_t b = 0; b < EVENTS_NUM_BUCKETS; b++) {
+        bucket_start[b + 1] = bucket_start[b] + bucket_size[b];
+    }
+    size_t fill[EVENTS_NUM_BUCKETS];
+    memcpy(fill, bucket_start, sizeof(fill));
+    for (size_t i = 0; i < EVENTS_NUM; i++) {
+        sorted[fill[events_bucket(&uarf_pfc_events[i])]++] = i;
+    }
+
+    size_t max_size = 0;
+    for (size_t b = 0; b < EVENTS_NUM_BUCKETS; b++) {
+        max_size = max(max_size, bucket_size[b]);
+    }
+    for (size_t size = max_size; size > 0; size--) {
+        for (size_t b = 0; b < EVENTS_NUM_BUCKETS; b++) {
+            if (bucket_size[b] == size) {
+                events_place(&sorted[bucket_start[b]], size, b);
+            }
+        }
+    }
+}
+
+const UarfPfcEvent *uarf_pfc_event_lookup(uint32_t uarch, const char *name) {
+    UARF_LOG_TRACE("(0x%x, %s)\n", uarch, name);
+
+    size_t b = events_hash(uarch, name, 0) % EVENTS_NUM_BUCKETS;
+    size_t slot = events_hash(uarch, name, events_seeds[b]) % EVENTS_NUM_SLOTS;
+    int16_t i = events_slots[slot];
+
+    if (i < 0 || uarf_pfc_events[i].uarch != uarch ||
+        strcmp(uarf_pfc_events[i].name, name)) {
+        return NULL;
+    }
+    return &uarf_pfc_events[i];
+}
+
+uint32_t uarf_pfc_host_uarch(void) {
+    bool amd = uarf_cpu_is_amd();
+
+    uint32_t sig = uarf_cpuid_eax(1);
+    uint32_t family = (sig >> 8) & 0xf;
+    uint32_t model = (sig >> 4) & 0xf;
+    if (family == 0x6 || family == 0xf) {
+        model |= ((sig >> 16) & 0xf) << 4;
+    }
+    if (family == 0xf) {
+        family += (sig >> 20) & 0xff;
+    }
+
+    if (amd) {
+        switch (family) {
+        case 0x17:
+            // Earlier models are Zen and Zen+
+            return model >= 0x30 ? ZEN2 : 0;
+        case 0x19:
+            if (model <= 0x0f || (model >= 0x20 && model <= 0x5f)) {
+                return ZEN3;
+            }
+            return ZEN4;
+        case 0x1a:
+            return ZEN5;
+        default:
+            return 0;
+        }
+    }
+
+    if (family != 0x6) {
+        return 0;
+    }
+    switch (model) {
+    case 0x8e:
+    case 0x9e:
+        return COFFEE_LAKE;
+    case 0x97:
+    case 0x9a:
+        return ALDER_LAKE;
+    case 0xb7:
+    case 0xba:
+    case 0xbf:
+        return RAPTOR_LAKE;
+    default:
+        return 0;
+    }
+}
+
+const char *uarf_pfc_uarch_str(uint32_t uarch) {
+    switch (uarch) {
+    case COFFEE_LAKE:
+        return "Coffee Lake";
+    case ALDER_LAKE:
+        return "Alder Lake";
+    case RAPTOR_LAKE:
+        return "Raptor Lake";
+    case ZEN2:
+        return "Zen 2";
+    case ZEN3:
+        return "Zen 3";
+    case ZEN4:
+        return "Zen 4";
+    case ZEN5:
+        return "Zen 5";
+    default:
+        return "unknown";
+    }
+}
+
+int uarf_pfc_init_by_name(UarfPfc *pfc, const char *name, UarfPfcConfig config) {
+    UARF_LOG_TRACE("(%p, %s)\n", pfc, name);
+
+    uint32_t uarch = uarf_pfc_host_uarch();
+    const UarfPfcEvent *ev = uarf_pfc_event_lookup(uarch, name);
+    if (!ev) {
+        UARF_LOG_ERROR("No event %s on %s\n", name, uarf_pfc_uarch_str(uarch));
+        return -1;
+    }
+
+    config.pmu_conf = ev->pmu_conf;
+    return uarf_pfc_init(pfc, config);
+}
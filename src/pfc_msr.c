@@ -0,0 +1,281 @@
+#define _GNU_SOURCE
+#include "pfc_msr.h"
+#include "kmod/pi.h"
+#include "lib.h"
+#include "log.h"
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef UARF_LOG_TAG
+#undef UARF_LOG_TAG
+#define UARF_LOG_TAG UARF_LOG_TAG_PFC
+#endif
+
+// Enable bit of PerfEvtSel
+#define PFC_MSR_SEL_EN BIT(22)
+
+// Intel architectural performance monitoring
+#define MSR_IA32_PERFEVTSEL0      0x186
+#define MSR_IA32_PMC0             0xc1
+#define MSR_IA32_PERF_GLOBAL_CTRL 0x38f
+
+// AMD legacy, extended and PerfMonV2 core counters
+#define MSR_AMD_PERF_CTL0            0xc0010000
+#define MSR_AMD_PERF_CTR0            0xc0010004
+#define MSR_AMD_PERF_CTL_EXT0        0xc0010200
+#define MSR_AMD_PERF_CNTR_GLOBAL_CTL 0xc0000301
+
+#define PFC_MSR_NMI_WATCHDOG_PATH "/proc/sys/kernel/nmi_watchdog"
+
+/**
+ * MSRs of the general purpose counters of the CPU.
+ */
+typedef struct PfcMsrLayout PfcMsrLayout;
+struct PfcMsrLayout {
+    size_t num_counters;
+    uint32_t msr_sel[UARF_PFC_MSR_MAX];
+    uint32_t msr_ctr[UARF_PFC_MSR_MAX];
+    uint32_t msr_global_ctrl;
+    uint8_t width;
+};
+
+static PfcMsrLayout pfc_msr_layout(void) {
+    PfcMsrLayout layout = {.width = 48};
+
+    if (uarf_cpu_is_amd()) {
+        bool ext = uarf_cpuid_eax(0x80000000) >= 0x80000001 &&
+                   (uarf_cpuid_ecx(0x80000001) & BIT(23));
+        layout.num_counters = uarf_pfc_num_counters();
+
+        if (uarf_cpuid_eax(0x80000000) >= 0x80000022 &&
+            (uarf_cpuid_eax(0x80000022) & BIT(0))) {
+            layout.msr_global_ctrl = MSR_AMD_PERF_CNTR_GLOBAL_CTL;
+        }
+
+        for (size_t i = 0; i < layout.num_counters && i < UARF_PFC_MSR_MAX; i++) {
+            layout.msr_sel[i] = ext ? MSR_AMD_PERF_CTL_EXT0 + 2 * i : MSR_AMD_PERF_CTL0 + i;
+            layout.msr_ctr[i] =
+                ext ? MSR_AMD_PERF_CTL_EXT0 + 2 * i + 1 : MSR_AMD_PERF_CTR0 + i;
+        }
+    }
+    else if (uarf_cpuid_eax(0) >= 0xa) {
+        uint32_t eax = uarf_cpuid_eax(0xa);
+        uint8_t version = eax & 0xff;
+        layout.num_counters = uarf_pfc_num_counters();
+        layout.width = (eax >> 16) & 0xff;
+        layout.msr_global_ctrl = version >= 2 ? MSR_IA32_PERF_GLOBAL_CTRL : 0;
+
+        for (size_t i = 0; i < layout.num_counters && i < UARF_PFC_MSR_MAX; i++) {
+            layout.msr_sel[i] = MSR_IA32_PERFEVTSEL0 + i;
+            layout.msr_ctr[i] = MSR_IA32_PMC0 + i;
+        }
+    }
+
+    layout.num_counters = min(layout.num_counters, _ul(UARF_PFC_MSR_MAX));
+    return layout;
+}
+
+/**
+ * Pin the calling thread to `cpu`, saving its previous affinity in `pm`.
+ */
+static bool pfc_msr_pin(UarfPfcMsr *pm, int cpu) {
+    if (sched_getaffinity(0, sizeof(pm->saved_affinity), &pm->saved_affinity)) {
+        UARF_LOG_ERROR("Failed to get affinity: %s\n", strerror(errno));
+        return false;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set)) {
+        UARF_LOG_ERROR("Failed to pin to CPU %d: %s\n", cpu, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Let the calling thread run on the CPUs it did before `pfc_msr_pin`.
+ */
+static void pfc_msr_unpin(UarfPfcMsr *pm) {
+    if (sched_setaffinity(0, sizeof(pm->saved_affinity), &pm->saved_affinity)) {
+        UARF_LOG_WARNING("Failed to restore affinity: %s\n", strerror(errno));
+    }
+}
+
+/**
+ * Whether the NMI watchdog, which occupies a counter through perf, is active.
+ */
+static bool pfc_msr_nmi_watchdog(void) {
+    FILE *f = fopen(PFC_MSR_NMI_WATCHDOG_PATH, "r");
+    if (!f) {
+        return false;
+    }
+    int enabled = 0;
+    if (fscanf(f, "%d", &enabled) != 1) {
+        enabled = 0;
+    }
+    fclose(f);
+    return enabled;
+}
+
+/**
+ * Get the event selection for `config`, without the enable bit.
+ */
+static uint64_t pfc_msr_sel(UarfPfcConfig config) {
+    UarfPfcEventSel sel = {.value = config.pmu_conf};
+    sel.bits.en = 0;
+    sel.bits.interrupt = 0;
+    sel.bits.usr = !(config.exclude & UARF_PFC_EXCLUDE_USER);
+    sel.bits.os = !(config.exclude & UARF_PFC_EXCLUDE_KERNEL);
+    return sel.value;
+}
+
+int uarf_pfc_msr_init(UarfPfcMsr *pm, int cpu, const UarfPfcConfig *configs, size_t n) {
+    UARF_LOG_TRACE("(%p, %d, %p, %lu)\n", pm, cpu, configs, n);
+    uarf_assert(n > 0 && n <= UARF_PFC_MSR_MAX);
+
+    memset(pm, 0, sizeof(UarfPfcMsr));
+    pm->cpu = cpu;
+
+    uarf_pi_init();
+    if (fd_pi == -1) {
+        UARF_LOG_ERROR("Direct PMU access needs the pi module\n");
+        return -1;
+    }
+
+    if (!pfc_msr_pin(pm, cpu)) {
+        uarf_pi_deinit();
+        return -1;
+    }
+
+    if (pfc_msr_nmi_watchdog()) {
+        UARF_LOG_WARNING("NMI watchdog is active and occupies a counter\n");
+    }
+
+    // Only take counters nobody enabled, neither perf nor anyone else
+    PfcMsrLayout layout = pfc_msr_layout();
+    pm->mask = layout.width < 64 ? BIT(layout.width) - 1 : ~0ul;
+    for (size_t i = 0; i < layout.num_counters && pm->num_pfcs < n; i++) {
+        uint64_t sel = uarf_pi_rdmsr(layout.msr_sel[i]);
+        if (sel & PFC_MSR_SEL_EN) {
+            UARF_LOG_DEBUG("Counter %lu is in use: 0x%lx\n", i, sel);
+            continue;
+        }
+
+        size_t k = pm->num_pfcs++;
+        pm->index[k] = i;
+        pm->msr_sel[k] = layout.msr_sel[i];
+        pm->msr_ctr[k] = layout.msr_ctr[i];
+        pm->saved_sel[k] = sel;
+        pm->saved_ctr[k] = uarf_pi_rdmsr(layout.msr_ctr[i]);
+        pm->sel[k] = pfc_msr_sel(configs[k]);
+    }
+
+    if (pm->num_pfcs < n) {
+        UARF_LOG_ERROR("Only %lu of %lu counters are free on CPU %d\n", pm->num_pfcs, n,
+                       cpu);
+        pm->num_pfcs = 0;
+        pfc_msr_unpin(pm);
+        uarf_pi_deinit();
+        return -1;
+    }
+
+    // A disabled, mapped event makes the kernel set CR4.PCE for the process, without
+    // occupying a counter
+    UarfPfcConfig pce_config = configs[0];
+    pce_config.start_disabled = true;
+    pce_config.pinned = false;
+    if (uarf_pfc_init(&pm->pce, pce_config)) {
+        UARF_LOG_WARNING("rdpmc may not be allowed\n");
+    }
+
+    for (size_t k = 0; k < pm->num_pfcs; k++) {
+        uarf_pi_wrmsr(pm->msr_sel[k], pm->sel[k]);
+    }
+    if (layout.msr_global_ctrl) {
+        pm->msr_global_ctrl = layout.msr_global_ctrl;
+        pm->saved_global_ctrl = uarf_pi_rdmsr(pm->msr_global_ctrl);
+        uint64_t global_ctrl = pm->saved_global_ctrl;
+        for (size_t k = 0; k < pm->num_pfcs; k++) {
+            global_ctrl |= BIT(pm->index[k]);
+        }
+        uarf_pi_wrmsr(pm->msr_global_ctrl, global_ctrl);
+    }
+
+    return 0;
+}
+
+void uarf_pfc_msr_deinit(UarfPfcMsr *pm) {
+    UARF_LOG_TRACE("(%p)\n", pm);
+
+    if (!pm->num_pfcs) {
+        return;
+    }
+
+    for (size_t k = 0; k < pm->num_pfcs; k++) {
+        uarf_pi_wrmsr(pm->msr_sel[k], pm->saved_sel[k] & ~PFC_MSR_SEL_EN);
+        uarf_pi_wrmsr(pm->msr_ctr[k], pm->saved_ctr[k]);
+        uarf_pi_wrmsr(pm->msr_sel[k], pm->saved_sel[k]);
+    }
+    if (pm->msr_global_ctrl) {
+        uarf_pi_wrmsr(pm->msr_global_ctrl, pm->saved_global_ctrl);
+    }
+
+    if (pm->pce.page) {
+        uarf_pfc_deinit(&pm->pce);
+    }
+    pfc_msr_unpin(pm);
+    uarf_pi_deinit();
+    pm->num_pfcs = 0;
+}
+
+void uarf_pfc_msr_start(UarfPfcMsr *pm) {
+    UARF_LOG_TRACE("(%p)\n", pm);
+    for (size_t k = 0; k < pm->num_pfcs; k++) {
+        uarf_pi_wrmsr(pm->msr_sel[k], pm->sel[k] | PFC_MSR_SEL_EN);
+    }
+}
+
+void uarf_pfc_msr_stop(UarfPfcMsr *pm) {
+    // No tracing, it falsifies the result
+    for (size_t k = 0; k < pm->num_pfcs; k++) {
+        uarf_pi_wrmsr(pm->msr_sel[k], pm->sel[k]);
+    }
+}
+
+void uarf_pfc_msr_reset(UarfPfcMsr *pm) {
+    UARF_LOG_TRACE("(%p)\n", pm);
+    uarf_pfc_msr_stop(pm);
+    for (size_t k = 0; k < pm->num_pfcs; k++) {
+        uarf_pi_wrmsr(pm->msr_ctr[k], 0);
+    }
+}
+
+bool uarf_pfc_msr_check(UarfPfcMsr *pm) {
+    UARF_LOG_TRACE("(%p)\n", pm);
+
+    bool ok = true;
+    for (size_t k = 0; k < pm->num_pfcs; k++) {
+        uint64_t sel = uarf_pi_rdmsr(pm->msr_sel[k]) & ~PFC_MSR_SEL_EN;
+        if (sel != pm->sel[k]) {
+            UARF_LOG_WARNING("Counter %u got reprogrammed: 0x%lx\n", pm->index[k], sel);
+            ok = false;
+        }
+    }
+
+    // perf rewrites the global enable on Intel, when it schedules its own events
+    if (pm->msr_global_ctrl) {
+        uint64_t global_ctrl = uarf_pi_rdmsr(pm->msr_global_ctrl);
+        for (size_t k = 0; k < pm->num_pfcs; k++) {
+            if (!(global_ctrl & BIT(pm->index[k]))) {
+                UARF_LOG_WARNING("Counter %u got disabled globally: 0x%lx\n",
+                                 pm->index[k], global_ctrl);
+                ok = false;
+            }
+        }
+    }
+    return ok;
+}
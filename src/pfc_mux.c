@@ -0,0 +1,248 @@
+#include "pfc_mux.h"
+#include "lib.h"
+#include "log.h"
+#include "pfc_events.h"
+#include <stdio.h>
+#include <string.h>
+
+#ifdef UARF_LOG_TAG
+#undef UARF_LOG_TAG
+#define UARF_LOG_TAG UARF_LOG_TAG_PFC
+#endif
+
+// Two-sided 95% quantile of the normal distribution
+#define PFC_MUX_Z95 1.96
+
+/**
+ * Square root of `x` >= 0.
+ *
+ * Newton's method, so we do not make everyone linking the library also link libm.
+ */
+static double pfc_mux_sqrt(double x) {
+    if (x <= 0) {
+        return 0;
+    }
+
+    double r = x > 1 ? x : 1;
+    for (int i = 0; i < 100; i++) {
+        double next = (r + x / r) / 2;
+        if (next >= r) {
+            break;
+        }
+        r = next;
+    }
+    return r;
+}
+
+/**
+ * Whether the kernel can put the whole group onto the PMU at once.
+ *
+ * A group that does not fit is never scheduled, so it does not run at all.
+ */
+static bool pfc_mux_group_fits(UarfPfcGroup *group) {
+    uint64_t counts[UARF_PFC_GROUP_MAX];
+
+    uarf_pfc_group_reset(group);
+    uarf_pfc_group_start(group);
+    for (volatile int i = 0; i < 1000; i++) {
+    }
+    uarf_pfc_group_stop(group);
+    uarf_pfc_group_read(group, counts);
+
+    return group->time_running > 0;
+}
+
+/**
+ * Add groups for the `n` `configs`, starting with event `first`.
+ *
+ * Splits the events in halves until every group fits.
+ */
+static int pfc_mux_partition(UarfPfcMux *mux, const UarfPfcConfig *configs, size_t first,
+                             size_t n) {
+    uarf_assert(mux->num_groups < UARF_PFC_MUX_MAX);
+
+    UarfPfcGroup *group = &mux->groups[mux->num_groups];
+    if (uarf_pfc_group_init(group, &configs[first], n)) {
+        return -1;
+    }
+
+    if (pfc_mux_group_fits(group)) {
+        mux->first[mux->num_groups++] = first;
+        return 0;
+    }
+
+    uarf_pfc_group_deinit(group);
+    if (n == 1) {
+        UARF_LOG_ERROR("Event 0x%lx cannot be scheduled\n", configs[first].pmu_conf);
+        return -1;
+    }
+
+    UARF_LOG_DEBUG("Events %lu to %lu do not fit at once\n", first, first + n - 1);
+    if (pfc_mux_partition(mux, configs, first, n / 2)) {
+        return -1;
+    }
+    return pfc_mux_partition(mux, configs, first + n / 2, n - n / 2);
+}
+
+int uarf_pfc_mux_init(UarfPfcMux *mux, const UarfPfcConfig *configs, size_t n,
+                      size_t group_size) {
+    UARF_LOG_TRACE("(%p, %p, %lu, %lu)\n", mux, configs, n, group_size);
+    uarf_assert(n > 0 && n <= UARF_PFC_MUX_MAX);
+
+    memset(mux, 0, sizeof(UarfPfcMux));
+    mux->num_events = n;
+
+    if (!group_size) {
+        group_size = uarf_pfc_num_counters();
+        if (!group_size) {
+            UARF_LOG_ERROR("CPU reports no performance counters\n");
+            return -1;
+        }
+    }
+    group_size = min(group_size, _ul(UARF_PFC_GROUP_MAX));
+
+    // Groups only run between begin and end
+    UarfPfcConfig group_configs[UARF_PFC_MUX_MAX];
+    for (size_t i = 0; i < n; i++) {
+        group_configs[i] = configs[i];
+        group_configs[i].start_disabled = true;
+        group_configs[i].pinned = false;
+    }
+
+    for (size_t first = 0; first < n; first += group_size) {
+        if (pfc_mux_partition(mux, group_configs, first, min(group_size, n - first))) {
+            uarf_pfc_mux_deinit(mux);
+            return -1;
+        }
+    }
+
+    UARF_LOG_INFO("Multiplexing %lu events in %lu groups\n", n, mux->num_groups);
+    return 0;
+}
+
+int uarf_pfc_mux_init_by_name(UarfPfcMux *mux, const char *const *names, size_t n,
+                              UarfPfcConfig config, size_t group_size) {
+    UARF_LOG_TRACE("(%p, %p, %lu, %lu)\n", mux, names, n, group_size);
+    uarf_assert(n > 0 && n <= UARF_PFC_MUX_MAX);
+
+    uint32_t uarch = uarf_pfc_host_uarch();
+    UarfPfcConfig configs[UARF_PFC_MUX_MAX];
+    for (size_t i = 0; i < n; i++) {
+        const UarfPfcEvent *ev = uarf_pfc_event_lookup(uarch, names[i]);
+        if (!ev) {
+            UARF_LOG_ERROR("No event %s on %s\n", names[i], uarf_pfc_uarch_str(uarch));
+            return -1;
+        }
+        configs[i] = config;
+        configs[i].pmu_conf = ev->pmu_conf;
+    }
+
+    if (uarf_pfc_mux_init(mux, configs, n, group_size)) {
+        return -1;
+    }
+    memcpy(mux->names, names, n * sizeof(*names));
+    return 0;
+}
+
+void uarf_pfc_mux_deinit(UarfPfcMux *mux) {
+    UARF_LOG_TRACE("(%p)\n", mux);
+
+    while (mux->num_groups) {
+        uarf_pfc_group_deinit(&mux->groups[--mux->num_groups]);
+    }
+}
+
+void uarf_pfc_mux_begin(UarfPfcMux *mux) {
+    UARF_LOG_TRACE("(%p)\n", mux);
+
+    mux->cur = mux->num_reps % mux->num_groups;
+    UarfPfcGroup *group = &mux->groups[mux->cur];
+    uarf_pfc_group_reset(group);
+
+    uint64_t counts[UARF_PFC_GROUP_MAX];
+    uarf_pfc_group_read(group, counts);
+    mux->time_enabled = group->time_enabled;
+    mux->time_running = group->time_running;
+
+    uarf_pfc_group_start(group);
+}
+
+void uarf_pfc_mux_end(UarfPfcMux *mux) {
+    // No tracing, it falsifies the result
+    UarfPfcGroup *group = &mux->groups[mux->cur];
+    uarf_pfc_group_stop(group);
+
+    uint64_t counts[UARF_PFC_GROUP_MAX];
+    uarf_pfc_group_read(group, counts);
+    mux->num_reps++;
+
+    // Counts of a partially descheduled group would need scaling by time
+    uint64_t enabled = group->time_enabled - mux->time_enabled;
+    uint64_t running = group->time_running - mux->time_running;
+    if (running != enabled) {
+        mux->num_dropped++;
+        return;
+    }
+
+    for (size_t k = 0; k < group->num_pfcs; k++) {
+        UarfPfcMuxStat *s = &mux->stats[mux->first[mux->cur] + k];
+        double x = counts[k];
+        s->num_samples++;
+        double delta = x - s->mean;
+        s->mean += delta / s->num_samples;
+        s->m2 += delta * (x - s->mean);
+    }
+}
+
+void uarf_pfc_mux_clear(UarfPfcMux *mux) {
+    UARF_LOG_TRACE("(%p)\n", mux);
+
+    memset(mux->stats, 0, sizeof(mux->stats));
+    mux->num_reps = 0;
+    mux->num_dropped = 0;
+}
+
+UarfPfcMuxResult uarf_pfc_mux_result(UarfPfcMux *mux, size_t i) {
+    UARF_LOG_TRACE("(%p, %lu)\n", mux, i);
+    uarf_assert(i < mux->num_events);
+
+    UarfPfcMuxStat *s = &mux->stats[i];
+    UarfPfcMuxResult res = {.mean = s->mean, .num_samples = s->num_samples};
+
+    if (s->num_samples < 2) {
+        res.error = __builtin_inf();
+    }
+    else {
+        double var = s->m2 / (s->num_samples - 1);
+        res.error = pfc_mux_sqrt(var / s->num_samples);
+    }
+
+    // Every repetition would have counted the event about as often as the sampled ones
+    res.total = res.mean * mux->num_reps;
+    res.total_error = res.error * mux->num_reps;
+    return res;
+}
+
+void uarf_pfc_mux_print(UarfPfcMux *mux) {
+    UARF_LOG_TRACE("(%p)\n", mux);
+
+    printf("%lu events in %lu groups, %lu repetitions, %lu dropped\n", mux->num_events,
+           mux->num_groups, mux->num_reps, mux->num_dropped);
+
+    for (size_t g = 0; g < mux->num_groups; g++) {
+        for (size_t k = 0; k < mux->groups[g].num_pfcs; k++) {
+            size_t i = mux->first[g] + k;
+            UarfPfcMuxResult res = uarf_pfc_mux_result(mux, i);
+
+            char conf[32];
+            const char *name = mux->names[i];
+            if (!name) {
+                snprintf(conf, sizeof(conf), "0x%lx",
+                         mux->groups[g].pfcs[k].config.pmu_conf);
+                name = conf;
+            }
+            printf("\t%-36s %12.2f +- %-10.2f per rep (n=%lu, total %.0f)\n", name,
+                   res.mean, PFC_MUX_Z95 * res.error, res.num_samples, res.total);
+        }
+    }
+}
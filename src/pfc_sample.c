@@ -0,0 +1,228 @@
+#include "pfc_sample.h"
+#include "lib.h"
+#include "log.h"
+#include "page.h"
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef UARF_LOG_TAG
+#undef UARF_LOG_TAG
+#define UARF_LOG_TAG UARF_LOG_TAG_PFC
+#endif
+
+#define PFC_SAMPLE_DEFAULT_PAGES 64
+#define PFC_SAMPLE_TOP 5
+
+int uarf_pfc_sampler_init(UarfPfcSampler *s, UarfPfcConfig config) {
+    UARF_LOG_TRACE("(%p)\n", s);
+    uarf_assert(config.sample_period);
+
+    memset(s, 0, sizeof(UarfPfcSampler));
+
+    if (!config.sample_pages) {
+        config.sample_pages = PFC_SAMPLE_DEFAULT_PAGES;
+    }
+    if (uarf_pfc_init(&s->pfc, config)) {
+        return -1;
+    }
+
+    // Older kernels leave the data fields zero, the ring then directly follows the page
+    struct perf_event_mmap_page *page = s->pfc.page;
+    uint64_t offset = page->data_offset ? page->data_offset : PAGE_SIZE;
+    uint64_t size = page->data_size ? page->data_size : config.sample_pages * PAGE_SIZE;
+    s->data = (uint8_t *) page + offset;
+    s->data_mask = size - 1;
+
+    return 0;
+}
+
+void uarf_pfc_sampler_deinit(UarfPfcSampler *s) {
+    UARF_LOG_TRACE("(%p)\n", s);
+
+    for (size_t i = 0; i < s->num_regions; i++) {
+        free(s->regions[i].hist);
+    }
+    s->num_regions = 0;
+    uarf_pfc_deinit(&s->pfc);
+}
+
+static size_t pfc_sample_add(UarfPfcSampler *s, UarfPfcSampleRegion region) {
+    uarf_assert(s->num_regions < UARF_PFC_SAMPLE_MAX_REGIONS);
+
+    region.hist = calloc(region.hist_size, sizeof(uint32_t));
+    uarf_assert(region.hist);
+
+    s->regions[s->num_regions] = region;
+    return s->num_regions++;
+}
+
+size_t uarf_pfc_sampler_add_region(UarfPfcSampler *s, const char *name, uint64_t start,
+                                   uint64_t size) {
+    UARF_LOG_TRACE("(%p, %s, 0x%lx, %lu)\n", s, name, start, size);
+
+    return pfc_sample_add(s, (UarfPfcSampleRegion) {
+                                 .name = name,
+                                 .start = start,
+                                 .size = size,
+                                 .hist_size = min(size, _ul(UARF_PFC_SAMPLE_HIST_MAX)),
+                             });
+}
+
+size_t uarf_pfc_sampler_add_stub(UarfPfcSampler *s, const char *name,
+                                 const UarfStub *stub) {
+    UARF_LOG_TRACE("(%p, %s, %p)\n", s, name, stub);
+
+    // The stub may still grow, so its size is not known yet
+    return pfc_sample_add(s, (UarfPfcSampleRegion) {
+                                 .name = name,
+                                 .stub = stub,
+                                 .hist_size = UARF_PFC_SAMPLE_HIST_MAX,
+                             });
+}
+
+size_t uarf_pfc_sampler_add_jita(UarfPfcSampler *s, const char *name,
+                                 const UarfJitaCtxt *ctxt, const UarfStub *stub) {
+    UARF_LOG_TRACE("(%p, %s, %p, %p)\n", s, name, ctxt, stub);
+
+    size_t i = uarf_pfc_sampler_add_stub(s, name, stub);
+    s->regions[i].ctxt = ctxt;
+    return i;
+}
+
+/**
+ * Count a sample at `ip` into the region it falls into.
+ */
+static __always_inline void pfc_sample_attribute(UarfPfcSampler *s, uint64_t ip) {
+    // No tracing, it is called for every record
+    for (size_t i = 0; i < s->num_regions; i++) {
+        UarfPfcSampleRegion *r = &s->regions[i];
+        uint64_t start = r->stub ? r->stub->addr : r->start;
+        uint64_t size = r->stub ? r->stub->end_addr - r->stub->addr : r->size;
+
+        // Wraps around for IPs below start
+        uint64_t off = ip - start;
+        if (off < size) {
+            r->num_samples++;
+            if (off < r->hist_size) {
+                r->hist[off]++;
+            }
+            return;
+        }
+    }
+    s->num_other++;
+}
+
+uint64_t uarf_pfc_sampler_drain(UarfPfcSampler *s) {
+    // No tracing, it is meant to be called within the measurement loop
+    struct perf_event_mmap_page *page = s->pfc.page;
+    uint64_t head = page->data_head;
+    // Read the records only after the head
+    uarf_barrier();
+    uarf_lfence();
+
+    uint64_t tail = page->data_tail;
+    uint64_t n = 0;
+    while (tail < head) {
+        // Records are 8-byte aligned, so a header never wraps around the ring
+        struct perf_event_header *hdr = (void *) &s->data[tail & s->data_mask];
+
+        switch (hdr->type) {
+        case PERF_RECORD_SAMPLE: {
+            // The IP is the only sampled field and directly follows the header
+            uint64_t ip = *(uint64_t *) &s->data[(tail + sizeof(*hdr)) & s->data_mask];
+            pfc_sample_attribute(s, ip);
+            n++;
+            break;
+        }
+        case PERF_RECORD_LOST: {
+            // Followed by the id and the number of lost records
+            uint64_t off = tail + sizeof(*hdr) + sizeof(uint64_t);
+            s->num_lost += *(uint64_t *) &s->data[off & s->data_mask];
+            break;
+        }
+        default:
+            break;
+        }
+
+        uarf_assert(hdr->size);
+        tail += hdr->size;
+    }
+    s->num_samples += n;
+
+    // Finish reading the records before handing them back to the kernel
+    uarf_mfence();
+    page->data_tail = tail;
+
+    return n;
+}
+
+void uarf_pfc_sampler_clear(UarfPfcSampler *s) {
+    UARF_LOG_TRACE("(%p)\n", s);
+
+    for (size_t i = 0; i < s->num_regions; i++) {
+        UarfPfcSampleRegion *r = &s->regions[i];
+        memset(r->hist, 0, r->hist_size * sizeof(uint32_t));
+        r->num_samples = 0;
+    }
+    s->num_samples = 0;
+    s->num_other = 0;
+    s->num_lost = 0;
+}
+
+uint64_t uarf_pfc_sampler_snip_samples(UarfPfcSampleRegion *region, size_t i) {
+    UARF_LOG_TRACE("(%p, %lu)\n", region, i);
+    uarf_assert(region->ctxt && i < region->ctxt->n_snips);
+
+    uint64_t start = i ? region->ctxt->snip_ends[i - 1] : 0;
+    uint64_t end = min(_ul(region->ctxt->snip_ends[i]), region->hist_size);
+
+    uint64_t n = 0;
+    for (uint64_t off = start; off < end; off++) {
+        n += region->hist[off];
+    }
+    return n;
+}
+
+static void pfc_sample_print_top(UarfPfcSampleRegion *r) {
+    // Selection over the histogram, the list is short
+    uint64_t prev_off = 0;
+    uint32_t prev_cnt = UINT32_MAX;
+    for (size_t k = 0; k < PFC_SAMPLE_TOP; k++) {
+        uint64_t best_off = 0;
+        uint32_t best_cnt = 0;
+        for (uint64_t off = 0; off < r->hist_size; off++) {
+            uint32_t cnt = r->hist[off];
+            // Strictly after the previous entry in order of (count desc, offset asc)
+            bool after = cnt < prev_cnt || (cnt == prev_cnt && off > prev_off);
+            if (after && cnt > best_cnt) {
+                best_off = off;
+                best_cnt = cnt;
+            }
+        }
+        if (!best_cnt) {
+            break;
+        }
+        printf("\t\t+0x%04lx: %u\n", best_off, best_cnt);
+        prev_off = best_off;
+        prev_cnt = best_cnt;
+    }
+}
+
+void uarf_pfc_sampler_print(UarfPfcSampler *s) {
+    UARF_LOG_TRACE("(%p)\n", s);
+
+    printf("Samples: %lu, outside of regions: %lu, lost: %lu\n", s->num_samples,
+           s->num_other, s->num_lost);
+    for (size_t i = 0; i < s->num_regions; i++) {
+        UarfPfcSampleRegion *r = &s->regions[i];
+        printf("\t%s: %lu\n", r->name, r->num_samples);
+        if (r->ctxt) {
+            for (size_t j = 0; j < r->ctxt->n_snips; j++) {
+                printf("\t\tsnip %2lu: %lu\n", j, uarf_pfc_sampler_snip_samples(r, j));
+            }
+        }
+        pfc_sample_print_top(r);
+    }
+}
@@ -0,0 +1,163 @@
+#define _GNU_SOURCE
+#include "pfc_session.h"
+#include "lib.h"
+#include "log.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef UARF_LOG_TAG
+#undef UARF_LOG_TAG
+#define UARF_LOG_TAG UARF_LOG_TAG_PFC
+#endif
+
+int uarf_pfc_session_init(UarfPfcSession *s, const UarfPfcConfig *configs, size_t n,
+                          const cpu_set_t *cpus, pid_t pid) {
+    UARF_LOG_TRACE("(%p, %p, %lu, %p, %d)\n", s, configs, n, cpus, pid);
+    uarf_assert(n > 0 && n <= UARF_PFC_GROUP_MAX);
+
+    memset(s, 0, sizeof(UarfPfcSession));
+    s->pid = pid;
+
+    size_t num_cpus = CPU_COUNT(cpus);
+    uarf_assert(num_cpus > 0);
+    s->cpus = calloc(num_cpus, sizeof(int));
+    s->groups = calloc(num_cpus, sizeof(UarfPfcGroup));
+    s->snaps = calloc(num_cpus, sizeof(UarfPfcSnapshot));
+    uarf_assert(s->cpus && s->groups && s->snaps);
+
+    // Started together later, not one after the other while opening
+    UarfPfcConfig group_configs[UARF_PFC_GROUP_MAX];
+    memcpy(group_configs, configs, n * sizeof(UarfPfcConfig));
+    group_configs[0].start_disabled = true;
+
+    for (int cpu = 0; cpu < CPU_SETSIZE && s->num_cpus < num_cpus; cpu++) {
+        if (!CPU_ISSET(cpu, cpus)) {
+            continue;
+        }
+        if (uarf_pfc_group_init_on(&s->groups[s->num_cpus], group_configs, n, pid, cpu)) {
+            uarf_pfc_session_deinit(s);
+            return -1;
+        }
+        s->cpus[s->num_cpus++] = cpu;
+    }
+
+    return 0;
+}
+
+void uarf_pfc_session_deinit(UarfPfcSession *s) {
+    UARF_LOG_TRACE("(%p)\n", s);
+
+    while (s->num_cpus) {
+        uarf_pfc_group_deinit(&s->groups[--s->num_cpus]);
+    }
+    free(s->cpus);
+    free(s->groups);
+    free(s->snaps);
+    s->cpus = NULL;
+    s->groups = NULL;
+    s->snaps = NULL;
+}
+
+void uarf_pfc_session_start(UarfPfcSession *s) {
+    // No tracing and no rdpmc refresh as in uarf_pfc_group_start, both add skew between
+    // the CPUs
+    for (size_t i = 0; i < s->num_cpus; i++) {
+        if (ioctl(s->groups[i].pfcs[0].fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP)) {
+            UARF_LOG_WARNING("Failed to start CPU %d: %d\n", s->cpus[i], errno);
+        }
+    }
+}
+
+void uarf_pfc_session_stop(UarfPfcSession *s) {
+    // No tracing, it adds skew between the CPUs
+    for (size_t i = 0; i < s->num_cpus; i++) {
+        uarf_pfc_group_stop(&s->groups[i]);
+    }
+}
+
+void uarf_pfc_session_reset(UarfPfcSession *s) {
+    UARF_LOG_TRACE("(%p)\n", s);
+
+    for (size_t i = 0; i < s->num_cpus; i++) {
+        uarf_pfc_group_reset(&s->groups[i]);
+    }
+}
+
+void uarf_pfc_session_read(UarfPfcSession *s) {
+    UARF_LOG_TRACE("(%p)\n", s);
+
+    for (size_t i = 0; i < s->num_cpus; i++) {
+        UarfPfcGroup *group = &s->groups[i];
+        UarfPfcSnapshot *snap = &s->snaps[i];
+        uarf_pfc_group_read(group, snap->counts);
+        snap->time_enabled = group->time_enabled;
+        snap->time_running = group->time_running;
+    }
+}
+
+const UarfPfcSnapshot *uarf_pfc_session_snap(UarfPfcSession *s, int cpu) {
+    UARF_LOG_TRACE("(%p, %d)\n", s, cpu);
+
+    for (size_t i = 0; i < s->num_cpus; i++) {
+        if (s->cpus[i] == cpu) {
+            return &s->snaps[i];
+        }
+    }
+    return NULL;
+}
+
+uint64_t uarf_pfc_session_sum(UarfPfcSession *s, size_t i) {
+    UARF_LOG_TRACE("(%p, %lu)\n", s, i);
+    uarf_assert(s->num_cpus && i < s->groups[0].num_pfcs);
+
+    uint64_t sum = 0;
+    for (size_t c = 0; c < s->num_cpus; c++) {
+        sum += s->snaps[c].counts[i];
+    }
+    return sum;
+}
+
+void uarf_pfc_session_print(UarfPfcSession *s) {
+    UARF_LOG_TRACE("(%p)\n", s);
+
+    for (size_t c = 0; c < s->num_cpus; c++) {
+        UarfPfcGroup *group = &s->groups[c];
+        UarfPfcSnapshot *snap = &s->snaps[c];
+        printf("CPU %3d (running %lu/%lu ns):\n", s->cpus[c], snap->time_running,
+               snap->time_enabled);
+        for (size_t i = 0; i < group->num_pfcs; i++) {
+            printf("\t0x%06lx: %lu\n", group->pfcs[i].config.pmu_conf, snap->counts[i]);
+        }
+    }
+}
+
+int uarf_pfc_smt_sibling(int cpu) {
+    UARF_LOG_TRACE("(%d)\n", cpu);
+
+    char path[96];
+    snprintf(path, sizeof(path),
+             "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        UARF_LOG_WARNING("Failed to open %s\n", path);
+        return -1;
+    }
+
+    // Either a list "0,8" or a range "0-1"
+    int sibling = -1;
+    int a, b;
+    char sep;
+    if (fscanf(f, "%d%c%d", &a, &sep, &b) == 3) {
+        if (sep == ',') {
+            sibling = a == cpu ? b : a;
+        }
+        else if (sep == '-') {
+            sibling = a == cpu ? a + 1 : a;
+        }
+    }
+    fclose(f);
+
+    return sibling;
+}
@@ -0,0 +1,337 @@
+#include "policy.h"
+#include "compiler.h"
+#include "jita.h"
+#include "lib.h"
+#include "log.h"
+#include "mem.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef UARF_LOG_TAG
+#undef UARF_LOG_TAG
+#define UARF_LOG_TAG UARF_LOG_TAG_FR
+#endif
+
+// Largest age of QLRU and RRIP
+#define POLICY_MAX_AGE 3
+
+bool uarf_policy_parse(UarfPolicyPattern *pat, const char *str) {
+    UARF_LOG_TRACE("(%p, %s)\n", pat, str);
+
+    memset(pat, 0, sizeof(*pat));
+
+    while (*str) {
+        if (isspace((unsigned char) *str)) {
+            str++;
+            continue;
+        }
+
+        size_t len = 0;
+        while (str[len] && !isspace((unsigned char) str[len])) {
+            len++;
+        }
+
+        bool probe = str[len - 1] == '?';
+        size_t name_len = probe ? len - 1 : len;
+        if (!name_len || name_len >= UARF_POLICY_MAX_NAME) {
+            UARF_LOG_WARNING("Invalid line name in pattern at \"%s\"\n", str);
+            return false;
+        }
+        if (pat->num_steps == UARF_POLICY_MAX_STEPS) {
+            UARF_LOG_WARNING("Pattern has more than %u steps\n", UARF_POLICY_MAX_STEPS);
+            return false;
+        }
+
+        size_t line = 0;
+        while (line < pat->num_lines && (strlen(pat->names[line]) != name_len ||
+                                         strncmp(pat->names[line], str, name_len))) {
+            line++;
+        }
+        if (line == pat->num_lines) {
+            if (pat->num_lines == UARF_POLICY_MAX_LINES) {
+                UARF_LOG_WARNING("Pattern has more than %u lines\n", UARF_POLICY_MAX_LINES);
+                return false;
+            }
+            memcpy(pat->names[line], str, name_len);
+            pat->names[line][name_len] = '\0';
+            pat->num_lines++;
+        }
+
+        pat->steps[pat->num_steps++] = (UarfPolicyStep) {.line = line, .probe = probe};
+        pat->num_probes += probe ? 1 : 0;
+        str += len;
+    }
+
+    return pat->num_steps > 0;
+}
+
+/**
+ * State of a single cache set under simulation.
+ */
+typedef struct PolicySet PolicySet;
+struct PolicySet {
+    UarfPolicy policy;
+    size_t ways;
+    // Line in every way, -1 if invalid
+    int16_t tag[UARF_POLICY_MAX_WAYS];
+    // Time of last access (LRU) or insertion (FIFO)
+    uint64_t stamp[UARF_POLICY_MAX_WAYS];
+    uint64_t clock;
+    // Age of QLRU and RRIP
+    uint8_t age[UARF_POLICY_MAX_WAYS];
+    // Tree of PLRU, node i has children 2i + 1 and 2i + 2, set bits point right
+    bool tree[UARF_POLICY_MAX_WAYS - 1];
+};
+
+static size_t policy_oldest(PolicySet *set) {
+    size_t victim = 0;
+    for (size_t w = 1; w < set->ways; w++) {
+        if (set->stamp[w] < set->stamp[victim]) {
+            victim = w;
+        }
+    }
+    return victim;
+}
+
+static size_t policy_victim(PolicySet *set) {
+    for (size_t w = 0; w < set->ways; w++) {
+        if (set->tag[w] < 0) {
+            return w;
+        }
+    }
+
+    switch (set->policy) {
+    case UARF_POLICY_LRU:
+    case UARF_POLICY_FIFO:
+        return policy_oldest(set);
+    case UARF_POLICY_TREE_PLRU: {
+        size_t node = 0;
+        while (node < set->ways - 1) {
+            node = 2 * node + 1 + set->tree[node];
+        }
+        return node - (set->ways - 1);
+    }
+    case UARF_POLICY_QLRU_M1:
+    case UARF_POLICY_QLRU_M2:
+    case UARF_POLICY_SRRIP_FP:
+        while (true) {
+            for (size_t w = 0; w < set->ways; w++) {
+                if (set->age[w] == POLICY_MAX_AGE) {
+                    return w;
+                }
+            }
+            for (size_t w = 0; w < set->ways; w++) {
+                set->age[w]++;
+            }
+        }
+    default:
+        uarf_bug();
+    }
+    return 0;
+}
+
+static void policy_update(PolicySet *set, size_t w, bool hit) {
+    switch (set->policy) {
+    case UARF_POLICY_LRU:
+        set->stamp[w] = set->clock++;
+        break;
+    case UARF_POLICY_FIFO:
+        if (!hit) {
+            set->stamp[w] = set->clock++;
+        }
+        break;
+    case UARF_POLICY_TREE_PLRU:
+        // Point every node on the path away from the accessed way
+        for (size_t node = w + set->ways - 1; node; node = (node - 1) / 2) {
+            set->tree[(node - 1) / 2] = node % 2;
+        }
+        break;
+    case UARF_POLICY_QLRU_M1:
+        set->age[w] = hit ? 0 : 1;
+        break;
+    case UARF_POLICY_QLRU_M2:
+        set->age[w] = hit ? 0 : 2;
+        break;
+    case UARF_POLICY_SRRIP_FP:
+        set->age[w] = hit ? (set->age[w] ? set->age[w] - 1 : 0) : 2;
+        break;
+    default:
+        uarf_bug();
+    }
+}
+
+/**
+ * Access `line` in `set`.
+ *
+ * @returns whether it hit
+ */
+static bool policy_access(PolicySet *set, int16_t line) {
+    for (size_t w = 0; w < set->ways; w++) {
+        if (set->tag[w] == line) {
+            policy_update(set, w, true);
+            return true;
+        }
+    }
+
+    size_t w = policy_victim(set);
+    set->tag[w] = line;
+    policy_update(set, w, false);
+    return false;
+}
+
+static bool policy_supports(UarfPolicy policy, size_t ways) {
+    if (!ways || ways > UARF_POLICY_MAX_WAYS) {
+        return false;
+    }
+    return policy != UARF_POLICY_TREE_PLRU || IS_POW_TWO(ways);
+}
+
+void uarf_policy_simulate(UarfPolicy policy, size_t ways, const UarfPolicyPattern *pat,
+                          bool *hit) {
+    UARF_LOG_TRACE("(%d, %lu, %p, %p)\n", policy, ways, pat, hit);
+
+    uarf_assert(policy_supports(policy, ways));
+
+    PolicySet set = {.policy = policy, .ways = ways};
+    memset(set.tag, 0xff, sizeof(set.tag));
+
+    size_t k = 0;
+    for (size_t i = 0; i < pat->num_steps; i++) {
+        bool h = policy_access(&set, pat->steps[i].line);
+        if (pat->steps[i].probe) {
+            hit[k++] = h;
+        }
+    }
+}
+
+void uarf_policy_measure(const UarfPolicyPattern *pat, Es *es, size_t reps,
+                         uint64_t thresh, uint32_t *hits) {
+    UARF_LOG_TRACE("(%p, %p, %lu, %lu, %p)\n", pat, es, reps, thresh, hits);
+
+    uarf_assert(uarf_es_size(es) >= pat->num_lines);
+
+    uint64_t addrs[UARF_POLICY_MAX_STEPS];
+    bool probe[UARF_POLICY_MAX_STEPS];
+    for (size_t i = 0; i < pat->num_steps; i++) {
+        addrs[i] = uarf_es_get(es, pat->steps[i].line);
+        probe[i] = pat->steps[i].probe;
+    }
+
+    UarfJitaCtxt ctxt = uarf_jita_init();
+    UarfStub stub = uarf_stub_init();
+    uarf_jita_push_vsnip_timed_access(&ctxt, addrs, probe, pat->num_steps);
+    uarf_jita_push_vsnip_ret(&ctxt);
+    uarf_jita_allocate(&ctxt, &stub, uarf_rand47());
+    void (*run)(uint32_t *) = (void (*)(uint32_t *)) stub.ptr;
+
+    // The kernel stores the probe times mid-pattern. Keep them out of the set under test:
+    // they start a line after the page offset of the lines and cover less than a page, so
+    // their L1 set, given by the page offset, and thus their L2 and L3 sets differ.
+    uint64_t line_off = uarf_es_get(es, 0) & (PAGE_SIZE - cache.cache_line_size);
+    uarf_assert(pat->num_probes * sizeof(uint32_t) < PAGE_SIZE - cache.cache_line_size);
+    uint64_t res = uarf_alloc_map_or_die(2 * PAGE_SIZE);
+    uint32_t *times = _ptr(res + line_off + cache.cache_line_size);
+    memset(hits, 0, pat->num_probes * sizeof(uint32_t));
+
+    for (size_t rep = 0; rep < reps; rep++) {
+        for (size_t l = 0; l < pat->num_lines; l++) {
+            uarf_clflush(_ptr(uarf_es_get(es, l)));
+        }
+        uarf_mfence();
+
+        run(times);
+
+        for (size_t k = 0; k < pat->num_probes; k++) {
+            hits[k] += times[k] < thresh ? 1 : 0;
+        }
+    }
+
+    uarf_unmap_or_die(_ptr(res), 2 * PAGE_SIZE);
+    uarf_jita_deallocate(&ctxt, &stub);
+}
+
+UarfPolicyMatch uarf_policy_match(const UarfPolicyPattern *pat, size_t ways,
+                                  const uint32_t *hits, size_t reps) {
+    UARF_LOG_TRACE("(%p, %lu, %p, %lu)\n", pat, ways, hits, reps);
+
+    UarfPolicyMatch match = {.ways = ways, .best = UARF_POLICY_LRU};
+    bool hit[UARF_POLICY_MAX_STEPS];
+
+    for (UarfPolicy policy = 0; policy < UARF_POLICY_NUM; policy++) {
+        if (!policy_supports(policy, ways)) {
+            match.score[policy] = -1;
+            continue;
+        }
+
+        uarf_policy_simulate(policy, ways, pat, hit);
+
+        size_t num_agree = 0;
+        for (size_t k = 0; k < pat->num_probes; k++) {
+            num_agree += hit[k] == (2 * hits[k] > reps) ? 1 : 0;
+        }
+        match.score[policy] = pat->num_probes ? (double) num_agree / pat->num_probes : 0;
+
+        if (match.score[policy] > match.score[match.best]) {
+            match.best = policy;
+        }
+    }
+
+    return match;
+}
+
+const char *uarf_policy_str(UarfPolicy policy) {
+    switch (policy) {
+    case UARF_POLICY_LRU:
+        return "LRU";
+    case UARF_POLICY_FIFO:
+        return "FIFO";
+    case UARF_POLICY_TREE_PLRU:
+        return "Tree-PLRU";
+    case UARF_POLICY_QLRU_M1:
+        return "QLRU-M1";
+    case UARF_POLICY_QLRU_M2:
+        return "QLRU-M2";
+    case UARF_POLICY_SRRIP_FP:
+        return "SRRIP-FP";
+    default:
+        return "invalid";
+    }
+}
+
+void uarf_policy_print_match(const UarfPolicyPattern *pat, const UarfPolicyMatch *match,
+                             const uint32_t *hits, size_t reps) {
+    UARF_LOG_TRACE("(%p, %p, %p, %lu)\n", pat, match, hits, reps);
+
+    bool hit[UARF_POLICY_NUM][UARF_POLICY_MAX_STEPS];
+    for (UarfPolicy policy = 0; policy < UARF_POLICY_NUM; policy++) {
+        if (match->score[policy] >= 0) {
+            uarf_policy_simulate(policy, match->ways, pat, hit[policy]);
+        }
+    }
+
+    printf("%-16s %8s", "probe", "hit rate");
+    for (UarfPolicy policy = 0; policy < UARF_POLICY_NUM; policy++) {
+        printf(" %9s", uarf_policy_str(policy));
+    }
+    printf("\n");
+
+    size_t k = 0;
+    for (size_t i = 0; i < pat->num_steps; i++) {
+        if (!pat->steps[i].probe) {
+            continue;
+        }
+        printf("%-16s %8.3f", pat->names[pat->steps[i].line], (double) hits[k] / reps);
+        for (UarfPolicy policy = 0; policy < UARF_POLICY_NUM; policy++) {
+            printf(" %9s", match->score[policy] < 0 ? "-" : hit[policy][k] ? "H" : "M");
+        }
+        printf("\n");
+        k++;
+    }
+
+    printf("%-16s %8s", "score", "");
+    for (UarfPolicy policy = 0; policy < UARF_POLICY_NUM; policy++) {
+        printf(" %9.3f", match->score[policy]);
+    }
+    printf("\nBest match for %lu ways: %s\n", match->ways, uarf_policy_str(match->best));
+}
@@ -0,0 +1,403 @@
+#include "reduce.h"
+#include "compiler.h"
+#include "lib.h"
+#include "log.h"
+#include <immintrin.h>
+#include <string.h>
+
+/**
+ * Kernels that make up one implementation. Everything else is derived from them.
+ */
+typedef struct UarfReduceImpl UarfReduceImpl;
+struct UarfReduceImpl {
+    const char *name;
+    // Sum of all elements
+    uint64_t (*sum)(const uint32_t *v, size_t n);
+    // acc[i] += v[i] for all i
+    void (*acc)(uint64_t *acc, const uint32_t *v, size_t n);
+    // Largest element, 0 if empty
+    uint32_t (*vmax)(const uint32_t *v, size_t n);
+    uint64_t (*vmax_u64)(const uint64_t *v, size_t n);
+    // Index of first element equal to val, n if there is none
+    size_t (*find)(const uint32_t *v, size_t n, uint32_t val);
+    size_t (*find_u64)(const uint64_t *v, size_t n, uint64_t val);
+};
+
+/* Scalar */
+
+static uint64_t sum_scalar(const uint32_t *v, size_t n) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += v[i];
+    }
+    return sum;
+}
+
+static void acc_scalar(uint64_t *acc, const uint32_t *v, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        acc[i] += v[i];
+    }
+}
+
+static uint32_t max_scalar(const uint32_t *v, size_t n) {
+    uint32_t max = 0;
+    for (size_t i = 0; i < n; i++) {
+        max = v[i] > max ? v[i] : max;
+    }
+    return max;
+}
+
+static uint64_t max_u64_scalar(const uint64_t *v, size_t n) {
+    uint64_t max = 0;
+    for (size_t i = 0; i < n; i++) {
+        max = v[i] > max ? v[i] : max;
+    }
+    return max;
+}
+
+static size_t find_scalar(const uint32_t *v, size_t n, uint32_t val) {
+    for (size_t i = 0; i < n; i++) {
+        if (v[i] == val) {
+            return i;
+        }
+    }
+    return n;
+}
+
+static size_t find_u64_scalar(const uint64_t *v, size_t n, uint64_t val) {
+    for (size_t i = 0; i < n; i++) {
+        if (v[i] == val) {
+            return i;
+        }
+    }
+    return n;
+}
+
+static const UarfReduceImpl impl_scalar = {
+    .name = "scalar",
+    .sum = sum_scalar,
+    .acc = acc_scalar,
+    .vmax = max_scalar,
+    .vmax_u64 = max_u64_scalar,
+    .find = find_scalar,
+    .find_u64 = find_u64_scalar,
+};
+
+/* AVX2 */
+
+#define __avx2 __attribute__((target("avx2")))
+
+static __avx2 uint64_t sum_avx2(const uint32_t *v, size_t n) {
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i x = _mm256_loadu_si256((const __m256i *) (v + i));
+        acc = _mm256_add_epi64(acc, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(x)));
+        acc = _mm256_add_epi64(acc, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(x, 1)));
+    }
+
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *) lanes, acc);
+    uint64_t sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    return sum + sum_scalar(v + i, n - i);
+}
+
+static __avx2 void acc_avx2(uint64_t *acc, const uint32_t *v, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i x = _mm256_cvtepu32_epi64(_mm_loadu_si128((const __m128i *) (v + i)));
+        __m256i a = _mm256_loadu_si256((const __m256i *) (acc + i));
+        _mm256_storeu_si256((__m256i *) (acc + i), _mm256_add_epi64(a, x));
+    }
+    acc_scalar(acc + i, v + i, n - i);
+}
+
+static __avx2 uint32_t max_avx2(const uint32_t *v, size_t n) {
+    __m256i max_v = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        max_v = _mm256_max_epu32(max_v, _mm256_loadu_si256((const __m256i *) (v + i)));
+    }
+
+    uint32_t lanes[8];
+    _mm256_storeu_si256((__m256i *) lanes, max_v);
+    uint32_t max = max_scalar(lanes, 8);
+    uint32_t max_tail = max_scalar(v + i, n - i);
+    return max_tail > max ? max_tail : max;
+}
+
+static __avx2 uint64_t max_u64_avx2(const uint64_t *v, size_t n) {
+    // There is no unsigned 64 bit compare, flip the sign bit and compare signed
+    const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+    __m256i max_v = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i x = _mm256_loadu_si256((const __m256i *) (v + i));
+        __m256i gt = _mm256_cmpgt_epi64(_mm256_xor_si256(x, sign),
+                                        _mm256_xor_si256(max_v, sign));
+        max_v = _mm256_blendv_epi8(max_v, x, gt);
+    }
+
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *) lanes, max_v);
+    uint64_t max = max_u64_scalar(lanes, 4);
+    uint64_t max_tail = max_u64_scalar(v + i, n - i);
+    return max_tail > max ? max_tail : max;
+}
+
+static __avx2 size_t find_avx2(const uint32_t *v, size_t n, uint32_t val) {
+    const __m256i val_v = _mm256_set1_epi32(val);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i eq = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *) (v + i)), val_v);
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(eq));
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + find_scalar(v + i, n - i, val);
+}
+
+static __avx2 size_t find_u64_avx2(const uint64_t *v, size_t n, uint64_t val) {
+    const __m256i val_v = _mm256_set1_epi64x(val);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i eq = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i *) (v + i)), val_v);
+        int mask = _mm256_movemask_pd(_mm256_castsi256_pd(eq));
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + find_u64_scalar(v + i, n - i, val);
+}
+
+static const UarfReduceImpl impl_avx2 = {
+    .name = "avx2",
+    .sum = sum_avx2,
+    .acc = acc_avx2,
+    .vmax = max_avx2,
+    .vmax_u64 = max_u64_avx2,
+    .find = find_avx2,
+    .find_u64 = find_u64_avx2,
+};
+
+/* AVX-512 */
+
+#define __avx512 __attribute__((target("avx512f")))
+
+static __avx512 uint64_t sum_avx512(const uint32_t *v, size_t n) {
+    __m512i acc = _mm512_setzero_si512();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i x = _mm256_loadu_si256((const __m256i *) (v + i));
+        acc = _mm512_add_epi64(acc, _mm512_cvtepu32_epi64(x));
+    }
+    return _mm512_reduce_add_epi64(acc) + sum_scalar(v + i, n - i);
+}
+
+static __avx512 void acc_avx512(uint64_t *acc, const uint32_t *v, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m512i x = _mm512_cvtepu32_epi64(_mm256_loadu_si256((const __m256i *) (v + i)));
+        __m512i a = _mm512_loadu_si512(acc + i);
+        _mm512_storeu_si512(acc + i, _mm512_add_epi64(a, x));
+    }
+    acc_scalar(acc + i, v + i, n - i);
+}
+
+static __avx512 uint32_t max_avx512(const uint32_t *v, size_t n) {
+    __m512i max_v = _mm512_setzero_si512();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        max_v = _mm512_max_epu32(max_v, _mm512_loadu_si512(v + i));
+    }
+    uint32_t max = _mm512_reduce_max_epu32(max_v);
+    uint32_t max_tail = max_scalar(v + i, n - i);
+    return max_tail > max ? max_tail : max;
+}
+
+static __avx512 uint64_t max_u64_avx512(const uint64_t *v, size_t n) {
+    __m512i max_v = _mm512_setzero_si512();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        max_v = _mm512_max_epu64(max_v, _mm512_loadu_si512(v + i));
+    }
+    uint64_t max = _mm512_reduce_max_epu64(max_v);
+    uint64_t max_tail = max_u64_scalar(v + i, n - i);
+    return max_tail > max ? max_tail : max;
+}
+
+static __avx512 size_t find_avx512(const uint32_t *v, size_t n, uint32_t val) {
+    const __m512i val_v = _mm512_set1_epi32(val);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __mmask16 mask = _mm512_cmpeq_epi32_mask(_mm512_loadu_si512(v + i), val_v);
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + find_scalar(v + i, n - i, val);
+}
+
+static __avx512 size_t find_u64_avx512(const uint64_t *v, size_t n, uint64_t val) {
+    const __m512i val_v = _mm512_set1_epi64(val);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __mmask8 mask = _mm512_cmpeq_epi64_mask(_mm512_loadu_si512(v + i), val_v);
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + find_u64_scalar(v + i, n - i, val);
+}
+
+static const UarfReduceImpl impl_avx512 = {
+    .name = "avx512",
+    .sum = sum_avx512,
+    .acc = acc_avx512,
+    .vmax = max_avx512,
+    .vmax_u64 = max_u64_avx512,
+    .find = find_avx512,
+    .find_u64 = find_u64_avx512,
+};
+
+/* Dispatch */
+
+static const UarfReduceImpl *impl = NULL;
+
+UarfReduceImplType uarf_reduce_select(UarfReduceImplType type) {
+    UARF_LOG_TRACE("(%d)\n", type);
+
+    __builtin_cpu_init();
+    bool has_avx512 = __builtin_cpu_supports("avx512f");
+    bool has_avx2 = __builtin_cpu_supports("avx2");
+
+    if (type == UARF_REDUCE_IMPL_AUTO) {
+        type = UARF_REDUCE_IMPL_AVX512;
+    }
+    if (type == UARF_REDUCE_IMPL_AVX512 && !has_avx512) {
+        type = UARF_REDUCE_IMPL_AVX2;
+    }
+    if (type == UARF_REDUCE_IMPL_AVX2 && !has_avx2) {
+        type = UARF_REDUCE_IMPL_SCALAR;
+    }
+
+    switch (type) {
+    case UARF_REDUCE_IMPL_AVX512:
+        impl = &impl_avx512;
+        break;
+    case UARF_REDUCE_IMPL_AVX2:
+        impl = &impl_avx2;
+        break;
+    default:
+        impl = &impl_scalar;
+        break;
+    }
+
+    UARF_LOG_DEBUG("Use %s reduction\n", impl->name);
+    return type;
+}
+
+static __always_inline const UarfReduceImpl *get_impl(void) {
+    if (!impl) {
+        uarf_reduce_select(UARF_REDUCE_IMPL_AUTO);
+    }
+    return impl;
+}
+
+const char *uarf_reduce_impl_name(void) {
+    return get_impl()->name;
+}
+
+uint64_t uarf_reduce_sum(const uint32_t *v, size_t n) {
+    return get_impl()->sum(v, n);
+}
+
+void uarf_reduce_row_sums(const uint32_t *m, size_t num_rows, size_t num_cols,
+                          uint64_t *out) {
+    const UarfReduceImpl *im = get_impl();
+    for (size_t row = 0; row < num_rows; row++) {
+        out[row] = im->sum(m + row * num_cols, num_cols);
+    }
+}
+
+void uarf_reduce_col_sums(const uint32_t *m, size_t num_rows, size_t num_cols,
+                          uint64_t *out) {
+    const UarfReduceImpl *im = get_impl();
+    memset(out, 0, num_cols * sizeof(*out));
+    for (size_t row = 0; row < num_rows; row++) {
+        im->acc(out, m + row * num_cols, num_cols);
+    }
+}
+
+size_t uarf_reduce_argmax(const uint32_t *v, size_t n, bool *is_tie) {
+    uarf_assert(n > 0);
+    const UarfReduceImpl *im = get_impl();
+
+    uint32_t max = im->vmax(v, n);
+    size_t i = im->find(v, n, max);
+    if (is_tie) {
+        *is_tie = im->find(v + i + 1, n - i - 1, max) != n - i - 1;
+    }
+    return i;
+}
+
+size_t uarf_reduce_argmax_u64(const uint64_t *v, size_t n, bool *is_tie) {
+    uarf_assert(n > 0);
+    const UarfReduceImpl *im = get_impl();
+
+    uint64_t max = im->vmax_u64(v, n);
+    size_t i = im->find_u64(v, n, max);
+    if (is_tie) {
+        *is_tie = im->find_u64(v + i + 1, n - i - 1, max) != n - i - 1;
+    }
+    return i;
+}
+
+/**
+ * Keep the `k` largest elements in `top` (values) and `idx` (indices), sorted in
+ * descending order. `len` is the number of elements already in `top`.
+ *
+ * Elements are offered with ascending index, hence equal values keep their order.
+ */
+static __always_inline void top_k_offer(uint64_t *top, size_t *idx, size_t *len,
+                                        size_t k, uint64_t val, size_t i) {
+    if (*len == k && val <= top[k - 1]) {
+        return;
+    }
+
+    size_t pos = *len < k ? (*len)++ : k - 1;
+    while (pos > 0 && top[pos - 1] < val) {
+        top[pos] = top[pos - 1];
+        idx[pos] = idx[pos - 1];
+        pos--;
+    }
+    top[pos] = val;
+    idx[pos] = i;
+}
+
+size_t uarf_reduce_top_k(const uint32_t *v, size_t n, size_t k, size_t *idx) {
+    if (k == 0) {
+        return 0;
+    }
+
+    uint64_t top[k];
+    size_t len = 0;
+    for (size_t i = 0; i < n; i++) {
+        top_k_offer(top, idx, &len, k, v[i], i);
+    }
+    return len;
+}
+
+size_t uarf_reduce_top_k_u64(const uint64_t *v, size_t n, size_t k, size_t *idx) {
+    if (k == 0) {
+        return 0;
+    }
+
+    uint64_t top[k];
+    size_t len = 0;
+    for (size_t i = 0; i < n; i++) {
+        top_k_offer(top, idx, &len, k, v[i], i);
+    }
+    return len;
+}
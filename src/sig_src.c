@@ -0,0 +1,150 @@
+#include "sig_src.h"
+#include "lib.h"
+#include "log.h"
+#include <stdio.h>
+#include <string.h>
+
+#ifdef UARF_LOG_TAG
+#undef UARF_LOG_TAG
+#define UARF_LOG_TAG UARF_LOG_TAG_PFC
+#endif
+
+void uarf_sig_src_init_fr(UarfSigSrc *src, UarfFrConfig *fr) {
+    UARF_LOG_TRACE("(%p, %p)\n", src, fr);
+
+    memset(src, 0, sizeof(UarfSigSrc));
+    src->kind = UARF_SIG_SRC_FR;
+    src->fr = fr;
+}
+
+int uarf_sig_src_init_pfc(UarfSigSrc *src, const UarfPfcConfig *configs, size_t n) {
+    UARF_LOG_TRACE("(%p, %p, %lu)\n", src, configs, n);
+    uarf_assert(n > 0 && n <= UARF_PFC_GROUP_MAX);
+
+    memset(src, 0, sizeof(UarfSigSrc));
+    src->kind = UARF_SIG_SRC_PFC;
+
+    UarfPfcConfig group_configs[UARF_PFC_GROUP_MAX];
+    memcpy(group_configs, configs, n * sizeof(UarfPfcConfig));
+    group_configs[0].start_disabled = false;
+
+    UarfPfcGroup *group = &src->pfc.group;
+    if (uarf_pfc_group_init(group, group_configs, n)) {
+        return -1;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (!uarf_pfc_refresh_rdpmc(&group->pfcs[i])) {
+            UARF_LOG_ERROR("Counter %lu cannot be read with rdpmc\n", i);
+            uarf_pfc_group_deinit(group);
+            return -1;
+        }
+    }
+
+    uarf_sig_src_reset(src);
+    return 0;
+}
+
+size_t uarf_sig_src_add_diff(UarfSigSrc *src, size_t minuend, size_t subtrahend) {
+    UARF_LOG_TRACE("(%p, %lu, %lu)\n", src, minuend, subtrahend);
+    uarf_assert(src->kind == UARF_SIG_SRC_PFC);
+
+    UarfSigSrcPfc *pfc = &src->pfc;
+    size_t n = pfc->group.num_pfcs;
+    uarf_assert(minuend < n && subtrahend < n);
+    uarf_assert(pfc->num_diffs < UARF_SIG_SRC_MAX_DIFFS);
+
+    pfc->diffs[pfc->num_diffs] = (UarfSigSrcDiff) {
+        .minuend = minuend,
+        .subtrahend = subtrahend,
+    };
+    return n + pfc->num_diffs++;
+}
+
+void uarf_sig_src_deinit(UarfSigSrc *src) {
+    UARF_LOG_TRACE("(%p)\n", src);
+
+    if (src->kind == UARF_SIG_SRC_PFC) {
+        uarf_pfc_group_deinit(&src->pfc.group);
+    }
+}
+
+void uarf_sig_src_reset(UarfSigSrc *src) {
+    UARF_LOG_TRACE("(%p)\n", src);
+
+    switch (src->kind) {
+    case UARF_SIG_SRC_FR:
+        uarf_fr_reset(src->fr);
+        break;
+    case UARF_SIG_SRC_PFC:
+        for (size_t i = 0; i < UARF_SIG_SRC_MAX_SIGNALS; i++) {
+            src->pfc.max[i] = INT64_MIN;
+        }
+        memset(src->pfc.sum, 0, sizeof(src->pfc.sum));
+        memset(src->pfc.hits, 0, sizeof(src->pfc.hits));
+        src->pfc.num_rounds = 0;
+        break;
+    }
+}
+
+void uarf_sig_src_calibrate(UarfSigSrc *src) {
+    UARF_LOG_TRACE("(%p)\n", src);
+
+    if (src->kind != UARF_SIG_SRC_PFC) {
+        return;
+    }
+
+    UarfSigSrcPfc *pfc = &src->pfc;
+    if (!pfc->num_rounds) {
+        UARF_LOG_WARNING("No rounds to calibrate with\n");
+        return;
+    }
+
+    for (size_t i = 0; i < pfc->group.num_pfcs + pfc->num_diffs; i++) {
+        pfc->thresh[i] = pfc->max[i];
+        UARF_LOG_DEBUG("Threshold of signal %lu: %ld\n", i, pfc->thresh[i]);
+    }
+    uarf_sig_src_reset(src);
+}
+
+uint64_t uarf_sig_src_hits(UarfSigSrc *src) {
+    UARF_LOG_TRACE("(%p)\n", src);
+
+    switch (src->kind) {
+    case UARF_SIG_SRC_FR:
+        return uarf_fr_num_hits(src->fr);
+    case UARF_SIG_SRC_PFC:
+        return src->pfc.hits[src->pfc.primary];
+    }
+    return 0;
+}
+
+void uarf_sig_src_print(UarfSigSrc *src) {
+    UARF_LOG_TRACE("(%p)\n", src);
+
+    switch (src->kind) {
+    case UARF_SIG_SRC_FR:
+        uarf_fr_print(src->fr);
+        break;
+    case UARF_SIG_SRC_PFC: {
+        UarfSigSrcPfc *pfc = &src->pfc;
+        UarfPfc *pfcs = pfc->group.pfcs;
+        size_t n = pfc->group.num_pfcs;
+        for (size_t i = 0; i < n + pfc->num_diffs; i++) {
+            char name[32];
+            if (i < n) {
+                snprintf(name, sizeof(name), "0x%06lx", pfcs[i].config.pmu_conf);
+            }
+            else {
+                UarfSigSrcDiff *diff = &pfc->diffs[i - n];
+                snprintf(name, sizeof(name), "0x%06lx - 0x%06lx",
+                         pfcs[diff->minuend].config.pmu_conf,
+                         pfcs[diff->subtrahend].config.pmu_conf);
+            }
+            double mean = pfc->num_rounds ? (double) pfc->sum[i] / pfc->num_rounds : 0;
+            printf("%-19s: %5lu/%lu rounds > %ld, mean %.2f\n", name, pfc->hits[i],
+                   pfc->num_rounds, pfc->thresh[i], mean);
+        }
+        break;
+    }
+    }
+}
@@ -0,0 +1,276 @@
+#include "slice.h"
+#include "cache.h"
+#include "compiler.h"
+#include "evict.h"
+#include "lib.h"
+#include "log.h"
+#include "mem.h"
+#include "page.h"
+#include <string.h>
+
+#ifdef UARF_LOG_TAG
+#undef UARF_LOG_TAG
+#define UARF_LOG_TAG UARF_LOG_TAG_MEM
+#endif
+
+// Number of repetitions to decide whether a line got evicted
+#define SLICE_REPS 20
+
+static UarfSliceHash slice_hash;
+
+void uarf_slice_hash_set(const UarfSliceHash *hash) {
+    UARF_LOG_TRACE("(%p)\n", hash);
+    slice_hash = *hash;
+}
+
+uint64_t uarf_slice_of(uint64_t pa) {
+    return uarf_slice_hash_apply(&slice_hash, pa);
+}
+
+bool uarf_slice_hash_solve(UarfSliceHash *hash, const uint64_t *pa, const uint64_t *group,
+                           size_t n, uint8_t min_bit, uint8_t max_bit) {
+    UARF_LOG_TRACE("(%p, %p, %p, %lu, %u, %u)\n", hash, pa, group, n, min_bit, max_bit);
+
+    uarf_assert(min_bit <= max_bit && max_bit < 64);
+
+    uint64_t bits = (max_bit == 63 ? ~0ul : BIT(max_bit + 1) - 1) & ~(BIT(min_bit) - 1);
+
+    // Bits that never change cannot be solved for and would end up in the masks
+    uint64_t varying = 0;
+    for (size_t i = 1; i < n; i++) {
+        varying |= pa[i] ^ pa[0];
+    }
+    bits &= varying;
+
+    // First address of every group
+    uint64_t *rep_group = uarf_malloc_or_die(n * sizeof(uint64_t));
+    uint64_t *rep_pa = uarf_malloc_or_die(n * sizeof(uint64_t));
+    size_t num_groups = 0;
+
+    // Basis of the differences of addresses within the same group, basis[b] has its
+    // highest bit at b
+    uint64_t basis[64] = {};
+
+    for (size_t i = 0; i < n; i++) {
+        if (group[i] == UINT64_MAX) {
+            continue;
+        }
+
+        size_t r = 0;
+        while (r < num_groups && rep_group[r] != group[i]) {
+            r++;
+        }
+        if (r == num_groups) {
+            rep_group[num_groups] = group[i];
+            rep_pa[num_groups++] = pa[i];
+            continue;
+        }
+
+        // Same slice, so the difference is in the kernel of the hash
+        uint64_t d = (pa[i] ^ rep_pa[r]) & bits;
+        while (d) {
+            uint8_t b = 63 - __builtin_clzl(d);
+            if (!basis[b]) {
+                basis[b] = d;
+                break;
+            }
+            d ^= basis[b];
+        }
+    }
+
+    // Reduce, such that each pivot bit only occurs in its own row
+    for (int p = 0; p < 64; p++) {
+        for (int q = p + 1; basis[p] && q < 64; q++) {
+            if (basis[q] & BIT(p)) {
+                basis[q] ^= basis[p];
+            }
+        }
+    }
+
+    // The masks span the null space of the kernel. One vector per free bit, which is
+    // set together with the pivot bits whose row contains the free bit.
+    hash->num_bits = 0;
+    bool ok = true;
+    for (int f = 0; f < 64; f++) {
+        if (!(bits & BIT(f)) || basis[f]) {
+            continue;
+        }
+        if (hash->num_bits == UARF_SLICE_MAX_BITS) {
+            UARF_LOG_WARNING("More than %u slice bits, need more samples\n",
+                             UARF_SLICE_MAX_BITS);
+            ok = false;
+            break;
+        }
+        uint64_t mask = BIT(f);
+        for (int p = f + 1; p < 64; p++) {
+            if (basis[p] & BIT(f)) {
+                mask |= BIT(p);
+            }
+        }
+        hash->masks[hash->num_bits++] = mask;
+    }
+
+    // Every group needs its own slice
+    if (ok && BIT(hash->num_bits) != num_groups) {
+        UARF_LOG_WARNING("%lu groups but %u slice bits\n", num_groups, hash->num_bits);
+        ok = false;
+    }
+    for (size_t r = 0; ok && r < num_groups; r++) {
+        for (size_t s = r + 1; ok && s < num_groups; s++) {
+            ok = uarf_slice_hash_apply(hash, rep_pa[r]) !=
+                 uarf_slice_hash_apply(hash, rep_pa[s]);
+        }
+    }
+
+    uarf_free_or_die(rep_group);
+    uarf_free_or_die(rep_pa);
+
+    return ok;
+}
+
+// Threshold of the current grouping
+static uint64_t slice_thresh;
+
+static bool slice_is_cached(void *p) {
+    return uarf_get_access_time(p) < slice_thresh;
+}
+
+static float slice_es_eff(Es *es, void *victim, size_t reps,
+                          void es_access(Es *es, size_t num_rep)) {
+    return uarf_es_effectiveness(es, victim, reps, slice_is_cached, es_access);
+}
+
+size_t uarf_slice_group_by_conflicts(const uint64_t *va, size_t n, uint64_t thresh,
+                                     uint64_t *group) {
+    UARF_LOG_TRACE("(%p, %lu, %lu, %p)\n", va, n, thresh, group);
+
+    slice_thresh = thresh;
+
+    uint64_t *cands = uarf_malloc_or_die(n * sizeof(uint64_t));
+    size_t num_groups = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        group[i] = UINT64_MAX;
+    }
+
+    for (size_t pivot = 0; pivot < n; pivot++) {
+        if (group[pivot] != UINT64_MAX) {
+            continue;
+        }
+
+        size_t num_cands = 0;
+        for (size_t j = pivot + 1; j < n; j++) {
+            if (group[j] == UINT64_MAX) {
+                cands[num_cands++] = va[j];
+            }
+        }
+
+        Es *es;
+        uarf_es_init_addrs(&es, cands, num_cands);
+
+        // Not enough lines of this slice left
+        if (slice_es_eff(es, _ptr(va[pivot]), SLICE_REPS, uarf_es_access_fbf) <= 0.5 ||
+            uarf_es_reduce_group(es, _ptr(va[pivot]), cache.l3_ways, SLICE_REPS,
+                                 slice_es_eff, uarf_es_access_fbf) > cache.l3_ways) {
+            UARF_LOG_DEBUG("No eviction set for line %lu\n", pivot);
+            uarf_es_deinit(es);
+            continue;
+        }
+
+        group[pivot] = num_groups;
+        for (size_t j = pivot + 1; j < n; j++) {
+            if (group[j] != UINT64_MAX) {
+                continue;
+            }
+
+            // Lines of the ES get accessed by it, so cannot be tested
+            bool in_es = false;
+            for (size_t e = 0; e < uarf_es_size(es); e++) {
+                in_es |= uarf_es_get(es, e) == va[j];
+            }
+
+            if (in_es ||
+                slice_es_eff(es, _ptr(va[j]), SLICE_REPS, uarf_es_access_fbf) > 0.5) {
+                group[j] = num_groups;
+            }
+        }
+
+        UARF_LOG_DEBUG("Group %lu from line %lu\n", num_groups, pivot);
+        num_groups++;
+        uarf_es_deinit(es);
+    }
+
+    uarf_free_or_die(cands);
+    return num_groups;
+}
+
+bool uarf_slice_hash_solve_set(UarfSliceHash *hash, const uint64_t *pa,
+                               const uint64_t *group, size_t n) {
+    UARF_LOG_TRACE("(%p, %p, %p, %lu)\n", hash, pa, group, n);
+    uarf_assert(cache.l3_set_bits);
+
+    // All lines are in the same set of their slice, so only the bits above the set index
+    // of a slice differ. The sets of all slices would hide the lowest bits of the hash.
+    uint8_t min_bit = cache.cache_line_bits + cache.l3_set_bits;
+    return uarf_slice_hash_solve(hash, pa, group, n, min_bit, 63);
+}
+
+bool uarf_slice_hash_discover(UarfSliceHash *hash, size_t num_pages, uint64_t thresh) {
+    UARF_LOG_TRACE("(%p, %lu, %lu)\n", hash, num_pages, thresh);
+
+    uarf_assert(cache.l3_set_bits);
+
+    uint64_t map = uarf_alloc_map_or_die(num_pages * PAGE_SIZE);
+    uarf_assert(!mlock(_ptr(map), num_pages * PAGE_SIZE));
+
+    // Same page offset for all lines, so the set index bits within the page match
+    uint64_t *va = uarf_malloc_or_die(num_pages * sizeof(uint64_t));
+    uint64_t *pa = uarf_malloc_or_die(num_pages * sizeof(uint64_t));
+    for (size_t i = 0; i < num_pages; i++) {
+        va[i] = map + i * PAGE_SIZE;
+    }
+
+    UarfPagemap pm = uarf_pagemap_open(0);
+    uarf_pagemap_va_to_pa_batch(&pm, va, pa, num_pages);
+    uarf_pagemap_close(&pm);
+
+    // Only keep lines in the same L3 set as the first one
+    size_t n = 0;
+    uint64_t set = uarf_get_l3_set(pa[0]);
+    for (size_t i = 0; i < num_pages; i++) {
+        if (pa[i] && uarf_get_l3_set(pa[i]) == set) {
+            va[n] = va[i];
+            pa[n++] = pa[i];
+        }
+    }
+    UARF_LOG_INFO("Found %lu lines in L3 set %lu\n", n, set);
+
+    uint64_t *group = uarf_malloc_or_die(n * sizeof(uint64_t));
+    size_t num_groups = uarf_slice_group_by_conflicts(va, n, thresh, group);
+    UARF_LOG_INFO("Grouped lines into %lu slices\n", num_groups);
+
+    bool ok = num_groups && uarf_slice_hash_solve_set(hash, pa, group, n);
+
+    if (ok) {
+        uarf_slice_hash_print(hash);
+    }
+    else {
+        UARF_LOG_WARNING("Failed to solve for slice hash\n");
+    }
+
+    uarf_free_or_die(group);
+    uarf_free_or_die(pa);
+    uarf_free_or_die(va);
+    uarf_unmap_or_die(_ptr(map), num_pages * PAGE_SIZE);
+
+    return ok;
+}
+
+void uarf_slice_hash_print(const UarfSliceHash *hash) {
+    UARF_LOG_TRACE("(%p)\n", hash);
+
+    printf("Slice hash with %u bits:\n", hash->num_bits);
+    for (uint8_t i = 0; i < hash->num_bits; i++) {
+        printf("\tbit %u: 0x%016lx\n", i, hash->masks[i]);
+    }
+}
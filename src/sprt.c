@@ -0,0 +1,153 @@
+#include "sprt.h"
+#include "compiler.h"
+#include "lib.h"
+#include "log.h"
+
+#ifdef UARF_LOG_TAG
+#undef UARF_LOG_TAG
+#define UARF_LOG_TAG UARF_LOG_TAG_FR
+#endif
+
+#define LN2 0.69314718055994530942
+
+/**
+ * Natural logarithm of `x` > 0.
+ *
+ * Only needed when setting up a test, so we do not make everyone linking the library
+ * also link libm.
+ */
+static double sprt_ln(double x) {
+    uarf_assert(x > 0);
+
+    // x = m * 2^e with m in [1, 2)
+    int e = 0;
+    while (x >= 2) {
+        x /= 2;
+        e++;
+    }
+    while (x < 1) {
+        x *= 2;
+        e--;
+    }
+
+    // ln(m) = 2 * atanh(t) with t = (m - 1) / (m + 1) <= 1/3
+    double t = (x - 1) / (x + 1);
+    double t2 = t * t;
+    double term = t;
+    double sum = 0;
+    for (int k = 1; k < 40; k += 2) {
+        sum += term / k;
+        term *= t2;
+    }
+
+    return 2 * sum + e * LN2;
+}
+
+UarfSprt uarf_sprt_init(double p0, double p1, double alpha, double beta) {
+    UARF_LOG_TRACE("(%f, %f, %f, %f)\n", p0, p1, alpha, beta);
+
+    uarf_assert(0 < p0 && p0 < p1 && p1 < 1);
+    uarf_assert(0 < alpha && alpha < 0.5);
+    uarf_assert(0 < beta && beta < 0.5);
+
+    UarfSprt sprt = {
+        .p0 = p0,
+        .p1 = p1,
+        .alpha = alpha,
+        .beta = beta,
+        .llr_hit = sprt_ln(p1 / p0),
+        .llr_miss = sprt_ln((1 - p1) / (1 - p0)),
+        // Wald's approximation of the boundaries
+        .upper = sprt_ln((1 - beta) / alpha),
+        .lower = sprt_ln(beta / (1 - alpha)),
+    };
+    uarf_sprt_reset(&sprt);
+
+    return sprt;
+}
+
+void uarf_sprt_reset(UarfSprt *sprt) {
+    UARF_LOG_TRACE("(%p)\n", sprt);
+
+    sprt->llr = 0;
+    sprt->n = 0;
+    sprt->hits = 0;
+    sprt->decision = UARF_SPRT_UNDECIDED;
+}
+
+UarfSprtDecision uarf_sprt_update(UarfSprt *sprt, uint64_t hits, uint64_t rounds) {
+    UARF_LOG_TRACE("(%p, %lu, %lu)\n", sprt, hits, rounds);
+
+    if (sprt->decision != UARF_SPRT_UNDECIDED) {
+        return sprt->decision;
+    }
+
+    // A round has at most one hit
+    hits = min(hits, rounds);
+
+    sprt->n += rounds;
+    sprt->hits += hits;
+    sprt->llr += hits * sprt->llr_hit + (rounds - hits) * sprt->llr_miss;
+
+    if (sprt->llr >= sprt->upper) {
+        sprt->decision = UARF_SPRT_SIGNAL;
+    }
+    else if (sprt->llr <= sprt->lower) {
+        sprt->decision = UARF_SPRT_NO_SIGNAL;
+    }
+
+    if (sprt->decision != UARF_SPRT_UNDECIDED) {
+        UARF_LOG_DEBUG("%s after %lu rounds with %lu hits\n",
+                       uarf_sprt_decision_str(sprt->decision), sprt->n, sprt->hits);
+    }
+
+    return sprt->decision;
+}
+
+UarfSprtDecision uarf_sprt_update_total(UarfSprt *sprt, uint64_t total_hits,
+                                        uint64_t total_rounds) {
+    UARF_LOG_TRACE("(%p, %lu, %lu)\n", sprt, total_hits, total_rounds);
+
+    uarf_assert(total_rounds >= sprt->n);
+    uarf_assert(total_hits >= sprt->hits);
+
+    return uarf_sprt_update(sprt, total_hits - sprt->hits, total_rounds - sprt->n);
+}
+
+UarfSprtDecision uarf_sprt_update_fr(UarfSprt *sprt, UarfFrConfig *conf, size_t slot,
+                                     uint64_t total_rounds) {
+    UARF_LOG_TRACE("(%p, %p, %lu, %lu)\n", sprt, conf, slot, total_rounds);
+
+    uarf_assert(slot < conf->num_slots);
+
+    uint64_t total_hits = 0;
+    for (size_t bin = 0; bin < conf->num_bins; bin++) {
+        total_hits += conf->res_p[bin * conf->num_slots + slot];
+    }
+
+    return uarf_sprt_update_total(sprt, total_hits, total_rounds);
+}
+
+uint64_t uarf_sprt_expected_rounds(UarfSprt *sprt) {
+    UARF_LOG_TRACE("(%p)\n", sprt);
+
+    // The test takes longest for the hit rate at which the log-likelihood ratio does
+    // not drift, there the expected number of rounds is about -lower * upper / E[llr^2]
+    double p = -sprt->llr_miss / (sprt->llr_hit - sprt->llr_miss);
+    double var = p * sprt->llr_hit * sprt->llr_hit +
+                 (1 - p) * sprt->llr_miss * sprt->llr_miss;
+
+    return (uint64_t) (-sprt->lower * sprt->upper / var) + 1;
+}
+
+const char *uarf_sprt_decision_str(UarfSprtDecision decision) {
+    switch (decision) {
+    case UARF_SPRT_UNDECIDED:
+        return "undecided";
+    case UARF_SPRT_SIGNAL:
+        return "signal";
+    case UARF_SPRT_NO_SIGNAL:
+        return "no signal";
+    }
+    return "invalid";
+}
@@ -0,0 +1,276 @@
+#include "timer.h"
+#include "lib.h"
+#include "log.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define TIMER_STARTUP_ROUNDS 1001
+
+#define TIMER_PROFILE_MAGIC "UARFTMR1"
+
+// Identifies the build, the overheads change with the compiler and its flags
+#define TIMER_BUILD_ID __VERSION__ " " __DATE__ " " __TIME__
+
+uint64_t uarf_access_time_a_overhead = UARF_ACCESS_TIME_A_OVERHEAD;
+uint64_t uarf_access_time_m_overhead = UARF_ACCESS_TIME_M_OVERHEAD;
+
+static UarfTimerCal timer_cals[UARF_TIMER_NUM];
+
+/**
+ * Layout of a profile file: the header, followed by the calibration of every timer.
+ */
+typedef struct TimerProfileHeader TimerProfileHeader;
+struct TimerProfileHeader {
+    char magic[8];
+    uint32_t cpu_sig;
+    uint32_t num_timers;
+    uint64_t build;
+};
+
+static uint64_t timer_build_hash(void) {
+    // FNV-1a
+    uint64_t h = 0xcbf29ce484222325ul;
+    for (const char *c = TIMER_BUILD_ID; *c; c++) {
+        h = (h ^ (uint8_t) *c) * 0x100000001b3ul;
+    }
+    return h;
+}
+
+static bool timer_has_rdpru(void) {
+    return uarf_cpuid_eax(0x80000000) >= 0x80000008 &&
+           (uarf_cpuid_ebx(0x80000008) & BIT(4));
+}
+
+// Empty regions, with the same fences as the timing helpers of lib.h
+
+static uint64_t timer_empty_tsc(void) {
+    uarf_mfence();
+    uarf_lfence();
+    uint64_t t0 = uarf_rdtsc();
+    uarf_mfence();
+    uarf_mfence();
+    t0 = uarf_rdtscp() - t0;
+    uarf_mfence();
+    uarf_lfence();
+    return t0;
+}
+
+static uint64_t timer_empty_aperf(void) {
+    uarf_mfence();
+    uarf_lfence();
+    uint64_t t0 = uarf_rdpru_aperf();
+    uarf_lfence();
+    uarf_lfence();
+    t0 = uarf_rdpru_aperf() - t0;
+    uarf_mfence();
+    uarf_lfence();
+    return t0;
+}
+
+static uint64_t timer_empty_mperf(void) {
+    uarf_mfence();
+    uarf_lfence();
+    uint64_t t0 = uarf_rdpru_mperf();
+    uarf_mfence();
+    uarf_mfence();
+    t0 = uarf_rdpru_mperf() - t0;
+    uarf_mfence();
+    uarf_lfence();
+    return t0;
+}
+
+static uint64_t timer_empty_clock(void) {
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (t1.tv_sec - t0.tv_sec) * 1000000000ul + t1.tv_nsec - t0.tv_nsec;
+}
+
+static int timer_cmp(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Summarize the `n` `samples`, sorts them.
+ */
+static UarfTimerCal timer_summarize(uint64_t *samples, size_t n) {
+    qsort(samples, n, sizeof(uint64_t), timer_cmp);
+    return (UarfTimerCal) {
+        .available = true,
+        .min = samples[0],
+        .median = samples[n / 2],
+        .jitter = samples[n * 9 / 10] - samples[n / 10],
+    };
+}
+
+static void timer_update_overheads(void) {
+    if (timer_cals[UARF_TIMER_APERF].available) {
+        uarf_access_time_a_overhead = timer_cals[UARF_TIMER_APERF].min;
+    }
+    if (timer_cals[UARF_TIMER_MPERF].available) {
+        uarf_access_time_m_overhead = timer_cals[UARF_TIMER_MPERF].min;
+    }
+}
+
+void uarf_timer_calibrate(size_t rounds) {
+    UARF_LOG_TRACE("(%lu)\n", rounds);
+    uarf_assert(rounds > 0);
+
+    uint64_t *samples = malloc(rounds * sizeof(uint64_t));
+    uarf_assert(samples);
+
+    uint64_t (*empty[UARF_TIMER_NUM])(void) = {
+        [UARF_TIMER_TSC] = timer_empty_tsc,
+        [UARF_TIMER_APERF] = timer_has_rdpru() ? timer_empty_aperf : NULL,
+        [UARF_TIMER_MPERF] = timer_has_rdpru() ? timer_empty_mperf : NULL,
+        [UARF_TIMER_CLOCK] = timer_empty_clock,
+    };
+
+    for (size_t t = 0; t < UARF_TIMER_NUM; t++) {
+        if (!empty[t]) {
+            continue;
+        }
+        // Warm up the code and the timer
+        empty[t]();
+        for (size_t r = 0; r < rounds; r++) {
+            samples[r] = empty[t]();
+        }
+        timer_cals[t] = timer_summarize(samples, rounds);
+    }
+
+    free(samples);
+    timer_update_overheads();
+}
+
+void uarf_timer_calibrate_pmc(UarfPfc *pfc, size_t rounds) {
+    UARF_LOG_TRACE("(%p, %lu)\n", pfc, rounds);
+    uarf_assert(rounds > 0);
+    uarf_assert(pfc->rdpmc_index != UARF_PFC_RDPMC_INVALID);
+
+    uint64_t *samples = malloc(rounds * sizeof(uint64_t));
+    uarf_assert(samples);
+
+    uint32_t index = pfc->rdpmc_index;
+    uint16_t width = pfc->rdpmc_width;
+    for (size_t r = 0; r < rounds; r++) {
+        uarf_mfence();
+        uarf_lfence();
+        uint64_t t0 = uarf_rdpmc(index);
+        uarf_lfence();
+        uarf_lfence();
+        samples[r] = uarf_pfc_sign_extend(uarf_rdpmc(index) - t0, width);
+        uarf_mfence();
+        uarf_lfence();
+    }
+    timer_cals[UARF_TIMER_PMC] = timer_summarize(samples, rounds);
+
+    free(samples);
+}
+
+/**
+ * Load the profile at `path`.
+ *
+ * @returns false if there is none or it was made on another CPU or by another build
+ */
+static bool timer_profile_load(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return false;
+    }
+
+    TimerProfileHeader hdr;
+    UarfTimerCal cals[UARF_TIMER_NUM];
+    bool ok = fread(&hdr, sizeof(hdr), 1, f) == 1 &&
+              !memcmp(hdr.magic, TIMER_PROFILE_MAGIC, sizeof(hdr.magic)) &&
+              hdr.cpu_sig == uarf_cpuid_eax(1) && hdr.num_timers == UARF_TIMER_NUM &&
+              hdr.build == timer_build_hash() &&
+              fread(cals, sizeof(cals), 1, f) == 1;
+    fclose(f);
+
+    if (!ok) {
+        UARF_LOG_INFO("Timer profile %s does not match, calibrating again\n", path);
+        return false;
+    }
+
+    memcpy(timer_cals, cals, sizeof(cals));
+    // Counters are only calibrated on request
+    timer_cals[UARF_TIMER_PMC].available = false;
+    timer_update_overheads();
+    return true;
+}
+
+static void timer_profile_save(const char *path) {
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        UARF_LOG_WARNING("Failed to open %s: %s\n", path, strerror(errno));
+        return;
+    }
+
+    TimerProfileHeader hdr = {
+        .cpu_sig = uarf_cpuid_eax(1),
+        .num_timers = UARF_TIMER_NUM,
+        .build = timer_build_hash(),
+    };
+    memcpy(hdr.magic, TIMER_PROFILE_MAGIC, sizeof(hdr.magic));
+    if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+        fwrite(timer_cals, sizeof(timer_cals), 1, f) != 1) {
+        UARF_LOG_WARNING("Failed to write %s\n", path);
+    }
+    fclose(f);
+}
+
+__attribute__((constructor)) static void timer_init(void) {
+    const char *path = getenv(UARF_TIMER_PROFILE_ENV);
+    if (path && timer_profile_load(path)) {
+        return;
+    }
+
+    uarf_timer_calibrate(TIMER_STARTUP_ROUNDS);
+
+    if (path) {
+        timer_profile_save(path);
+    }
+}
+
+const UarfTimerCal *uarf_timer_cal(UarfTimer timer) {
+    UARF_LOG_TRACE("(%d)\n", timer);
+    uarf_assert(timer < UARF_TIMER_NUM);
+    return &timer_cals[timer];
+}
+
+const char *uarf_timer_str(UarfTimer timer) {
+    switch (timer) {
+    case UARF_TIMER_TSC:
+        return "tsc";
+    case UARF_TIMER_APERF:
+        return "aperf";
+    case UARF_TIMER_MPERF:
+        return "mperf";
+    case UARF_TIMER_PMC:
+        return "pmc";
+    case UARF_TIMER_CLOCK:
+        return "clock";
+    default:
+        return "unknown";
+    }
+}
+
+void uarf_timer_print(void) {
+    UARF_LOG_TRACE("()\n");
+
+    printf("Timer overheads:\n");
+    for (size_t t = 0; t < UARF_TIMER_NUM; t++) {
+        const UarfTimerCal *cal = &timer_cals[t];
+        if (!cal->available) {
+            printf("\t%-6s n/a\n", uarf_timer_str(t));
+            continue;
+        }
+        printf("\t%-6s min: %4lu, median: %4lu, jitter: %4lu\n", uarf_timer_str(t),
+               cal->min, cal->median, cal->jitter);
+    }
+}
@@ -0,0 +1,417 @@
+#include "tlb.h"
+#include "cache.h"
+#include "compiler.h"
+#include "jita.h"
+#include "lib.h"
+#include "log.h"
+#include "mem.h"
+#include "page.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef UARF_LOG_TAG
+#undef UARF_LOG_TAG
+#define UARF_LOG_TAG UARF_LOG_TAG_MEM
+#endif
+
+UarfTlb tlb = {};
+
+// TLB types as reported by CPUID leaf 0x18
+#define CPUID_TLB_TYPE_NULL        0
+#define CPUID_TLB_TYPE_DATA        1
+#define CPUID_TLB_TYPE_INSTRUCTION 2
+#define CPUID_TLB_TYPE_UNIFIED     3
+#define CPUID_TLB_TYPE_LOAD        4
+
+// AMD encoding of fully associative
+#define AMD_L1_TLB_FULLY_ASSOC 0xff
+#define AMD_L2_TLB_FULLY_ASSOC 0xf
+
+// Minimal difference between hot and evicted translation for calibration to succeed
+#define TLB_MIN_DIFF 10
+// Fraction of the slowdown of the full pattern the calibrated pattern has to reach
+#define TLB_MIN_GAP 0.9
+// Rounds of `trials` measurements the calibrated pattern has to pass
+#define TLB_CALIBRATE_ROUNDS 3
+
+static void tlb_set_geometry(UarfTlbGeometry *geo, uint32_t entries, uint32_t ways) {
+    if (!entries || !ways) {
+        return;
+    }
+    geo->sets = entries / ways;
+    geo->ways = ways;
+}
+
+/**
+ * Discover the TLBs through the deterministic address translation parameters of Intel.
+ */
+static void tlb_init_intel(void) {
+    if (uarf_cpuid_eax(0) < 0x18) {
+        return;
+    }
+
+    uint32_t eax, ebx = 0, ecx = 0, edx = 0;
+    uarf_cpuid(0x18, &eax, &ebx, &ecx, &edx);
+    uint32_t max_subleaf = eax;
+
+    for (uint32_t i = 0; i <= max_subleaf; i++) {
+        ebx = 0;
+        ecx = i;
+        edx = 0;
+        uarf_cpuid(0x18, &eax, &ebx, &ecx, &edx);
+
+        uint32_t type = edx & 0x1f;
+        uint8_t level = (edx >> 5) & 0x7;
+        // Only care about 4KB pages
+        if (type == CPUID_TLB_TYPE_NULL || !(ebx & BIT(0))) {
+            continue;
+        }
+
+        uint32_t ways = ebx >> 16;
+        uint32_t sets = edx & BIT(8) ? 1 : ecx;
+        UARF_LOG_DEBUG("L%u TLB of type %u: %u ways, %u sets\n", level, type, ways, sets);
+
+        if (level == 1 && type == CPUID_TLB_TYPE_INSTRUCTION) {
+            tlb_set_geometry(&tlb.l1i, sets * ways, ways);
+        }
+        else if (level == 1 && (type == CPUID_TLB_TYPE_DATA || type == CPUID_TLB_TYPE_LOAD ||
+                                type == CPUID_TLB_TYPE_UNIFIED)) {
+            tlb_set_geometry(&tlb.l1d, sets * ways, ways);
+        }
+        else if (level == 2) {
+            tlb_set_geometry(&tlb.l2, sets * ways, ways);
+        }
+    }
+}
+
+/**
+ * Decode the associativity of an AMD L2 TLB.
+ */
+static uint32_t amd_l2_ways(uint32_t assoc, uint32_t entries) {
+    static const uint32_t ways[] = {0, 1, 2, 3, 4, 0, 8, 0, 16, 0, 32, 48, 64, 96, 128};
+    if (assoc == AMD_L2_TLB_FULLY_ASSOC) {
+        return entries;
+    }
+    return assoc < sizeof(ways) / sizeof(*ways) ? ways[assoc] : 0;
+}
+
+/**
+ * Discover the TLBs through the L1 and L2 TLB identifiers of AMD.
+ */
+static void tlb_init_amd(void) {
+    uint32_t max_leaf = uarf_cpuid_eax(0x80000000);
+
+    if (max_leaf >= 0x80000005) {
+        uint32_t ebx = uarf_cpuid_ebx(0x80000005);
+        uint32_t d_assoc = ebx >> 24;
+        uint32_t d_entries = (ebx >> 16) & 0xff;
+        uint32_t i_assoc = (ebx >> 8) & 0xff;
+        uint32_t i_entries = ebx & 0xff;
+        tlb_set_geometry(&tlb.l1d, d_entries,
+                         d_assoc == AMD_L1_TLB_FULLY_ASSOC ? d_entries : d_assoc);
+        tlb_set_geometry(&tlb.l1i, i_entries,
+                         i_assoc == AMD_L1_TLB_FULLY_ASSOC ? i_entries : i_assoc);
+    }
+
+    if (max_leaf >= 0x80000006) {
+        uint32_t ebx = uarf_cpuid_ebx(0x80000006);
+        uint32_t d_entries = (ebx >> 16) & 0xfff;
+        tlb_set_geometry(&tlb.l2, d_entries, amd_l2_ways(ebx >> 28, d_entries));
+    }
+}
+
+void uarf_tlb_init(void) {
+    UARF_LOG_TRACE("()\n");
+
+    memset(&tlb, 0, sizeof(tlb));
+
+    if (uarf_cpu_is_amd()) {
+        tlb_init_amd();
+    }
+    else {
+        tlb_init_intel();
+        // Since Skylake, the L2 TLB set is the XOR of the two lowest groups of VPN bits
+        tlb.l2.xor_index = true;
+    }
+
+    // Typical values, calibration makes up for deviations
+    if (!tlb.l1d.ways) {
+        UARF_LOG_DEBUG("Assume default L1 dTLB\n");
+        tlb_set_geometry(&tlb.l1d, 64, 4);
+    }
+    if (!tlb.l1i.ways) {
+        UARF_LOG_DEBUG("Assume default L1 iTLB\n");
+        tlb_set_geometry(&tlb.l1i, 128, 8);
+    }
+    if (!tlb.l2.ways) {
+        UARF_LOG_DEBUG("Assume default L2 TLB\n");
+        tlb_set_geometry(&tlb.l2, 1536, 12);
+    }
+}
+
+__attribute__((constructor)) static void tlb_init_constructor(void) {
+    uarf_tlb_init();
+}
+
+static UarfTlbGeometry *tlb_geometry(UarfTlbTarget target) {
+    switch (target) {
+    case UARF_TLB_L1D:
+        return &tlb.l1d;
+    case UARF_TLB_L1I:
+        return &tlb.l1i;
+    case UARF_TLB_L2:
+    case UARF_TLB_L2_CODE:
+        return &tlb.l2;
+    default:
+        uarf_bug();
+    }
+    return NULL;
+}
+
+/**
+ * Get the page offset of the line on the `i`-th page of an ES for `victim`.
+ *
+ * The lines rotate through all lines of a page except the one of the victim, so they
+ * neither conflict with each other nor with the victim in the cache.
+ */
+static uint64_t tlb_page_offset(uint64_t victim, size_t i) {
+    size_t num_lines = PAGE_SIZE / cache.cache_line_size;
+    size_t victim_line = (victim % PAGE_SIZE) / cache.cache_line_size;
+    size_t line = (victim_line + 1 + i % (num_lines - 1)) % num_lines;
+    return line * cache.cache_line_size;
+}
+
+UarfTlbEs uarf_tlb_es_init(UarfTlbTarget target, uint64_t victim, size_t num_pages) {
+    UARF_LOG_TRACE("(%d, 0x%lx, %lu)\n", target, victim, num_pages);
+
+    UarfTlbGeometry *geo = tlb_geometry(target);
+    uarf_assert(num_pages > 0 && geo->sets);
+
+    UarfTlbEs tes = {
+        .target = target,
+        .pages = uarf_malloc_or_die(num_pages * sizeof(uint64_t)),
+        .num_pages = 0,
+        .es = NULL,
+        .stubs = NULL,
+        .size = num_pages,
+        .reps = 2,
+        .thresh = 0,
+    };
+
+    // Every run of `sets` pages has exactly one page of every set, also with XOR index.
+    // Find a free range by mapping and unmapping it.
+    size_t span = (num_pages + 1) * geo->sets * PAGE_SIZE;
+    uint64_t base = uarf_alloc_map_or_die(span);
+    uarf_unmap_or_die(_ptr(base), span);
+
+    uint64_t set = uarf_tlb_set(geo, victim);
+    for (uint64_t page = base; tes.num_pages < num_pages; page += PAGE_SIZE) {
+        if (uarf_tlb_set(geo, page) == set && page != ALIGN_DOWN(victim, PAGE_SIZE)) {
+            tes.pages[tes.num_pages++] = page;
+        }
+    }
+
+    if (target == UARF_TLB_L1I || target == UARF_TLB_L2_CODE) {
+        UarfJitaCtxt ctxt = uarf_jita_init();
+        uarf_jita_push_vsnip_ret(&ctxt);
+
+        tes.stubs = uarf_malloc_or_die(num_pages * sizeof(UarfStub));
+        for (size_t i = 0; i < num_pages; i++) {
+            tes.stubs[i] = uarf_stub_init();
+            uarf_jita_allocate(&ctxt, &tes.stubs[i],
+                               tes.pages[i] + tlb_page_offset(victim, i));
+        }
+        return tes;
+    }
+
+    // Different offsets, so the lines spread over all cache sets
+    uint64_t *lines = uarf_malloc_or_die(num_pages * sizeof(uint64_t));
+    for (size_t i = 0; i < num_pages; i++) {
+        uarf_map_or_die(_ptr(tes.pages[i]), PAGE_SIZE);
+        lines[i] = tes.pages[i] + tlb_page_offset(victim, i);
+    }
+    uarf_es_init_addrs(&tes.es, lines, num_pages);
+    uarf_free_or_die(lines);
+
+    return tes;
+}
+
+void uarf_tlb_es_deinit(UarfTlbEs *tes) {
+    UARF_LOG_TRACE("(%p)\n", tes);
+
+    if (tes->stubs) {
+        for (size_t i = 0; i < tes->num_pages; i++) {
+            uarf_stub_free(&tes->stubs[i]);
+        }
+        uarf_free_or_die(tes->stubs);
+    }
+    else {
+        uarf_es_deinit(tes->es);
+        for (size_t i = 0; i < tes->num_pages; i++) {
+            uarf_unmap_or_die(_ptr(tes->pages[i]), PAGE_SIZE);
+        }
+    }
+
+    uarf_free_or_die(tes->pages);
+    tes->num_pages = 0;
+}
+
+/**
+ * Only access the first `size` pages of `tes`.
+ */
+static void tlb_es_resize(UarfTlbEs *tes, size_t size) {
+    uarf_assert(size && size <= tes->num_pages);
+    tes->size = size;
+
+    if (!tes->es) {
+        return;
+    }
+    while (tes->es->num_removed) {
+        uarf_es_restore(tes->es);
+    }
+    while (uarf_es_size(tes->es) > size) {
+        uarf_es_remove(tes->es, uarf_es_size(tes->es) - 1);
+    }
+}
+
+void uarf_tlb_es_access(UarfTlbEs *tes) {
+    for (size_t round = 0; round < tes->reps; round++) {
+        if (tes->stubs) {
+            for (size_t i = 0; i < tes->size; i++) {
+                tes->stubs[i].f();
+            }
+            continue;
+        }
+
+        // Pointer chase, so every access waits for the translation of the previous one
+        volatile UarfEsLine *line = tes->es->ring;
+        for (size_t i = 0; i < tes->size; i++) {
+            line = line->next;
+        }
+    }
+}
+
+uint64_t uarf_tlb_time_load(void *p) {
+    return uarf_get_access_time(p);
+}
+
+uint64_t uarf_tlb_time_exec(void *p) {
+    uarf_mfence();
+    uarf_lfence();
+    uint64_t t0 = uarf_rdtsc();
+    uarf_lfence();
+    ((void (*)(void)) p)();
+    t0 = uarf_rdtscp() - t0;
+    uarf_lfence();
+    return t0;
+}
+
+static uint64_t tlb_time_victim(UarfTlbEs *tes, uint64_t victim) {
+    return tes->stubs ? uarf_tlb_time_exec(_ptr(victim)) : uarf_tlb_time_load(_ptr(victim));
+}
+
+/**
+ * Time the victim in `trials` trials, once with a hot translation and once after
+ * accessing `tes`. Pairing the two makes up for drift of the timer over the trials.
+ *
+ * @param hot receives the times with a hot translation
+ * @param gap receives the difference between the evicted and the hot time
+ */
+static void tlb_measure(UarfTlbEs *tes, uint64_t victim, size_t trials, uint64_t *hot,
+                        int64_t *gap) {
+    for (size_t t = 0; t < trials; t++) {
+        tlb_time_victim(tes, victim);
+        hot[t] = tlb_time_victim(tes, victim);
+        uarf_tlb_es_access(tes);
+        gap[t] = (int64_t) tlb_time_victim(tes, victim) - (int64_t) hot[t];
+    }
+}
+
+static int tlb_cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static int tlb_cmp_i64(const void *a, const void *b) {
+    int64_t x = *(const int64_t *) a;
+    int64_t y = *(const int64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+bool uarf_tlb_es_calibrate(UarfTlbEs *tes, uint64_t victim, size_t trials) {
+    UARF_LOG_TRACE("(%p, 0x%lx, %lu)\n", tes, victim, trials);
+
+    uarf_assert(trials > 0);
+    UarfTlbGeometry *geo = tlb_geometry(tes->target);
+    uint64_t *hot = uarf_malloc_or_die(trials * sizeof(uint64_t));
+    int64_t *gap = uarf_malloc_or_die(trials * sizeof(int64_t));
+
+    tlb_es_resize(tes, tes->num_pages);
+    tes->reps = 2;
+    tlb_measure(tes, victim, trials, hot, gap);
+    qsort(hot, trials, sizeof(*hot), tlb_cmp_u64);
+    qsort(gap, trials, sizeof(*gap), tlb_cmp_i64);
+    uint64_t hot_median = hot[trials / 2];
+    int64_t gap_median = gap[trials / 2];
+
+    UARF_LOG_DEBUG("Translation hot: %lu, evicted: +%ld\n", hot_median, gap_median);
+    if (gap_median < TLB_MIN_DIFF) {
+        UARF_LOG_WARNING("Cannot evict translation of 0x%lx\n", victim);
+        uarf_free_or_die(hot);
+        uarf_free_or_die(gap);
+        return false;
+    }
+    tes->thresh = hot_median + gap_median / 2;
+
+    // Cheapest pattern that evicts about as well as the full one, which is the fallback
+    size_t best_size = tes->num_pages;
+    size_t best_reps = 2;
+    bool found = false;
+    size_t step = max(geo->ways / 2, 1u);
+    for (size_t size = min(_ul(geo->ways), tes->num_pages); size <= tes->num_pages;
+         size += step) {
+        for (size_t reps = 1; reps <= 3; reps++) {
+            if (found && size * reps >= best_size * best_reps) {
+                continue;
+            }
+
+            tlb_es_resize(tes, size);
+            tes->reps = reps;
+
+            // Noise lets single rounds pass by chance, so the pattern has to pass several
+            size_t round = 0;
+            for (; round < TLB_CALIBRATE_ROUNDS; round++) {
+                tlb_measure(tes, victim, trials, hot, gap);
+                qsort(gap, trials, sizeof(*gap), tlb_cmp_i64);
+                if (gap[trials / 2] < TLB_MIN_GAP * gap_median) {
+                    break;
+                }
+            }
+            if (round == TLB_CALIBRATE_ROUNDS) {
+                best_size = size;
+                best_reps = reps;
+                found = true;
+            }
+        }
+    }
+
+    tlb_es_resize(tes, best_size);
+    tes->reps = best_reps;
+    uarf_free_or_die(hot);
+    uarf_free_or_die(gap);
+
+    UARF_LOG_INFO("Evict with %lu pages %lu times, threshold %lu\n", tes->size, tes->reps,
+                  tes->thresh);
+    return true;
+}
+
+bool uarf_tlb_es_evicted(UarfTlbEs *tes, uint64_t victim) {
+    // No tracing, it adds noise
+    uarf_assert(tes->thresh);
+
+    // Translation in the TLB first, so only the eviction set can remove it
+    tlb_time_victim(tes, victim);
+    uarf_tlb_es_access(tes);
+    return tlb_time_victim(tes, victim) > tes->thresh;
+}
@@ -128,3 +128,248 @@ int uarf_vsnip_fill_alloc(Uarf_VsnipFill *snip, uint64_t *base_addr_ptr,
     }
     return ESUCCESS;
 }
+
+// movabs al, [imm64]
+#define MOVABS_AL_OPCODE 0xa0
+#define MOVABS_AL_SIZE   9
+#define FENCE_SIZE       3
+
+static const uint8_t fence_bytes[][FENCE_SIZE] = {
+    [UARF_FENCE_LFENCE] = {0x0f, 0xae, 0xe8},
+    [UARF_FENCE_MFENCE] = {0x0f, 0xae, 0xf0},
+};
+
+/**
+ * Emit a load from `addr` and the fence, if any, at `*bytes_ptr`.
+ */
+static void access_emit(uint8_t **bytes_ptr, uint64_t addr, UarfAccessFence fence) {
+    uint8_t *bytes = *bytes_ptr;
+
+    bytes[0] = MOVABS_AL_OPCODE;
+    memcpy(&bytes[1], &addr, sizeof(addr));
+    bytes += MOVABS_AL_SIZE;
+
+    if (fence != UARF_FENCE_NONE) {
+        memcpy(bytes, fence_bytes[fence], FENCE_SIZE);
+        bytes += FENCE_SIZE;
+    }
+
+    *bytes_ptr = bytes;
+}
+
+int uarf_vsnip_access_alloc(UarfVsnipAccess *snip, uint64_t *base_addr_ptr,
+                            uint64_t rem_size) {
+    UARF_LOG_TRACE("(%p, %p, %lu)\n", snip, base_addr_ptr, rem_size);
+
+    uarf_assert(snip);
+    uarf_assert(base_addr_ptr);
+    uarf_assert(snip->addrs || !snip->n);
+
+    uint64_t num_passes = snip->pattern == UARF_ACCESS_FBF ? 3 : 1;
+    uint64_t access_size =
+        MOVABS_AL_SIZE + (snip->fence == UARF_FENCE_NONE ? 0 : FENCE_SIZE);
+    uint64_t required_size = access_size * snip->n * num_passes * snip->reps;
+
+    UARF_LOG_DEBUG("Require %lu bytes for %u accesses %lu times\n", required_size,
+                   snip->n, num_passes * snip->reps);
+
+    if (required_size > rem_size) {
+        return -ENOSPC;
+    }
+
+    uint8_t *bytes = (uint8_t *) (*base_addr_ptr);
+    for (uint32_t rep = 0; rep < snip->reps; rep++) {
+        if (snip->pattern != UARF_ACCESS_BWD) {
+            for (uint32_t i = 0; i < snip->n; i++) {
+                access_emit(&bytes, snip->addrs[i], snip->fence);
+            }
+        }
+        if (snip->pattern != UARF_ACCESS_FWD) {
+            for (uint32_t i = snip->n; i-- > 0;) {
+                access_emit(&bytes, snip->addrs[i], snip->fence);
+            }
+        }
+        if (snip->pattern == UARF_ACCESS_FBF) {
+            for (uint32_t i = 0; i < snip->n; i++) {
+                access_emit(&bytes, snip->addrs[i], snip->fence);
+            }
+        }
+    }
+
+    *base_addr_ptr += required_size;
+    uarf_assert(_ul(bytes) == *base_addr_ptr);
+
+    return ESUCCESS;
+}
+
+// Timed load, patched with the address at offset 2 and the result slot at offset 35
+static const uint8_t timed_load_bytes[] = {
+    0x48, 0xbe, 0, 0, 0, 0, 0, 0, 0, 0, // movabs rsi, addr
+    0x0f, 0xae, 0xe8,                   // lfence
+    0x0f, 0x01, 0xf9,                   // rdtscp
+    0x41, 0x89, 0xc0,                   // mov r8d, eax
+    0x0f, 0xae, 0xe8,                   // lfence
+    0x8a, 0x06,                         // mov al, [rsi]
+    0x0f, 0x01, 0xf9,                   // rdtscp
+    0x0f, 0xae, 0xe8,                   // lfence
+    0x44, 0x29, 0xc0,                   // sub eax, r8d
+    0x89, 0x87, 0, 0, 0, 0,             // mov [rdi + slot], eax
+};
+#define TIMED_LOAD_ADDR_OFF 2
+#define TIMED_LOAD_SLOT_OFF 35
+
+int uarf_vsnip_timed_access_alloc(UarfVsnipTimedAccess *snip, uint64_t *base_addr_ptr,
+                                  uint64_t rem_size) {
+    UARF_LOG_TRACE("(%p, %p, %lu)\n", snip, base_addr_ptr, rem_size);
+
+    uarf_assert(snip);
+    uarf_assert(base_addr_ptr);
+    uarf_assert(snip->addrs || !snip->n);
+
+    uint64_t required_size = 0;
+    for (uint32_t i = 0; i < snip->n; i++) {
+        required_size +=
+            snip->probe[i] ? sizeof(timed_load_bytes) : MOVABS_AL_SIZE + FENCE_SIZE;
+    }
+
+    UARF_LOG_DEBUG("Require %lu bytes for %u accesses\n", required_size, snip->n);
+
+    if (required_size > rem_size) {
+        return -ENOSPC;
+    }
+
+    uint8_t *bytes = (uint8_t *) (*base_addr_ptr);
+    uint32_t slot = 0;
+    for (uint32_t i = 0; i < snip->n; i++) {
+        if (!snip->probe[i]) {
+            access_emit(&bytes, snip->addrs[i], UARF_FENCE_LFENCE);
+            continue;
+        }
+
+        uint32_t disp = slot++ * sizeof(uint32_t);
+        memcpy(bytes, timed_load_bytes, sizeof(timed_load_bytes));
+        memcpy(&bytes[TIMED_LOAD_ADDR_OFF], &snip->addrs[i], sizeof(uint64_t));
+        memcpy(&bytes[TIMED_LOAD_SLOT_OFF], &disp, sizeof(disp));
+        bytes += sizeof(timed_load_bytes);
+    }
+
+    *base_addr_ptr += required_size;
+    uarf_assert(_ul(bytes) == *base_addr_ptr);
+
+    return ESUCCESS;
+}
+
+static const uint8_t measure_lfence[] = {0x0f, 0xae, 0xe8};
+// mov ecx, index; rdpmc
+static const uint8_t measure_rdpmc[] = {0xb9, 0, 0, 0, 0, 0x0f, 0x33};
+#define MEASURE_RDPMC_INDEX_OFF 1
+static const uint8_t measure_rdtscp[] = {0x0f, 0x01, 0xf9};
+static const uint8_t measure_combine[] = {
+    0x48, 0xc1, 0xe2, 0x20, // shl rdx, 32
+    0x48, 0x09, 0xd0,       // or rax, rdx
+};
+// movabs [slot], rax
+static const uint8_t measure_store[] = {0x48, 0xa3, 0, 0, 0, 0, 0, 0, 0, 0};
+#define MEASURE_STORE_SLOT_OFF 2
+static const uint8_t measure_sub[] = {
+    0x48, 0xba, 0, 0, 0, 0, 0, 0, 0, 0, // movabs rdx, slot
+    0x48, 0x2b, 0x02,                   // sub rax, [rdx]
+};
+#define MEASURE_SUB_SLOT_OFF 2
+static const uint8_t measure_sign_extend[] = {
+    0x48, 0xc1, 0xe0, 0, // shl rax, 64 - width
+    0x48, 0xc1, 0xf8, 0, // sar rax, 64 - width
+};
+#define MEASURE_SHL_OFF 3
+#define MEASURE_SAR_OFF 7
+// mov [rdx], rax
+static const uint8_t measure_store_rdx[] = {0x48, 0x89, 0x02};
+
+/**
+ * Copy `size` bytes to `*bytes_ptr`, unless it is NULL, and count them into `size_ptr`.
+ */
+static uint8_t *measure_emit(uint8_t *bytes, size_t *size_ptr, const uint8_t *code,
+                             size_t size) {
+    *size_ptr += size;
+    if (!bytes) {
+        return NULL;
+    }
+    memcpy(bytes, code, size);
+    return bytes + size;
+}
+
+/**
+ * Emit the code of `snip` to `bytes`, or only get its size if `bytes` is NULL.
+ */
+static size_t measure_gen(UarfVsnipMeasure *snip, uint8_t *bytes) {
+    UarfMeasure *m = snip->m;
+    size_t size = 0;
+    uint8_t *p;
+
+    bytes = measure_emit(bytes, &size, measure_lfence, sizeof(measure_lfence));
+    for (uint32_t i = 0; i < m->n; i++) {
+        uint64_t slot = _ul(&m->res[i]);
+
+        if (m->index[i] == UARF_MEASURE_TSC) {
+            bytes = measure_emit(bytes, &size, measure_rdtscp, sizeof(measure_rdtscp));
+        }
+        else {
+            p = bytes;
+            bytes = measure_emit(bytes, &size, measure_rdpmc, sizeof(measure_rdpmc));
+            if (p) {
+                memcpy(&p[MEASURE_RDPMC_INDEX_OFF], &m->index[i], sizeof(uint32_t));
+            }
+        }
+        bytes = measure_emit(bytes, &size, measure_combine, sizeof(measure_combine));
+
+        if (!snip->end) {
+            p = bytes;
+            bytes = measure_emit(bytes, &size, measure_store, sizeof(measure_store));
+            if (p) {
+                memcpy(&p[MEASURE_STORE_SLOT_OFF], &slot, sizeof(slot));
+            }
+            continue;
+        }
+
+        p = bytes;
+        bytes = measure_emit(bytes, &size, measure_sub, sizeof(measure_sub));
+        if (p) {
+            memcpy(&p[MEASURE_SUB_SLOT_OFF], &slot, sizeof(slot));
+        }
+        if (m->width[i] < 64) {
+            p = bytes;
+            bytes = measure_emit(bytes, &size, measure_sign_extend,
+                                 sizeof(measure_sign_extend));
+            if (p) {
+                p[MEASURE_SHL_OFF] = p[MEASURE_SAR_OFF] = 64 - m->width[i];
+            }
+        }
+        bytes = measure_emit(bytes, &size, measure_store_rdx, sizeof(measure_store_rdx));
+    }
+    measure_emit(bytes, &size, measure_lfence, sizeof(measure_lfence));
+
+    return size;
+}
+
+int uarf_vsnip_measure_alloc(UarfVsnipMeasure *snip, uint64_t *base_addr_ptr,
+                             uint64_t rem_size) {
+    UARF_LOG_TRACE("(%p, %p, %lu)\n", snip, base_addr_ptr, rem_size);
+
+    uarf_assert(snip);
+    uarf_assert(snip->m);
+    uarf_assert(base_addr_ptr);
+
+    uint64_t required_size = measure_gen(snip, NULL);
+
+    UARF_LOG_DEBUG("Require %lu bytes to read %u counters\n", required_size,
+                   snip->m->n);
+
+    if (required_size > rem_size) {
+        return -ENOSPC;
+    }
+
+    uarf_assert(measure_gen(snip, (uint8_t *) *base_addr_ptr) == required_size);
+    *base_addr_ptr += required_size;
+
+    return ESUCCESS;
+}
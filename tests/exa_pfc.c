@@ -2,11 +2,15 @@
  * Play with performance counters and show how we can interact with them.
  */
 
+#define _GNU_SOURCE
 #include "jita.h"
 #include "lib.h"
 #include "pfc.h"
 #include "pfc_amd.h"
 #include "pfc_intel.h"
+#include "pfc_msr.h"
+#include "pfc_mux.h"
+#include "pfc_session.h"
 #include "spec_lib.h"
 #include "test.h"
 #include "uarch.h"
@@ -131,7 +135,8 @@ UARF_TEST_CASE(rdpmc) {
 #elif UARF_IS_AMD()
         .pmu_conf = UARF_AMD_EX_RET_INSTR,
 #endif
-        .exclude = UARF_PFC_EXCLUDE_KERNEL};
+        .exclude = UARF_PFC_EXCLUDE_KERNEL,
+        .pinned = true};
 
     uarf_pfc_init(&pfc, config);
     uarf_pfc_reset(&pfc);
@@ -150,6 +155,72 @@ UARF_TEST_CASE(rdpmc) {
     UARF_TEST_PASS();
 }
 
+/**
+ * Read with the seqlock protected rdpmc, which copes with rescheduled counters.
+ */
+UARF_TEST_CASE(rdpmc_safe) {
+    UarfPfc pfc;
+
+    UarfPfcConfig config = (UarfPfcConfig) {
+#if UARF_IS_INTEL()
+        .pmu_conf = UARF_INTEL_INST_RETIRED_PREC_DIST,
+#elif UARF_IS_AMD()
+        .pmu_conf = UARF_AMD_EX_RET_INSTR,
+#endif
+        .exclude = UARF_PFC_EXCLUDE_KERNEL};
+
+    uarf_pfc_init(&pfc, config);
+    uarf_pfc_reset(&pfc);
+    uarf_pfc_start(&pfc);
+
+    uint64_t start = uarf_pfc_read_rdpmc_safe(&pfc);
+
+    func1_loop();
+
+    uint64_t count = uarf_pfc_read_rdpmc_safe(&pfc) - start;
+
+    printf("%lu\n", count);
+    UARF_TEST_ASSERT(count >= FUNC1_LOOP_INSNS_RDPMC);
+
+    uarf_pfc_deinit(&pfc);
+    UARF_TEST_PASS();
+}
+
+/**
+ * Program the counter directly through its MSRs, needs the pi kernel module.
+ */
+UARF_TEST_CASE(msr) {
+    UarfPfcMsr pm;
+
+    UarfPfcConfig config = (UarfPfcConfig) {
+#if UARF_IS_INTEL()
+        .pmu_conf = UARF_INTEL_INST_RETIRED_ANY_P,
+#elif UARF_IS_AMD()
+        .pmu_conf = UARF_AMD_EX_RET_INSTR,
+#endif
+        .exclude = UARF_PFC_EXCLUDE_KERNEL};
+
+    if (uarf_pfc_msr_init(&pm, 0, &config, 1)) {
+        UARF_TEST_FAIL("Failed to program PMU\n");
+    }
+    uarf_pfc_msr_reset(&pm);
+    uarf_pfc_msr_start(&pm);
+
+    uint64_t start = uarf_pfc_msr_read(&pm, 0);
+
+    func1_loop();
+
+    uint64_t count = uarf_pfc_msr_read(&pm, 0) - start;
+
+    uarf_pfc_msr_stop(&pm);
+    printf("%lu\n", count);
+    UARF_TEST_ASSERT(uarf_pfc_msr_check(&pm));
+    UARF_TEST_ASSERT(FUNC1_LOOP_INSNS_RDPMC >= count);
+
+    uarf_pfc_msr_deinit(&pm);
+    UARF_TEST_PASS();
+}
+
 UARF_TEST_CASE(two_pmc) {
     UarfPfc pfc;
     UarfPfc pfc2;
@@ -196,6 +267,130 @@ UARF_TEST_CASE(two_pmc) {
     UARF_TEST_PASS();
 }
 
+/**
+ * Count the same event twice in a group, started, stopped and read together.
+ */
+UARF_TEST_CASE(group) {
+    UarfPfcGroup group;
+
+    UarfPfcConfig config = (UarfPfcConfig) {
+#if UARF_IS_INTEL()
+        .pmu_conf = UARF_INTEL_INST_RETIRED_PREC_DIST,
+#elif UARF_IS_AMD()
+        .pmu_conf = UARF_AMD_EX_RET_INSTR,
+#endif
+        .exclude = UARF_PFC_EXCLUDE_KERNEL};
+    UarfPfcConfig configs[] = {config, config};
+
+    UARF_TEST_ASSERT(uarf_pfc_group_init(&group, configs, 2) == 0);
+
+    uarf_pfc_group_reset(&group);
+    uarf_pfc_group_start(&group);
+
+    func1_loop();
+
+    uarf_pfc_group_stop(&group);
+
+    uint64_t counts[2];
+    uarf_pfc_group_read(&group, counts);
+    printf("count1: %lu\n", counts[0]);
+    printf("count2: %lu\n", counts[1]);
+    UARF_TEST_ASSERT(counts[0] == counts[1]);
+
+    // Both counters in one burst
+    uint64_t start[2];
+    uint64_t end[2];
+    uarf_pfc_group_start(&group);
+    uarf_pfc_group_read_rdpmc(&group, start);
+    func1_loop();
+    uarf_pfc_group_read_rdpmc(&group, end);
+    for (size_t i = 0; i < 2; i++) {
+        UarfPfc *pfc = &group.pfcs[i];
+        uint64_t count = uarf_pm_transform_raw2(pfc, end[i]) -
+                         uarf_pm_transform_raw2(pfc, start[i]);
+        printf("rdpmc count%lu: %lu\n", i + 1, count);
+    }
+
+    uarf_pfc_group_deinit(&group);
+    UARF_TEST_PASS();
+}
+
+/**
+ * Count the same event five times, two per group, over repetitions of a region.
+ *
+ * All five estimates should agree within their confidence intervals.
+ */
+UARF_TEST_CASE(mux) {
+    UarfPfcMux mux;
+
+    UarfPfcConfig config = (UarfPfcConfig) {
+#if UARF_IS_INTEL()
+        .pmu_conf = UARF_INTEL_INST_RETIRED_PREC_DIST,
+#elif UARF_IS_AMD()
+        .pmu_conf = UARF_AMD_EX_RET_INSTR,
+#endif
+        .exclude = UARF_PFC_EXCLUDE_KERNEL};
+    UarfPfcConfig configs[] = {config, config, config, config, config};
+
+    UARF_TEST_ASSERT(uarf_pfc_mux_init(&mux, configs, 5, 2) == 0);
+    UARF_TEST_ASSERT(mux.num_groups >= 3);
+
+    for (size_t i = 0; i < 300; i++) {
+        uarf_pfc_mux_begin(&mux);
+        func1_loop();
+        uarf_pfc_mux_end(&mux);
+    }
+    uarf_pfc_mux_print(&mux);
+
+    for (size_t i = 0; i < 5; i++) {
+        UARF_TEST_ASSERT(uarf_pfc_mux_result(&mux, i).num_samples > 0);
+    }
+
+    uarf_pfc_mux_deinit(&mux);
+    UARF_TEST_PASS();
+}
+
+/**
+ * Count on the own CPU and its SMT sibling, for all threads running there.
+ *
+ * The own CPU sees at least the loop, the sibling whatever else runs on the core.
+ */
+UARF_TEST_CASE(session) {
+    UarfPfcSession session;
+
+    UarfPfcConfig configs[] = {{
+#if UARF_IS_INTEL()
+        .pmu_conf = UARF_INTEL_INST_RETIRED_PREC_DIST,
+#elif UARF_IS_AMD()
+        .pmu_conf = UARF_AMD_EX_RET_INSTR,
+#endif
+        .exclude = UARF_PFC_EXCLUDE_KERNEL}};
+
+    int cpu = sched_getcpu();
+    int sibling = uarf_pfc_smt_sibling(cpu);
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    if (sibling >= 0) {
+        CPU_SET(sibling, &cpus);
+    }
+    // Stay on the measured CPU
+    UARF_TEST_ASSERT(sched_setaffinity(0, sizeof(cpus), &cpus) == 0);
+
+    UARF_TEST_ASSERT(uarf_pfc_session_init(&session, configs, 1, &cpus, -1) == 0);
+    uarf_pfc_session_reset(&session);
+    uarf_pfc_session_start(&session);
+    func1_loop();
+    uarf_pfc_session_stop(&session);
+    uarf_pfc_session_read(&session);
+    uarf_pfc_session_print(&session);
+
+    UARF_TEST_ASSERT(uarf_pfc_session_sum(&session, 0) >= FUNC1_LOOP_INSNS_RDPMC);
+
+    uarf_pfc_session_deinit(&session);
+    UARF_TEST_PASS();
+}
+
 uarf_psnip_declare(rdpmc, psnip_rdpmc);
 uarf_psnip_declare_define(psnip_ret, "ret\n\t");
 
@@ -342,7 +537,12 @@ UARF_TEST_SUITE() {
     UARF_TEST_RUN_CASE(man);
     UARF_TEST_RUN_CASE(basic);
     UARF_TEST_RUN_CASE(rdpmc);
+    UARF_TEST_RUN_CASE(rdpmc_safe);
     UARF_TEST_RUN_CASE(two_pmc);
+    UARF_TEST_RUN_CASE(group);
+    UARF_TEST_RUN_CASE(mux);
+    UARF_TEST_RUN_CASE(session);
+    // UARF_TEST_RUN_CASE(msr); // Needs the pi kernel module
     // UARF_TEST_RUN_CASE(raw_asm);
     return 0;
 }
@@ -9,15 +9,24 @@
  *
  * We can train a memory indirect branch using a register indirect branch. But get no
  * signal vice versa.
+ *
+ * Define SIG_PFC to observe the injection through mispredicted branches and ops that got
+ * dispatched but not retired instead of flush+reload.
  */
 
+// #define SIG_PFC
+
 #include "flush_reload.h"
 #include "jita.h"
 #include "kmod/pi.h"
 #include "lib.h"
 #include "log.h"
+#include "pfc_amd.h"
+#include "pfc_intel.h"
+#include "sig_src.h"
 #include "spec_lib.h"
 #include "test.h"
+#include "uarch.h"
 
 #include <sys/mman.h>
 
@@ -46,21 +55,18 @@ struct TestCaseData {
     bool match_history;
 };
 
-UARF_TEST_CASE_ARG(basic, arg) {
-    struct TestCaseData *data = (struct TestCaseData *) arg;
-    srand(data->seed);
-
-    // struct FrConfig fr = fr_init(8, 6, (size_t[]){0, 1, 2, 3, 5, 10});
-    UarfFrConfig fr = uarf_fr_init(8, 1, NULL);
-
+/**
+ * Run all candidates, observing the victim with `sig`.
+ *
+ * Not inlined, the labels of the asm blocks must be unique.
+ */
+static __attribute__((noinline)) void run_cands(struct TestCaseData *data,
+                                                UarfSigSrc *sig, UarfFrConfig *fr,
+                                                size_t num_train_rounds) {
     UarfStub stub_main = uarf_stub_init();
     UarfStub stub_gadget = uarf_stub_init();
     UarfStub stub_dummy = uarf_stub_init();
 
-    uarf_ibpb();
-
-    uarf_fr_reset(&fr);
-
     for (size_t c = 0; c < data->num_cands; c++) {
         uint64_t main_addr = uarf_rand47();
         uarf_jita_allocate(data->jita_gadget, &stub_gadget, uarf_rand47());
@@ -72,7 +78,7 @@ UARF_TEST_CASE_ARG(basic, arg) {
         UarfSpecData train_data = {
             .spec_prim_p = main_addr,
             .spec_dst_p_p = _ul(&stub_gadget.addr),
-            .fr_buf_p = fr.buf2.addr,
+            .fr_buf_p = fr->buf2.addr,
             .secret = 0,
             .hist = h1,
         };
@@ -80,7 +86,7 @@ UARF_TEST_CASE_ARG(basic, arg) {
         UarfSpecData signal_data = {
             .spec_prim_p = main_addr,
             .spec_dst_p_p = _ul(&stub_dummy.addr),
-            .fr_buf_p = fr.buf.addr,
+            .fr_buf_p = fr->buf.addr,
             .secret = 1,
             .hist = h2,
         };
@@ -90,7 +96,7 @@ UARF_TEST_CASE_ARG(basic, arg) {
             uarf_ibpb();
 
             uarf_jita_allocate(data->jita_train, &stub_main, main_addr);
-            for (size_t t = 0; t < data->num_train_rounds; t++) {
+            for (size_t t = 0; t < num_train_rounds; t++) {
                 asm("train:\n\t");
                 asm volatile("lea return_here%=, %%rax\n\t"
                              "pushq %%rax\n\t"
@@ -102,7 +108,7 @@ UARF_TEST_CASE_ARG(basic, arg) {
             uarf_jita_deallocate(data->jita_train, &stub_main);
 
             uarf_jita_allocate(data->jita_signal, &stub_main, main_addr);
-            uarf_fr_flush(&fr);
+            uarf_sig_src_prepare(sig);
             uarf_clflush_spec_dst(&signal_data);
             // uarf_invlpg_spec_dst(&signal_data);
             uarf_prefetcht0(&train_data);
@@ -116,16 +122,58 @@ UARF_TEST_CASE_ARG(basic, arg) {
                          "c"(&signal_data)
                          : "rax", "rdx", "rdi", "rsi", "r8", "memory");
 
-            uarf_fr_reload_binned(&fr, r);
+            uarf_sig_src_collect(sig, r);
             uarf_jita_deallocate(data->jita_signal, &stub_main);
         }
         uarf_jita_deallocate(data->jita_gadget, &stub_gadget);
         uarf_jita_deallocate(data->jita_dummy, &stub_dummy);
     }
+}
+
+UARF_TEST_CASE_ARG(basic, arg) {
+    struct TestCaseData *data = (struct TestCaseData *) arg;
+    srand(data->seed);
+
+    // struct FrConfig fr = fr_init(8, 6, (size_t[]){0, 1, 2, 3, 5, 10});
+    UarfFrConfig fr = uarf_fr_init(8, 1, NULL);
+
+    UarfSigSrc sig;
+#ifdef SIG_PFC
+    // Mispredicted branches, and ops dispatched but not retired
+    UarfPfcConfig sig_configs[] = {
+#if UARF_IS_INTEL()
+        {.pmu_conf = UARF_INTEL_BR_MISP_RETIRED_ALL_BRANCHES, .pinned = true},
+        {.pmu_conf = UARF_INTEL_UOPS_ISSUED_ANY},
+        {.pmu_conf = UARF_INTEL_UOPS_RETIRED_SLOTS},
+#elif UARF_IS_AMD()
+        {.pmu_conf = UARF_AMD_EX_RET_BRN_IND_MISP, .pinned = true},
+        {.pmu_conf = UARF_AMD_DE_SRC_OP_DISP},
+        {.pmu_conf = UARF_AMD_EX_RET_OPS},
+#endif
+    };
+    for (size_t i = 0; i < 3; i++) {
+        sig_configs[i].exclude = UARF_PFC_EXCLUDE_KERNEL;
+    }
+    UARF_TEST_ASSERT(uarf_sig_src_init_pfc(&sig, sig_configs, 3) == 0);
+    uarf_sig_src_add_diff(&sig, 1, 2);
+
+    // Without training, the victim does the same work without speculating
+    uarf_ibpb();
+    run_cands(data, &sig, &fr, 0);
+    uarf_sig_src_calibrate(&sig);
+#else
+    uarf_sig_src_init_fr(&sig, &fr);
+#endif
+
+    uarf_ibpb();
+
+    uarf_sig_src_reset(&sig);
+    run_cands(data, &sig, &fr, data->num_train_rounds);
 
-    UARF_LOG_INFO("Fr Buffer\n");
-    uarf_fr_print(&fr);
+    UARF_LOG_INFO("Signal\n");
+    uarf_sig_src_print(&sig);
 
+    uarf_sig_src_deinit(&sig);
     uarf_fr_deinit(&fr);
 
     UARF_TEST_PASS();
@@ -35,7 +35,7 @@
  * - L1:
  */
 
-#include "dll.h"
+#include "cache.h"
 #include "evict.h"
 #include "lib.h"
 #include "mem.h"
@@ -43,9 +43,6 @@
 #include "test.h"
 #include <string.h>
 
-typedef UarfDll Es;
-typedef UarfDllNode EsElem;
-
 /**
  * Get the cache set bits of p.
  */
@@ -136,11 +133,7 @@ UARF_TEST_CASE(l1_eviction) {
     uint64_t victim_page = uarf_alloc_map_or_die(PAGE_SIZE);
     void *victim = _ptr(victim_page + (random() % PAGE_SIZE));
 
-    Es es;
-    EsElem head;
-    EsElem tail;
-
-    uarf_dll_init(&es, &head, NULL, &tail, NULL);
+    Es *es;
 
     uint64_t victim_l1_set = get_l1_set(victim);
     UARF_LOG_INFO("Victim maps into L1 cache set %lu\n", victim_l1_set);
@@ -162,27 +155,23 @@ UARF_TEST_CASE(l1_eviction) {
 
     UARF_LOG_DEBUG("Trying to reduce ES\n");
     size_t es_size =
-        uarf_es_reduce(&es, victim, es_l1_effectiveness, uarf_es_access_local);
+        uarf_es_reduce_group(es, victim, cache.l1_ways, 100, es_l1_effectiveness,
+                             uarf_es_access_local);
 
     UARF_LOG_INFO("Reduced ES from %lu to %lu elements\n", ES_SIZE_INIT, es_size);
 
     UARF_LOG_INFO("ES:\n");
-    size_t i = 0;
-    uarf_dll_for_each(&es, elem) {
-        if (elem->type != UARF_DLL_NODE_TYPE_NORMAL) {
-            continue;
-        }
-        uarf_assert(_ptr(elem) == elem->data);
-        printf("%lu: %d; ", i++, elem->id);
-        print_addr_info(_ul(elem->data));
+    for (size_t i = 0; i < uarf_es_size(es); i++) {
+        printf("%lu; ", i);
+        print_addr_info(uarf_es_get(es, i));
     }
     printf("Victim; ");
     print_addr_info(_ul(victim));
 
     // Last sanity check...
-    uarf_assert(es_l1_effectiveness(&es, victim, 10, uarf_es_access_local) > 0.5);
+    uarf_assert(es_l1_effectiveness(es, victim, 10, uarf_es_access_local) > 0.5);
 
-    // TODO: free stuff
+    uarf_es_deinit(es);
     UARF_TEST_PASS();
 }
 
@@ -194,11 +183,7 @@ UARF_TEST_CASE(l2_eviction) {
 
     uarf_assert(!mlock(_ptr(victim_page), PAGE_SIZE));
 
-    Es es;
-    EsElem head;
-    EsElem tail;
-
-    uarf_dll_init(&es, &head, NULL, &tail, NULL);
+    Es *es;
 
     uint64_t victim_l2_set = get_l2_set(victim);
     UARF_LOG_INFO("Victim maps into L2 cache set %lu\n", victim_l2_set);
@@ -220,23 +205,19 @@ UARF_TEST_CASE(l2_eviction) {
 
     UARF_LOG_DEBUG("Trying to reduce ES\n");
     size_t es_size =
-        uarf_es_reduce(&es, victim, es_l2_effectiveness, uarf_es_access_local);
+        uarf_es_reduce_group(es, victim, cache.l2_ways, 100, es_l2_effectiveness,
+                             uarf_es_access_local);
     UARF_LOG_INFO("Reduced ES from %lu to %lu elements\n", ES_SIZE_INIT, es_size);
 
     UARF_LOG_INFO("ES:\n");
-    size_t i = 0;
-    uarf_dll_for_each(&es, elem) {
-        if (elem->type != UARF_DLL_NODE_TYPE_NORMAL) {
-            continue;
-        }
-        uarf_assert(_ptr(elem) == elem->data);
-        printf("%lu: %d; ", i++, elem->id);
-        print_addr_info(_ul(elem->data));
+    for (size_t i = 0; i < uarf_es_size(es); i++) {
+        printf("%lu; ", i);
+        print_addr_info(uarf_es_get(es, i));
     }
     printf("Victim; ");
     print_addr_info(_ul(victim));
 
-    // TODO: free stuff
+    uarf_es_deinit(es);
     UARF_TEST_PASS();
 }
 
@@ -244,8 +225,8 @@ UARF_TEST_SUITE() {
 
     srand(uarf_get_seed());
 
-    // Linked needs to fit into cache line
-    uarf_assert(sizeof(EsElem) < CACHE_LINE_SIZE);
+    // Links need to fit into cache line
+    uarf_assert(sizeof(UarfEsLine) < CACHE_LINE_SIZE);
 
     uarf_log_system_base_level = UARF_LOG_LEVEL_DEBUG;
 
@@ -19,9 +19,8 @@
 uint64_t victim;
 uint64_t victim_l2_set;
 
-bool cand_different_l2_set(EsElem *elem) {
-    uarf_assert(!mlock(elem->data, sizeof(EsElem)));
-    uint64_t set = uarf_get_l2_set(uarf_va_to_pa(_ul(elem->data), 0));
+bool cand_different_l2_set(uint64_t addr) {
+    uint64_t set = uarf_get_l2_set(uarf_va_to_pa(addr, 0));
     return set != victim_l2_set && set != victim_l2_set + 1 && set != victim_l2_set - 1 &&
            set != victim_l2_set + 2 && set != victim_l2_set - 2 &&
            set != victim_l2_set + 3 && set != victim_l2_set - 3 &&
@@ -62,20 +61,16 @@ UARF_TEST_CASE(basic) {
     uarf_es_init(&es, 1000000);
 
     UARF_LOG_DEBUG("Filter ES\n");
-    uarf_dll_filter(es, cand_different_l2_set);
-
-    // uarf_dll_for_each(es, elem) {
-    //     if (elem->type == UARF_DLL_NODE_TYPE_NORMAL) {
-    //         uarf_assert(uarf_get_l2_set(uarf_va_to_pa(_ul(elem->data), 0)) !=
-    //                     victim_l2_set);
-    //         uarf_assert(uarf_get_l2_set(uarf_va_to_pa(_ul(elem->data), 0)) !=
-    //                     victim_l2_set - 1);
-    //         uarf_assert(uarf_get_l2_set(uarf_va_to_pa(_ul(elem->data), 0)) !=
-    //                     victim_l2_set - 2);
-    //     }
+    uarf_es_filter(es, cand_different_l2_set);
+
+    // for (size_t i = 0; i < uarf_es_size(es); i++) {
+    //     uint64_t set = uarf_get_l2_set(uarf_va_to_pa(uarf_es_get(es, i), 0));
+    //     uarf_assert(set != victim_l2_set);
+    //     uarf_assert(set != victim_l2_set - 1);
+    //     uarf_assert(set != victim_l2_set - 2);
     // }
 
-    UARF_LOG_DEBUG("ES size: %lu\n", uarf_dll_size(es));
+    UARF_LOG_DEBUG("ES size: %lu\n", uarf_es_size(es));
 
     UARF_LOG_INFO("Access time before:\n");
 
@@ -109,6 +104,8 @@ UARF_TEST_CASE(basic) {
     uarf_lfence();
     UARF_LOG_INFO("\tVictim: %lu\n", uarf_get_access_time_a(_ptr(victim)));
 
+    uarf_es_deinit(es);
+
     UARF_TEST_PASS();
 }
 
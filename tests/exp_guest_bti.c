@@ -98,6 +98,7 @@
 #include "uarf/lib.h"
 #include "uarf/log.h"
 #include "uarf/spec_lib.h"
+#include "uarf/sprt.h"
 #include "uarf/test.h"
 
 #define ERRNO_GENERAL          1
@@ -106,6 +107,12 @@
 
 #define SECRET 5
 
+// Sequential test to stop the rounds of a candidate early, see -q
+#define SPRT_P0    0.01
+#define SPRT_P1    0.2
+#define SPRT_ALPHA 0.01
+#define SPRT_BETA  0.01
+
 // Ealuation mode enable
 //  - Continuously dump results
 //  - Instant quit on error
@@ -229,6 +236,7 @@ struct TestCaseData {
     bool fn_test;
     bool guest_interleave; // Run another guest in-between training and signaling
     enum SmtMode smt;
+    bool sprt; // Stop the rounds of a candidate once the outcome is certain
 };
 
 struct GuestData {
@@ -544,6 +552,25 @@ void run_training(struct TestCaseData *data, UarfSpecData *train_data,
     }
 }
 
+// Get the flush+reload results of the signaling domain
+uint64_t *get_signal_res(struct TestCaseData *data, Guest *g1, Guest *g2) {
+    switch (data->signal_mode) {
+    case RUN_MODE_HOST_USER:
+    case RUN_MODE_HOST_SUPERVISOR:
+        return _ptr(UARF_FRS_RES);
+    case RUN_MODE_GUEST_USER:
+    case RUN_MODE_GUEST_SUPERVISOR:
+        return addr_gva2hva(g1->vm, UARF_FRS_RES);
+    case RUN_MODE_GUEST2_USER:
+    case RUN_MODE_GUEST2_SUPERVISOR:
+        return addr_gva2hva(g2->vm, UARF_FRS_RES);
+    case RUN_MODE_NONE:
+        break;
+    }
+    uarf_assert(false);
+    return NULL;
+}
+
 void run_signal(struct TestCaseData *data, UarfSpecData *train_data,
                 UarfSpecData *signal_data, Guest *g1, Guest *g2) {
     switch (data->signal_mode) {
@@ -757,6 +784,9 @@ UARF_TEST_CASE_ARG(basic, arg) {
             break;
         }
 
+        UarfSprt sprt = uarf_sprt_init(SPRT_P0, SPRT_P1, SPRT_ALPHA, SPRT_BETA);
+        uint64_t res_base = 0;
+
         switch (data->smt) {
         case SMT_MODE_TRAIN:
             while (true) {
@@ -774,24 +804,7 @@ UARF_TEST_CASE_ARG(basic, arg) {
                     // uarf_ibpb_user();
                     usleep(1000);
                 }
-                uint64_t *res;
-                switch (data->signal_mode) {
-                case RUN_MODE_HOST_USER:
-                case RUN_MODE_HOST_SUPERVISOR:
-                    res = _ptr(UARF_FRS_RES);
-                    break;
-                case RUN_MODE_GUEST_USER:
-                case RUN_MODE_GUEST_SUPERVISOR:
-                    res = addr_gva2hva(g1.vm, UARF_FRS_RES);
-                    break;
-                case RUN_MODE_GUEST2_USER:
-                case RUN_MODE_GUEST2_SUPERVISOR:
-                    res = addr_gva2hva(g2.vm, UARF_FRS_RES);
-                    break;
-                case RUN_MODE_NONE:
-                    uarf_assert(false);
-                    break;
-                }
+                uint64_t *res = get_signal_res(data, &g1, &g2);
 
                 if (res != _ptr(UARF_FRS_RES)) {
                     if (IN_EVALUATION_MODE) {
@@ -811,6 +824,8 @@ UARF_TEST_CASE_ARG(basic, arg) {
             }
             break;
         case SMT_MODE_OFF:
+            // Host results accumulate over candidates
+            res_base = data->sprt ? get_signal_res(data, &g1, &g2)[SECRET] : 0;
             for (size_t r = 0; r < data->num_rounds; r++) {
                 run_training(data, &train_data, &signal_data, &g1, &g2,
                              data->num_train_rounds);
@@ -828,29 +843,25 @@ UARF_TEST_CASE_ARG(basic, arg) {
                 }
 
                 run_signal(data, &train_data, &signal_data, &g1, &g2);
-            }
 
-            uint64_t *res;
-            switch (data->signal_mode) {
-            case RUN_MODE_HOST_USER:
-            case RUN_MODE_HOST_SUPERVISOR:
-                res = _ptr(UARF_FRS_RES);
-                break;
-            case RUN_MODE_GUEST_USER:
-            case RUN_MODE_GUEST_SUPERVISOR:
-                res = addr_gva2hva(g1.vm, UARF_FRS_RES);
-                break;
-            case RUN_MODE_GUEST2_USER:
-            case RUN_MODE_GUEST2_SUPERVISOR:
-                res = addr_gva2hva(g2.vm, UARF_FRS_RES);
-                break;
-            case RUN_MODE_NONE:
-                uarf_assert(false);
-                break;
+                if (data->sprt) {
+                    uint64_t hits = get_signal_res(data, &g1, &g2)[SECRET] - res_base;
+                    if (uarf_sprt_update_total(&sprt, hits, r + 1) !=
+                        UARF_SPRT_UNDECIDED) {
+                        break;
+                    }
+                }
             }
 
+            uint64_t *res = get_signal_res(data, &g1, &g2);
+
             if (res != _ptr(UARF_FRS_RES)) {
-                if (IN_EVALUATION_MODE) {
+                if (IN_EVALUATION_MODE && data->sprt) {
+                    printf("%lu\t%lu\t%s\n", res[SECRET], sprt.n,
+                           uarf_sprt_decision_str(sprt.decision));
+                    uarf_frs_reset();
+                }
+                else if (IN_EVALUATION_MODE) {
                     printf("%lu\t%u\n", res[SECRET], data->num_rounds);
                     uarf_frs_reset();
                 }
@@ -1100,10 +1111,11 @@ int get_test_data_arg(uint32_t seed, int argc, char **argv) {
         .fn_test = false,
         .guest_interleave = false,
         .smt = SMT_MODE_OFF,
+        .sprt = false,
     };
 
     int opt;
-    while ((opt = getopt(argc, argv, "t:s:c:r:pnjei:a:goxyh")) != -1) {
+    while ((opt = getopt(argc, argv, "t:s:c:r:pnjei:a:goxyqh")) != -1) {
         switch (opt) {
         case 't': {
             // if (data[0].train_mode != -1) {
@@ -1203,6 +1215,10 @@ int get_test_data_arg(uint32_t seed, int argc, char **argv) {
             data[0].smt = SMT_MODE_SIGNAL;
             break;
         };
+        case 'q': {
+            data[0].sprt = true;
+            break;
+        };
         case 'h': {
             printf("Usage: [OPTIONS]\n");
             printf("\n");
@@ -1229,6 +1245,10 @@ int get_test_data_arg(uint32_t seed, int argc, char **argv) {
             printf("  -o                Enable IBRS when signaling in supervisor.\n");
             printf("  -x                Run as SMT training thread.\n");
             printf("  -y                Run as SMT signaling thread.\n");
+            printf("  -q                Stop the rounds of a candidate early once a "
+                   "sequential test\n"
+                   "                    decided, print the decision in evaluation "
+                   "mode.\n");
             printf("  -h                Show this help menu.\n");
             printf("\n");
             exit(0);
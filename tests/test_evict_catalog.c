@@ -0,0 +1,136 @@
+/**
+ * Eviction Set Catalogue Test
+ *
+ * Build a catalogue for a tiny cache geometry, save it, and load it again. Catalogues
+ * built with other parameters or corrupt ones get rejected.
+ *
+ * The threshold is 0, so no access counts as cached and every set evicts its victim.
+ * This makes building independent of timing noise and only tests the bookkeeping.
+ */
+
+#include "cache.h"
+#include "evict.h"
+#include "evict_catalog.h"
+#include "lib.h"
+#include "log.h"
+#include "test.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef UARF_LOG_TAG
+#undef UARF_LOG_TAG
+#define UARF_LOG_TAG UARF_LOG_TAG_TEST
+#endif
+
+#define CAT_PATH     "/tmp/uarf_test_evict_catalog.cat"
+#define BACKING_PATH "/dev/shm/uarf_test_evict_catalog"
+
+#define NUM_THREADS 2
+#define ARENA_PAGES 4
+#define NUM_SETS    4
+
+// Offsets of the lines of every set into the backing file
+static uint64_t victim_off[NUM_SETS];
+static size_t es_size[NUM_SETS];
+static uint64_t es_off[NUM_SETS][64];
+
+// Few sets and ways, so that every set gets plenty of lines from small arenas
+static void fake_geometry(void) {
+    uarf_assert(uarf_cache_set_l3(NUM_SETS, 4, 1));
+}
+
+// Every set is there, and in the catalogue of `loaded` if given
+static bool same_sets(UarfEsCatalog *cat, bool loaded) {
+    for (size_t set = 0; set < NUM_SETS; set++) {
+        UarfEsCatalogEntry *entry = uarf_es_catalog_entry(cat, set, 0);
+        if (!entry->es || uarf_es_size(entry->es) > cache.l3_ways) {
+            return false;
+        }
+        if (!loaded) {
+            victim_off[set] = entry->victim - cat->base;
+            es_size[set] = uarf_es_size(entry->es);
+            for (size_t i = 0; i < es_size[set]; i++) {
+                es_off[set][i] = uarf_es_get(entry->es, i) - cat->base;
+            }
+            continue;
+        }
+
+        if (entry->builder != UARF_ES_CATALOG_LOADED ||
+            entry->victim - cat->base != victim_off[set] ||
+            uarf_es_size(entry->es) != es_size[set]) {
+            return false;
+        }
+        for (size_t i = 0; i < es_size[set]; i++) {
+            if (uarf_es_get(entry->es, i) - cat->base != es_off[set][i]) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+UARF_TEST_CASE(round_trip) {
+    UarfEsCatalog cat = uarf_es_catalog_build_backed(BACKING_PATH, NUM_THREADS,
+                                                     ARENA_PAGES, NULL, 1, 0);
+    uarf_es_catalog_print_stats(&cat);
+    UARF_TEST_ASSERT(cat.num_sets == NUM_SETS);
+    UARF_TEST_ASSERT(cat.stats.num_built == NUM_SETS && !cat.stats.num_missing);
+    UARF_TEST_ASSERT(!cat.stats.num_rebuilt);
+    UARF_TEST_ASSERT(same_sets(&cat, false));
+
+    uarf_es_catalog_save(&cat, CAT_PATH);
+    uarf_es_catalog_free(&cat);
+
+    UARF_TEST_ASSERT(uarf_es_catalog_load(&cat, CAT_PATH, BACKING_PATH, NUM_THREADS,
+                                          ARENA_PAGES, NULL, 1, 0));
+    uarf_es_catalog_print_stats(&cat);
+    UARF_TEST_ASSERT(cat.stats.num_loaded == NUM_SETS && !cat.stats.num_stale);
+    UARF_TEST_ASSERT(same_sets(&cat, true));
+    uarf_es_catalog_free(&cat);
+
+    // Without a matching backing file, nothing can be reused
+    UARF_TEST_ASSERT(!uarf_es_catalog_load(&cat, CAT_PATH, CAT_PATH, NUM_THREADS,
+                                           ARENA_PAGES, NULL, 1, 0));
+
+    UARF_TEST_PASS();
+}
+
+UARF_TEST_CASE(reject) {
+    UarfEsCatalog cat;
+
+    // Built with other parameters
+    UARF_TEST_ASSERT(!uarf_es_catalog_load(&cat, CAT_PATH, BACKING_PATH, NUM_THREADS + 1,
+                                           ARENA_PAGES, NULL, 1, 0));
+    UARF_TEST_ASSERT(!uarf_es_catalog_load(&cat, CAT_PATH, BACKING_PATH, NUM_THREADS,
+                                           ARENA_PAGES * 2, NULL, 1, 0));
+
+    // A set larger than the arenas, right after the header
+    FILE *f = fopen(CAT_PATH, "r+b");
+    uarf_assert(f);
+    uint64_t hdr[6];
+    uint64_t rec[3];
+    uarf_assert(fread(hdr, sizeof(hdr), 1, f) == 1);
+    uarf_assert(fread(rec, sizeof(rec), 1, f) == 1);
+    rec[2] = UINT64_MAX / 8;
+    uarf_assert(!fseek(f, sizeof(hdr), SEEK_SET));
+    uarf_assert(fwrite(rec, sizeof(rec), 1, f) == 1);
+    fclose(f);
+    UARF_TEST_ASSERT(!uarf_es_catalog_load(&cat, CAT_PATH, BACKING_PATH, NUM_THREADS,
+                                           ARENA_PAGES, NULL, 1, 0));
+
+    UARF_TEST_PASS();
+}
+
+UARF_TEST_SUITE() {
+    uarf_assert(cache.cache_line_size);
+    fake_geometry();
+
+    UARF_TEST_RUN_CASE(round_trip);
+    UARF_TEST_RUN_CASE(reject);
+
+    unlink(CAT_PATH);
+    unlink(BACKING_PATH);
+
+    UARF_TEST_PASS();
+}
@@ -10,6 +10,7 @@
 #include "flush_reload_static.h"
 #include "log.h"
 #include "mem.h"
+#include "sig_src.h"
 #include "test.h"
 #include <stdbool.h>
 
@@ -209,6 +210,72 @@ UARF_TEST_CASE(flush_reload_bin) {
     UARF_TEST_PASS();
 }
 
+// Collect a latency histogram alongside the hits and re-apply the threshold offline
+UARF_TEST_CASE(flush_reload_hist) {
+
+    UarfFrConfig conf = uarf_fr_init(8, 1, NULL);
+    uarf_fr_hist_init(&conf, UARF_FR_HIST_LINEAR, 32, 8);
+    uarf_fr_reset(&conf);
+
+#define SECRET    1
+#define NUM_RUNDS 10
+
+    for (size_t i = 0; i < NUM_RUNDS; i++) {
+        uarf_fr_flush(&conf);
+        *(volatile uint8_t *) (conf.buf.addr + SECRET * FR_STRIDE);
+        uarf_fr_reload(&conf);
+    }
+
+    UARF_LOG_DEBUG("FR Buffer\n");
+    uarf_fr_print(&conf);
+    uarf_fr_hist_print(&conf);
+    UARF_LOG_INFO("Suggested threshold: %lu\n", uarf_fr_hist_thresh(&conf));
+
+    // Every reload lands in exactly one bucket per slot
+    uarf_fr_hist_merge(&conf);
+    for (size_t slot = 0; slot < conf.num_slots; slot++) {
+        uint64_t sum = 0;
+        for (size_t b = 0; b < conf.hist.num_buckets; b++) {
+            sum += conf.hist.p[slot * conf.hist.num_buckets + b];
+        }
+        UARF_TEST_ASSERT(sum == NUM_RUNDS);
+    }
+
+    // The bucket boundaries align with the threshold, hence the counts match exactly
+    UARF_TEST_ASSERT(FR_THRESH % 8 == 0);
+    for (size_t slot = 0; slot < conf.num_slots; slot++) {
+        UARF_TEST_ASSERT(uarf_fr_hist_hits(&conf, slot, FR_THRESH) == conf.res_p[slot]);
+    }
+
+    uarf_fr_deinit(&conf);
+
+    UARF_TEST_PASS();
+}
+
+// Flush and reload behind the signal source interface
+UARF_TEST_CASE(sig_src_fr) {
+    UarfFrConfig conf = uarf_fr_init(8, 1, NULL);
+    UarfSigSrc sig;
+    uarf_sig_src_init_fr(&sig, &conf);
+    uarf_sig_src_reset(&sig);
+
+    for (size_t i = 0; i < NUM_RUNDS; i++) {
+        uarf_sig_src_prepare(&sig);
+        *(volatile uint8_t *) (conf.buf.addr + SECRET * FR_STRIDE);
+        uarf_sig_src_collect(&sig, i);
+    }
+
+    uint64_t res[8];
+    uarf_fr_slot_hits(&conf, res);
+    UARF_TEST_ASSERT(res[SECRET] >= NUM_RUNDS - 1);
+    UARF_TEST_ASSERT(uarf_sig_src_hits(&sig) == uarf_fr_num_hits(&conf));
+
+    uarf_sig_src_deinit(&sig);
+    uarf_fr_deinit(&conf);
+
+    UARF_TEST_PASS();
+}
+
 UARF_TEST_CASE(flush_reload_static) {
     uarf_frs_init();
 
@@ -250,6 +317,8 @@ UARF_TEST_SUITE() {
     UARF_TEST_RUN_CASE(flush_reload_large);
     UARF_TEST_RUN_CASE(buffer_values);
     UARF_TEST_RUN_CASE(flush_reload_bin);
+    UARF_TEST_RUN_CASE(flush_reload_hist);
+    UARF_TEST_RUN_CASE(sig_src_fr);
     UARF_TEST_RUN_CASE(flush_reload_static);
 
     return 0;
@@ -425,6 +425,84 @@ UARF_TEST_CASE(vsnip_fill) {
     UARF_TEST_PASS();
 }
 
+// Test that vsnip_access emits the loads in order and can be executed
+UARF_TEST_CASE(vsnip_access) {
+    UarfJitaCtxt ctxt = uarf_jita_init();
+    UarfStub stub = uarf_stub_init();
+    UarfStub dump_before = uarf_stub_init();
+    UarfStub dump_after = uarf_stub_init();
+
+    uint64_t buf = _ul(uarf_alloc_random_page());
+    uint64_t addrs[4];
+    for (size_t i = 0; i < 4; i++) {
+        addrs[i] = buf + i * 64;
+    }
+
+    uarf_jita_push_psnip(&ctxt, &psnip_inc);
+    uarf_jita_push_vsnip_dump_stub(&ctxt, &dump_before);
+    uarf_jita_push_vsnip_access(&ctxt, addrs, 4, UARF_ACCESS_FBF, 2, UARF_FENCE_LFENCE);
+    uarf_jita_push_vsnip_dump_stub(&ctxt, &dump_after);
+    uarf_jita_push_psnip(&ctxt, &psnip_ret_val);
+
+    uarf_jita_allocate(&ctxt, &stub, uarf_rand47());
+
+    // 2 reps of 3 passes over 4 lines, each a 9 byte load and a 3 byte lfence
+    UARF_TEST_ASSERT(dump_after.end_addr == dump_before.end_addr + 2 * 3 * 4 * 12);
+
+    // Forward pass starts with the first line, backward pass with the last
+    uint8_t *code = (uint8_t *) dump_before.end_ptr;
+    UARF_TEST_ASSERT(code[0] == 0xa0 && *(uint64_t *) &code[1] == addrs[0]);
+    UARF_TEST_ASSERT(code[9] == 0x0f && code[10] == 0xae && code[11] == 0xe8);
+    UARF_TEST_ASSERT(*(uint64_t *) &code[4 * 12 + 1] == addrs[3]);
+
+    int (*a)(int) = (int (*)(int)) stub.ptr;
+    UARF_TEST_ASSERT(a(5) == 6);
+
+    uarf_jita_deallocate(&ctxt, &stub);
+    uarf_unmap_or_die(_ptr(buf), PAGE_SIZE);
+
+    UARF_TEST_PASS();
+}
+
+// Test that the measure vsnips time a region without disturbing the stub
+UARF_TEST_CASE(vsnip_measure) {
+    UarfJitaCtxt ctxt = uarf_jita_init();
+    UarfStub stub = uarf_stub_init();
+
+    uint64_t buf = _ul(uarf_alloc_random_page());
+    uint64_t addrs[4];
+    for (size_t i = 0; i < 4; i++) {
+        addrs[i] = buf + i * 64;
+    }
+
+    UarfMeasure m = uarf_measure_init();
+    uarf_measure_add_tsc(&m);
+    uarf_jita_measure_calibrate(&m, 100);
+    UARF_TEST_ASSERT(m.overhead[0] > 0);
+
+    uarf_jita_push_psnip(&ctxt, &psnip_inc);
+    uarf_jita_push_vsnip_measure_begin(&ctxt, &m);
+    uarf_jita_push_vsnip_access(&ctxt, addrs, 4, UARF_ACCESS_FWD, 50, UARF_FENCE_MFENCE);
+    uarf_jita_push_vsnip_measure_end(&ctxt, &m);
+    uarf_jita_push_psnip(&ctxt, &psnip_inc);
+    uarf_jita_push_psnip(&ctxt, &psnip_ret_val);
+
+    uarf_jita_allocate(&ctxt, &stub, uarf_rand47());
+
+    int (*a)(int) = (int (*)(int)) stub.ptr;
+    UARF_TEST_ASSERT(a(5) == 7);
+
+    // 200 fenced loads take longer than reading the counter
+    UARF_LOG_INFO("Overhead: %lu, region: %lu\n", m.overhead[0], uarf_measure_get(&m, 0));
+    UARF_TEST_ASSERT(uarf_measure_get(&m, 0) > 0);
+    UARF_TEST_ASSERT(m.res[0] < 1000000);
+
+    uarf_jita_deallocate(&ctxt, &stub);
+    uarf_unmap_or_die(_ptr(buf), PAGE_SIZE);
+
+    UARF_TEST_PASS();
+}
+
 /**
  * Test how we can use C code as a snippet.
  */
@@ -505,6 +583,8 @@ UARF_TEST_SUITE() {
     UARF_TEST_RUN_CASE(vsnip_jmp_near_rel_inclusive);
     UARF_TEST_RUN_CASE(vsnip_jmp_near_rel_exclusive);
     UARF_TEST_RUN_CASE(vsnip_fill);
+    UARF_TEST_RUN_CASE(vsnip_access);
+    UARF_TEST_RUN_CASE(vsnip_measure);
     UARF_TEST_RUN_CASE(psnip_c_src);
     UARF_TEST_RUN_CASE(psnip_c_src_32);
 
@@ -2,10 +2,20 @@
  * Test various functionality that has not been tested elsewhere.
  */
 
+#include "cache.h"
+#include "evict.h"
 #include "lib.h"
 #include "log.h"
+#include "mem.h"
+#include "page.h"
+#include "pfc_sample.h"
+#include "sprt.h"
 #include "test.h"
+#include "timer.h"
+#include <linux/perf_event.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
 
 #ifdef UARF_LOG_TAG
 #undef UARF_LOG_TAG
@@ -51,8 +61,270 @@ UARF_TEST_CASE(round) {
     UARF_TEST_PASS();
 }
 
+/**
+ * Test that the SPRT decides for clear signals and clear noise
+ */
+UARF_TEST_CASE(sprt) {
+    UarfSprt sprt = uarf_sprt_init(0.01, 0.5, 0.01, 0.01);
+    uarf_assert(uarf_sprt_expected_rounds(&sprt) > 1);
+
+    // Hit in every round
+    uint64_t r = 0;
+    while (uarf_sprt_update(&sprt, 1, 1) == UARF_SPRT_UNDECIDED) {
+        uarf_assert(++r < 100);
+    }
+    uarf_assert(sprt.decision == UARF_SPRT_SIGNAL);
+
+    // Decisions are final
+    uarf_assert(uarf_sprt_update(&sprt, 0, 1000) == UARF_SPRT_SIGNAL);
+
+    // Never hit
+    uarf_sprt_reset(&sprt);
+    for (r = 1; uarf_sprt_update_total(&sprt, 0, r) == UARF_SPRT_UNDECIDED; r++) {
+        uarf_assert(r < 100);
+    }
+    uarf_assert(sprt.decision == UARF_SPRT_NO_SIGNAL);
+
+    // Hitting at exactly the noise rate is no signal
+    uarf_sprt_reset(&sprt);
+    uarf_assert(uarf_sprt_update(&sprt, 10, 1000) == UARF_SPRT_NO_SIGNAL);
+
+    UARF_TEST_PASS();
+}
+
+/**
+ * Test that the page pool recycles and releases its pages
+ */
+UARF_TEST_CASE(page_pool) {
+    UarfPagePool pool = {};
+    uint64_t pages[16];
+
+    for (size_t i = 0; i < 16; i++) {
+        pages[i] = uarf_page_pool_get(&pool);
+        *(volatile uint64_t *) pages[i] = i;
+    }
+    uarf_assert(pool.num_pages == 16 && pool.num_free == 0);
+
+    // Pages get recycled instead of mapping new ones, but at fresh addresses
+    for (size_t i = 0; i < 16; i++) {
+        uarf_page_pool_put(&pool, pages[i]);
+    }
+    for (size_t i = 0; i < 8; i++) {
+        uint64_t page = uarf_page_pool_get(&pool);
+        for (size_t j = 0; j < 16; j++) {
+            uarf_assert(page != pages[j]);
+        }
+        // Still the same physical page
+        uarf_assert(*(volatile uint64_t *) page < 16);
+    }
+    uarf_assert(pool.num_pages == 16 && pool.num_free == 8);
+    uarf_assert(pool.num_recycled == 8);
+
+    // Some recycled pages get replaced by new ones
+    for (size_t i = 0; i < UARF_PAGE_POOL_REMAP_PERIOD; i++) {
+        uint64_t page = uarf_page_pool_get(&pool);
+        uarf_page_pool_put(&pool, page);
+    }
+    uarf_assert(pool.num_pages == 16 && pool.num_free == 8);
+
+    // Only the free pages get released
+    uarf_page_pool_trim(&pool);
+    uarf_assert(pool.num_pages == 8 && pool.num_free == 0);
+
+    for (size_t i = 0; i < 8; i++) {
+        uarf_page_pool_put(&pool, pool.pages[i]);
+    }
+    uarf_page_pool_deinit(&pool);
+    uarf_assert(pool.num_pages == 0 && !pool.pages);
+
+    UARF_TEST_PASS();
+}
+
+/**
+ * Test that the pool keeps track of many pages across recycling
+ */
+UARF_TEST_CASE(page_pool_many) {
+    UarfPagePool pool = {};
+    uint64_t pages[512];
+
+    for (size_t i = 0; i < 512; i++) {
+        pages[i] = uarf_page_pool_get(&pool);
+    }
+    for (size_t r = 0; r < 4; r++) {
+        for (size_t i = 0; i < 512; i++) {
+            uarf_page_pool_put(&pool, pages[i]);
+        }
+        for (size_t i = 0; i < 512; i++) {
+            pages[i] = uarf_page_pool_get(&pool);
+        }
+    }
+    UARF_TEST_ASSERT(pool.num_pages == 512 && pool.num_free == 0);
+
+    // Putting back exits for pages the pool does not know or that are already free
+    for (size_t i = 0; i < 512; i++) {
+        uarf_page_pool_put(&pool, pages[i]);
+    }
+    UARF_TEST_ASSERT(pool.num_free == 512);
+    uarf_page_pool_deinit(&pool);
+
+    UARF_TEST_PASS();
+}
+
+/**
+ * Test that the timers got calibrated at startup
+ */
+UARF_TEST_CASE(timer) {
+    uarf_timer_print();
+
+    for (UarfTimer t = 0; t < UARF_TIMER_NUM; t++) {
+        const UarfTimerCal *cal = uarf_timer_cal(t);
+        UARF_TEST_ASSERT(!cal->available || cal->min <= cal->median);
+    }
+    UARF_TEST_ASSERT(uarf_timer_cal(UARF_TIMER_TSC)->available);
+    UARF_TEST_ASSERT(uarf_timer_cal(UARF_TIMER_CLOCK)->available);
+    UARF_TEST_ASSERT(!uarf_timer_cal(UARF_TIMER_PMC)->available);
+
+    // A cached load takes longer than nothing, but not a lot longer
+    uint64_t dt = uarf_get_access_time_cached(1000);
+    UARF_TEST_ASSERT(dt >= uarf_timer_cal(UARF_TIMER_TSC)->min);
+
+    UARF_TEST_PASS();
+}
+
+/**
+ * Test parsing the sample ring buffer, filled by hand instead of the kernel
+ */
+UARF_TEST_CASE(pfc_sample) {
+    UarfPfcSampler s;
+    memset(&s, 0, sizeof(s));
+    s.pfc.map_size = 2 * PAGE_SIZE;
+    s.pfc.fd = -1;
+    s.pfc.page = mmap(NULL, s.pfc.map_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    UARF_TEST_ASSERT(s.pfc.page != MAP_FAILED);
+    s.data = (uint8_t *) s.pfc.page + PAGE_SIZE;
+    s.data_mask = PAGE_SIZE - 1;
+
+    UarfStub stub = {.addr = 0x10000, .end_addr = 0x10020};
+    UarfJitaCtxt ctxt = {.n_snips = 2, .snip_ends = {0x10, 0x20}};
+    uarf_pfc_sampler_add_jita(&s, "stub", &ctxt, &stub);
+    uarf_pfc_sampler_add_region(&s, "fixed", 0x20000, 0x100);
+
+    // Start close to the end of the ring, so that records wrap around
+    struct perf_event_mmap_page *page = s.pfc.page;
+    uint64_t head = PAGE_SIZE - 32;
+    page->data_tail = head;
+    uint64_t ips[] = {0x10000, 0x10004, 0x10018, 0x200ff, 0x20100, 0xffff};
+    for (size_t i = 0; i < sizeof(ips) / sizeof(ips[0]); i++) {
+        struct perf_event_header hdr = {.type = PERF_RECORD_SAMPLE, .size = 16};
+        memcpy(&s.data[head & s.data_mask], &hdr, sizeof(hdr));
+        memcpy(&s.data[(head + 8) & s.data_mask], &ips[i], sizeof(uint64_t));
+        head += hdr.size;
+    }
+    struct perf_event_header lost = {.type = PERF_RECORD_LOST, .size = 24};
+    uint64_t num_lost = 3;
+    memcpy(&s.data[head & s.data_mask], &lost, sizeof(lost));
+    memcpy(&s.data[(head + 16) & s.data_mask], &num_lost, sizeof(uint64_t));
+    head += lost.size;
+    page->data_head = head;
+
+    UARF_TEST_ASSERT(uarf_pfc_sampler_drain(&s) == 6);
+    UARF_TEST_ASSERT(page->data_tail == head);
+    UARF_TEST_ASSERT(uarf_pfc_sampler_drain(&s) == 0);
+    uarf_pfc_sampler_print(&s);
+
+    UARF_TEST_ASSERT(s.num_samples == 6 && s.num_other == 2 && s.num_lost == 3);
+    UARF_TEST_ASSERT(s.regions[0].num_samples == 3 && s.regions[1].num_samples == 1);
+    UARF_TEST_ASSERT(uarf_pfc_sampler_snip_samples(&s.regions[0], 0) == 2);
+    UARF_TEST_ASSERT(uarf_pfc_sampler_snip_samples(&s.regions[0], 1) == 1);
+    UARF_TEST_ASSERT(s.regions[1].hist[0xff] == 1);
+
+    uarf_pfc_sampler_clear(&s);
+    UARF_TEST_ASSERT(!s.num_samples && !s.regions[0].hist[0]);
+    uarf_pfc_sampler_deinit(&s);
+
+    UARF_TEST_PASS();
+}
+
+#define REDUCE_LINES 64
+#define REDUCE_WAYS  4
+
+// Lines the oracle needs for eviction, the last one is in the last group
+static const size_t reduce_needed[REDUCE_WAYS] = {3, 20, 41, REDUCE_LINES - 1};
+static uint64_t reduce_addrs[REDUCE_LINES];
+
+/**
+ * Evicts with all needed lines, and also claims to evict right after removing the last
+ * group on the first level, which misses the last needed line.
+ */
+static float reduce_oracle(Es *es, void *victim, size_t reps,
+                           void es_access(Es *es, size_t num_rep)) {
+    (void) victim, (void) reps, (void) es_access;
+    size_t num_needed = 0;
+    for (size_t i = 0; i < uarf_es_size(es); i++) {
+        for (size_t j = 0; j < REDUCE_WAYS; j++) {
+            num_needed += uarf_es_get(es, i) == reduce_addrs[reduce_needed[j]];
+        }
+    }
+    size_t last_group = REDUCE_LINES - REDUCE_WAYS * (REDUCE_LINES / (REDUCE_WAYS + 1));
+    bool lie = num_needed == REDUCE_WAYS - 1 &&
+               uarf_es_size(es) == REDUCE_LINES - last_group;
+    return num_needed == REDUCE_WAYS || lie;
+}
+
+/**
+ * Test that group reduction backtracks past a group that only seemed removable
+ */
+UARF_TEST_CASE(es_reduce_group) {
+    uint8_t *buf = aligned_alloc(PAGE_SIZE, REDUCE_LINES * PAGE_SIZE);
+    uarf_assert(buf);
+    for (size_t i = 0; i < REDUCE_LINES; i++) {
+        reduce_addrs[i] = _ul(buf + i * PAGE_SIZE);
+    }
+
+    Es *es;
+    uarf_es_init_addrs(&es, reduce_addrs, REDUCE_LINES);
+    size_t size = uarf_es_reduce_group(es, NULL, REDUCE_WAYS, 1, reduce_oracle,
+                                       uarf_es_access_fbf);
+    UARF_TEST_ASSERT(size == REDUCE_WAYS);
+    UARF_TEST_ASSERT(reduce_oracle(es, NULL, 1, uarf_es_access_fbf) == 1);
+
+    uarf_es_deinit(es);
+    free(buf);
+    UARF_TEST_PASS();
+}
+
+/**
+ * Test that the L3 set bits are the ones of a single slice
+ */
+UARF_TEST_CASE(cache_l3) {
+    UarfCache saved = cache;
+
+    // Intel client, 8 slices of 2048 sets
+    UARF_TEST_ASSERT(uarf_cache_set_l3(16384, 16, 8) && cache.l3_set_bits == 11);
+    UARF_TEST_ASSERT(cache.l3_set_mask == 0x7ff * cache.cache_line_size);
+    // Zen 4 CCX, 8 slices of 4096 sets
+    UARF_TEST_ASSERT(uarf_cache_set_l3(32768, 16, 8) && cache.l3_set_bits == 12);
+    // 10 slices of 2048 sets
+    UARF_TEST_ASSERT(uarf_cache_set_l3(20480, 12, 10) && cache.l3_set_bits == 11);
+    UARF_TEST_ASSERT(uarf_cache_set_l3(2048, 16, 1) && cache.l3_set_bits == 11);
+
+    UARF_TEST_ASSERT(!uarf_cache_set_l3(245760, 16, 1) && cache.l3_set_bits == 0);
+    UARF_TEST_ASSERT(!uarf_cache_set_l3(20480, 12, 3) && cache.l3_set_mask == 0);
+
+    cache = saved;
+    UARF_TEST_PASS();
+}
+
 UARF_TEST_SUITE() {
     UARF_TEST_RUN_CASE(round);
+    UARF_TEST_RUN_CASE(sprt);
+    UARF_TEST_RUN_CASE(page_pool);
+    UARF_TEST_RUN_CASE(page_pool_many);
+    UARF_TEST_RUN_CASE(timer);
+    UARF_TEST_RUN_CASE(pfc_sample);
+    UARF_TEST_RUN_CASE(es_reduce_group);
+    UARF_TEST_RUN_CASE(cache_l3);
 
     return 0;
 }
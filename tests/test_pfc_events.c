@@ -0,0 +1,60 @@
+/**
+ * Event Catalogue Test
+ *
+ * Look up every event of the catalogue through the perfect hash table.
+ */
+
+#include "lib.h"
+#include "log.h"
+#include "pfc_amd.h"
+#include "pfc_events.h"
+#include "pfc_intel.h"
+#include "test.h"
+#include <string.h>
+
+#ifdef UARF_LOG_TAG
+#undef UARF_LOG_TAG
+#define UARF_LOG_TAG UARF_LOG_TAG_TEST
+#endif
+
+UARF_TEST_CASE(lookup_all) {
+    for (size_t i = 0; i < uarf_pfc_num_events; i++) {
+        const UarfPfcEvent *ev = &uarf_pfc_events[i];
+        UARF_TEST_ASSERT(uarf_pfc_event_lookup(ev->uarch, ev->name) == ev);
+    }
+
+    UARF_TEST_PASS();
+}
+
+UARF_TEST_CASE(lookup) {
+    // Same encodings as the compile-time macros
+    const UarfPfcEvent *ev = uarf_pfc_event_lookup(ZEN4, "ex_ret_brn_ind_misp");
+    UARF_TEST_ASSERT(ev && ev->pmu_conf == UARF_AMD_EX_RET_BRN_IND_MISP);
+    ev = uarf_pfc_event_lookup(ALDER_LAKE, "inst_retired.prec_dist");
+    UARF_TEST_ASSERT(ev && ev->pmu_conf == UARF_INTEL_INST_RETIRED_PREC_DIST);
+    ev = uarf_pfc_event_lookup(ALDER_LAKE, "uops_issued.any");
+    UARF_TEST_ASSERT(ev && ev->pmu_conf == UARF_INTEL_UOPS_ISSUED_ANY);
+
+    // Encodings differ between microarchitectures
+    const char *walk = "itlb_misses.walk_completed";
+    const UarfPfcEvent *cfl = uarf_pfc_event_lookup(COFFEE_LAKE, walk);
+    const UarfPfcEvent *rpl = uarf_pfc_event_lookup(RAPTOR_LAKE, walk);
+    UARF_TEST_ASSERT(cfl && rpl && cfl->pmu_conf != rpl->pmu_conf);
+
+    // Unknown names and events of another microarchitecture
+    UARF_TEST_ASSERT(!uarf_pfc_event_lookup(ZEN4, "ex_ret_brn_ind"));
+    UARF_TEST_ASSERT(!uarf_pfc_event_lookup(ZEN2, "ex_ret_ind_brch_instr"));
+    UARF_TEST_ASSERT(!uarf_pfc_event_lookup(ZEN4, "inst_retired.any_p"));
+    UARF_TEST_ASSERT(!uarf_pfc_event_lookup(0, "ex_ret_instr"));
+
+    UARF_LOG_INFO("Host: %s\n", uarf_pfc_uarch_str(uarf_pfc_host_uarch()));
+
+    UARF_TEST_PASS();
+}
+
+UARF_TEST_SUITE() {
+    UARF_TEST_RUN_CASE(lookup_all);
+    UARF_TEST_RUN_CASE(lookup);
+
+    UARF_TEST_PASS();
+}
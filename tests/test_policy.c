@@ -0,0 +1,138 @@
+/**
+ * Replacement Policy Test
+ *
+ * Parse access patterns and check the policy simulators on patterns that tell them apart.
+ * Check the code timing the probes of a pattern.
+ */
+
+#include "jita.h"
+#include "lib.h"
+#include "log.h"
+#include "mem.h"
+#include "policy.h"
+#include "test.h"
+#include <string.h>
+
+#ifdef UARF_LOG_TAG
+#undef UARF_LOG_TAG
+#define UARF_LOG_TAG UARF_LOG_TAG_TEST
+#endif
+
+// Fill 4 ways, hit the first line and replace one line
+#define PATTERN "A B C D A E A? B?"
+
+UARF_TEST_CASE(parse) {
+    UarfPolicyPattern pat;
+
+    UARF_TEST_ASSERT(uarf_policy_parse(&pat, "  A B1  A? long_name? "));
+    UARF_TEST_ASSERT(pat.num_steps == 4);
+    UARF_TEST_ASSERT(pat.num_lines == 3);
+    UARF_TEST_ASSERT(pat.num_probes == 2);
+    UARF_TEST_ASSERT(pat.steps[2].line == 0 && pat.steps[2].probe);
+    UARF_TEST_ASSERT(pat.steps[3].line == 2 && pat.steps[3].probe);
+    UARF_TEST_ASSERT(!strcmp(pat.names[2], "long_name"));
+
+    UARF_TEST_ASSERT(!uarf_policy_parse(&pat, "A ? B"));
+    UARF_TEST_ASSERT(!uarf_policy_parse(&pat, "   "));
+
+    UARF_TEST_PASS();
+}
+
+UARF_TEST_CASE(simulate) {
+    UarfPolicyPattern pat;
+    bool hit[2];
+    uarf_assert(uarf_policy_parse(&pat, PATTERN));
+
+    // E replaces B, the least recently used line
+    uarf_policy_simulate(UARF_POLICY_LRU, 4, &pat, hit);
+    UARF_TEST_ASSERT(hit[0] && !hit[1]);
+
+    // E replaces A, the first inserted line, then A replaces B
+    uarf_policy_simulate(UARF_POLICY_FIFO, 4, &pat, hit);
+    UARF_TEST_ASSERT(!hit[0] && !hit[1]);
+
+    // The tree points away from A and D, so E replaces C
+    uarf_policy_simulate(UARF_POLICY_TREE_PLRU, 4, &pat, hit);
+    UARF_TEST_ASSERT(hit[0] && hit[1]);
+
+    // All lines but A age to 3, E replaces the leftmost, B
+    uarf_policy_simulate(UARF_POLICY_QLRU_M1, 4, &pat, hit);
+    UARF_TEST_ASSERT(hit[0] && !hit[1]);
+
+    // With more ways than lines, everything hits
+    for (UarfPolicy policy = 0; policy < UARF_POLICY_NUM; policy++) {
+        uarf_policy_simulate(policy, 8, &pat, hit);
+        UARF_TEST_ASSERT(hit[0] && hit[1]);
+    }
+
+    UARF_TEST_PASS();
+}
+
+UARF_TEST_CASE(match) {
+    UarfPolicyPattern pat;
+    uarf_assert(uarf_policy_parse(&pat, PATTERN));
+
+    // Measured like FIFO, with some noise
+    uint32_t hits[2] = {10, 3};
+    UarfPolicyMatch match = uarf_policy_match(&pat, 4, hits, 100);
+    UARF_TEST_ASSERT(match.best == UARF_POLICY_FIFO);
+    UARF_TEST_ASSERT(match.score[UARF_POLICY_FIFO] == 1);
+    UARF_TEST_ASSERT(match.score[UARF_POLICY_TREE_PLRU] == 0);
+
+    // Tree-PLRU needs a power of two ways
+    match = uarf_policy_match(&pat, 6, hits, 100);
+    UARF_TEST_ASSERT(match.score[UARF_POLICY_TREE_PLRU] < 0);
+
+    UARF_TEST_PASS();
+}
+
+// Test that vsnip_timed_access loads in order and only times the probes
+UARF_TEST_CASE(timed_access) {
+    UarfJitaCtxt ctxt = uarf_jita_init();
+    UarfStub stub = uarf_stub_init();
+
+    uint64_t buf = _ul(uarf_alloc_random_page());
+    uint64_t addrs[4];
+    for (size_t i = 0; i < 4; i++) {
+        addrs[i] = buf + i * 64;
+    }
+    bool probe[4] = {false, true, false, true};
+
+    uarf_jita_push_vsnip_timed_access(&ctxt, addrs, probe, 4);
+    uarf_jita_push_vsnip_ret(&ctxt);
+    uarf_jita_allocate(&ctxt, &stub, uarf_rand47());
+
+    // Plain accesses are a 9 byte load and a 3 byte lfence, probes take 39 bytes
+    uint8_t *code = (uint8_t *) stub.ptr;
+    UARF_TEST_ASSERT(code[0] == 0xa0 && *(uint64_t *) &code[1] == addrs[0]);
+    UARF_TEST_ASSERT(code[9] == 0x0f && code[10] == 0xae && code[11] == 0xe8);
+
+    // Probes write to consecutive slots of the array in rdi
+    uint8_t *p = &code[12];
+    UARF_TEST_ASSERT(p[0] == 0x48 && p[1] == 0xbe && *(uint64_t *) &p[2] == addrs[1]);
+    UARF_TEST_ASSERT(p[33] == 0x89 && p[34] == 0x87 && *(uint32_t *) &p[35] == 0);
+    UARF_TEST_ASSERT(*(uint64_t *) &code[12 + 39 + 1] == addrs[2]);
+    p = &code[12 + 39 + 12];
+    UARF_TEST_ASSERT(*(uint64_t *) &p[2] == addrs[3] && *(uint32_t *) &p[35] == 4);
+    UARF_TEST_ASSERT(p[39] == 0xc3);
+
+    uint32_t times[3] = {0, 0, UINT32_MAX};
+    ((void (*)(uint32_t *)) stub.ptr)(times);
+    UARF_TEST_ASSERT(times[0] && times[1]);
+    // Nothing written beyond the probes
+    UARF_TEST_ASSERT(times[2] == UINT32_MAX);
+
+    uarf_jita_deallocate(&ctxt, &stub);
+    uarf_unmap_or_die(_ptr(buf), PAGE_SIZE);
+
+    UARF_TEST_PASS();
+}
+
+UARF_TEST_SUITE() {
+    UARF_TEST_RUN_CASE(parse);
+    UARF_TEST_RUN_CASE(simulate);
+    UARF_TEST_RUN_CASE(match);
+    UARF_TEST_RUN_CASE(timed_access);
+
+    UARF_TEST_PASS();
+}
@@ -0,0 +1,141 @@
+/**
+ * Reduction Test
+ *
+ * Compare all available reduction implementations against the scalar one.
+ */
+
+#include "lib.h"
+#include "log.h"
+#include "reduce.h"
+#include "test.h"
+#include <string.h>
+
+#define NUM_ROWS 7
+#define NUM_COLS 259
+
+static uint32_t m[NUM_ROWS * NUM_COLS];
+static uint64_t m64[NUM_ROWS * NUM_COLS];
+
+static UarfReduceImplType impls[] = {
+    UARF_REDUCE_IMPL_SCALAR,
+    UARF_REDUCE_IMPL_AVX2,
+    UARF_REDUCE_IMPL_AVX512,
+};
+
+// Fill the matrices with random values, some of them large and many equal
+static void fill_random(void) {
+    for (size_t i = 0; i < NUM_ROWS * NUM_COLS; i++) {
+        m[i] = (rand() % 4 == 0) ? (uint32_t) rand() << 1 : (uint32_t) rand() % 16;
+        m64[i] = (_ul(m[i]) << 32) | m[i];
+    }
+}
+
+// Sums agree with a naive reference
+UARF_TEST_CASE(sums) {
+    uint64_t ref_sum = 0;
+    uint64_t ref_rows[NUM_ROWS] = {0};
+    uint64_t ref_cols[NUM_COLS] = {0};
+    for (size_t row = 0; row < NUM_ROWS; row++) {
+        for (size_t col = 0; col < NUM_COLS; col++) {
+            ref_sum += m[row * NUM_COLS + col];
+            ref_rows[row] += m[row * NUM_COLS + col];
+            ref_cols[col] += m[row * NUM_COLS + col];
+        }
+    }
+
+    for (size_t i = 0; i < sizeof(impls) / sizeof(*impls); i++) {
+        if (uarf_reduce_select(impls[i]) != impls[i]) {
+            UARF_LOG_INFO("Skip unsupported %d\n", impls[i]);
+            continue;
+        }
+        UARF_LOG_DEBUG("Check %s\n", uarf_reduce_impl_name());
+
+        uint64_t rows[NUM_ROWS];
+        uint64_t cols[NUM_COLS];
+        uarf_reduce_row_sums(m, NUM_ROWS, NUM_COLS, rows);
+        uarf_reduce_col_sums(m, NUM_ROWS, NUM_COLS, cols);
+
+        UARF_TEST_ASSERT(uarf_reduce_sum(m, NUM_ROWS * NUM_COLS) == ref_sum);
+        UARF_TEST_ASSERT(!memcmp(rows, ref_rows, sizeof(rows)));
+        UARF_TEST_ASSERT(!memcmp(cols, ref_cols, sizeof(cols)));
+    }
+
+    UARF_TEST_PASS();
+}
+
+// Argmax finds the first maximum and detects ties
+UARF_TEST_CASE(argmax) {
+    for (size_t i = 0; i < sizeof(impls) / sizeof(*impls); i++) {
+        if (uarf_reduce_select(impls[i]) != impls[i]) {
+            continue;
+        }
+
+        for (size_t n = 1; n < NUM_COLS; n++) {
+            size_t ref = 0;
+            for (size_t j = 1; j < n; j++) {
+                ref = m[j] > m[ref] ? j : ref;
+            }
+            bool ref_tie = false;
+            for (size_t j = ref + 1; j < n; j++) {
+                ref_tie |= m[j] == m[ref];
+            }
+
+            bool is_tie;
+            UARF_TEST_ASSERT(uarf_reduce_argmax(m, n, &is_tie) == ref);
+            UARF_TEST_ASSERT(is_tie == ref_tie);
+
+            UARF_TEST_ASSERT(uarf_reduce_argmax_u64(m64, n, &is_tie) == ref);
+            UARF_TEST_ASSERT(is_tie == ref_tie);
+        }
+    }
+
+    uint32_t tie[] = {0, 5, 1, 5};
+    bool is_tie;
+    UARF_TEST_ASSERT(uarf_reduce_argmax(tie, 4, &is_tie) == 1);
+    UARF_TEST_ASSERT(is_tie);
+    UARF_TEST_ASSERT(uarf_reduce_argmax(tie, 3, &is_tie) == 1);
+    UARF_TEST_ASSERT(!is_tie);
+
+    UARF_TEST_PASS();
+}
+
+// Top-k is sorted by value, then by index
+UARF_TEST_CASE(top_k) {
+    const size_t K = 10;
+    size_t idx[K];
+    size_t idx64[K];
+
+    UARF_TEST_ASSERT(uarf_reduce_top_k(m, NUM_COLS, K, idx) == K);
+    UARF_TEST_ASSERT(uarf_reduce_top_k_u64(m64, NUM_COLS, K, idx64) == K);
+    UARF_TEST_ASSERT(!memcmp(idx, idx64, sizeof(idx)));
+
+    // The k-th largest is at least as large as any element not in the top-k
+    for (size_t j = 0; j < NUM_COLS; j++) {
+        bool in_top = false;
+        for (size_t i = 0; i < K; i++) {
+            in_top |= idx[i] == j;
+        }
+        UARF_TEST_ASSERT(in_top || m[j] <= m[idx[K - 1]]);
+    }
+    for (size_t i = 1; i < K; i++) {
+        UARF_TEST_ASSERT(m[idx[i - 1]] > m[idx[i]] ||
+                         (m[idx[i - 1]] == m[idx[i]] && idx[i - 1] < idx[i]));
+    }
+
+    uint32_t small[] = {3, 1, 3};
+    UARF_TEST_ASSERT(uarf_reduce_top_k(small, 3, K, idx) == 3);
+    UARF_TEST_ASSERT(idx[0] == 0 && idx[1] == 2 && idx[2] == 1);
+
+    UARF_TEST_PASS();
+}
+
+UARF_TEST_SUITE() {
+    srand(uarf_get_seed());
+    fill_random();
+
+    UARF_TEST_RUN_CASE(sums);
+    UARF_TEST_RUN_CASE(argmax);
+    UARF_TEST_RUN_CASE(top_k);
+
+    UARF_TEST_PASS();
+}
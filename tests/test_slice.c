@@ -0,0 +1,134 @@
+/**
+ * Slice Hash Test
+ *
+ * Solve for known XOR hashes from synthetic addresses.
+ */
+
+#include "cache.h"
+#include "lib.h"
+#include "log.h"
+#include "slice.h"
+#include "test.h"
+
+#ifdef UARF_LOG_TAG
+#undef UARF_LOG_TAG
+#define UARF_LOG_TAG UARF_LOG_TAG_TEST
+#endif
+
+#define NUM_ADDRS 512
+#define MIN_BIT   17
+#define MAX_BIT   39
+
+static uint64_t pa[NUM_ADDRS];
+static uint64_t group[NUM_ADDRS];
+
+// Random physical address in the same cache set
+static uint64_t rand_pa(void) {
+    return (uarf_rand47() & (BIT(MAX_BIT + 1) - 1) & ~(BIT(MIN_BIT) - 1)) | 0x1c0;
+}
+
+// Solve for `ref` with the slices relabeled, and check that we get the same partition
+static bool solves(const UarfSliceHash *ref) {
+    for (size_t i = 0; i < NUM_ADDRS; i++) {
+        pa[i] = rand_pa();
+        group[i] = uarf_slice_hash_apply(ref, pa[i]) ^ 0x5;
+    }
+
+    UarfSliceHash hash;
+    if (!uarf_slice_hash_solve(&hash, pa, group, NUM_ADDRS, MIN_BIT, MAX_BIT)) {
+        return false;
+    }
+    if (hash.num_bits != ref->num_bits) {
+        return false;
+    }
+
+    for (size_t i = 0; i < 1000; i++) {
+        uint64_t a = rand_pa();
+        uint64_t b = rand_pa();
+        bool same_ref = uarf_slice_hash_apply(ref, a) == uarf_slice_hash_apply(ref, b);
+        bool same = uarf_slice_hash_apply(&hash, a) == uarf_slice_hash_apply(&hash, b);
+        if (same != same_ref) {
+            return false;
+        }
+    }
+    return true;
+}
+
+UARF_TEST_CASE(solve) {
+    UarfSliceHash ref = {
+        .num_bits = 3,
+        .masks = {0x1b5d5a4000ul, 0x2eb5d60000ul, 0x3cccc00000ul},
+    };
+    UARF_TEST_ASSERT(solves(&ref));
+
+    // Random hashes, bit MIN_BIT + i only occurs in mask i to keep them independent
+    for (size_t r = 0; r < 20; r++) {
+        ref.num_bits = 1 + r % 4;
+        for (size_t i = 0; i < ref.num_bits; i++) {
+            ref.masks[i] = (rand_pa() & ~(0xful << MIN_BIT)) | BIT(MIN_BIT + i);
+        }
+        UARF_TEST_ASSERT(solves(&ref));
+    }
+
+    UARF_TEST_PASS();
+}
+
+// Groups that are not consistent with an XOR hash are rejected
+UARF_TEST_CASE(inconsistent) {
+    for (size_t i = 0; i < NUM_ADDRS; i++) {
+        pa[i] = rand_pa();
+        group[i] = rand() % 4;
+    }
+
+    UarfSliceHash hash;
+    UARF_TEST_ASSERT(!uarf_slice_hash_solve(&hash, pa, group, NUM_ADDRS, MIN_BIT, MAX_BIT));
+
+    UARF_TEST_PASS();
+}
+
+// The hash uses the bits right above the set index of a slice, on an L3 whose sets over
+// all slices are a power of two, like Intel client parts with 8 slices of 2048 sets
+UARF_TEST_CASE(solve_set) {
+    UarfCache saved = cache;
+    uarf_assert(uarf_cache_set_l3(16384, 16, 8));
+    uint8_t min_bit = cache.cache_line_bits + cache.l3_set_bits;
+    UARF_TEST_ASSERT(min_bit == MIN_BIT);
+
+    UarfSliceHash ref = {
+        .num_bits = 3,
+        .masks = {0x1b5d5a0000ul | BIT(17), 0x2eb5d40000ul, 0x3cccc80000ul},
+    };
+    for (size_t i = 0; i < NUM_ADDRS; i++) {
+        pa[i] = rand_pa();
+        group[i] = uarf_slice_hash_apply(&ref, pa[i]);
+    }
+
+    UarfSliceHash hash;
+    UARF_TEST_ASSERT(uarf_slice_hash_solve_set(&hash, pa, group, NUM_ADDRS));
+    UARF_TEST_ASSERT(hash.num_bits == ref.num_bits);
+    for (size_t i = 0; i < NUM_ADDRS; i++) {
+        for (size_t j = 0; j < 16; j++) {
+            bool same_ref = group[i] == group[j];
+            bool same = uarf_slice_hash_apply(&hash, pa[i]) ==
+                        uarf_slice_hash_apply(&hash, pa[j]);
+            UARF_TEST_ASSERT(same == same_ref);
+        }
+    }
+
+    // Taking the bits of all sets skips bits 17 to 19, which the hash needs
+    uarf_assert(uarf_cache_set_l3(16384, 16, 1));
+    UARF_TEST_ASSERT(!uarf_slice_hash_solve_set(&hash, pa, group, NUM_ADDRS));
+
+    cache = saved;
+    UARF_TEST_PASS();
+}
+
+UARF_TEST_SUITE() {
+    srand(uarf_get_seed());
+
+    UARF_TEST_RUN_CASE(solve);
+    UARF_TEST_RUN_CASE(inconsistent);
+    UARF_TEST_RUN_CASE(solve_set);
+
+    UARF_TEST_PASS();
+}
@@ -0,0 +1,124 @@
+/**
+ * TLB Eviction Set Test
+ *
+ * Check that calibrated L2 TLB eviction sets make the page walk of a victim visible in
+ * its access time, for loads and for instruction fetches.
+ *
+ * Evicting only from the L1 TLBs costs too little to tell apart reliably.
+ */
+
+#include "jita.h"
+#include "lib.h"
+#include "log.h"
+#include "mem.h"
+#include "page.h"
+#include "test.h"
+#include "tlb.h"
+
+#ifdef UARF_LOG_TAG
+#undef UARF_LOG_TAG
+#define UARF_LOG_TAG UARF_LOG_TAG_TEST
+#endif
+
+#define TRIALS 101
+
+// The last line of the victim page, no ES line shares its cache set
+#define VICTIM_OFFSET (PAGE_SIZE - 64)
+
+static uint64_t median_time(UarfTlbEs *tes, uint64_t victim, bool evict) {
+    uint64_t times[TRIALS];
+
+    for (size_t t = 0; t < TRIALS; t++) {
+        uint64_t (*time)(void *) = tes->stubs ? uarf_tlb_time_exec : uarf_tlb_time_load;
+        time(_ptr(victim));
+        if (evict) {
+            uarf_tlb_es_access(tes);
+        }
+        times[t] = time(_ptr(victim));
+    }
+
+    for (size_t i = 1; i < TRIALS; i++) {
+        for (size_t j = i; j > 0 && times[j - 1] > times[j]; j--) {
+            uint64_t tmp = times[j];
+            times[j] = times[j - 1];
+            times[j - 1] = tmp;
+        }
+    }
+    return times[TRIALS / 2];
+}
+
+UARF_TEST_CASE(geometry) {
+    UarfTlbGeometry *geos[] = {&tlb.l1d, &tlb.l1i, &tlb.l2};
+
+    for (size_t i = 0; i < 3; i++) {
+        UARF_TEST_ASSERT(geos[i]->sets && geos[i]->ways);
+    }
+
+    // Consecutive pages go to consecutive sets
+    UarfTlbGeometry geo = {.sets = 16, .ways = 4};
+    UARF_TEST_ASSERT(uarf_tlb_set(&geo, 0x1000) == 1);
+    UARF_TEST_ASSERT(uarf_tlb_set(&geo, 0x10000) == 0);
+
+    // With XOR index, the next group of VPN bits flips the set
+    geo.xor_index = true;
+    UARF_TEST_ASSERT(uarf_tlb_set(&geo, 0x1000) == 1);
+    UARF_TEST_ASSERT(uarf_tlb_set(&geo, 0x11000) == 0);
+    UARF_TEST_ASSERT(uarf_tlb_set(&geo, 0x10000) == 1);
+
+    UARF_TEST_PASS();
+}
+
+UARF_TEST_CASE(stlb) {
+    uint64_t page = uarf_alloc_map_or_die(PAGE_SIZE);
+    uint64_t victim = page + VICTIM_OFFSET;
+    *(volatile uint8_t *) _ptr(victim) = 1;
+
+    UarfTlbEs tes = uarf_tlb_es_init(UARF_TLB_L2, victim, 16 * tlb.l2.ways);
+    UARF_TEST_ASSERT(uarf_tlb_es_calibrate(&tes, victim, TRIALS));
+
+    uint64_t hot = median_time(&tes, victim, false);
+    uint64_t evicted = median_time(&tes, victim, true);
+    UARF_LOG_INFO("Load with hot translation: %lu, evicted: %lu\n", hot, evicted);
+    UARF_TEST_ASSERT(evicted > hot);
+
+    // The calibrated threshold tells an evicted translation apart
+    size_t num_evicted = 0;
+    for (size_t t = 0; t < TRIALS; t++) {
+        num_evicted += uarf_tlb_es_evicted(&tes, victim);
+    }
+    UARF_LOG_INFO("Evicted in %lu of %u trials\n", num_evicted, TRIALS);
+    UARF_TEST_ASSERT(num_evicted > TRIALS / 2);
+
+    uarf_tlb_es_deinit(&tes);
+    uarf_unmap_or_die(_ptr(page), PAGE_SIZE);
+    UARF_TEST_PASS();
+}
+
+UARF_TEST_CASE(stlb_code) {
+    UarfJitaCtxt ctxt = uarf_jita_init();
+    UarfStub stub = uarf_stub_init();
+    uarf_jita_push_vsnip_ret(&ctxt);
+    uarf_jita_allocate(&ctxt, &stub, ALIGN_DOWN(uarf_rand47(), PAGE_SIZE) + VICTIM_OFFSET);
+    uint64_t victim = stub.addr;
+
+    // Fetches are noisier than loads, check with the uncalibrated pattern
+    UarfTlbEs tes = uarf_tlb_es_init(UARF_TLB_L2_CODE, victim, 32 * tlb.l2.ways);
+    uint64_t hot = median_time(&tes, victim, false);
+    uint64_t evicted = median_time(&tes, victim, true);
+    UARF_LOG_INFO("Call with hot translation: %lu, evicted: %lu\n", hot, evicted);
+    UARF_TEST_ASSERT(evicted > hot);
+
+    UARF_TEST_ASSERT(uarf_tlb_es_calibrate(&tes, victim, TRIALS));
+
+    uarf_tlb_es_deinit(&tes);
+    uarf_stub_free(&stub);
+    UARF_TEST_PASS();
+}
+
+UARF_TEST_SUITE() {
+    UARF_TEST_RUN_CASE(geometry);
+    UARF_TEST_RUN_CASE(stlb);
+    UARF_TEST_RUN_CASE(stlb_code);
+
+    UARF_TEST_PASS();
+}
@@ -73,7 +73,7 @@ for t in all_data_files:
     )
 
     # TODO: Assert that format is correct
-    hits, total = map(int, open(cmp_file, "r").read().strip().split("\t"))
+    hits, total = map(int, open(cmp_file, "r").read().strip().split("\t")[:2])
     signal = hits / total
 
     x = domains.index(td)
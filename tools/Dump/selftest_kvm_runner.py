@@ -6,6 +6,7 @@ Runner script for the guest bti experiment
 
 import argparse
 import itertools
+import math
 import os
 import platform
 import subprocess
@@ -43,6 +44,48 @@ class Domain(Enum):
     GS = "GS"
 
 
+class Sprt:
+    """
+    Sequential probability ratio test on the hit rate, mirrors `include/sprt.h`.
+
+    Attributes:
+        p0: Hit rate without a signal.
+        p1: Hit rate with a signal.
+        alpha: False positive rate.
+        beta: False negative rate.
+    """
+
+    def __init__(self, p0: float, p1: float, alpha: float, beta: float) -> None:
+        assert 0 < p0 < p1 < 1
+        self.llr_hit = math.log(p1 / p0)
+        self.llr_miss = math.log((1 - p1) / (1 - p0))
+        self.upper = math.log((1 - beta) / alpha)
+        self.lower = math.log(beta / (1 - alpha))
+        self.llr = 0.0
+        self.decision = "undecided"
+
+    def update(self, hits: int, rounds: int) -> str:
+        """Add `rounds` rounds with `hits` hits, return the decision."""
+        if self.decision != "undecided":
+            return self.decision
+
+        hits = min(hits, rounds)
+        self.llr += hits * self.llr_hit + (rounds - hits) * self.llr_miss
+
+        if self.llr >= self.upper:
+            self.decision = "signal"
+        elif self.llr <= self.lower:
+            self.decision = "no signal"
+
+        return self.decision
+
+
+# Parameters of the sequential test used with --sprt, same as in the test
+SPRT_P0 = 0.01
+SPRT_P1 = 0.2
+SPRT_ALPHA = 0.01
+SPRT_BETA = 0.01
+
 # Number of iteration that we let the test run at one. Should not be too large as the results of a full back are lost when one iteration fails
 BATCH_RERAND_SIZE = 10
 
@@ -186,6 +229,8 @@ def run_config(cfg: Config, args: argparse.Namespace, out_dir: Path) -> None:
     hit_accum = 0
     n_accum = 0
 
+    sprt = Sprt(SPRT_P0, SPRT_P1, SPRT_ALPHA, SPRT_BETA) if args.sprt else None
+
     print("Iteration: ", end="", flush=True)
 
     # The executable can segfault, number of successful runs
@@ -205,6 +250,7 @@ def run_config(cfg: Config, args: argparse.Namespace, out_dir: Path) -> None:
             f"{'-p' if cfg.fp_test else ''}",
             f"{'-n' if cfg.fn_test else ''}",
             f"{'-j' if cfg.use_jmp else ''}",
+            f"{'-q' if args.sprt else ''}",
             "-e",
         ]
 
@@ -251,17 +297,28 @@ def run_config(cfg: Config, args: argparse.Namespace, out_dir: Path) -> None:
 
         for line in out.splitlines():
             parts = line.split("\t")
-            assert len(parts) == 2, f"invalid output: {parts}"
-            hits, total = map(int, parts)
+            # With --sprt, the test also prints its per candidate decision
+            assert len(parts) == (3 if args.sprt else 2), f"invalid output: {parts}"
+            hits, total = map(int, parts[:2])
             hit_accum += hits
             n_accum += total
+            if sprt:
+                sprt.update(hits, total)
 
         raw_accum += out
         succ_iter += cfg.cand_batch
 
+        # Outcome of the configuration is certain, spend the time on the next one
+        if sprt and sprt.decision != "undecided":
+            break
+
     print("")
 
-    assert n_accum == cfg.num_measures
+    if sprt:
+        print(f"Decision: {sprt.decision} after {n_accum} measures")
+        assert n_accum <= cfg.num_measures
+    else:
+        assert n_accum == cfg.num_measures
 
     if args.dry_run:
         print(f"total hist: {hit_accum} of: {n_accum}")
@@ -271,6 +328,8 @@ def run_config(cfg: Config, args: argparse.Namespace, out_dir: Path) -> None:
 
         with open(cmp_out_file, "w") as f:
             f.write(f"{hit_accum}\t{n_accum}")
+            if sprt:
+                f.write(f"\t{sprt.decision}")
 
 
 if __name__ == "__main__":
@@ -298,6 +357,13 @@ if __name__ == "__main__":
         help="Do not write output to file but print to STDOUT.",
     )
 
+    parser.add_argument(
+        "-s",
+        "--sprt",
+        action="store_true",
+        help="Stop candidates and configurations early once a sequential test decided.",
+    )
+
     args = parser.parse_args()
 
     for cfg in cfgs:
@@ -1,15 +1,65 @@
+/**
+ * Translate virtual to physical addresses of a process.
+ *
+ * Usage:
+ *  virt2phys <VA> <PID>   Translate a single hex VA
+ *  virt2phys - <PID>      Translate hex VAs from stdin, one per line
+ *
+ * A PID of 0 refers to the process itself. Prints one physical address per line, 0 for
+ * pages that are not present in bulk mode.
+ */
+
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <uarf/mem.h>
 
+// Number of addresses translated at once in bulk mode
+#define BATCH_SIZE 4096
+
+static void translate_stdin(uint64_t pid) {
+    static uint64_t va[BATCH_SIZE];
+    static uint64_t pa[BATCH_SIZE];
+    UarfPagemap pm = uarf_pagemap_open(pid);
+    char line[64];
+    size_t n = 0;
+
+    while (true) {
+        bool eof = !fgets(line, sizeof(line), stdin);
+        if (!eof) {
+            va[n++] = strtoull(line, NULL, 16);
+        }
+        if (n == BATCH_SIZE || (eof && n)) {
+            uarf_pagemap_va_to_pa_batch(&pm, va, pa, n);
+            for (size_t i = 0; i < n; i++) {
+                printf("%lu\n", pa[i]);
+            }
+            n = 0;
+        }
+        if (eof) {
+            break;
+        }
+    }
+
+    uarf_pagemap_close(&pm);
+}
+
 int main(int argc, char **argv) {
     if (argc != 3) {
         printf("Invalid arguments\n");
+        printf("Usage: %s <VA>|- <PID>\n", argv[0]);
         return 1;
     }
 
+    uint64_t pid = strtoull(argv[2], NULL, 10);
+
+    if (!strcmp(argv[1], "-")) {
+        translate_stdin(pid);
+        return 0;
+    }
+
     uint64_t va = strtoull(argv[1], NULL, 16);
-    uint64_t pid = strtoull(argv[1], NULL, 16);
 
     uint64_t pa = uarf_va_to_pa(va, pid);
     printf("%lu\n", pa);